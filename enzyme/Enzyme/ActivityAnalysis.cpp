@@ -53,6 +53,7 @@
 
 #include "FunctionUtils.h"
 #include "LibraryFuncs.h"
+#include "TimeReport.h"
 #include "TypeAnalysis/TBAA.h"
 
 #include "llvm/Analysis/ValueTracking.h"
@@ -592,6 +593,7 @@ static inline void propagateArgumentInformation(
 /// do not propagate adjoints themselves
 bool ActivityAnalyzer::isConstantInstruction(TypeResults const &TR,
                                              Instruction *I) {
+  EnzymeTimeRegion timer(EnzymePhase::ActivityAnalysis);
   // This analysis may only be called by instructions corresponding to
   // the function analyzed by TypeInfo
   assert(I);
@@ -918,6 +920,7 @@ bool isValuePotentiallyUsedAsPointer(llvm::Value *val) {
 }
 
 bool ActivityAnalyzer::isConstantValue(TypeResults const &TR, Value *Val) {
+  EnzymeTimeRegion timer(EnzymePhase::ActivityAnalysis);
   // This analysis may only be called by instructions corresponding to
   // the function analyzed by TypeInfo -- however if the Value
   // was created outside a function (e.g. global, constant), that is allowed
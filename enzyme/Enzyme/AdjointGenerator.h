@@ -8655,6 +8655,188 @@ public:
     llvm_unreachable("Unhandled MPI FUNCTION");
   }
 
+  /// Differentiate __enzyme_checkpoint(step, n, state, bytes, args...), which
+  /// calls step(state, args...) n times updating state in place. Rather than
+  /// caching every iteration, the forward pass keeps a copy of the state every
+  /// few iterations and the reverse pass recomputes the iterations in between
+  /// before differentiating them.
+  void visitCheckpointCall(llvm::CallInst &call) {
+    Function *step =
+        dyn_cast<Function>(call.getArgOperand(0)->stripPointerCasts());
+#if LLVM_VERSION_MAJOR >= 14
+    size_t num_args = call.arg_size();
+#else
+    size_t num_args = call.getNumArgOperands();
+#endif
+    if (!step || step->empty() || step->arg_size() == 0 ||
+        !step->getFunctionType()->getParamType(0)->isPointerTy() ||
+        num_args != step->arg_size() + 3) {
+      EmitFailure("InvalidCheckpoint", call.getDebugLoc(), &call,
+                  "__enzyme_checkpoint requires a defined step function "
+                  "taking the state pointer and the trailing arguments ",
+                  call);
+      return;
+    }
+
+    CallInst *const newCall = cast<CallInst>(gutils->getNewFromOriginal(&call));
+    IRBuilder<> BuilderZ(newCall);
+    BuilderZ.setFastMathFlags(getFast());
+    Module &M = *gutils->newFunc->getParent();
+    Type *i64 = Type::getInt64Ty(call.getContext());
+
+    auto origArg = [&](unsigned i) {
+      return call.getArgOperand(i == 0 ? 2 : i + 3);
+    };
+
+    std::vector<DIFFE_TYPE> argsInverted;
+    std::map<Argument *, bool> uncacheable_args;
+    FnTypeInfo nextTypeInfo(step);
+    bool active = false;
+    for (auto &arg : step->args()) {
+      Value *op = origArg(arg.getArgNo());
+      DIFFE_TYPE ty = gutils->isConstantInstruction(&call)
+                          ? DIFFE_TYPE::CONSTANT
+                          : gutils->getDiffeType(op, /*foreignFunction*/ false);
+      if (ty == DIFFE_TYPE::OUT_DIFF) {
+        EmitFailure("InvalidCheckpoint", call.getDebugLoc(), &call,
+                    "__enzyme_checkpoint does not support active non-pointer "
+                    "argument ",
+                    *op);
+        return;
+      }
+      if (ty != DIFFE_TYPE::CONSTANT)
+        active = true;
+      argsInverted.push_back(ty);
+      // Every gradient is taken in combined mode on a private copy of the
+      // state, so nothing can overwrite the arguments in between.
+      uncacheable_args[&arg] = false;
+      nextTypeInfo.Arguments.insert(
+          std::pair<Argument *, TypeTree>(&arg, TR.query(op)));
+      nextTypeInfo.KnownValues.insert(std::pair<Argument *, std::set<int64_t>>(
+          &arg, TR.knownIntegralValues(op)));
+    }
+
+    auto primalArgs = [&](IRBuilder<> &B) {
+      SmallVector<Value *, 4> args;
+      for (auto &arg : step->args())
+        args.push_back(castCheckpointArgument(
+            B, gutils->getNewFromOriginal(origArg(arg.getArgNo())),
+            arg.getType()));
+      return args;
+    };
+    auto countArg = [&](IRBuilder<> &B, unsigned i, bool reverse) {
+      Value *op = gutils->getNewFromOriginal(call.getArgOperand(i));
+      if (reverse)
+        op = lookup(op, B);
+      return castCheckpointArgument(B, op, i64);
+    };
+
+    if (!active) {
+      if (Mode == DerivativeMode::ReverseModeGradient) {
+        eraseIfUnused(call, /*erase*/ true, /*check*/ false);
+        return;
+      }
+      SmallVector<Value *, 4> args = {countArg(BuilderZ, 1, false)};
+      args.append(primalArgs(BuilderZ));
+      BuilderZ.CreateCall(getOrInsertCheckpointLoop(M, step), args);
+      BuilderZ.SetInsertPoint(newCall->getNextNode());
+      gutils->erase(newCall);
+      return;
+    }
+
+    if (Mode == DerivativeMode::ForwardMode) {
+      Function *fwd = gutils->Logic.CreateForwardDiff(
+          step, DIFFE_TYPE::CONSTANT, argsInverted,
+          TR.analyzer.interprocedural, /*returnValue*/ false, Mode,
+          ((DiffeGradientUtils *)gutils)->FreeMemory, gutils->getWidth(),
+          /*additionalArg*/ nullptr, nextTypeInfo, uncacheable_args,
+          /*augmented*/ nullptr);
+      SmallVector<Value *, 4> args = {countArg(BuilderZ, 1, false)};
+      for (auto &arg : step->args()) {
+        Value *op = origArg(arg.getArgNo());
+        args.push_back(castCheckpointArgument(
+            BuilderZ, gutils->getNewFromOriginal(op), arg.getType()));
+        if (argsInverted[arg.getArgNo()] == DIFFE_TYPE::CONSTANT)
+          continue;
+        args.push_back(gutils->applyChainRule(
+            arg.getType(), BuilderZ,
+            [&](Value *dop) {
+              return castCheckpointArgument(BuilderZ, dop, arg.getType());
+            },
+            gutils->invertPointerM(op, BuilderZ)));
+      }
+      BuilderZ.CreateCall(getOrInsertCheckpointLoop(M, fwd), args);
+      BuilderZ.SetInsertPoint(newCall->getNextNode());
+      gutils->erase(newCall);
+      return;
+    }
+
+    if (Mode == DerivativeMode::ForwardModeSplit || gutils->getWidth() != 1) {
+      EmitFailure("InvalidCheckpoint", call.getDebugLoc(), &call,
+                  "__enzyme_checkpoint is not supported in this mode ", call);
+      return;
+    }
+
+    Value *snapshots = nullptr;
+    if (Mode == DerivativeMode::ReverseModePrimal ||
+        Mode == DerivativeMode::ReverseModeCombined) {
+      SmallVector<Value *, 4> args = {countArg(BuilderZ, 1, false),
+                                      countArg(BuilderZ, 3, false)};
+      args.append(primalArgs(BuilderZ));
+      snapshots = BuilderZ.CreateCall(getOrInsertCheckpointForward(M, step),
+                                      args, "checkpoints");
+      BuilderZ.SetInsertPoint(newCall->getNextNode());
+      gutils->erase(newCall);
+      if (Mode == DerivativeMode::ReverseModePrimal) {
+        gutils->cacheForReverse(BuilderZ, snapshots,
+                                getIndex(&call, CacheType::Tape));
+        return;
+      }
+    } else {
+      snapshots = BuilderZ.CreatePHI(Type::getInt8PtrTy(call.getContext()), 0,
+                                     "checkpoints");
+      snapshots = gutils->cacheForReverse(BuilderZ, snapshots,
+                                          getIndex(&call, CacheType::Tape));
+      eraseIfUnused(call, /*erase*/ true, /*check*/ false);
+    }
+
+    IRBuilder<> Builder2(call.getParent());
+    getReverseBuilder(Builder2);
+
+    Function *grad = gutils->Logic.CreatePrimalAndGradient(
+        (ReverseCacheKey){.todiff = step,
+                          .retType = DIFFE_TYPE::CONSTANT,
+                          .constant_args = argsInverted,
+                          .uncacheable_args = uncacheable_args,
+                          .returnUsed = false,
+                          .shadowReturnUsed = false,
+                          .mode = DerivativeMode::ReverseModeCombined,
+                          .width = 1,
+                          .freeMemory = true,
+                          .AtomicAdd = gutils->AtomicAdd,
+                          .additionalType = nullptr,
+                          .typeInfo = nextTypeInfo},
+        TR.analyzer.interprocedural, /*augmented*/ nullptr);
+
+    snapshots = lookup(snapshots, Builder2);
+    SmallVector<Value *, 4> args = {countArg(Builder2, 1, true),
+                                    countArg(Builder2, 3, true), snapshots};
+    for (auto &arg : step->args()) {
+      Value *op = origArg(arg.getArgNo());
+      if (arg.getArgNo() != 0)
+        args.push_back(castCheckpointArgument(
+            Builder2, lookup(gutils->getNewFromOriginal(op), Builder2),
+            arg.getType()));
+      if (argsInverted[arg.getArgNo()] != DIFFE_TYPE::CONSTANT)
+        args.push_back(castCheckpointArgument(
+            Builder2, lookup(gutils->invertPointerM(op, Builder2), Builder2),
+            arg.getType()));
+    }
+    Builder2.CreateCall(
+        getOrInsertCheckpointReverse(M, step, grad, argsInverted), args);
+    CreateDealloc(Builder2, snapshots);
+  }
+
   // Return
   void visitCallInst(llvm::CallInst &call) {
     CallInst *const newCall = cast<CallInst>(gutils->getNewFromOriginal(&call));
@@ -8873,6 +9055,11 @@ public:
       }
     }
 
+    if (funcName == "__enzyme_checkpoint") {
+      visitCheckpointCall(call);
+      return;
+    }
+
     if ((funcName.startswith("MPI_") || funcName.startswith("PMPI_")) &&
         (!gutils->isConstantInstruction(&call) || funcName == "MPI_Barrier" ||
          funcName == "MPI_Comm_free" || funcName == "MPI_Comm_disconnect" ||
@@ -182,6 +182,27 @@ void EnzymeLogicErasePreprocessedFunctions(EnzymeLogicRef Ref) {
 
 void FreeEnzymeLogic(EnzymeLogicRef Ref) { delete (EnzymeLogic *)Ref; }
 
+EnzymeCacheStatistics ewrap(const EnzymeLogic::CacheStatistics &stats) {
+  EnzymeCacheStatistics CS;
+  CS.hits = stats.Hits;
+  CS.misses = stats.Misses;
+  CS.persistentHits = stats.PersistentHits;
+  return CS;
+}
+
+void EnzymeLogicGetCacheStatistics(EnzymeLogicRef Ref,
+                                   EnzymeCacheStatistics *augmented,
+                                   EnzymeCacheStatistics *reverse,
+                                   EnzymeCacheStatistics *forward) {
+  auto &Logic = eunwrap(Ref);
+  if (augmented)
+    *augmented = ewrap(Logic.AugmentedCacheStats);
+  if (reverse)
+    *reverse = ewrap(Logic.ReverseCacheStats);
+  if (forward)
+    *forward = ewrap(Logic.ForwardCacheStats);
+}
+
 EnzymeTypeAnalysisRef CreateTypeAnalysis(EnzymeLogicRef Log,
                                          char **customRuleNames,
                                          CustomRuleType *customRules,
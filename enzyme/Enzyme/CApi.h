@@ -164,6 +164,21 @@ EnzymeLogicRef CreateEnzymeLogic(uint8_t PostOpt);
 void ClearEnzymeLogic(EnzymeLogicRef);
 void FreeEnzymeLogic(EnzymeLogicRef);
 
+/// Lookups in one of the derivative caches of an EnzymeLogic since it was
+/// created or last cleared, as ClearEnzymeLogic empties the caches and
+/// resets their statistics. Persistent hits are derivatives reloaded from
+/// the on-disk cache, which also count as misses.
+struct EnzymeCacheStatistics {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t persistentHits;
+};
+
+void EnzymeLogicGetCacheStatistics(EnzymeLogicRef,
+                                   struct EnzymeCacheStatistics *augmented,
+                                   struct EnzymeCacheStatistics *reverse,
+                                   struct EnzymeCacheStatistics *forward);
+
 void EnzymeExtractReturnInfo(EnzymeAugmentedReturnPtr ret, int64_t *data,
                              uint8_t *existed, size_t len);
 
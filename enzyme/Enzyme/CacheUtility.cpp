@@ -27,6 +27,10 @@
 #include "CacheUtility.h"
 #include "FunctionUtils.h"
 
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/ConstantRange.h"
+#include "llvm/Support/KnownBits.h"
+
 using namespace llvm;
 
 /// Pack 8 bools together in a single byte
@@ -47,23 +51,116 @@ llvm::cl::opt<bool> EfficientMaxCache(
     "enzyme-max-cache", cl::init(false), cl::Hidden,
     cl::desc(
         "Avoid reallocs when possible by potentially overallocating cache"));
+
+llvm::cl::opt<int> EnzymeSegmentedCache(
+    "enzyme-segmented-cache", cl::init(0), cl::Hidden,
+    cl::desc("Cache dynamic loops in blocks of this many iterations, "
+             "released as the reverse pass proceeds (0 disables)"));
+
+llvm::cl::opt<bool> EnzymeCoalesceCache(
+    "enzyme-coalesce-cache", cl::init(false), cl::Hidden,
+    cl::desc("Store all statically sized caches of a loop nest in a single "
+             "allocation, interleaving the values of each iteration"));
+
+llvm::cl::opt<bool> EnzymeNontemporalCache(
+    "enzyme-nontemporal-cache", cl::init(false), cl::Hidden,
+    cl::desc("Write loop caches with non-temporal stores in the forward "
+             "pass, bypassing the cache hierarchy"));
+
+llvm::cl::opt<int> EnzymeCachePrefetch(
+    "enzyme-cache-prefetch", cl::init(0), cl::Hidden,
+    cl::desc("Prefetch loop caches this many iterations ahead of the "
+             "reverse pass (0 disables)"));
+
+llvm::cl::opt<bool> EnzymeNarrowIntCache(
+    "enzyme-narrow-int-cache", cl::init(false), cl::Hidden,
+    cl::desc("Store cached integers in the narrowest type that holds every "
+             "value they may take"));
+
+llvm::cl::opt<std::string> EnzymeCachePrecision(
+    "enzyme-cache-precision", cl::init(""), cl::Hidden,
+    cl::desc("Store floating point caches at reduced precision, one of "
+             "float, half or bfloat"));
+
+llvm::cl::opt<bool> EnzymeCachePrecisionCheck(
+    "enzyme-cache-precision-check", cl::init(false), cl::Hidden,
+    cl::desc("Record the largest relative error of the values stored in "
+             "reduced precision caches in __enzyme_cache_precision_error"));
+
+llvm::cl::opt<bool> EnzymeFileTape(
+    "enzyme-file-tape", cl::init(false), cl::Hidden,
+    cl::desc("Map large loop caches from unlinked files in $ENZYME_TAPE_DIR, "
+             "storing dynamic loops in segments, and read them ahead during "
+             "the reverse pass"));
+
+llvm::cl::opt<bool> EnzymeCacheInstrument(
+    "enzyme-cache-instrument", cl::init(false), cl::Hidden,
+    cl::desc("Record the bytes allocated, peak live bytes and reallocations "
+             "of each cache at runtime, reported at exit or by calling "
+             "__enzyme_cache_report"));
 }
 
 CacheUtility::~CacheUtility() {}
 
+/// Hand the coalesced allocation owned by cache, if any, to another cache
+/// sharing it, as it is about to no longer be tracked
+void CacheUtility::transferCoalescedCache(AllocaInst *cache) {
+  auto found = CoalescedMembers.find(cache);
+  if (found == CoalescedMembers.end())
+    return;
+  auto &record = *found->second;
+  CoalescedMembers.erase(found);
+  if (record.owner != cache)
+    return;
+  record.owner = nullptr;
+  for (auto &pair : CoalescedMembers)
+    if (pair.second == &record) {
+      record.owner = pair.first;
+      break;
+    }
+  if (!record.owner)
+    return;
+
+  auto &from = scopeInstructions[cache];
+  auto &to = scopeInstructions[record.owner];
+  for (auto I : record.instructions) {
+    from.erase(std::remove(from.begin(), from.end(), I), from.end());
+    to.insert(to.begin(), I);
+  }
+  auto allocs = scopeAllocs.find(cache);
+  if (allocs != scopeAllocs.end()) {
+    scopeAllocs[record.owner] = allocs->second;
+    scopeAllocs.erase(allocs);
+  }
+  auto frees = scopeFrees.find(cache);
+  if (frees != scopeFrees.end()) {
+    scopeFrees[record.owner].insert(frees->second.begin(), frees->second.end());
+    scopeFrees.erase(frees);
+  }
+  auto sites = CacheSites.find(cache);
+  if (sites != CacheSites.end() && sites->second.count(0)) {
+    CacheSites[record.owner][0] = sites->second[0];
+    sites->second.erase(0);
+  }
+}
+
 /// Erase this instruction both from LLVM modules and any local data-structures
 void CacheUtility::erase(Instruction *I) {
   assert(I);
 
   if (auto found = findInMap(scopeMap, (Value *)I)) {
+    transferCoalescedCache(found->first);
     scopeFrees.erase(found->first);
     scopeAllocs.erase(found->first);
     scopeInstructions.erase(found->first);
   }
   if (auto AI = dyn_cast<AllocaInst>(I)) {
+    transferCoalescedCache(AI);
     scopeFrees.erase(AI);
     scopeAllocs.erase(AI);
     scopeInstructions.erase(AI);
+    NarrowedCaches.erase(AI);
+    CacheSites.erase(AI);
   }
   scopeMap.erase(I);
   SE.eraseValueFromMap(I);
@@ -753,6 +850,239 @@ bool CacheUtility::getContext(BasicBlock *BB, LoopContext &loopContext,
   return true;
 }
 
+/// Add a field for the cache alloc to the coalesced allocation of record,
+/// allocating it on first use, and return a pointer to the field of the first
+/// record
+Value *CacheUtility::allocateCoalescedCache(IRBuilder<> &B,
+                                            CoalescedCache &record,
+                                            AllocaInst *alloc, Type *T,
+                                            Type *PT, Value *size,
+                                            StringRef name) {
+  auto &DL = newFunc->getParent()->getDataLayout();
+  uint64_t bsize = DL.getTypeAllocSizeInBits(T) / 8;
+  uint64_t align = std::max((uint64_t)DL.getPrefTypeAlignment(T),
+                            (uint64_t)getCacheAlignment((unsigned)bsize));
+  uint64_t offset = alignTo(record.size, align);
+  record.size = offset + bsize;
+  record.align = std::max(record.align, align);
+  CoalescedMembers[alloc] = &record;
+
+  auto i8 = Type::getInt8Ty(T->getContext());
+  if (!record.allocation) {
+    record.owner = alloc;
+    IRBuilder<> entryBuilder(inversionAllocs, inversionAllocs->begin());
+    record.stride = entryBuilder.CreatePHI(size->getType(), 0,
+                                           name + "_recordsize");
+
+    CallInst *malloccall = nullptr;
+    Instruction *ZeroInst = nullptr;
+    record.allocation = CreateAllocation(
+        B, i8, B.CreateMul(size, record.stride, "", /*NUW*/ true, /*NSW*/ true),
+        name + "_malloccache", &malloccall,
+        /*ZeroMem*/ EnzymeZeroCache ? &ZeroInst : nullptr);
+    if (EnzymeFileTape)
+      RedirectToFileTape(malloccall);
+    instrumentCacheAllocation(malloccall, alloc, /*i*/ 0,
+                              name + " (coalesced)");
+    record.instructions.push_back(malloccall);
+    if (record.allocation != malloccall)
+      record.instructions.push_back(cast<Instruction>(record.allocation));
+    if (ZeroInst)
+      record.instructions.push_back(ZeroInst);
+    scopeInstructions[alloc].append(record.instructions.begin(),
+                                    record.instructions.end());
+    scopeAllocs[alloc].push_back(malloccall);
+  }
+
+  Value *field = record.allocation;
+  if (offset) {
+#if LLVM_VERSION_MAJOR > 7
+    field = B.CreateConstInBoundsGEP1_64(i8, field, offset);
+#else
+    field = B.CreateConstInBoundsGEP1_64(field, offset);
+#endif
+    scopeInstructions[alloc].push_back(cast<Instruction>(field));
+  }
+  if (field->getType() != PT) {
+    field = B.CreatePointerCast(field, PT);
+    scopeInstructions[alloc].push_back(cast<Instruction>(field));
+  }
+  return field;
+}
+
+void CacheUtility::instrumentCacheAllocation(CallInst *call, AllocaInst *alloc,
+                                             int i, const Twine &name) {
+  if (!EnzymeCacheInstrument)
+    return;
+  std::string siteName = (name + " in " + newFunc->getName()).str();
+  if (auto site = InstrumentCacheAllocation(call, siteName))
+    CacheSites[alloc][i] = CacheSite{site, siteName, false};
+}
+
+/// Prefix the names of the runtime records of cache with the source location
+/// of the value it stores, once known
+void CacheUtility::locateCacheSites(AllocaInst *cache, Value *val) {
+  auto found = CacheSites.find(cache);
+  if (found == CacheSites.end())
+    return;
+  // Narrowed or packed values are stored through casts inserted by Enzyme
+  while (auto CI = dyn_cast<CastInst>(val)) {
+    if (CI->getDebugLoc())
+      break;
+    val = CI->getOperand(0);
+  }
+  auto inst = dyn_cast<Instruction>(val);
+  if (!inst || !inst->getDebugLoc())
+    return;
+  const DebugLoc &DL = inst->getDebugLoc();
+  for (auto &pair : found->second) {
+    auto &site = pair.second;
+    if (site.located)
+      continue;
+    site.located = true;
+    std::string name;
+    raw_string_ostream ss(name);
+    ss << cast<DIScope>(DL.getScope())->getFilename() << ":" << DL.getLine()
+       << ":" << DL.getCol() << " " << site.name;
+    SetCacheSiteName(site.record, ss.str());
+  }
+}
+
+bool CacheUtility::isInstrumentedCache(AllocaInst *alloc, int i) const {
+  auto found = CacheSites.find(alloc);
+  return found != CacheSites.end() && found->second.count(i);
+}
+
+void CacheUtility::finalizeCoalescedCaches() {
+  for (auto &pair : CoalescedCaches) {
+    auto &record = pair.second;
+    if (!record.stride)
+      continue;
+    record.stride->replaceAllUsesWith(ConstantInt::get(
+        record.stride->getType(), alignTo(record.size, record.align)));
+    erase(record.stride);
+  }
+  CoalescedCaches.clear();
+  CoalescedMembers.clear();
+}
+
+/// Return the type caches of floating point type T are stored in, or nullptr
+/// if they keep their full precision. bfloat is stored as the upper half of
+/// the float encoding in an i16.
+Type *CacheUtility::getReducedPrecisionType(Type *T) {
+  if (!T->isFloatingPointTy())
+    return nullptr;
+  StringRef precision = EnzymeCachePrecision;
+  if (newFunc->hasFnAttribute("enzyme_cache_precision"))
+    precision =
+        newFunc->getFnAttribute("enzyme_cache_precision").getValueAsString();
+  if (precision.empty())
+    return nullptr;
+
+  Type *reduced = nullptr;
+  if (precision == "float")
+    reduced = Type::getFloatTy(T->getContext());
+  else if (precision == "half")
+    reduced = Type::getHalfTy(T->getContext());
+  else if (precision == "bfloat")
+    reduced = Type::getInt16Ty(T->getContext());
+  else {
+    EmitWarning("IllegalCachePrecision", newFunc,
+                "Unknown cache precision ", precision, ", expected one of ",
+                "float, half or bfloat");
+    return nullptr;
+  }
+  if (reduced->getPrimitiveSizeInBits() >= T->getPrimitiveSizeInBits())
+    return nullptr;
+  return reduced;
+}
+
+/// Return the narrowest type holding every value V may take, or nullptr if V
+/// cannot be cached narrower. Integers are narrowed to their known range,
+/// and floating point values to the requested reduced precision. The
+/// conversion back on lookup is recorded in narrowed.
+Type *CacheUtility::getNarrowCacheType(Value *V, NarrowedCache &narrowed) {
+  if (V->getType()->isFloatingPointTy())
+    return getReducedPrecisionType(V->getType());
+  if (!EnzymeNarrowIntCache)
+    return nullptr;
+
+  auto IT = dyn_cast<IntegerType>(V->getType());
+  if (!IT || IT->getBitWidth() == 1)
+    return nullptr;
+  unsigned width = IT->getBitWidth();
+  auto i1 = Type::getInt1Ty(V->getContext());
+
+  // Intersect every bound we know of. These are all context insensitive,
+  // as the cache is filled wherever V is defined.
+  const DataLayout &DL = newFunc->getParent()->getDataLayout();
+  KnownBits known = computeKnownBits(V, DL);
+  ConstantRange unsignedRange =
+      ConstantRange::fromKnownBits(known, /*signed*/ false);
+  ConstantRange signedRange =
+      ConstantRange::fromKnownBits(known, /*signed*/ true);
+#if LLVM_VERSION_MAJOR >= 14
+  unsignedRange = unsignedRange.intersectWith(
+      computeConstantRange(V, /*ForSigned*/ false), ConstantRange::Unsigned);
+  signedRange = signedRange.intersectWith(
+      computeConstantRange(V, /*ForSigned*/ true), ConstantRange::Signed);
+#elif LLVM_VERSION_MAJOR >= 9
+  unsignedRange = unsignedRange.intersectWith(computeConstantRange(V),
+                                              ConstantRange::Unsigned);
+  signedRange =
+      signedRange.intersectWith(computeConstantRange(V), ConstantRange::Signed);
+#endif
+  if (SE.isSCEVable(IT)) {
+    const SCEV *S = SE.getSCEV(V);
+    unsignedRange = unsignedRange.intersectWith(SE.getUnsignedRange(S),
+                                                ConstantRange::Unsigned);
+    signedRange = signedRange.intersectWith(SE.getSignedRange(S),
+                                            ConstantRange::Signed);
+  }
+
+  // Values which are one of two are stored as bools, which may be packed
+  // eight to a byte by EfficientBoolCache. Ranges of {0, 1} are simply
+  // truncated, others select between their two values on lookup.
+  if (unsignedRange.getUnsignedMax().getActiveBits() <= 1) {
+    narrowed.isSigned = false;
+    return i1;
+  }
+  for (auto &range : {unsignedRange, signedRange})
+    if (range.getUpper() - range.getLower() == 2) {
+      narrowed.low = ConstantInt::get(V->getContext(), range.getLower());
+      narrowed.high = ConstantInt::get(V->getContext(), range.getLower() + 1);
+      return i1;
+    }
+  // Values with a single unknown bit are one of two as well
+  if ((~(known.Zero | known.One)).countPopulation() == 1) {
+    narrowed.low = ConstantInt::get(V->getContext(), known.One);
+    narrowed.high = ConstantInt::get(V->getContext(), ~known.Zero);
+    return i1;
+  }
+
+  if (width <= 8)
+    return nullptr;
+  for (unsigned bits : {8u, 16u, 32u}) {
+    if (bits >= width)
+      break;
+    if (unsignedRange.getUnsignedMax().getActiveBits() <= bits) {
+      narrowed.isSigned = false;
+      return IntegerType::get(V->getContext(), bits);
+    }
+#if LLVM_VERSION_MAJOR > 14
+    if (signedRange.getSignedMin().getSignificantBits() <= bits &&
+        signedRange.getSignedMax().getSignificantBits() <= bits) {
+#else
+    if (signedRange.getSignedMin().getMinSignedBits() <= bits &&
+        signedRange.getSignedMax().getMinSignedBits() <= bits) {
+#endif
+      narrowed.isSigned = true;
+      return IntegerType::get(V->getContext(), bits);
+    }
+  }
+  return nullptr;
+}
+
 /// Caching mechanism: creates a cache of type T in a scope given by ctx
 /// (where if ctx is in a loop there will be a corresponding number of slots)
 AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
@@ -790,6 +1120,10 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
                                                      &malloccall, nullptr)
                                         ->getType());
       malloctypes.push_back(cast<PointerType>(malloccall->getType()));
+      // A segmented chunk stores a table of pointers to its blocks
+      if (getSegmentSize(sublimits, i))
+        allocType = cast<PointerType>(
+            CreateAllocation(B, allocType, P, "tmpfortypecalc")->getType());
       SmallVector<Instruction *, 2> toErase;
       for (auto &I : *BB)
         toErase.push_back(&I);
@@ -800,6 +1134,24 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
     types.push_back(allocType);
   }
 
+  // Caches of a single statically sized chunk may share one allocation with
+  // the other such caches of the loop nest
+  CoalescedCache *record = nullptr;
+  if (EnzymeCoalesceCache && canCoalesceCaches() && allocateInternal &&
+      shouldFree && !extraSize && sublimits.size() == 1 &&
+      sublimits[0].second.back().first.maxLimit &&
+      !(EfficientBoolCache && isi1)) {
+    const auto &containedloops = sublimits[0].second;
+    bool offset = false;
+    for (auto &actx : containedloops)
+      if (actx.first.offset)
+        offset = true;
+    if (!offset)
+      record = &CoalescedCaches[std::make_tuple(
+          containedloops.front().first.header,
+          containedloops.back().first.header, sublimits[0].first)];
+  }
+
   // Allocate the outermost type on the stack
   IRBuilder<> entryBuilder(inversionAllocs);
   entryBuilder.setFastMathFlags(getFast());
@@ -822,6 +1174,12 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
     scopeInstructions[alloc].push_back(
         entryBuilder.CreateStore(Constant::getNullValue(types.back()), alloc));
 
+  // Chunks of a cache read from the tape may have been allocated through the
+  // cache runtime by the augmented forward pass
+  if (!allocateInternal && TapeCacheSites)
+    for (int i : *TapeCacheSites)
+      CacheSites[alloc][i] = CacheSite{nullptr, name.str(), /*located*/ true};
+
   Value *storeInto = alloc;
 
   // Iterating from outermost chunk to innermost chunk
@@ -872,30 +1230,41 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
       StoreInst *storealloc = nullptr;
       // Statically allocate memory for all iterations if possible
       if (sublimits[i].second.back().first.maxLimit) {
-        CallInst *malloccall = nullptr;
-        Instruction *ZeroInst = nullptr;
-        Value *firstallocation = CreateAllocation(
-            allocationBuilder, myType, size, name + "_malloccache", &malloccall,
-            /*ZeroMem*/ (EnzymeZeroCache && i == 0) ? &ZeroInst : nullptr);
-
-        scopeInstructions[alloc].push_back(malloccall);
-        if (firstallocation != malloccall)
-          scopeInstructions[alloc].push_back(
-              cast<Instruction>(firstallocation));
-
-        for (auto &actx : sublimits[i].second) {
-          if (actx.first.offset) {
-            malloccall->setMetadata("enzyme_ompfor",
-                                    MDNode::get(malloccall->getContext(), {}));
-            break;
+        Value *firstallocation;
+        if (record) {
+          firstallocation = allocateCoalescedCache(
+              allocationBuilder, *record, alloc, myType, types[i + 1], size,
+              name);
+        } else {
+          CallInst *malloccall = nullptr;
+          Instruction *ZeroInst = nullptr;
+          firstallocation = CreateAllocation(
+              allocationBuilder, myType, size, name + "_malloccache",
+              &malloccall,
+              /*ZeroMem*/ (EnzymeZeroCache && i == 0) ? &ZeroInst : nullptr);
+          if (EnzymeFileTape)
+            RedirectToFileTape(malloccall);
+          instrumentCacheAllocation(malloccall, alloc, i, name);
+
+          scopeInstructions[alloc].push_back(malloccall);
+          if (firstallocation != malloccall)
+            scopeInstructions[alloc].push_back(
+                cast<Instruction>(firstallocation));
+
+          for (auto &actx : sublimits[i].second) {
+            if (actx.first.offset) {
+              malloccall->setMetadata(
+                  "enzyme_ompfor", MDNode::get(malloccall->getContext(), {}));
+              break;
+            }
           }
-        }
 
-        if (ZeroInst)
-          scopeInstructions[alloc].push_back(ZeroInst);
-        storealloc = allocationBuilder.CreateStore(firstallocation, storeInto);
+          if (ZeroInst)
+            scopeInstructions[alloc].push_back(ZeroInst);
 
-        scopeAllocs[alloc].push_back(malloccall);
+          scopeAllocs[alloc].push_back(malloccall);
+        }
+        storealloc = allocationBuilder.CreateStore(firstallocation, storeInto);
 
         // Mark the store as invariant since the allocation is static and
         // will not be changed
@@ -912,6 +1281,45 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
         for (auto post : PostCacheStore(storealloc, allocationBuilder)) {
           scopeInstructions[alloc].push_back(post);
         }
+      } else if (auto segment = getSegmentSize(sublimits, i)) {
+        llvm::PointerType *allocType = cast<PointerType>(types[i + 1]);
+
+        // Allocate a fresh block on the first iteration of every segment
+        // rather than growing a single allocation, so no cached iteration is
+        // ever copied and blocks may be released during the reverse pass
+        auto zerostore = allocationBuilder.CreateStore(
+            ConstantPointerNull::get(allocType), storeInto);
+        scopeInstructions[alloc].push_back(zerostore);
+
+        IRBuilder<> build(containedloops.back().first.incvar->getNextNode());
+#if LLVM_VERSION_MAJOR > 7
+        Value *table = build.CreateLoad(
+            storeInto->getType()->getPointerElementType(), storeInto);
+#else
+        Value *table = build.CreateLoad(storeInto);
+#endif
+
+        CallInst *segmentcall = CreateSegmentAllocation(
+            build, table, myType, containedloops.back().first.var, segment,
+            build.CreateMul(size, segment, "", /*NUW*/ true, /*NSW*/ true),
+            name + "_segmentcache", EnzymeZeroCache && i == 0,
+            EnzymeFileTape);
+        scopeInstructions[alloc].push_back(segmentcall);
+        scopeAllocs[alloc].push_back(segmentcall);
+
+        Value *reallocation = segmentcall;
+        if (reallocation->getType() != allocType) {
+          auto I =
+              cast<Instruction>(build.CreateBitCast(reallocation, allocType));
+          scopeInstructions[alloc].push_back(I);
+          reallocation = I;
+        }
+
+        storealloc = build.CreateStore(reallocation, storeInto);
+        scopeInstructions[alloc].push_back(storealloc);
+        for (auto post : PostCacheStore(storealloc, build)) {
+          scopeInstructions[alloc].push_back(post);
+        }
       } else {
         llvm::PointerType *allocType = cast<PointerType>(types[i + 1]);
         llvm::PointerType *mallocType = malloctypes[i];
@@ -941,6 +1349,7 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
         auto reallocation = CreateReAllocation(
             build, allocation, myType, containedloops.back().first.incvar, size,
             name + "_realloccache", &realloccall, EnzymeZeroCache && i == 0);
+        instrumentCacheAllocation(realloccall, alloc, i, name);
 
         scopeInstructions[alloc].push_back(cast<Instruction>(reallocation));
 
@@ -972,8 +1381,9 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
 #endif
     }
 
-    // Free the memory, if requested
-    if (shouldFree) {
+    // Free the memory, if requested. A coalesced allocation is only released
+    // by the cache which allocated it.
+    if (shouldFree && (!record || scopeAllocs.count(alloc))) {
       if (CachePointerInvariantGroups.find(std::make_pair((Value *)alloc, i)) ==
           CachePointerInvariantGroups.end()) {
         MDNode *invgroup = MDNode::getDistinct(alloc->getContext(), {});
@@ -990,9 +1400,7 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
     if (i != 0) {
       IRBuilder<> v(&sublimits[i - 1].second.back().first.preheader->back());
 
-      Value *idx = computeIndexOfChunk(
-          /*inForwardPass*/ true, v, containedloops,
-          /*available*/ ValueToValueMapTy());
+      ValueToValueMapTy available;
 
 #if LLVM_VERSION_MAJOR > 7
       storeInto = v.CreateLoad(storeInto->getType()->getPointerElementType(),
@@ -1002,11 +1410,23 @@ AllocaInst *CacheUtility::createCacheForScope(LimitContext ctx, Type *T,
 #else
       cast<LoadInst>(storeInto)->setAlignment(alignSize);
 #endif
+      if (auto segment = getSegmentSize(sublimits, i))
+        storeInto =
+            loadSegmentOfChunk(/*inForwardPass*/ true, v, storeInto,
+                               containedloops, segment, available);
+      Value *idx = computeIndexOfChunk(/*inForwardPass*/ true, v,
+                                       containedloops, available);
       storeInto = v.CreateGEP(storeInto->getType()->getPointerElementType(),
                               storeInto, idx);
 #else
       storeInto = v.CreateLoad(storeInto);
       cast<LoadInst>(storeInto)->setAlignment(alignSize);
+      if (auto segment = getSegmentSize(sublimits, i))
+        storeInto =
+            loadSegmentOfChunk(/*inForwardPass*/ true, v, storeInto,
+                               containedloops, segment, available);
+      Value *idx = computeIndexOfChunk(/*inForwardPass*/ true, v,
+                                       containedloops, available);
       storeInto = v.CreateGEP(storeInto, idx);
 #endif
       cast<GetElementPtrInst>(storeInto)->setIsInBounds(true);
@@ -1076,6 +1496,74 @@ Value *CacheUtility::computeIndexOfChunk(
   return idx;
 }
 
+Value *CacheUtility::loadSegmentOfChunk(
+    bool inForwardPass, IRBuilder<> &v, Value *table,
+    ArrayRef<std::pair<LoopContext, llvm::Value *>> containedloops,
+    ConstantInt *segment, ValueToValueMapTy &available) {
+  // Segments are indexed by the outermost loop of the chunk
+  const auto &idx = containedloops.back().first;
+  Value *var;
+  if (available.count(idx.var)) {
+    var = available.find(idx.var)->second;
+  } else if (!inForwardPass) {
+#if LLVM_VERSION_MAJOR > 7
+    var = v.CreateLoad(idx.var->getType(), idx.antivaralloc);
+#else
+    var = v.CreateLoad(idx.antivaralloc);
+#endif
+  } else {
+    var = idx.var;
+  }
+
+  available[idx.var] = v.CreateURem(var, segment);
+
+  Type *blockType = table->getType()->getPointerElementType();
+#if LLVM_VERSION_MAJOR > 7
+  Value *slot =
+      v.CreateInBoundsGEP(blockType, table, v.CreateUDiv(var, segment));
+  LoadInst *block = v.CreateLoad(blockType, slot);
+#else
+  Value *slot = v.CreateInBoundsGEP(table, v.CreateUDiv(var, segment));
+  LoadInst *block = v.CreateLoad(slot);
+#endif
+  unsigned align = getCacheAlignment(
+      (unsigned)(newFunc->getParent()->getDataLayout().getTypeAllocSizeInBits(
+                     blockType) /
+                 8));
+#if LLVM_VERSION_MAJOR >= 10
+  block->setAlignment(Align(align));
+#else
+  block->setAlignment(align);
+#endif
+  return block;
+}
+
+ConstantInt *CacheUtility::getSegmentSize(const SubLimitType &sublimits,
+                                          int i) {
+  if (EnzymeSegmentedCache <= 0 && !EnzymeFileTape)
+    return nullptr;
+  const auto &idx = sublimits[i].second.back().first;
+  // Only chunks whose size is unknown until runtime are segmented. Offset
+  // (OpenMP) iteration spaces remain a single allocation.
+  if (idx.maxLimit || !idx.var || idx.offset)
+    return nullptr;
+  // Blocks hold a power of two iterations, and at least 8 so that blocks of
+  // packed bools begin on a byte boundary. The file tape maps each block
+  // separately, so defaults to blocks large enough to be worth a file.
+  uint64_t segment =
+      EnzymeSegmentedCache > 0
+          ? std::max((uint64_t)8, PowerOf2Ceil((uint64_t)EnzymeSegmentedCache))
+          : (uint64_t)1 << 20;
+  return ConstantInt::get(Type::getInt64Ty(newFunc->getContext()), segment);
+}
+
+unsigned CacheUtility::getCacheDepth(const SubLimitType &sublimits) {
+  unsigned depth = 0;
+  for (size_t i = 0; i < sublimits.size(); ++i)
+    depth += getSegmentSize(sublimits, i) ? 2 : 1;
+  return depth;
+}
+
 /// Given a LimitContext ctx, representing a location inside a loop nest,
 /// break each of the loops up into chunks of loops where each chunk's number
 /// of iterations can be computed at the chunk preheader. Every dynamic loop
@@ -1318,6 +1806,89 @@ CacheUtility::SubLimitType CacheUtility::getSubLimits(bool inForwardPass,
   return sublimits;
 }
 
+/// Convert V to the narrower type stored in a cache. Floats reduced to
+/// bfloat are stored as the upper half of their float encoding, rounded to
+/// nearest even, since few backends can convert to bfloat directly.
+static Value *narrowForCache(IRBuilder<> &BuilderM, Value *V, Type *stored) {
+  if (!V->getType()->isFloatingPointTy())
+    return BuilderM.CreateTrunc(V, stored);
+  if (stored->isFloatingPointTy())
+    return BuilderM.CreateFPTrunc(V, stored);
+
+  // Built without fast math flags, which would fold away the NaN check
+  IRBuilder<> B(BuilderM.GetInsertBlock(), BuilderM.GetInsertPoint());
+  auto i32 = B.getInt32Ty();
+  Value *f = B.CreateFPTrunc(V, B.getFloatTy());
+  Value *bits = B.CreateBitCast(f, i32);
+  Value *lsb = B.CreateAnd(B.CreateLShr(bits, 16), ConstantInt::get(i32, 1));
+  Value *rounded = B.CreateLShr(
+      B.CreateAdd(bits, B.CreateAdd(lsb, ConstantInt::get(i32, 0x7FFF))), 16);
+  rounded = B.CreateSelect(B.CreateFCmpUNO(f, f),
+                           ConstantInt::get(i32, 0x7FC0), rounded);
+  return B.CreateTrunc(rounded, stored);
+}
+
+/// Convert V, as stored in a narrowed cache, back to the cached type T
+static Value *extendFromCache(IRBuilder<> &B, Value *V, Type *T,
+                              bool isSigned) {
+  if (!T->isFloatingPointTy())
+    return isSigned ? B.CreateSExt(V, T) : B.CreateZExt(V, T);
+  if (V->getType()->isIntegerTy()) {
+    Value *bits = B.CreateShl(B.CreateZExt(V, B.getInt32Ty()), 16);
+    V = B.CreateBitCast(bits, B.getFloatTy());
+  }
+  return B.CreateFPExt(V, T);
+}
+
+/// Fold the relative error of storing full as reduced into the running
+/// maximum kept in __enzyme_cache_precision_error
+void CacheUtility::recordPrecisionError(IRBuilder<> &BuilderM, Value *full,
+                                        Value *reduced) {
+  // The comparison must see NaNs and signed zeros, so it is built without
+  // the fast math flags of the cache store
+  IRBuilder<> B(BuilderM.GetInsertBlock(), BuilderM.GetInsertPoint());
+  Module &M = *newFunc->getParent();
+  auto DT = Type::getDoubleTy(M.getContext());
+  auto GV = M.getGlobalVariable("__enzyme_cache_precision_error");
+  if (!GV) {
+    GV = new GlobalVariable(M, DT, /*isConstant*/ false,
+                            GlobalValue::WeakAnyLinkage,
+                            ConstantFP::get(DT, 0.0),
+                            "__enzyme_cache_precision_error");
+#if LLVM_VERSION_MAJOR >= 10
+    GV->setAlignment(Align(8));
+#else
+    GV->setAlignment(8);
+#endif
+  }
+
+  // |extend(reduced) - full| / |full|, or 0 if full is 0 or the error is
+  // NaN, as when full is infinite
+  auto T = full->getType();
+  Function *fabs = Intrinsic::getDeclaration(&M, Intrinsic::fabs, {T});
+  Value *ext = extendFromCache(B, reduced, T, /*isSigned*/ false);
+  Value *diff = B.CreateCall(fabs, {B.CreateFSub(ext, full)});
+  Value *mag = B.CreateCall(fabs, {full});
+  Value *rel = B.CreateSelect(B.CreateFCmpOEQ(mag, ConstantFP::get(T, 0.0)),
+                              ConstantFP::get(T, 0.0), B.CreateFDiv(diff, mag));
+  rel = B.CreateSelect(B.CreateFCmpUNO(rel, rel), ConstantFP::get(T, 0.0),
+                       rel);
+  rel = B.CreateFPCast(rel, DT);
+
+  // The error is never negative, so non-negative doubles order as their
+  // bits and the running maximum can be kept with an atomic unsigned max,
+  // which stays correct when several threads store to caches
+  auto I64 = B.getInt64Ty();
+  Value *bits = B.CreateBitCast(rel, I64);
+  Value *ptr = B.CreateBitCast(GV, PointerType::getUnqual(I64));
+#if LLVM_VERSION_MAJOR >= 13
+  B.CreateAtomicRMW(AtomicRMWInst::UMax, ptr, bits, MaybeAlign(8),
+                    AtomicOrdering::Monotonic);
+#else
+  B.CreateAtomicRMW(AtomicRMWInst::UMax, ptr, bits, AtomicOrdering::Monotonic);
+#endif
+}
+
 /// Given an allocation defined at a particular ctx, store the value val
 /// in the cache at the location defined in the given builder
 void CacheUtility::storeInstructionInCache(LimitContext ctx,
@@ -1326,6 +1897,7 @@ void CacheUtility::storeInstructionInCache(LimitContext ctx,
   assert(BuilderM.GetInsertBlock()->getParent() == newFunc);
   if (auto inst = dyn_cast<Instruction>(val))
     assert(inst->getParent()->getParent() == newFunc);
+  locateCacheSites(cache, val);
   IRBuilder<> v(BuilderM.GetInsertBlock());
   v.SetInsertPoint(BuilderM.GetInsertBlock(), BuilderM.GetInsertPoint());
   v.setFastMathFlags(getFast());
@@ -1356,6 +1928,31 @@ void CacheUtility::storeInstructionInCache(LimitContext ctx,
     }
   }
 
+  // Narrowed caches hold the value converted to their type
+  auto narrowed = NarrowedCaches.find(cache);
+  if (narrowed != NarrowedCaches.end()) {
+    assert(val->getType() == narrowed->second.type);
+    BasicBlock *BB = v.GetInsertBlock();
+    Instruction *prev = v.GetInsertPoint() == BB->begin()
+                            ? nullptr
+                            : &*std::prev(v.GetInsertPoint());
+    Value *full = val;
+    if (narrowed->second.high)
+      val = v.CreateICmpEQ(val, narrowed->second.high);
+    else
+      val = narrowForCache(v, val, narrowed->second.stored);
+    if (EnzymeCachePrecisionCheck && full->getType()->isFloatingPointTy() &&
+        !isa<Constant>(full))
+      recordPrecisionError(v, full, val);
+
+    // The conversion is removed along with the cache if it turns out to be
+    // unnecessary
+    for (auto &I : make_range(prev ? std::next(prev->getIterator())
+                                   : BB->begin(),
+                              v.GetInsertPoint()))
+      scopeInstructions[cache].push_back(&I);
+  }
+
   bool isi1 = val->getType()->isIntegerTy() &&
               cast<IntegerType>(val->getType())->getBitWidth() == 1;
   Value *loc = getCachePointer(/*inForwardPass*/ true, v, ctx, cache, isi1,
@@ -1428,6 +2025,17 @@ void CacheUtility::storeInstructionInCache(LimitContext ctx,
 #else
   storeinst->setAlignment(align);
 #endif
+
+  // Values cached per iteration are written once and not read again until
+  // the reverse pass, so they need not displace the working set
+  if (EnzymeNontemporalCache && tostore == val && !isa<AllocaInst>(loc) &&
+      !isa<LoadInst>(loc)) {
+    storeinst->setMetadata(
+        LLVMContext::MD_nontemporal,
+        MDNode::get(cache->getContext(),
+                    ConstantAsMetadata::get(ConstantInt::get(
+                        Type::getInt32Ty(cache->getContext()), 1))));
+  }
   scopeInstructions[cache].push_back(storeinst);
   for (auto post : PostCacheStore(storeinst, v)) {
     scopeInstructions[cache].push_back(post);
@@ -1528,8 +2136,21 @@ Value *CacheUtility::getCachePointer(bool inForwardPass, IRBuilder<> &BuilderM,
     const auto &containedloops = sublimits[i].second;
 
     if (containedloops.size() > 0) {
+      ValueToValueMapTy chunkAvailable;
+      for (auto pair : available)
+        chunkAvailable[pair.first] = pair.second;
+      if (auto segment = getSegmentSize(sublimits, i)) {
+        next = loadSegmentOfChunk(inForwardPass, BuilderM, next,
+                                  containedloops, segment, chunkAvailable);
+        if (storeInInstructionsMap && isa<AllocaInst>(cache)) {
+          scopeInstructions[cast<AllocaInst>(cache)].push_back(
+              cast<Instruction>(cast<LoadInst>(next)->getPointerOperand()));
+          scopeInstructions[cast<AllocaInst>(cache)].push_back(
+              cast<Instruction>(next));
+        }
+      }
       Value *idx = computeIndexOfChunk(inForwardPass, BuilderM, containedloops,
-                                       available);
+                                       chunkAvailable);
       if (EfficientBoolCache && isi1 && i == 0)
         idx = BuilderM.CreateLShr(
             idx, ConstantInt::get(Type::getInt64Ty(newFunc->getContext()), 3));
@@ -1538,16 +2159,43 @@ Value *CacheUtility::getCachePointer(bool inForwardPass, IRBuilder<> &BuilderM,
         assert(es);
         idx = BuilderM.CreateMul(idx, es, "", /*NUW*/ true, /*NSW*/ true);
       }
+      auto coalesced = isa<AllocaInst>(cache)
+                           ? CoalescedMembers.find(cast<AllocaInst>(cache))
+                           : CoalescedMembers.end();
+      if (coalesced != CoalescedMembers.end()) {
+        // Consecutive values of a coalesced cache are one record apart
+        Value *loaded = next;
+        auto PT = cast<PointerType>(next->getType());
+        auto i8 = Type::getInt8Ty(PT->getContext());
+        Value *bytes = BuilderM.CreatePointerCast(
+            next, PointerType::get(i8, PT->getAddressSpace()));
+        idx = BuilderM.CreateMul(idx, coalesced->second->stride, "",
+                                 /*NUW*/ true, /*NSW*/ true);
 #if LLVM_VERSION_MAJOR > 7
-      next = BuilderM.CreateGEP(next->getType()->getPointerElementType(), next,
-                                idx);
+        Value *gep = BuilderM.CreateInBoundsGEP(i8, bytes, idx);
 #else
-      next = BuilderM.CreateGEP(next, idx);
+        Value *gep = BuilderM.CreateInBoundsGEP(bytes, idx);
 #endif
-      cast<GetElementPtrInst>(next)->setIsInBounds(true);
-      if (storeInInstructionsMap && isa<AllocaInst>(cache))
-        scopeInstructions[cast<AllocaInst>(cache)].push_back(
-            cast<Instruction>(next));
+        next = BuilderM.CreatePointerCast(gep, PT);
+        if (storeInInstructionsMap) {
+          SmallPtrSet<Value *, 4> seen = {loaded};
+          for (auto V : {bytes, gep, next})
+            if (seen.insert(V).second)
+              scopeInstructions[cast<AllocaInst>(cache)].push_back(
+                  cast<Instruction>(V));
+        }
+      } else {
+#if LLVM_VERSION_MAJOR > 7
+        next = BuilderM.CreateGEP(next->getType()->getPointerElementType(),
+                                  next, idx);
+#else
+        next = BuilderM.CreateGEP(next, idx);
+#endif
+        cast<GetElementPtrInst>(next)->setIsInBounds(true);
+        if (storeInInstructionsMap && isa<AllocaInst>(cache))
+          scopeInstructions[cast<AllocaInst>(cache)].push_back(
+              cast<Instruction>(next));
+      }
     }
     assert(next->getType()->isPointerTy());
   }
@@ -1590,6 +2238,64 @@ llvm::Value *CacheUtility::loadFromCachePointer(llvm::IRBuilder<> &BuilderM,
   return result;
 }
 
+/// Given a pointer into a loop cache, return the address of the entry offset
+/// iterations after it as an i8*, or nullptr if the entry is not indexed by a
+/// loop. The address may lie outside the allocation, so it is not inbounds.
+Value *CacheUtility::getCacheNeighbour(IRBuilder<> &BuilderM, Value *cptr,
+                                       Value *cache, int64_t offset) {
+  auto coalesced = isa<AllocaInst>(cache)
+                       ? CoalescedMembers.find(cast<AllocaInst>(cache))
+                       : CoalescedMembers.end();
+  if (coalesced == CoalescedMembers.end() && !isa<GetElementPtrInst>(cptr))
+    return nullptr;
+
+  auto i64 = Type::getInt64Ty(cptr->getContext());
+  auto i8 = Type::getInt8Ty(cptr->getContext());
+  auto PT = cast<PointerType>(cptr->getType());
+  auto BPT = PointerType::get(i8, PT->getAddressSpace());
+  if (coalesced != CoalescedMembers.end()) {
+    Value *bytes = BuilderM.CreatePointerCast(cptr, BPT);
+    Value *off = BuilderM.CreateMul(coalesced->second->stride,
+                                    ConstantInt::get(i64, offset));
+#if LLVM_VERSION_MAJOR > 7
+    return BuilderM.CreateGEP(i8, bytes, off);
+#else
+    return BuilderM.CreateGEP(bytes, off);
+#endif
+  }
+#if LLVM_VERSION_MAJOR > 7
+  Value *next = BuilderM.CreateGEP(PT->getPointerElementType(), cptr,
+                                   ConstantInt::get(i64, offset));
+#else
+  Value *next = BuilderM.CreateGEP(cptr, ConstantInt::get(i64, offset));
+#endif
+  return BuilderM.CreatePointerCast(next, BPT);
+}
+
+/// Given a pointer into a loop cache computed in the reverse pass, prefetch
+/// the entry EnzymeCachePrefetch iterations ahead of it
+void CacheUtility::prefetchCachePointer(IRBuilder<> &BuilderM, Value *cptr,
+                                        Value *cache) {
+  // The reverse pass walks the cache backwards, so the entry it will need
+  // next lives at a lower index
+  Value *ahead = getCacheNeighbour(BuilderM, cptr, cache, -EnzymeCachePrefetch);
+  if (!ahead)
+    return;
+
+  auto i32 = Type::getInt32Ty(cptr->getContext());
+#if LLVM_VERSION_MAJOR >= 10
+  Function *prefetch = Intrinsic::getDeclaration(
+      newFunc->getParent(), Intrinsic::prefetch, {ahead->getType()});
+#else
+  Function *prefetch =
+      Intrinsic::getDeclaration(newFunc->getParent(), Intrinsic::prefetch);
+#endif
+  // Read access, high temporal locality, data cache
+  Value *args[] = {ahead, ConstantInt::get(i32, 0), ConstantInt::get(i32, 3),
+                   ConstantInt::get(i32, 1)};
+  BuilderM.CreateCall(prefetch, args);
+}
+
 /// Given an allocation specified by the LimitContext ctx and cache, lookup the
 /// underlying cached value.
 Value *
@@ -1597,11 +2303,34 @@ CacheUtility::lookupValueFromCache(bool inForwardPass, IRBuilder<> &BuilderM,
                                    LimitContext ctx, Value *cache, bool isi1,
                                    const ValueToValueMapTy &available,
                                    Value *extraSize, Value *extraOffset) {
+  // Narrowed caches are read at their stored type and extended back
+  auto narrowed = isa<AllocaInst>(cache)
+                      ? NarrowedCaches.find(cast<AllocaInst>(cache))
+                      : NarrowedCaches.end();
+  if (narrowed != NarrowedCaches.end())
+    isi1 = narrowed->second.stored->isIntegerTy(1);
+
   // Get the underlying cache pointer
   auto cptr =
       getCachePointer(inForwardPass, BuilderM, ctx, cache, isi1,
                       /*storeInInstructionsMap*/ false, available, extraSize);
 
+  if (EnzymeCachePrefetch > 0 && !inForwardPass && !extraSize &&
+      !(EfficientBoolCache && isi1))
+    prefetchCachePointer(BuilderM, cptr, cache);
+
+  // Compare against the entry read the iteration before to read the file
+  // tape ahead of the reverse pass
+  if (EnzymeFileTape && !inForwardPass && !extraSize &&
+      !(EfficientBoolCache && isi1) &&
+      cptr->getType()->getPointerAddressSpace() == 0)
+    if (Value *last = getCacheNeighbour(BuilderM, cptr, cache, 1)) {
+      auto i8p = Type::getInt8PtrTy(cptr->getContext());
+      Value *args[] = {BuilderM.CreatePointerCast(cptr, i8p), last};
+      BuilderM.CreateCall(getOrInsertFileTapeReadahead(*newFunc->getParent()),
+                          args);
+    }
+
   // Optionally apply the additional offset
   if (extraOffset) {
 #if LLVM_VERSION_MAJOR > 7
@@ -1627,8 +2356,17 @@ CacheUtility::lookupValueFromCache(bool inForwardPass, IRBuilder<> &BuilderM,
               BuilderM.CreateTrunc(bo->getOperand(0),
                                    Type::getInt8Ty(cache->getContext())),
               ConstantInt::get(Type::getInt8Ty(cache->getContext()), 7)));
-      return BuilderM.CreateTrunc(res, Type::getInt1Ty(result->getContext()));
+      result =
+          BuilderM.CreateTrunc(res, Type::getInt1Ty(result->getContext()));
     }
   }
+
+  if (narrowed != NarrowedCaches.end()) {
+    if (narrowed->second.high)
+      return BuilderM.CreateSelect(result, narrowed->second.high,
+                                   narrowed->second.low);
+    return extendFromCache(BuilderM, result, narrowed->second.type,
+                           narrowed->second.isSigned);
+  }
   return result;
 }
@@ -45,6 +45,37 @@ extern "C" {
 extern llvm::cl::opt<bool> EfficientBoolCache;
 
 extern llvm::cl::opt<bool> EnzymeZeroCache;
+
+/// Grow dynamic loop caches geometrically, overallocating to avoid reallocs
+extern llvm::cl::opt<bool> EfficientMaxCache;
+
+/// Cache dynamic loops in blocks of this many iterations
+extern llvm::cl::opt<int> EnzymeSegmentedCache;
+
+/// Pack the caches of a loop nest into a single interleaved allocation
+extern llvm::cl::opt<bool> EnzymeCoalesceCache;
+
+/// Write loop caches with non-temporal stores
+extern llvm::cl::opt<bool> EnzymeNontemporalCache;
+
+/// Prefetch loop caches this many iterations ahead of the reverse pass
+extern llvm::cl::opt<int> EnzymeCachePrefetch;
+
+/// Store cached integers in the narrowest type that holds their range
+extern llvm::cl::opt<bool> EnzymeNarrowIntCache;
+
+/// Store floating point caches at this reduced precision
+extern llvm::cl::opt<std::string> EnzymeCachePrecision;
+
+/// Record the largest relative error of values stored in reduced precision
+/// caches
+extern llvm::cl::opt<bool> EnzymeCachePrecisionCheck;
+
+/// Map large loop caches from files, read ahead during the reverse pass
+extern llvm::cl::opt<bool> EnzymeFileTape;
+
+/// Record the footprint of each cache site at runtime
+extern llvm::cl::opt<bool> EnzymeCacheInstrument;
 }
 
 /// Container for all loop information to synthesize gradients
@@ -247,6 +278,16 @@ public:
   SubLimitType getSubLimits(bool inForwardPass, llvm::IRBuilder<> *RB,
                             LimitContext ctx, llvm::Value *extraSize = nullptr);
 
+  /// Return the number of iterations stored in each block of chunk i, or null
+  /// if the chunk is not segmented. Chunks headed by a dynamic loop are
+  /// segmented when EnzymeSegmentedCache or EnzymeFileTape is set, storing a
+  /// table of blocks rather than a single reallocated array.
+  llvm::ConstantInt *getSegmentSize(const SubLimitType &sublimits, int i);
+
+  /// Return the number of pointers loaded to reach the values of a cache
+  /// with the given chunks
+  unsigned getCacheDepth(const SubLimitType &sublimits);
+
 private:
   /// Internal data structure used by getSubLimit to avoid computing the same
   /// loop limit multiple times if possible. Map's a desired limitMinus1 (see
@@ -271,6 +312,14 @@ private:
       llvm::ArrayRef<std::pair<LoopContext, llvm::Value *>> containedloops,
       const llvm::ValueToValueMapTy &available);
 
+  /// Given the table of blocks of a segmented chunk, load the block holding
+  /// the current iteration of the chunk's outermost loop. The iteration
+  /// within the block is added to available for use by computeIndexOfChunk.
+  llvm::Value *loadSegmentOfChunk(
+      bool inForwardPass, llvm::IRBuilder<> &v, llvm::Value *table,
+      llvm::ArrayRef<std::pair<LoopContext, llvm::Value *>> containedloops,
+      llvm::ConstantInt *segment, llvm::ValueToValueMapTy &available);
+
 private:
   /// Given a cache allocation and an index denoting how many Chunks deep the
   /// allocation is being indexed into, return the invariant metadata describing
@@ -308,6 +357,101 @@ protected:
            llvm::SmallVector<llvm::AssertingVH<llvm::CallInst>, 4>>
       scopeAllocs;
 
+  /// An allocation shared by all statically sized caches of a loop nest,
+  /// storing the values of each iteration together as one record
+  struct CoalescedCache {
+    /// Untyped pointer to the first record
+    llvm::Value *allocation = nullptr;
+    /// Placeholder for the size of a record, only known once every cache
+    /// of the loop nest has been created
+    llvm::PHINode *stride = nullptr;
+    /// Bytes used by the fields added so far
+    uint64_t size = 0;
+    /// Largest alignment of any field
+    uint64_t align = 1;
+    /// The cache which releases the allocation
+    llvm::AllocaInst *owner = nullptr;
+    /// Instructions creating the allocation, tracked as part of the owner
+    llvm::SmallVector<llvm::Instruction *, 3> instructions;
+  };
+
+  /// Coalesced allocations by innermost loop header, outermost loop header
+  /// and number of records
+  std::map<std::tuple<llvm::BasicBlock *, llvm::BasicBlock *, llvm::Value *>,
+           CoalescedCache>
+      CoalescedCaches;
+
+  /// The coalesced allocation storing each cache, if any. Only the owner of
+  /// each allocation releases it.
+  std::map<llvm::AllocaInst *, CoalescedCache *> CoalescedMembers;
+
+  /// Make another cache sharing the coalesced allocation owned by cache, if
+  /// any, its owner, so that it outlives cache
+  void transferCoalescedCache(llvm::AllocaInst *cache);
+
+  /// A cache storing values narrower than their type
+  struct NarrowedCache {
+    /// Type of the values being cached
+    llvm::Type *type = nullptr;
+    /// Type of the values as stored
+    llvm::Type *stored = nullptr;
+    /// Whether stored values are sign, rather than zero, extended on lookup
+    bool isSigned = false;
+    /// For integers taking one of two values, those values. The cache then
+    /// stores whether the value is high, and selects between them on lookup.
+    llvm::ConstantInt *low = nullptr;
+    llvm::ConstantInt *high = nullptr;
+  };
+
+  /// Narrowed caches, by their allocation
+  std::map<llvm::AllocaInst *, NarrowedCache> NarrowedCaches;
+
+  /// An allocation of a cache instrumented by the cache runtime
+  struct CacheSite {
+    /// Runtime record of the allocation, or nullptr if it was allocated by
+    /// the augmented forward pass and is read from the tape
+    llvm::GlobalVariable *record;
+    /// Name of the site, without its source location
+    std::string name;
+    /// Whether the record is named after the location of the cached value
+    bool located;
+  };
+
+  /// Instrumented allocations of each cache, by chunk
+  std::map<llvm::AllocaInst *, std::map<int, CacheSite>> CacheSites;
+
+public:
+  /// Chunks of the loop caches stored on the tape which are allocated
+  /// through the cache runtime, by tape index. The reverse pass reading them
+  /// from the tape must release them through the runtime as well.
+  std::map<int, std::set<int>> InstrumentedTapeCaches;
+
+protected:
+  /// Instrumented chunks of the cache being read from the tape, if any
+  const std::set<int> *TapeCacheSites = nullptr;
+
+  /// Route the allocation call of chunk i of cache alloc through the cache
+  /// runtime, if requested and possible
+  void instrumentCacheAllocation(llvm::CallInst *call, llvm::AllocaInst *alloc,
+                                 int i, const llvm::Twine &name);
+
+  /// Name the runtime records of cache after the location of val, which it
+  /// stores
+  void locateCacheSites(llvm::AllocaInst *cache, llvm::Value *val);
+
+  /// Whether the allocation of chunk i of alloc is instrumented, in which
+  /// case it must be released through the cache runtime
+  bool isInstrumentedCache(llvm::AllocaInst *alloc, int i) const;
+
+  /// Add a field of type T to a coalesced allocation with size records,
+  /// allocating it if this is the first cache to use it. Returns a pointer of
+  /// type PT to the field within the first record.
+  llvm::Value *allocateCoalescedCache(llvm::IRBuilder<> &B,
+                                      CoalescedCache &record,
+                                      llvm::AllocaInst *alloc, llvm::Type *T,
+                                      llvm::Type *PT, llvm::Value *size,
+                                      llvm::StringRef name);
+
   /// Perform the final load from the cache, applying requisite invariant
   /// group and alignment
   llvm::Value *loadFromCachePointer(llvm::IRBuilder<> &BuilderM,
@@ -350,6 +494,29 @@ public:
 
   virtual bool assumeDynamicLoopOfSizeOne(llvm::Loop *L) const = 0;
 
+  /// Whether caches of the same loop nest may share a single allocation,
+  /// rather than each being allocated (and possibly taped) separately
+  virtual bool canCoalesceCaches() const { return false; }
+
+  /// Set the record size of every coalesced allocation, once all caches
+  /// sharing it have been created
+  void finalizeCoalescedCaches();
+
+  /// Whether caches may store values narrower than their type, rather than
+  /// in the type expected when the cache is read from a tape
+  virtual bool canNarrowCaches() const { return false; }
+
+  /// Return the narrowest type holding every value V may take, or nullptr if
+  /// V cannot be cached narrower. Integers are narrowed to their known range,
+  /// and floating point values to the requested reduced precision. The
+  /// conversion back on lookup is recorded in narrowed.
+  llvm::Type *getNarrowCacheType(llvm::Value *V, NarrowedCache &narrowed);
+
+  /// Return the type caches of floating point type T are stored in, or
+  /// nullptr if they keep their full precision. bfloat is stored as the
+  /// upper half of the float encoding in an i16.
+  llvm::Type *getReducedPrecisionType(llvm::Type *T);
+
   /// If an allocation is requested to be freed, this subclass will be called to
   /// chose how and where to free it. It is by default not implemented, falling
   /// back to an error. Subclasses who want to free memory should implement this
@@ -392,6 +559,23 @@ public:
       llvm::Value *cache, bool isi1, const llvm::ValueToValueMapTy &available,
       llvm::Value *extraSize = nullptr, llvm::Value *extraOffset = nullptr);
 
+private:
+  /// Fold the relative error of storing full as reduced into the running
+  /// maximum kept in __enzyme_cache_precision_error
+  void recordPrecisionError(llvm::IRBuilder<> &BuilderM, llvm::Value *full,
+                            llvm::Value *reduced);
+
+  /// Given a pointer into a loop cache, return the address of the entry
+  /// offset iterations after it, or nullptr if it is not indexed by a loop
+  llvm::Value *getCacheNeighbour(llvm::IRBuilder<> &BuilderM,
+                                 llvm::Value *cptr, llvm::Value *cache,
+                                 int64_t offset);
+
+  /// Given a pointer into a loop cache computed in the reverse pass, prefetch
+  /// the entry EnzymeCachePrefetch iterations ahead of it
+  void prefetchCachePointer(llvm::IRBuilder<> &BuilderM, llvm::Value *cptr,
+                            llvm::Value *cache);
+
 protected:
   // List of values loaded from the cache
   llvm::SmallPtrSet<llvm::LoadInst *, 10> CacheLookups;
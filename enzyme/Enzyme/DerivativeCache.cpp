@@ -0,0 +1,436 @@
+//===- DerivativeCache.cpp - Persistent cache of derivative functions ---===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the persistent derivative cache, see
+// DerivativeCache.h. A cache entry is a bitcode module holding the derivative
+// and the functions created along with it, with declarations for everything
+// else it refers to. On loading, declarations are resolved by name against
+// the current module, which the key guarantees to match.
+//
+//===----------------------------------------------------------------------===//
+
+#include "DerivativeCache.h"
+
+#include "ActivityAnalysis.h"
+#include "CacheUtility.h"
+#include "EnzymeLogic.h"
+#include "FunctionUtils.h"
+#include "GradientUtils.h"
+#include "TypeAnalysis/TypeAnalysis.h"
+#include "Utils.h"
+
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#ifndef ENZYME_VERSION_STRING
+#define ENZYME_VERSION_STRING "unknown"
+#endif
+
+using namespace llvm;
+
+extern "C" {
+llvm::cl::opt<std::string> EnzymeCacheDir(
+    "enzyme-cache-dir", cl::init(""), cl::Hidden,
+    cl::desc("Directory in which derivatives are cached across compilations"));
+}
+
+/// Name of the metadata marking the derivative of a cache entry
+static const char CacheRootMD[] = "enzyme.cache.root";
+
+/// Add the globals used by the operands of U, looking through constants.
+static void collectGlobals(User *U, SetVector<GlobalValue *> &Globals,
+                           SmallPtrSetImpl<Constant *> &Seen) {
+  for (Value *Op : U->operands()) {
+    if (auto GV = dyn_cast<GlobalValue>(Op))
+      Globals.insert(GV);
+    else if (auto C = dyn_cast<Constant>(Op))
+      if (Seen.insert(C).second)
+        collectGlobals(C, Globals, Seen);
+  }
+}
+
+/// Add the globals referred to by MD, such as the custom derivatives that
+/// enzyme_gradient and the other registration metadata attach to functions.
+static void collectGlobals(MDNode *MD, SetVector<GlobalValue *> &Globals,
+                           SmallPtrSetImpl<Constant *> &Seen,
+                           SmallPtrSetImpl<MDNode *> &SeenMD) {
+  if (!SeenMD.insert(MD).second)
+    return;
+  for (const MDOperand &Op : MD->operands()) {
+    if (auto N = dyn_cast_or_null<MDNode>(Op.get()))
+      collectGlobals(N, Globals, Seen, SeenMD);
+    else if (auto C = dyn_cast_or_null<ConstantAsMetadata>(Op.get())) {
+      if (auto GV = dyn_cast<GlobalValue>(C->getValue()))
+        Globals.insert(GV);
+      else if (Seen.insert(C->getValue()).second)
+        collectGlobals(C->getValue(), Globals, Seen);
+    }
+  }
+}
+
+/// Metadata attached to F, other than its debug information.
+static void getFunctionMetadata(Function *F,
+                                SmallVectorImpl<std::pair<unsigned, MDNode *>>
+                                    &MDs) {
+  F->getAllMetadata(MDs);
+  llvm::erase_if(MDs, [](const std::pair<unsigned, MDNode *> &MD) {
+    return MD.first == LLVMContext::MD_dbg;
+  });
+}
+
+/// Root and the globals it refers to, transitively through the globals for
+/// which Follow holds.
+static SetVector<GlobalValue *>
+getReferencedGlobals(GlobalValue *Root,
+                     function_ref<bool(GlobalValue *)> Follow) {
+  SetVector<GlobalValue *> Globals;
+  SmallPtrSet<Constant *, 16> Seen;
+  SmallPtrSet<MDNode *, 16> SeenMD;
+  SmallVector<std::pair<unsigned, MDNode *>, 4> MDs;
+  Globals.insert(Root);
+  for (unsigned i = 0; i < Globals.size(); ++i) {
+    GlobalValue *GV = Globals[i];
+    if (!Follow(GV))
+      continue;
+    // The initializer of a variable, the aliasee of an alias and the
+    // personality of a function.
+    collectGlobals(GV, Globals, Seen);
+    auto F = dyn_cast<Function>(GV);
+    if (!F)
+      continue;
+    getFunctionMetadata(F, MDs);
+    for (auto &MD : MDs)
+      collectGlobals(MD.second, Globals, Seen, SeenMD);
+    for (auto &BB : *F)
+      for (auto &I : BB)
+        collectGlobals(&I, Globals, Seen);
+  }
+  return Globals;
+}
+
+/// Globals the derivative of Fn depends on, Fn included. Custom derivatives
+/// registered for Fn or its callees are among them, so that they are hashed
+/// and stored as declarations rather than as copies.
+static SetVector<GlobalValue *> getPrimalGlobals(Function *Fn) {
+  return getReferencedGlobals(Fn, [](GlobalValue *) { return true; });
+}
+
+/// Options that change the generated derivatives
+static void printOptions(raw_ostream &OS) {
+  auto print = [&](const auto &Opt) {
+    OS << Opt.ArgStr << "=" << Opt.getValue() << "\n";
+  };
+  print(looseTypeAnalysis);
+  print(nonmarkedglobals_inactiveloads);
+  print(EnzymeBatchVectorize);
+  print(EnzymeNonmarkedGlobalsInactive);
+  print(EfficientBoolCache);
+  print(EnzymeZeroCache);
+  print(EnzymeSegmentedCache);
+  print(EnzymeCoalesceCache);
+  print(EnzymeNontemporalCache);
+  print(EnzymeCachePrefetch);
+  print(EnzymeNarrowIntCache);
+  print(EnzymeCachePrecision);
+  print(EnzymeCachePrecisionCheck);
+  print(EnzymeFileTape);
+  print(EnzymeFileTapeMin);
+  print(EnzymeCacheInstrument);
+  print(EnzymeRuntimeActivityCheck);
+  print(EnzymeInactiveDynamic);
+  print(EnzymeFreeInternalAllocations);
+  print(EnzymeRematerialize);
+  print(EnzymePrivatizeShadows);
+  print(EnzymeVectorShadows);
+  print(EnzymeCheckpointInterval);
+  print(EnzymeCheckpointRecompute);
+  print(EnzymePreopt);
+  print(EnzymeInline);
+  print(EnzymeNoAlias);
+  print(EnzymeLowerGlobals);
+  print(EnzymeCoalese);
+#if LLVM_VERSION_MAJOR >= 8
+  print(EnzymePHIRestructure);
+#endif
+  print(EnzymeSelectOpt);
+  print(EnzymeMinCutCache);
+  print(EnzymeLoopInvariantCache);
+  print(EfficientMaxCache);
+  print(EnzymeStrictAliasing);
+  print(MaxIntOffset);
+  print(RustTypeRules);
+  print(MaxTypeOffset);
+}
+
+/// Whether callbacks registered at runtime, which the key cannot describe,
+/// may change the derivatives generated with TA
+static bool hasCustomHandlers(const TypeAnalysis &TA) {
+  return CustomErrorHandler || CustomAllocator || CustomDeallocator ||
+         CustomRuntimeInactiveError || EnzymePostCacheStore ||
+         EnzymeDefaultTapeType || !shadowHandlers.empty() ||
+         !shadowErasers.empty() || !customCallHandlers.empty() ||
+         !customFwdCallHandlers.empty() || !TA.CustomRules.empty();
+}
+
+std::string getPersistentCacheKey(Function *Fn, StringRef Desc,
+                                  const TypeAnalysis &TA) {
+  if (EnzymeCacheDir.empty() || hasCustomHandlers(TA))
+    return "";
+  Module &M = *Fn->getParent();
+
+  std::string Buffer;
+  raw_string_ostream OS(Buffer);
+  OS << "enzyme " << ENZYME_VERSION_STRING << " llvm " << LLVM_VERSION_STRING
+     << "\n";
+  printOptions(OS);
+  OS << M.getTargetTriple() << "\n" << M.getDataLayoutStr() << "\n";
+  // Allocations are served from an enzyme_workspace if the module has one
+  OS << "workspace "
+     << (M.getGlobalVariable("__enzyme_workspace", /*AllowInternal*/ true) !=
+         nullptr)
+     << "\n";
+  OS << Desc << "\n";
+
+  ModuleSlotTracker MST(&M);
+  SmallVector<StringRef, 32> Kinds;
+  M.getContext().getMDKindNames(Kinds);
+  SmallVector<std::pair<unsigned, MDNode *>, 4> MDs;
+  for (GlobalValue *GV : getPrimalGlobals(Fn)) {
+    // Cached derivatives refer to the globals they use by name.
+    if (!GV->hasName())
+      return "";
+    GV->print(OS, MST);
+    OS << "\n";
+    auto F = dyn_cast<Function>(GV);
+    if (!F)
+      continue;
+    // Attribute groups and metadata are only printed as references.
+    F->getAttributes().print(OS);
+    getFunctionMetadata(F, MDs);
+    for (auto &MD : MDs) {
+      OS << Kinds[MD.first] << " ";
+      MD.second->printTree(OS, MST, &M);
+    }
+    for (auto &BB : *F)
+      for (auto &I : BB) {
+        if (auto CB = dyn_cast<CallBase>(&I))
+          CB->getAttributes().print(OS);
+        I.getAllMetadataOtherThanDebugLoc(MDs);
+        for (auto &MD : MDs)
+          MD.second->printTree(OS, MST, &M);
+      }
+  }
+  OS.flush();
+
+  auto Hash = SHA1::hash(
+      ArrayRef<uint8_t>((const uint8_t *)Buffer.data(), Buffer.size()));
+  return toHex(Hash, /*LowerCase*/ true);
+}
+
+static SmallString<128> getCachePath(StringRef Key) {
+  SmallString<128> Path(EnzymeCacheDir);
+  sys::path::append(Path, Key + ".bc");
+  return Path;
+}
+
+/// Create a function in M with the name, type and attributes of Src.
+static Function *createFunction(Function *Src, GlobalValue::LinkageTypes L,
+                                Module &M) {
+  auto F = Function::Create(Src->getFunctionType(), L, Src->getName(), &M);
+  F->setCallingConv(Src->getCallingConv());
+  F->setAttributes(Src->getAttributes());
+  return F;
+}
+
+/// Clone the bodies of the functions in Defs, which VMap maps to empty
+/// functions of another module.
+static void cloneBodies(ArrayRef<Function *> Defs, ValueToValueMapTy &VMap) {
+  for (Function *F : Defs) {
+    auto NF = cast<Function>(VMap[F]);
+    auto NewArg = NF->arg_begin();
+    for (auto &Arg : F->args()) {
+      NewArg->setName(Arg.getName());
+      VMap[&Arg] = &*NewArg++;
+    }
+    SmallVector<ReturnInst *, 4> Returns;
+#if LLVM_VERSION_MAJOR >= 13
+    CloneFunctionInto(NF, F, VMap, CloneFunctionChangeType::DifferentModule,
+                      Returns);
+#else
+    CloneFunctionInto(NF, F, VMap, /*ModuleLevelChanges*/ true, Returns);
+#endif
+  }
+}
+
+/// Remove the empty list of compile units left by cloning functions without
+/// debug information into M.
+static void dropEmptyCompileUnits(Module &M) {
+  if (auto CUs = M.getNamedMetadata("llvm.dbg.cu"))
+    if (CUs->getNumOperands() == 0)
+      M.eraseNamedMetadata(CUs);
+}
+
+Function *loadPersistentDerivative(Module &M, StringRef Key) {
+  if (Key.empty())
+    return nullptr;
+  auto Path = getCachePath(Key);
+  auto Buffer = MemoryBuffer::getFile(Path);
+  if (!Buffer)
+    return nullptr;
+  auto SrcOrErr = parseBitcodeFile((*Buffer)->getMemBufferRef(),
+                                   M.getContext());
+  if (!SrcOrErr) {
+    consumeError(SrcOrErr.takeError());
+    return nullptr;
+  }
+  Module &Src = **SrcOrErr;
+  NamedMDNode *RootMD = Src.getNamedMetadata(CacheRootMD);
+  if (!RootMD || RootMD->getNumOperands() != 1)
+    return nullptr;
+  auto Root = dyn_cast<Function>(
+      cast<ValueAsMetadata>(RootMD->getOperand(0)->getOperand(0))
+          ->getValue());
+  if (!Root)
+    return nullptr;
+
+  // Check that every declaration resolves before changing M. Functions
+  // missing from M, such as runtime functions, are declared.
+  SmallVector<Function *, 4> Defs;
+  for (GlobalValue &GV : Src.global_values()) {
+    if (!GV.isDeclaration()) {
+      if (!isa<Function>(GV))
+        return nullptr;
+      Defs.push_back(cast<Function>(&GV));
+      continue;
+    }
+    GlobalValue *Dst = M.getNamedValue(GV.getName());
+    if (Dst ? Dst->getType() != GV.getType() ||
+                  Dst->getValueType() != GV.getValueType()
+            : !isa<Function>(GV))
+      return nullptr;
+  }
+
+  ValueToValueMapTy VMap;
+  for (GlobalValue &GV : Src.global_values()) {
+    if (!GV.isDeclaration())
+      continue;
+    GlobalValue *Dst = M.getNamedValue(GV.getName());
+    if (!Dst)
+      Dst = createFunction(cast<Function>(&GV), GlobalValue::ExternalLinkage,
+                           M);
+    VMap[&GV] = Dst;
+  }
+  for (Function *F : Defs)
+    VMap[F] = createFunction(F, GlobalValue::InternalLinkage, M);
+  bool HadCUs = M.getNamedMetadata("llvm.dbg.cu");
+  cloneBodies(Defs, VMap);
+  if (!HadCUs)
+    dropEmptyCompileUnits(M);
+  return cast<Function>(VMap[Root]);
+}
+
+void storePersistentDerivative(Function *Derivative, Function *Fn,
+                               StringRef Key) {
+  if (Key.empty())
+    return;
+  auto Primal = getPrimalGlobals(Fn);
+  auto Globals = getReferencedGlobals(
+      Derivative, [&](GlobalValue *GV) { return !Primal.count(GV); });
+
+  // The functions created along with the derivative are stored with it.
+  SmallVector<Function *, 4> Defs;
+  for (GlobalValue *GV : Globals) {
+    if (Primal.count(GV) || GV->isDeclaration())
+      continue;
+    auto F = dyn_cast<Function>(GV);
+    if (!F || hasMetadata(F, "enzyme_placeholder"))
+      return;
+    Defs.push_back(F);
+  }
+
+  Module &M = *Fn->getParent();
+  Module Dst("enzyme_cache", M.getContext());
+  Dst.setTargetTriple(M.getTargetTriple());
+  Dst.setDataLayout(M.getDataLayout());
+  ValueToValueMapTy VMap;
+  for (GlobalValue *GV : Globals) {
+    if (!Primal.count(GV) && !GV->isDeclaration())
+      continue;
+    if (auto F = dyn_cast<Function>(GV)) {
+      VMap[GV] = createFunction(F, GlobalValue::ExternalLinkage, Dst);
+    } else if (GV->getValueType()->isFunctionTy()) {
+      VMap[GV] = Function::Create(cast<FunctionType>(GV->getValueType()),
+                                  GlobalValue::ExternalLinkage, GV->getName(),
+                                  &Dst);
+    } else {
+      auto G = dyn_cast<GlobalVariable>(GV);
+      VMap[GV] = new GlobalVariable(
+          Dst, GV->getValueType(), G && G->isConstant(),
+          GlobalValue::ExternalLinkage, nullptr, GV->getName(), nullptr,
+          GV->getThreadLocalMode(), GV->getAddressSpace());
+    }
+  }
+  for (Function *F : Defs)
+    VMap[F] = createFunction(F, GlobalValue::InternalLinkage, Dst);
+  cloneBodies(Defs, VMap);
+  dropEmptyCompileUnits(Dst);
+  // Without it, debug information is stripped when the entry is read.
+  if (auto Version = M.getModuleFlag("Debug Info Version"))
+    Dst.addModuleFlag(Module::Warning, "Debug Info Version", Version);
+  Dst.getOrInsertNamedMetadata(CacheRootMD)
+      ->addOperand(MDNode::get(M.getContext(),
+                               ValueAsMetadata::get(VMap[Derivative])));
+
+  // Write to a temporary file renamed into place, so that concurrent
+  // compilations never read a partial entry.
+  if (sys::fs::create_directories(EnzymeCacheDir))
+    return;
+  auto Path = getCachePath(Key);
+  int FD;
+  SmallString<128> TmpPath;
+  if (sys::fs::createUniqueFile(Path + ".tmp%%%%%%", FD, TmpPath))
+    return;
+  {
+    raw_fd_ostream OS(FD, /*shouldClose*/ true);
+    WriteBitcodeToFile(Dst, OS);
+    if (OS.has_error()) {
+      OS.clear_error();
+      sys::fs::remove(TmpPath);
+      return;
+    }
+  }
+  if (sys::fs::rename(TmpPath, Path))
+    sys::fs::remove(TmpPath);
+}
@@ -0,0 +1,63 @@
+//===- DerivativeCache.h - Persistent cache of derivative functions -----===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the persistent derivative cache enabled by
+// -enzyme-cache-dir. Derivatives are stored as bitcode files named by a hash
+// of the differentiated function, everything it references, the fields of
+// the derivative's cache key, the options changing the generated code and
+// the Enzyme version, so that later compilations and JIT sessions can reload
+// them instead of differentiating again.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef ENZYME_DERIVATIVE_CACHE_H
+#define ENZYME_DERIVATIVE_CACHE_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/Support/CommandLine.h"
+
+#include <string>
+
+extern "C" {
+/// Directory of the persistent derivative cache, disabled if empty
+extern llvm::cl::opt<std::string> EnzymeCacheDir;
+}
+
+class TypeAnalysis;
+
+/// Key under which the derivative of Fn is cached, given a description Desc
+/// of the other fields of its cache key and the type analysis TA it is
+/// differentiated with. Returns an empty string if the cache is disabled or
+/// the derivative cannot be cached, as when callbacks registered at runtime
+/// may change the generated code.
+std::string getPersistentCacheKey(llvm::Function *Fn, llvm::StringRef Desc,
+                                  const TypeAnalysis &TA);
+
+/// Load the derivative cached under Key into M, returning null on a miss
+llvm::Function *loadPersistentDerivative(llvm::Module &M, llvm::StringRef Key);
+
+/// Store Derivative, the derivative of Fn, under Key. Derivatives referring to
+/// global variables created during differentiation, such as shadow globals,
+/// are not stored.
+void storePersistentDerivative(llvm::Function *Derivative, llvm::Function *Fn,
+                               llvm::StringRef Key);
+
+#endif
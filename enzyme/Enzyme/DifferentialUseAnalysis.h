@@ -28,6 +28,7 @@
 #include <set>
 
 #include "GradientUtils.h"
+#include "TimeReport.h"
 
 typedef std::pair<const Value *, ValueType> UsageKey;
 
@@ -733,6 +734,7 @@ static inline void minCut(const DataLayout &DL, LoopInfo &OrigLI,
                           SmallPtrSetImpl<Value *> &MinReq,
                           const ValueMap<Value *, GradientUtils::Rematerializer>
                               &rematerializableAllocations) {
+  EnzymeTimeRegion timer(EnzymePhase::MinCut);
   Graph G;
   for (auto V : Intermediates) {
     G[Node(V, false)].insert(Node(V, true));
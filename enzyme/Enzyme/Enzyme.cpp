@@ -61,9 +61,11 @@
 #include "ActivityAnalysis.h"
 #include "EnzymeLogic.h"
 #include "GradientUtils.h"
+#include "TimeReport.h"
 #include "Utils.h"
 
 #include "InstructionBatcher.h"
+#include "JacobianSparsity.h"
 
 #include "llvm/Transforms/Utils.h"
 
@@ -91,6 +93,16 @@ llvm::cl::opt<bool> EnzymeAttributor("enzyme-attributor", cl::init(false),
 llvm::cl::opt<bool> EnzymeOMPOpt("enzyme-omp-opt", cl::init(false), cl::Hidden,
                                  cl::desc("Whether to enable openmp opt"));
 
+llvm::cl::opt<bool>
+    EnzymePrintCacheStats("enzyme-print-cache-stats", cl::init(false),
+                          cl::Hidden,
+                          cl::desc("Print lookups in the derivative caches"));
+
+llvm::cl::opt<unsigned> EnzymeJacobianWidth(
+    "enzyme-jacobian-width", cl::init(8), cl::Hidden,
+    cl::desc("Number of seeds per derivative call of __enzyme_jacobian when "
+             "no enzyme_width is given"));
+
 #if LLVM_VERSION_MAJOR >= 14
 #define addAttribute addAttributeAtIndex
 #endif
@@ -627,6 +639,19 @@ static Optional<StringRef> getMetadataName(llvm::Value *res) {
   }
 }
 
+/// Convert a vector mode shadow between the [width x T] array passed at the
+/// call site and the <width x T> vector used by derivatives with
+/// EnzymeVectorShadows.
+static Value *convertShadowLayout(IRBuilder<> &Builder, Value *V, Type *To) {
+  if (V->getType() == To)
+    return V;
+  Value *res = UndefValue::get(To);
+  for (unsigned i = 0; i < GradientUtils::getShadowWidth(To); ++i)
+    res = GradientUtils::insertMeta(
+        Builder, res, GradientUtils::extractMeta(Builder, V, i), i);
+  return res;
+}
+
 static Value *adaptReturnedVector(CallInst *CI, Value *diffret,
                                   IRBuilder<> &Builder, unsigned width) {
   /// Actual return type (including struct return)
@@ -752,9 +777,157 @@ static bool replaceOriginalCall(CallInst *CI, Function *fn, Value *diffret,
   return true;
 }
 
+/// Emit a loop over IV = 0, Step, 2 * Step, ... while IV < Count, calling
+/// Body to fill in the loop body. B is left at the start of the loop exit.
+static void emitCountedLoop(IRBuilder<> &B, Value *Count, uint64_t Step,
+                            const Twine &Name,
+                            function_ref<void(IRBuilder<> &, Value *)> Body) {
+  BasicBlock *Pre = B.GetInsertBlock();
+  Function *F = Pre->getParent();
+  BasicBlock *Next = Pre->getNextNode();
+  auto &Ctx = F->getContext();
+  BasicBlock *Header = BasicBlock::Create(Ctx, Name + ".header", F, Next);
+  BasicBlock *Loop = BasicBlock::Create(Ctx, Name + ".body", F, Next);
+  BasicBlock *Exit = BasicBlock::Create(Ctx, Name + ".exit", F, Next);
+  B.CreateBr(Header);
+
+  B.SetInsertPoint(Header);
+  Type *T = Count->getType();
+  PHINode *IV = B.CreatePHI(T, 2, Name);
+  IV->addIncoming(ConstantInt::get(T, 0), Pre);
+  B.CreateCondBr(B.CreateICmpULT(IV, Count), Loop, Exit);
+
+  B.SetInsertPoint(Loop);
+  Body(B, IV);
+  IV->addIncoming(B.CreateNUWAdd(IV, ConstantInt::get(T, Step), Name + ".next"),
+                  B.GetInsertBlock());
+  B.CreateBr(Header);
+
+  B.SetInsertPoint(Exit);
+}
+
+/// The type information of the arguments of fn implied by their LLVM types,
+/// used when differentiating fn from a call site.
+static FnTypeInfo getArgumentTypeInfo(Function *fn) {
+  FnTypeInfo type_args(fn);
+  for (auto &a : type_args.Function->args()) {
+    TypeTree dt;
+    if (a.getType()->isFPOrFPVectorTy()) {
+      dt = ConcreteType(a.getType()->getScalarType());
+    } else if (a.getType()->isPointerTy()) {
+      auto et = a.getType()->getPointerElementType();
+      if (et->isFPOrFPVectorTy()) {
+        dt = TypeTree(ConcreteType(et->getScalarType())).Only(-1);
+      } else if (et->isPointerTy()) {
+        dt = TypeTree(ConcreteType(BaseType::Pointer)).Only(-1);
+      }
+      dt.insert({}, BaseType::Pointer);
+    } else if (a.getType()->isIntOrIntVectorTy()) {
+      dt = ConcreteType(BaseType::Integer);
+    }
+    type_args.Arguments.insert(
+        std::pair<Argument *, TypeTree>(&a, dt.Only(-1)));
+    // TODO note that here we do NOT propagate constants in type info (and
+    // should consider whether we should)
+    type_args.KnownValues.insert(
+        std::pair<Argument *, std::set<int64_t>>(&a, {}));
+  }
+  return type_args;
+}
+
+/// Emit a conditional running Then when Cond holds. B is left at the start
+/// of the block following it.
+static void emitIf(IRBuilder<> &B, Value *Cond, const Twine &Name,
+                   function_ref<void(IRBuilder<> &)> Then) {
+  BasicBlock *Cur = B.GetInsertBlock();
+  Function *F = Cur->getParent();
+  BasicBlock *Next = Cur->getNextNode();
+  auto &Ctx = F->getContext();
+  BasicBlock *ThenBB = BasicBlock::Create(Ctx, Name + ".then", F, Next);
+  BasicBlock *Cont = BasicBlock::Create(Ctx, Name + ".cont", F, Next);
+  B.CreateCondBr(Cond, ThenBB, Cont);
+  B.SetInsertPoint(ThenBB);
+  Then(B);
+  B.CreateBr(Cont);
+  B.SetInsertPoint(Cont);
+}
+
+/// Emit a loop over the indices K of the set bits of Mask, lowest first,
+/// calling Body to fill in the loop body. B is left at the start of the loop
+/// exit.
+static void emitBitLoop(IRBuilder<> &B, Value *Mask, const Twine &Name,
+                        function_ref<void(IRBuilder<> &, Value *)> Body) {
+  BasicBlock *Pre = B.GetInsertBlock();
+  Function *F = Pre->getParent();
+  BasicBlock *Next = Pre->getNextNode();
+  auto &Ctx = F->getContext();
+  BasicBlock *Header = BasicBlock::Create(Ctx, Name + ".header", F, Next);
+  BasicBlock *Loop = BasicBlock::Create(Ctx, Name + ".body", F, Next);
+  BasicBlock *Exit = BasicBlock::Create(Ctx, Name + ".exit", F, Next);
+  B.CreateBr(Header);
+
+  B.SetInsertPoint(Header);
+  Type *T = Mask->getType();
+  PHINode *Bits = B.CreatePHI(T, 2, Name);
+  Bits->addIncoming(Mask, Pre);
+  B.CreateCondBr(B.CreateICmpNE(Bits, ConstantInt::get(T, 0)), Loop, Exit);
+
+  B.SetInsertPoint(Loop);
+  Function *Cttz = Intrinsic::getDeclaration(F->getParent(), Intrinsic::cttz, T);
+  Value *K = B.CreateCall(Cttz, {Bits, B.getTrue()});
+  Body(B, B.CreateZExtOrTrunc(K, B.getInt64Ty()));
+  Bits->addIncoming(
+      B.CreateAnd(Bits, B.CreateSub(Bits, ConstantInt::get(T, 1)),
+                  Name + ".next"),
+      B.GetInsertBlock());
+  B.CreateBr(Header);
+
+  B.SetInsertPoint(Exit);
+}
+
+static Value *emitLoad(IRBuilder<> &B, Type *T, Value *Ptr) {
+#if LLVM_VERSION_MAJOR > 7
+  return B.CreateLoad(T, Ptr);
+#else
+  return B.CreateLoad(Ptr);
+#endif
+}
+
+/// Emit a copy of Size bytes from Src to Dst, of unknown alignment.
+static void emitMemCpy(IRBuilder<> &B, Value *Dst, Value *Src, Value *Size) {
+#if LLVM_VERSION_MAJOR >= 10
+  B.CreateMemCpy(Dst, MaybeAlign(), Src, MaybeAlign(), Size);
+#else
+  B.CreateMemCpy(Dst, 1, Src, 1, Size);
+#endif
+}
+
+/// Emit a fill of Size bytes of the array of T at Ptr with Byte.
+static void emitMemSet(IRBuilder<> &B, Type *T, Value *Ptr, uint8_t Byte,
+                       Value *Size) {
+  auto &DL = B.GetInsertBlock()->getModule()->getDataLayout();
+#if LLVM_VERSION_MAJOR >= 10
+  B.CreateMemSet(Ptr, B.getInt8(Byte), Size,
+                 MaybeAlign(DL.getABITypeAlignment(T)));
+#else
+  B.CreateMemSet(Ptr, B.getInt8(Byte), Size, DL.getABITypeAlignment(T));
+#endif
+}
+
+/// Whether V is a pointer to integers, as the rows and cols of sparse
+/// Jacobians must be.
+static bool isIndexArray(Value *V) {
+  return V->getType()->isPointerTy() &&
+         V->getType()->getPointerElementType()->isIntegerTy();
+}
+
 class Enzyme final : public ModulePass {
 public:
   EnzymeLogic Logic;
+  /// Type analyses of the functions differentiated by each call, computed
+  /// concurrently before the calls are lowered
+  std::map<std::pair<CallInst *, Function *>, std::unique_ptr<TypeAnalysis>>
+      PrecomputedTypeAnalyses;
   static char ID;
   Enzyme(bool PostOpt = false)
       : ModulePass(ID), Logic(PostOpt | EnzymePostOpt) {
@@ -867,6 +1040,7 @@ public:
     std::map<unsigned, Value *> batchOffset;
     SmallVector<Value *, 4> args;
     SmallVector<BATCH_TYPE, 4> arg_types;
+    SmallVector<uint64_t, 4> arg_strides;
     IRBuilder<> Builder(CI);
     Function *F;
     auto parsedFunction = parseFunctionParameter(CI);
@@ -897,6 +1071,7 @@ public:
 
       args.push_back(sretPt);
       arg_types.push_back(BATCH_TYPE::VECTOR);
+      arg_strides.push_back(0);
     }
 
 #if LLVM_VERSION_MAJOR >= 14
@@ -953,11 +1128,15 @@ public:
       }
 
       arg_types.push_back(ty);
+      arg_strides.push_back(0);
 
       // wrap vector
       if (ty == BATCH_TYPE::VECTOR) {
         Value *res = nullptr;
-        bool batch = batchOffset.count(i - 1) != 0;
+        bool batch = batchOffset.count(i) != 0;
+        if (batch && PTy->isPointerTy())
+          if (auto offset = dyn_cast<ConstantInt>(batchOffset[i]))
+            arg_strides.back() = offset->getZExtValue();
 
         for (unsigned v = 0; v < width; ++v) {
 #if LLVM_VERSION_MAJOR >= 14
@@ -983,14 +1162,14 @@ public:
               element = Builder.CreateGEP(
                   Type::getInt8Ty(CI->getContext()), element,
                   Builder.CreateMul(
-                      batchOffset[i - 1],
-                      ConstantInt::get(batchOffset[i - 1]->getType(), v)));
+                      batchOffset[i],
+                      ConstantInt::get(batchOffset[i]->getType(), v)));
 #else
               element = Builder.CreateGEP(
                   element,
                   Builder.CreateMul(
-                      batchOffset[i - 1],
-                      ConstantInt::get(batchOffset[i - 1]->getType(), v)));
+                      batchOffset[i],
+                      ConstantInt::get(batchOffset[i]->getType(), v)));
 #endif
               element = Builder.CreateBitCast(element, elementPtrTy);
             } else {
@@ -1027,7 +1206,8 @@ public:
                               ? BATCH_TYPE::SCALAR
                               : BATCH_TYPE::VECTOR;
 
-    auto newFunc = Logic.CreateBatch(F, width, arg_types, ret_type);
+    auto newFunc =
+        Logic.CreateBatch(F, width, arg_types, ret_type, arg_strides);
 
     Value *batch =
         Builder.CreateCall(newFunc->getFunctionType(), newFunc, args);
@@ -1039,6 +1219,1153 @@ public:
     return true;
   }
 
+  /// Emit a vector mode derivative call of fn, a void(T *x, T *y), with the
+  /// shadows xLanes of x and yLanes of y. It is lowered with the other
+  /// __enzyme_fwddiff or __enzyme_autodiff calls.
+  void emitJacobianCall(IRBuilder<> &B, Function *fn, bool forward, Value *x,
+                        ArrayRef<Value *> xLanes, Value *y,
+                        ArrayRef<Value *> yLanes) {
+    Module &M = *fn->getParent();
+    auto &Ctx = M.getContext();
+    FunctionType *DFT = FunctionType::get(B.getVoidTy(), {fn->getType()},
+                                          /*isVarArg*/ true);
+    FunctionCallee entry = M.getOrInsertFunction(
+        forward ? "__enzyme_fwddiff_jacobian" : "__enzyme_autodiff_jacobian",
+        DFT);
+    auto marker = [&](StringRef name) {
+      return MetadataAsValue::get(Ctx, MDString::get(Ctx, name));
+    };
+    SmallVector<Value *, 24> args = {fn, marker("enzyme_width"),
+                                     B.getInt64(xLanes.size()),
+                                     marker("enzyme_dup"), x};
+    args.append(xLanes.begin(), xLanes.end());
+    args.push_back(marker("enzyme_dup"));
+    args.push_back(y);
+    args.append(yLanes.begin(), yLanes.end());
+    B.CreateCall(entry, args);
+  }
+
+  /// Emit the loop computing the Jacobian J of fn by seeding, width at a
+  /// time, the n inputs x in forward mode or the m outputs y in reverse mode.
+  void emitJacobianSweep(IRBuilder<> &B, Function *fn, Type *T, Value *x,
+                         Value *y, Value *J, Value *n, Value *m, unsigned width,
+                         bool rowMajor, bool forward) {
+    auto &DL = fn->getParent()->getDataLayout();
+    Type *I64 = B.getInt64Ty();
+
+    // Each call seeds width of the seedDim inputs (or outputs) and computes
+    // width vectors of len derivatives: columns of J in forward mode and rows
+    // in reverse mode.
+    Value *seedDim = forward ? n : m;
+    Value *len = forward ? m : n;
+    // Result vectors are written in place when contiguous in J.
+    bool direct = forward != rowMajor;
+
+    Value *scratch = CreateAllocation(
+        B, T, B.CreateMul(ConstantInt::get(I64, width), B.CreateAdd(n, m)),
+        "jacobian.scratch");
+    Value *seeds = scratch;
+    Value *results = B.CreateGEP(
+        T, scratch, B.CreateMul(ConstantInt::get(I64, width), seedDim));
+    Value *elemSize = ConstantInt::get(I64, DL.getTypeAllocSize(T));
+#if LLVM_VERSION_MAJOR >= 10
+    auto align = MaybeAlign(DL.getABITypeAlignment(T));
+#else
+    auto align = DL.getABITypeAlignment(T);
+#endif
+
+    // Seeds start out zero, and each chunk clears the ones it set.
+    B.CreateMemSet(
+        seeds, B.getInt8(0),
+        B.CreateMul(B.CreateMul(ConstantInt::get(I64, width), seedDim),
+                    elemSize),
+        align);
+
+    emitCountedLoop(B, seedDim, width, "jacobian.chunk", [&](IRBuilder<> &B,
+                                                             Value *c) {
+      SmallVector<Value *, 8> seedLanes, resultLanes, seedPtrs;
+      for (unsigned k = 0; k < width; ++k) {
+        Value *lane = B.CreateAdd(c, ConstantInt::get(I64, k));
+        Value *valid = B.CreateICmpULT(lane, seedDim);
+
+        // Lanes past the last seed get a zero seed.
+        Value *seedLane = B.CreateGEP(
+            T, seeds, B.CreateMul(ConstantInt::get(I64, k), seedDim));
+        Value *seedPtr = B.CreateGEP(
+            T, seedLane, B.CreateSelect(valid, lane, ConstantInt::get(I64, 0)));
+        B.CreateStore(B.CreateSelect(valid, ConstantFP::get(T, 1.0),
+                                     ConstantFP::get(T, 0.0)),
+                      seedPtr);
+        seedLanes.push_back(seedLane);
+        seedPtrs.push_back(seedPtr);
+
+        Value *resultLane = B.CreateGEP(
+            T, results, B.CreateMul(ConstantInt::get(I64, k), len));
+        if (direct)
+          resultLane = B.CreateSelect(
+              valid, B.CreateGEP(T, J, B.CreateMul(lane, len)), resultLane);
+        B.CreateMemSet(resultLane, B.getInt8(0), B.CreateMul(len, elemSize),
+                       align);
+        resultLanes.push_back(resultLane);
+      }
+
+      emitJacobianCall(B, fn, forward, x, forward ? seedLanes : resultLanes, y,
+                       forward ? resultLanes : seedLanes);
+
+      for (Value *seedPtr : seedPtrs)
+        B.CreateStore(ConstantFP::get(T, 0.0), seedPtr);
+
+      if (direct)
+        return;
+
+      // Scatter the result vectors to J[i * seedDim + lane].
+      Value *count = B.CreateSub(seedDim, c);
+      count = B.CreateSelect(
+          B.CreateICmpULT(count, ConstantInt::get(I64, width)), count,
+          ConstantInt::get(I64, width));
+      emitCountedLoop(B, count, 1, "jacobian.lane", [&](IRBuilder<> &B,
+                                                        Value *k) {
+        Value *src = B.CreateGEP(T, results, B.CreateMul(k, len));
+        Value *lane = B.CreateAdd(c, k);
+        emitCountedLoop(B, len, 1, "jacobian.copy", [&](IRBuilder<> &B,
+                                                        Value *i) {
+#if LLVM_VERSION_MAJOR > 7
+          Value *val = B.CreateLoad(T, B.CreateGEP(T, src, i));
+#else
+          Value *val = B.CreateLoad(B.CreateGEP(T, src, i));
+#endif
+          B.CreateStore(
+              val, B.CreateGEP(T, J, B.CreateAdd(B.CreateMul(i, seedDim),
+                                                 lane)));
+        });
+      });
+    });
+
+    CreateDealloc(B, scratch);
+  }
+
+  /// The floating point type T of fn, a void(T *x, T *y) whose Jacobian is
+  /// computed by CI, or null after emitting a failure.
+  Type *getJacobianElementType(CallInst *CI, Function *fn) {
+    FunctionType *FT = fn->getFunctionType();
+    if (FT->getReturnType()->isVoidTy() && FT->getNumParams() == 2 &&
+        FT->getParamType(0)->isPointerTy() &&
+        FT->getParamType(0) == FT->getParamType(1) &&
+        FT->getParamType(0)->getPointerElementType()->isFloatingPointTy())
+      return FT->getParamType(0)->getPointerElementType();
+    EmitFailure("IllegalJacobianFunction", CI->getDebugLoc(), CI,
+                "Jacobians need a function void(T *x, T *y) with a floating "
+                "point type T, found ",
+                *fn->getType(), " in ", *CI);
+    return nullptr;
+  }
+
+  /// Emit the computation of the Jacobian J of fn, with i64 sizes n and m,
+  /// at the end of the block of B, continuing to post.
+  void emitJacobian(IRBuilder<> &B, BasicBlock *post, Function *fn, Type *T,
+                    Value *x, Value *y, Value *J, Value *n, Value *m,
+                    unsigned width, bool widthGiven, bool rowMajor) {
+    // Fewer inputs than outputs favour forward mode. Both sweeps are emitted
+    // when the sizes are only known at runtime.
+    Value *useForward = B.CreateICmpULE(n, m);
+
+    auto emitSweep = [&](bool forward) {
+      unsigned W = width;
+      // Do not seed more lanes than there are inputs (or outputs).
+      if (!widthGiven)
+        if (auto size = dyn_cast<ConstantInt>(forward ? n : m))
+          W = std::max<uint64_t>(1, std::min<uint64_t>(W, size->getZExtValue()));
+      emitJacobianSweep(B, fn, T, x, y, J, n, m, W, rowMajor, forward);
+      B.CreateBr(post);
+    };
+
+    if (auto cfwd = dyn_cast<ConstantInt>(useForward)) {
+      emitSweep(cfwd->isOne());
+    } else {
+      auto &Ctx = fn->getContext();
+      Function *F = post->getParent();
+      BasicBlock *fwd = BasicBlock::Create(Ctx, "jacobian.fwd", F, post);
+      BasicBlock *rev = BasicBlock::Create(Ctx, "jacobian.rev", F, post);
+      B.CreateCondBr(useForward, fwd, rev);
+      B.SetInsertPoint(fwd);
+      emitSweep(/*forward*/ true);
+      B.SetInsertPoint(rev);
+      emitSweep(/*forward*/ false);
+    }
+  }
+
+  /// Lower __enzyme_jacobian(fn, x, y, J, n, m, ...) where fn is a
+  /// void(T *x, T *y) computing the m outputs y from the n inputs x. J is
+  /// filled with the m x n Jacobian, row-major unless enzyme_col_major is
+  /// passed, and y with the outputs. The Jacobian is computed in forward mode
+  /// when n <= m and in reverse mode otherwise, enzyme_width seeds at a time.
+  bool HandleJacobian(CallInst *CI) {
+    Function *fn;
+    auto parsedFunction = parseFunctionParameter(CI);
+    if (parsedFunction.hasValue()) {
+      fn = parsedFunction.getValue();
+    } else {
+      return false;
+    }
+
+    FunctionType *FT = fn->getFunctionType();
+    Type *T = getJacobianElementType(CI, fn);
+    if (!T)
+      return false;
+
+#if LLVM_VERSION_MAJOR >= 14
+    unsigned numArgs = CI->arg_size();
+#else
+    unsigned numArgs = CI->getNumArgOperands();
+#endif
+    if (numArgs < 6) {
+      EmitFailure("MissingJacobianArgs", CI->getDebugLoc(), CI,
+                  "__enzyme_jacobian(fn, x, y, J, n, m) is missing arguments "
+                  "in ",
+                  *CI);
+      return false;
+    }
+    Value *x = CI->getArgOperand(1);
+    Value *y = CI->getArgOperand(2);
+    Value *J = CI->getArgOperand(3);
+    Value *n = CI->getArgOperand(4);
+    Value *m = CI->getArgOperand(5);
+    if (!x->getType()->isPointerTy() || !y->getType()->isPointerTy() ||
+        !J->getType()->isPointerTy() || !n->getType()->isIntegerTy() ||
+        !m->getType()->isIntegerTy()) {
+      EmitFailure("IllegalJacobianArgs", CI->getDebugLoc(), CI,
+                  "__enzyme_jacobian(fn, x, y, J, n, m) needs pointers x, y, "
+                  "J and integer sizes n, m in ",
+                  *CI);
+      return false;
+    }
+
+    unsigned width = EnzymeJacobianWidth;
+    bool widthGiven = false;
+    bool rowMajor = true;
+    for (unsigned i = 6; i < numArgs; ++i) {
+      Value *arg = CI->getArgOperand(i);
+      auto MDName = getMetadataName(arg);
+      if (MDName && *MDName == "enzyme_width") {
+        ConstantInt *cint = nullptr;
+        if (i + 1 < numArgs)
+          cint = dyn_cast<ConstantInt>(CI->getArgOperand(i + 1));
+        if (!cint || cint->isZero()) {
+          EmitFailure("IllegalVectorWidth", CI->getDebugLoc(), CI,
+                      "enzyme_width must be followed by a positive constant "
+                      "integer in ",
+                      *CI);
+          return false;
+        }
+        width = cint->getZExtValue();
+        widthGiven = true;
+        ++i;
+      } else if (MDName && *MDName == "enzyme_row_major") {
+        rowMajor = true;
+      } else if (MDName && *MDName == "enzyme_col_major") {
+        rowMajor = false;
+      } else {
+        EmitFailure("IllegalJacobianArgs", CI->getDebugLoc(), CI,
+                    "illegal __enzyme_jacobian argument ", *arg, " in ", *CI);
+        return false;
+      }
+    }
+
+    IRBuilder<> B(CI);
+    Type *I64 = B.getInt64Ty();
+    x = B.CreatePointerCast(x, FT->getParamType(0));
+    y = B.CreatePointerCast(y, FT->getParamType(1));
+    J = B.CreatePointerCast(J, FT->getParamType(0));
+    n = B.CreateZExtOrTrunc(n, I64);
+    m = B.CreateZExtOrTrunc(m, I64);
+
+    BasicBlock *pre = CI->getParent();
+    BasicBlock *post = pre->splitBasicBlock(CI, "jacobian.done");
+    pre->getTerminator()->eraseFromParent();
+    B.SetInsertPoint(pre);
+    emitJacobian(B, post, fn, T, x, y, J, n, m, width, widthGiven, rowMajor);
+
+    if (!CI->getType()->isVoidTy())
+      CI->replaceAllUsesWith(UndefValue::get(CI->getType()));
+    CI->eraseFromParent();
+    return true;
+  }
+
+  /// Emit the computation of the nonzeros of the Jacobian of fn, a
+  /// void(T *x, T *y) computing the m outputs y from the n inputs x, at the
+  /// end of the block of B. The entries are written in row-major order as COO
+  /// triplets (rows, cols, vals), or in CSR format with m + 1 row offsets in
+  /// rows if csr is set. At most capacity entries are written. Returns the
+  /// number of entries.
+  ///
+  /// With constant sizes and a function without loops, the sparsity pattern
+  /// is derived when lowering and its columns are colored, so that a single
+  /// forward mode call with one seed per color computes all the entries.
+  /// Otherwise the pattern is found at runtime by propagating the
+  /// dependencies of each value through a copy of fn, and the columns are
+  /// colored then. Only if fn passes values through memory or calls that
+  /// cannot be tracked is the dense Jacobian computed and its nonzeros kept.
+  Value *emitSparseJacobian(IRBuilder<> &B, CallInst *CI, Function *fn,
+                            Type *T, Value *x, Value *y, Value *n, Value *m,
+                            Value *rows, Value *cols, Value *vals,
+                            Value *capacity, unsigned width, bool widthGiven,
+                            bool csr) {
+    FunctionType *FT = fn->getFunctionType();
+    Type *I64 = B.getInt64Ty();
+    Type *RowTy = rows->getType()->getPointerElementType();
+    Type *ColTy = cols->getType()->getPointerElementType();
+    BasicBlock *pre = B.GetInsertBlock();
+    Function *F = pre->getParent();
+    Module &M = *F->getParent();
+    auto &DL = M.getDataLayout();
+
+    Function *prefn =
+        Logic.PPC.preprocessForClone(fn, DerivativeMode::ForwardMode);
+    SparsityPattern pattern;
+    auto cn = dyn_cast<ConstantInt>(n);
+    auto cm = dyn_cast<ConstantInt>(m);
+    if (cn && cm &&
+        getStaticJacobianSparsity(*prefn, cn->getZExtValue(),
+                                  cm->getZExtValue(), pattern)) {
+      uint64_t numIn = cn->getZExtValue(), numOut = cm->getZExtValue();
+      std::vector<unsigned> colors;
+      unsigned numColors = colorJacobianColumns(pattern, numIn, colors);
+
+      // Constant tables of the pattern, in row-major order.
+      SmallVector<uint64_t, 16> rowTable, colTable, srcTable;
+      rowTable.push_back(0);
+      for (uint64_t i = 0; i < numOut; ++i) {
+        for (uint64_t j : pattern[i]) {
+          if (!csr)
+            rowTable.push_back(i);
+          colTable.push_back(j);
+          srcTable.push_back(colors[j] * numOut + i);
+        }
+        if (csr)
+          rowTable.push_back(colTable.size());
+      }
+      if (!csr)
+        rowTable.erase(rowTable.begin());
+      auto table = [&](ArrayRef<Constant *> elems, const Twine &name) {
+        ArrayType *AT = ArrayType::get(elems[0]->getType(), elems.size());
+        auto GV = new GlobalVariable(M, AT, /*isConstant*/ true,
+                                     GlobalValue::PrivateLinkage,
+                                     ConstantArray::get(AT, elems), name);
+        GV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+        return B.CreateConstInBoundsGEP2_64(AT, GV, 0, 0);
+      };
+      auto intTable = [&](Type *ty, ArrayRef<uint64_t> values,
+                          const Twine &name) {
+        SmallVector<Constant *, 16> elems;
+        for (uint64_t v : values)
+          elems.push_back(ConstantInt::get(ty, v));
+        return table(elems, name);
+      };
+
+      Value *results = nullptr;
+      if (numColors == 0) {
+        B.CreateCall(FT, fn, {x, y});
+      } else {
+        // Seed each color with the sum of the unit vectors of its columns.
+        SmallVector<Constant *, 16> seedElems;
+        for (unsigned c = 0; c < numColors; ++c)
+          for (uint64_t j = 0; j < numIn; ++j)
+            seedElems.push_back(ConstantFP::get(T, colors[j] == c ? 1.0 : 0.0));
+        Value *seeds = table(seedElems, "jacobian.seeds");
+        results = CreateAllocation(B, T, B.getInt64(numColors * numOut),
+                                   "jacobian.results");
+        emitMemSet(B, T, results, 0,
+                   B.getInt64(numColors * numOut * DL.getTypeAllocSize(T)));
+        SmallVector<Value *, 8> seedLanes, resultLanes;
+        for (unsigned c = 0; c < numColors; ++c) {
+          seedLanes.push_back(B.CreateConstInBoundsGEP1_64(T, seeds, c * numIn));
+          resultLanes.push_back(
+              B.CreateConstInBoundsGEP1_64(T, results, c * numOut));
+        }
+        emitJacobianCall(B, fn, /*forward*/ true, x, seedLanes, y,
+                         resultLanes);
+      }
+
+      Value *nnz = B.getInt64(colTable.size());
+      Value *count = B.CreateSelect(B.CreateICmpULT(nnz, capacity), nnz,
+                                    capacity);
+      if (!colTable.empty()) {
+        Value *src = intTable(I64, srcTable, "jacobian.src");
+        emitCountedLoop(B, count, 1, "jacobian.gather",
+                        [&](IRBuilder<> &B, Value *k) {
+                          Value *idx = emitLoad(B, I64, B.CreateGEP(I64, src, k));
+                          B.CreateStore(emitLoad(B, T, B.CreateGEP(T, results, idx)),
+                                        B.CreateGEP(T, vals, k));
+                        });
+        emitMemCpy(B, cols, intTable(ColTy, colTable, "jacobian.cols"),
+                   B.CreateMul(count, B.getInt64(DL.getTypeAllocSize(ColTy))));
+        if (!csr)
+          emitMemCpy(
+              B, rows, intTable(RowTy, rowTable, "jacobian.rows"),
+              B.CreateMul(count, B.getInt64(DL.getTypeAllocSize(RowTy))));
+      }
+      if (csr)
+        emitMemCpy(B, rows, intTable(RowTy, rowTable, "jacobian.rows"),
+                   B.getInt64(rowTable.size() * DL.getTypeAllocSize(RowTy)));
+      if (results)
+        CreateDealloc(B, results);
+      return nnz;
+    }
+
+    if (Function *deps = createJacobianDependencies(*prefn)) {
+      EmitWarning("SparseJacobianPattern", CI->getDebugLoc(), F, pre,
+                  "could not derive the sparsity pattern of ", fn->getName(),
+                  " statically, deriving it at runtime");
+      // There are at most n colors.
+      if (cn && !cn->isZero() && cn->getZExtValue() < width)
+        width = cn->getZExtValue();
+      return emitDependentJacobian(B, fn, deps, T, x, y, n, m, rows, cols,
+                                   vals, capacity, width, csr);
+    }
+
+    EmitWarning("SparseJacobianPattern", CI->getDebugLoc(), F, pre,
+                "could not track the dependencies of ", fn->getName(),
+                ", computing the dense Jacobian");
+    Value *J = CreateAllocation(B, T, B.CreateMul(n, m), "jacobian.dense");
+    BasicBlock *compress = BasicBlock::Create(F->getContext(),
+                                              "jacobian.compress", F,
+                                              pre->getNextNode());
+    emitJacobian(B, compress, fn, T, x, y, J, n, m, width, widthGiven,
+                 /*rowMajor*/ true);
+    B.SetInsertPoint(compress);
+
+    IRBuilder<> EB(&F->getEntryBlock().front());
+    Value *counter = EB.CreateAlloca(I64, nullptr, "jacobian.nnz");
+    B.CreateStore(B.getInt64(0), counter);
+    emitCountedLoop(B, m, 1, "jacobian.row", [&](IRBuilder<> &B, Value *i) {
+      if (csr)
+        B.CreateStore(B.CreateZExtOrTrunc(emitLoad(B, I64, counter), RowTy),
+                      B.CreateGEP(RowTy, rows, i));
+      emitCountedLoop(B, n, 1, "jacobian.col", [&](IRBuilder<> &B, Value *j) {
+        Value *val = emitLoad(
+            B, T, B.CreateGEP(T, J, B.CreateAdd(B.CreateMul(i, n), j)));
+        emitIf(B, B.CreateFCmpUNE(val, ConstantFP::get(T, 0.0)),
+               "jacobian.nonzero", [&](IRBuilder<> &B) {
+                 Value *k = emitLoad(B, I64, counter);
+                 emitIf(B, B.CreateICmpULT(k, capacity), "jacobian.store",
+                        [&](IRBuilder<> &B) {
+                          B.CreateStore(val, B.CreateGEP(T, vals, k));
+                          B.CreateStore(B.CreateZExtOrTrunc(j, ColTy),
+                                        B.CreateGEP(ColTy, cols, k));
+                          if (!csr)
+                            B.CreateStore(B.CreateZExtOrTrunc(i, RowTy),
+                                          B.CreateGEP(RowTy, rows, k));
+                        });
+                 B.CreateStore(B.CreateNUWAdd(k, B.getInt64(1)), counter);
+               });
+      });
+    });
+    Value *nnz = emitLoad(B, I64, counter);
+    if (csr)
+      B.CreateStore(B.CreateZExtOrTrunc(nnz, RowTy),
+                    B.CreateGEP(RowTy, rows, m));
+    CreateDealloc(B, J);
+    return nnz;
+  }
+
+  /// Emit the computation of the nonzeros of the Jacobian of fn, as for
+  /// emitSparseJacobian, using deps, the copy of fn propagating the inputs
+  /// each value depends on (see createJacobianDependencies).
+  ///
+  /// Sweeps of deps with one mask bit per input find the inputs each output
+  /// depends on. They run twice, first counting the entries of each row and
+  /// then filling in their columns, so that only the pattern is stored. Its
+  /// columns are colored greedily, as by colorJacobianColumns, and the
+  /// entries computed by vector forward mode calls, width colors at a time.
+  Value *emitDependentJacobian(IRBuilder<> &B, Function *fn, Function *deps,
+                               Type *T, Value *x, Value *y, Value *n,
+                               Value *m, Value *rows, Value *cols, Value *vals,
+                               Value *capacity, unsigned width, bool csr) {
+    Function *F = B.GetInsertBlock()->getParent();
+    Module &M = *F->getParent();
+    auto &DL = M.getDataLayout();
+    Type *I64 = B.getInt64Ty();
+    Type *RowTy = rows->getType()->getPointerElementType();
+    Type *ColTy = cols->getType()->getPointerElementType();
+    auto MaskTy = cast<IntegerType>(
+        deps->getFunctionType()->getParamType(2)->getPointerElementType());
+    unsigned bits = MaskTy->getBitWidth();
+    Value *one = B.getInt64(1);
+    Value *noColor = B.getInt64(~0ULL);
+
+    auto loadAt = [&](Type *Ty, Value *Ptr, Value *Idx) {
+      return emitLoad(B, Ty, B.CreateGEP(Ty, Ptr, Idx));
+    };
+    auto bytes = [&](Type *Ty, Value *Count) {
+      return B.CreateMul(Count, B.getInt64(DL.getTypeAllocSize(Ty)));
+    };
+    auto allocate = [&](Type *Ty, Value *Count, const Twine &Name,
+                        bool Zero = false) {
+      Instruction *ZeroMem = nullptr;
+      return CreateAllocation(B, Ty, Count, Name, /*caller*/ nullptr,
+                              Zero ? &ZeroMem : nullptr);
+    };
+    // Loop over the entries of row i, or of column j of the transpose.
+    auto entryLoop = [&](Value *offsets, Value *i, const Twine &Name,
+                         function_ref<void(IRBuilder<> &, Value *)> Body) {
+      Value *lo = loadAt(I64, offsets, i);
+      Value *hi = loadAt(I64, offsets, B.CreateAdd(i, one));
+      emitCountedLoop(B, B.CreateSub(hi, lo), 1, Name,
+                      [&](IRBuilder<> &B, Value *k) {
+                        Body(B, B.CreateAdd(lo, k));
+                      });
+    };
+    // Turn the counts in offsets[1..size] into offsets.
+    auto prefixSum = [&](Value *offsets, Value *size, const Twine &Name) {
+      emitCountedLoop(B, size, 1, Name, [&](IRBuilder<> &B, Value *i) {
+        Value *next = B.CreateGEP(I64, offsets, B.CreateAdd(i, one));
+        B.CreateStore(
+            B.CreateAdd(emitLoad(B, I64, next), loadAt(I64, offsets, i)),
+            next);
+      });
+    };
+
+    Value *xdeps = allocate(MaskTy, n, "jacobian.xdeps", /*Zero*/ true);
+    Value *ydeps = allocate(MaskTy, m, "jacobian.ydeps");
+    // Run deps for each group of bits inputs, passing Row the mask of the
+    // inputs from base that each output i depends on.
+    auto sweep = [&](function_ref<void(IRBuilder<> &, Value *base, Value *i,
+                                       Value *mask)>
+                         Row) {
+      emitCountedLoop(
+          B, n, bits, "jacobian.deps", [&](IRBuilder<> &B, Value *base) {
+            Value *count = B.CreateSub(n, base);
+            count = B.CreateSelect(B.CreateICmpULT(count, B.getInt64(bits)),
+                                   count, B.getInt64(bits));
+            auto mark = [&](bool set) {
+              emitCountedLoop(
+                  B, count, 1, set ? "jacobian.mark" : "jacobian.unmark",
+                  [&](IRBuilder<> &B, Value *k) {
+                    Value *bit = ConstantInt::get(MaskTy, 0);
+                    if (set)
+                      bit = B.CreateShl(ConstantInt::get(MaskTy, 1),
+                                        B.CreateZExtOrTrunc(k, MaskTy));
+                    B.CreateStore(bit, B.CreateGEP(MaskTy, xdeps,
+                                                   B.CreateAdd(base, k)));
+                  });
+            };
+            mark(true);
+            emitMemSet(B, MaskTy, ydeps, 0, bytes(MaskTy, m));
+            B.CreateCall(deps->getFunctionType(), deps, {x, y, xdeps, ydeps});
+            mark(false);
+            emitCountedLoop(B, m, 1, "jacobian.outdeps",
+                            [&](IRBuilder<> &B, Value *i) {
+                              Row(B, base, i, loadAt(MaskTy, ydeps, i));
+                            });
+          });
+    };
+
+    // Count the entries of each row, and place the rows.
+    Value *rowPtr =
+        allocate(I64, B.CreateAdd(m, one), "jacobian.rowptr", /*Zero*/ true);
+    Function *ctpop = Intrinsic::getDeclaration(&M, Intrinsic::ctpop, MaskTy);
+    sweep([&](IRBuilder<> &B, Value *, Value *i, Value *mask) {
+      Value *next = B.CreateGEP(I64, rowPtr, B.CreateAdd(i, one));
+      B.CreateStore(B.CreateAdd(emitLoad(B, I64, next),
+                                B.CreateZExt(B.CreateCall(ctpop, mask), I64)),
+                    next);
+    });
+    prefixSum(rowPtr, m, "jacobian.rowsum");
+    Value *nnz = loadAt(I64, rowPtr, m);
+
+    // Fill in the columns of each row, in increasing order.
+    Value *colIdx = allocate(I64, nnz, "jacobian.colidx");
+    Value *rowFill = allocate(I64, m, "jacobian.rowfill");
+    emitMemCpy(B, rowFill, rowPtr, bytes(I64, m));
+    sweep([&](IRBuilder<> &B, Value *base, Value *i, Value *mask) {
+      emitBitLoop(B, mask, "jacobian.dep", [&](IRBuilder<> &B, Value *k) {
+        Value *fill = B.CreateGEP(I64, rowFill, i);
+        Value *e = emitLoad(B, I64, fill);
+        B.CreateStore(B.CreateAdd(base, k), B.CreateGEP(I64, colIdx, e));
+        B.CreateStore(B.CreateAdd(e, one), fill);
+      });
+    });
+
+    // Transpose the pattern to find the rows of each column.
+    Value *colPtr =
+        allocate(I64, B.CreateAdd(n, one), "jacobian.colptr", /*Zero*/ true);
+    emitCountedLoop(B, nnz, 1, "jacobian.colcount",
+                    [&](IRBuilder<> &B, Value *e) {
+                      Value *next = B.CreateGEP(
+                          I64, colPtr, B.CreateAdd(loadAt(I64, colIdx, e), one));
+                      B.CreateStore(B.CreateAdd(emitLoad(B, I64, next), one),
+                                    next);
+                    });
+    prefixSum(colPtr, n, "jacobian.colsum");
+    Value *colRows = allocate(I64, nnz, "jacobian.colrows");
+    Value *colFill = allocate(I64, n, "jacobian.colfill");
+    emitMemCpy(B, colFill, colPtr, bytes(I64, n));
+    emitCountedLoop(B, m, 1, "jacobian.transpose",
+                    [&](IRBuilder<> &B, Value *i) {
+                      entryLoop(rowPtr, i, "jacobian.entry",
+                                [&](IRBuilder<> &B, Value *e) {
+                                  Value *fill = B.CreateGEP(
+                                      I64, colFill, loadAt(I64, colIdx, e));
+                                  Value *f = emitLoad(B, I64, fill);
+                                  B.CreateStore(i, B.CreateGEP(I64, colRows, f));
+                                  B.CreateStore(B.CreateAdd(f, one), fill);
+                                });
+                    });
+
+    // Give each column the lowest color not taken by a column sharing one of
+    // its rows. forbidden[c] == j when color c is taken for column j.
+    Value *colors = allocate(I64, n, "jacobian.colors");
+    emitMemSet(B, I64, colors, 0xff, bytes(I64, n));
+    Value *forbidden = allocate(I64, n, "jacobian.forbidden");
+    emitMemSet(B, I64, forbidden, 0xff, bytes(I64, n));
+    IRBuilder<> EB(&F->getEntryBlock().front());
+    Value *numColorsPtr = EB.CreateAlloca(I64, nullptr, "jacobian.numcolors");
+    Value *colorPtr = EB.CreateAlloca(I64, nullptr, "jacobian.color");
+    B.CreateStore(B.getInt64(0), numColorsPtr);
+    emitCountedLoop(B, n, 1, "jacobian.colorcol", [&](IRBuilder<> &B,
+                                                      Value *j) {
+      Value *used = B.CreateICmpNE(loadAt(I64, colPtr, j),
+                                   loadAt(I64, colPtr, B.CreateAdd(j, one)));
+      emitIf(B, used, "jacobian.used", [&](IRBuilder<> &B) {
+        entryLoop(colPtr, j, "jacobian.colentry",
+                  [&](IRBuilder<> &B, Value *e) {
+                    entryLoop(rowPtr, loadAt(I64, colRows, e),
+                              "jacobian.neighbour",
+                              [&](IRBuilder<> &B, Value *e2) {
+                                Value *c = loadAt(I64, colors,
+                                                  loadAt(I64, colIdx, e2));
+                                emitIf(B, B.CreateICmpNE(c, noColor),
+                                       "jacobian.colored", [&](IRBuilder<> &B) {
+                                         B.CreateStore(
+                                             j, B.CreateGEP(I64, forbidden, c));
+                                       });
+                              });
+                  });
+        Value *num = emitLoad(B, I64, numColorsPtr);
+        B.CreateStore(num, colorPtr);
+        emitCountedLoop(B, num, 1, "jacobian.pick",
+                        [&](IRBuilder<> &B, Value *c) {
+                          Value *best = emitLoad(B, I64, colorPtr);
+                          Value *free = B.CreateAnd(
+                              B.CreateICmpNE(loadAt(I64, forbidden, c), j),
+                              B.CreateICmpULT(c, best));
+                          B.CreateStore(B.CreateSelect(free, c, best),
+                                        colorPtr);
+                        });
+        Value *color = emitLoad(B, I64, colorPtr);
+        B.CreateStore(color, B.CreateGEP(I64, colors, j));
+        B.CreateStore(B.CreateSelect(B.CreateICmpEQ(color, num),
+                                     B.CreateAdd(num, one), num),
+                      numColorsPtr);
+      });
+    });
+    Value *numColors = emitLoad(B, I64, numColorsPtr);
+
+    // Compute the entries width colors at a time, seeding each lane with the
+    // sum of the unit vectors of the columns of its color.
+    Value *W = B.getInt64(width);
+    Value *seeds =
+        allocate(T, B.CreateMul(W, n), "jacobian.seeds", /*Zero*/ true);
+    Value *results = allocate(T, B.CreateMul(W, m), "jacobian.results");
+    emitCountedLoop(B, numColors, width, "jacobian.chunk", [&](IRBuilder<> &B,
+                                                               Value *c) {
+      auto seedColumns = [&](double v) {
+        emitCountedLoop(
+            B, n, 1, v ? "jacobian.seed" : "jacobian.unseed",
+            [&](IRBuilder<> &B, Value *j) {
+              Value *lane = B.CreateSub(loadAt(I64, colors, j), c);
+              emitIf(B, B.CreateICmpULT(lane, W), "jacobian.inchunk",
+                     [&](IRBuilder<> &B) {
+                       B.CreateStore(ConstantFP::get(T, v),
+                                     B.CreateGEP(T, seeds,
+                                                 B.CreateAdd(B.CreateMul(lane, n),
+                                                             j)));
+                     });
+            });
+      };
+      seedColumns(1.0);
+      emitMemSet(B, T, results, 0, bytes(T, B.CreateMul(W, m)));
+      SmallVector<Value *, 8> seedLanes, resultLanes;
+      for (unsigned k = 0; k < width; ++k) {
+        seedLanes.push_back(
+            B.CreateGEP(T, seeds, B.CreateMul(B.getInt64(k), n)));
+        resultLanes.push_back(
+            B.CreateGEP(T, results, B.CreateMul(B.getInt64(k), m)));
+      }
+      emitJacobianCall(B, fn, /*forward*/ true, x, seedLanes, y, resultLanes);
+      seedColumns(0.0);
+
+      emitCountedLoop(
+          B, m, 1, "jacobian.gatherrow", [&](IRBuilder<> &B, Value *i) {
+            entryLoop(rowPtr, i, "jacobian.gather", [&](IRBuilder<> &B,
+                                                        Value *e) {
+              Value *lane =
+                  B.CreateSub(loadAt(I64, colors, loadAt(I64, colIdx, e)), c);
+              emitIf(B,
+                     B.CreateAnd(B.CreateICmpULT(lane, W),
+                                 B.CreateICmpULT(e, capacity)),
+                     "jacobian.value", [&](IRBuilder<> &B) {
+                       B.CreateStore(
+                           loadAt(T, results,
+                                  B.CreateAdd(B.CreateMul(lane, m), i)),
+                           B.CreateGEP(T, vals, e));
+                     });
+            });
+          });
+    });
+    // The outputs are computed by deps and the derivative calls, which do not
+    // run without inputs or entries.
+    emitIf(B, B.CreateICmpEQ(numColors, B.getInt64(0)), "jacobian.primal",
+           [&](IRBuilder<> &B) {
+             B.CreateCall(fn->getFunctionType(), fn, {x, y});
+           });
+
+    emitCountedLoop(B, m, 1, "jacobian.outrow", [&](IRBuilder<> &B,
+                                                    Value *i) {
+      if (csr)
+        B.CreateStore(B.CreateZExtOrTrunc(loadAt(I64, rowPtr, i), RowTy),
+                      B.CreateGEP(RowTy, rows, i));
+      entryLoop(rowPtr, i, "jacobian.out", [&](IRBuilder<> &B, Value *e) {
+        emitIf(B, B.CreateICmpULT(e, capacity), "jacobian.store",
+               [&](IRBuilder<> &B) {
+                 B.CreateStore(
+                     B.CreateZExtOrTrunc(loadAt(I64, colIdx, e), ColTy),
+                     B.CreateGEP(ColTy, cols, e));
+                 if (!csr)
+                   B.CreateStore(B.CreateZExtOrTrunc(i, RowTy),
+                                 B.CreateGEP(RowTy, rows, e));
+               });
+      });
+    });
+    if (csr)
+      B.CreateStore(B.CreateZExtOrTrunc(nnz, RowTy),
+                    B.CreateGEP(RowTy, rows, m));
+
+    for (Value *ptr : {xdeps, ydeps, rowPtr, colIdx, rowFill, colPtr, colRows,
+                       colFill, colors, forbidden, seeds, results})
+      CreateDealloc(B, ptr);
+    return nnz;
+  }
+
+  /// Parse the trailing enzyme_width, enzyme_coo and enzyme_csr arguments of
+  /// a sparse Jacobian or Hessian call CI from argument first on.
+  bool parseSparseOptions(CallInst *CI, unsigned first, StringRef name,
+                          unsigned &width, bool &widthGiven, bool &csr) {
+#if LLVM_VERSION_MAJOR >= 14
+    unsigned numArgs = CI->arg_size();
+#else
+    unsigned numArgs = CI->getNumArgOperands();
+#endif
+    width = EnzymeJacobianWidth;
+    widthGiven = false;
+    csr = false;
+    for (unsigned i = first; i < numArgs; ++i) {
+      Value *arg = CI->getArgOperand(i);
+      auto MDName = getMetadataName(arg);
+      if (MDName && *MDName == "enzyme_width") {
+        ConstantInt *cint = nullptr;
+        if (i + 1 < numArgs)
+          cint = dyn_cast<ConstantInt>(CI->getArgOperand(i + 1));
+        if (!cint || cint->isZero()) {
+          EmitFailure("IllegalVectorWidth", CI->getDebugLoc(), CI,
+                      "enzyme_width must be followed by a positive constant "
+                      "integer in ",
+                      *CI);
+          return false;
+        }
+        width = cint->getZExtValue();
+        widthGiven = true;
+        ++i;
+      } else if (MDName && *MDName == "enzyme_coo") {
+        csr = false;
+      } else if (MDName && *MDName == "enzyme_csr") {
+        csr = true;
+      } else {
+        EmitFailure("IllegalJacobianArgs", CI->getDebugLoc(), CI, "illegal ",
+                    name, " argument ", *arg, " in ", *CI);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// Lower __enzyme_sparse_jacobian(fn, x, y, n, m, rows, cols, vals,
+  /// capacity, ...) where fn is a void(T *x, T *y) computing the m outputs y
+  /// from the n inputs x. The entries of the Jacobian are written in row-major
+  /// order as COO triplets (rows, cols, vals), or in CSR format with m + 1 row
+  /// offsets in rows if enzyme_csr is passed. At most capacity entries are
+  /// written, and the number of entries is returned. See emitSparseJacobian
+  /// for how the sparsity pattern is found.
+  bool HandleSparseJacobian(CallInst *CI) {
+    Function *fn;
+    auto parsedFunction = parseFunctionParameter(CI);
+    if (parsedFunction.hasValue()) {
+      fn = parsedFunction.getValue();
+    } else {
+      return false;
+    }
+    FunctionType *FT = fn->getFunctionType();
+    Type *T = getJacobianElementType(CI, fn);
+    if (!T)
+      return false;
+
+#if LLVM_VERSION_MAJOR >= 14
+    unsigned numArgs = CI->arg_size();
+#else
+    unsigned numArgs = CI->getNumArgOperands();
+#endif
+    if (numArgs < 9) {
+      EmitFailure("MissingJacobianArgs", CI->getDebugLoc(), CI,
+                  "__enzyme_sparse_jacobian(fn, x, y, n, m, rows, cols, vals, "
+                  "capacity) is missing arguments in ",
+                  *CI);
+      return false;
+    }
+    Value *x = CI->getArgOperand(1);
+    Value *y = CI->getArgOperand(2);
+    Value *n = CI->getArgOperand(3);
+    Value *m = CI->getArgOperand(4);
+    Value *rows = CI->getArgOperand(5);
+    Value *cols = CI->getArgOperand(6);
+    Value *vals = CI->getArgOperand(7);
+    Value *capacity = CI->getArgOperand(8);
+    if (!x->getType()->isPointerTy() || !y->getType()->isPointerTy() ||
+        !n->getType()->isIntegerTy() || !m->getType()->isIntegerTy() ||
+        !isIndexArray(rows) || !isIndexArray(cols) ||
+        !vals->getType()->isPointerTy() ||
+        !capacity->getType()->isIntegerTy()) {
+      EmitFailure("IllegalJacobianArgs", CI->getDebugLoc(), CI,
+                  "__enzyme_sparse_jacobian(fn, x, y, n, m, rows, cols, vals, "
+                  "capacity) needs pointers x, y, vals, integer arrays rows, "
+                  "cols and integers n, m, capacity in ",
+                  *CI);
+      return false;
+    }
+
+    unsigned width;
+    bool widthGiven, csr;
+    if (!parseSparseOptions(CI, 9, "__enzyme_sparse_jacobian", width,
+                            widthGiven, csr))
+      return false;
+
+    IRBuilder<> B(CI);
+    Type *I64 = B.getInt64Ty();
+    x = B.CreatePointerCast(x, FT->getParamType(0));
+    y = B.CreatePointerCast(y, FT->getParamType(1));
+    vals = B.CreatePointerCast(vals, FT->getParamType(0));
+    n = B.CreateZExtOrTrunc(n, I64);
+    m = B.CreateZExtOrTrunc(m, I64);
+    capacity = B.CreateZExtOrTrunc(capacity, I64);
+
+    BasicBlock *pre = CI->getParent();
+    BasicBlock *post = pre->splitBasicBlock(CI, "jacobian.done");
+    pre->getTerminator()->eraseFromParent();
+    B.SetInsertPoint(pre);
+    Value *nnz = emitSparseJacobian(B, CI, fn, T, x, y, n, m, rows, cols, vals,
+                                    capacity, width, widthGiven, csr);
+
+    if (CI->getType()->isIntegerTy())
+      CI->replaceAllUsesWith(B.CreateZExtOrTrunc(nnz, CI->getType()));
+    else if (!CI->getType()->isVoidTy())
+      CI->replaceAllUsesWith(UndefValue::get(CI->getType()));
+    B.CreateBr(post);
+    CI->eraseFromParent();
+    return true;
+  }
+
+  /// Lower __enzyme_sparse_hessian(fn, x, n, rows, cols, vals, capacity,
+  /// ...) where fn is a T(T *x) of the n inputs x. The entries of its Hessian,
+  /// both triangles, are written as by __enzyme_sparse_jacobian, and their
+  /// number is returned.
+  ///
+  /// The Hessian is the Jacobian of the gradient. The gradient of fn is
+  /// generated in combined reverse mode into a void(T *x, T *dx) and its
+  /// sparse Jacobian computed in forward mode. The pattern of the gradient is
+  /// the structure of the Hessian, so that each color of its columns costs one
+  /// Hessian-vector product.
+  bool HandleSparseHessian(CallInst *CI) {
+    Function *fn;
+    auto parsedFunction = parseFunctionParameter(CI);
+    if (parsedFunction.hasValue()) {
+      fn = parsedFunction.getValue();
+    } else {
+      return false;
+    }
+    FunctionType *FT = fn->getFunctionType();
+    Type *T = FT->getReturnType();
+    if (!T->isFloatingPointTy() || FT->getNumParams() != 1 ||
+        FT->getParamType(0) != T->getPointerTo()) {
+      EmitFailure("IllegalHessianFunction", CI->getDebugLoc(), CI,
+                  "Hessians need a function T(T *x) with a floating point "
+                  "type T, found ",
+                  *fn->getType(), " in ", *CI);
+      return false;
+    }
+
+#if LLVM_VERSION_MAJOR >= 14
+    unsigned numArgs = CI->arg_size();
+#else
+    unsigned numArgs = CI->getNumArgOperands();
+#endif
+    if (numArgs < 7) {
+      EmitFailure("MissingHessianArgs", CI->getDebugLoc(), CI,
+                  "__enzyme_sparse_hessian(fn, x, n, rows, cols, vals, "
+                  "capacity) is missing arguments in ",
+                  *CI);
+      return false;
+    }
+    Value *x = CI->getArgOperand(1);
+    Value *n = CI->getArgOperand(2);
+    Value *rows = CI->getArgOperand(3);
+    Value *cols = CI->getArgOperand(4);
+    Value *vals = CI->getArgOperand(5);
+    Value *capacity = CI->getArgOperand(6);
+    if (!x->getType()->isPointerTy() || !n->getType()->isIntegerTy() ||
+        !isIndexArray(rows) || !isIndexArray(cols) ||
+        !vals->getType()->isPointerTy() ||
+        !capacity->getType()->isIntegerTy()) {
+      EmitFailure("IllegalHessianArgs", CI->getDebugLoc(), CI,
+                  "__enzyme_sparse_hessian(fn, x, n, rows, cols, vals, "
+                  "capacity) needs pointers x, vals, integer arrays rows, "
+                  "cols and integers n, capacity in ",
+                  *CI);
+      return false;
+    }
+
+    unsigned width;
+    bool widthGiven, csr;
+    if (!parseSparseOptions(CI, 7, "__enzyme_sparse_hessian", width,
+                            widthGiven, csr))
+      return false;
+
+    std::map<Argument *, bool> volatile_args;
+    for (auto &a : fn->args())
+      volatile_args[&a] = false;
+    TypeAnalysis TA(Logic.PPC.FAM);
+    FnTypeInfo type_args =
+        TA.analyzeFunction(getArgumentTypeInfo(fn)).getAnalyzedTypeInfo();
+    // As for nested calls, the gradient is optimized before it is
+    // differentiated again.
+    bool PostOpt = Logic.PostOpt;
+    Logic.PostOpt = true;
+    Function *grad = Logic.CreatePrimalAndGradient(
+        (ReverseCacheKey){.todiff = fn,
+                          .retType = DIFFE_TYPE::OUT_DIFF,
+                          .constant_args = {DIFFE_TYPE::DUP_ARG},
+                          .uncacheable_args = volatile_args,
+                          .returnUsed = false,
+                          .shadowReturnUsed = false,
+                          .mode = DerivativeMode::ReverseModeCombined,
+                          .width = 1,
+                          .freeMemory = true,
+                          .AtomicAdd = false,
+                          .additionalType = nullptr,
+                          .typeInfo = type_args},
+        TA, /*augmented*/ nullptr);
+    Logic.PostOpt = PostOpt;
+    if (!grad)
+      return false;
+
+    // The gradient as a function of x into dx, inlined so that its pattern
+    // can be derived.
+    Module &M = *fn->getParent();
+    Type *PT = FT->getParamType(0);
+    Function *gradfn = Function::Create(
+        FunctionType::get(Type::getVoidTy(M.getContext()), {PT, PT},
+                          /*isVarArg*/ false),
+        GlobalValue::InternalLinkage, "hessian_grad_" + fn->getName(), &M);
+    {
+      gradfn->arg_begin()->setName("x");
+      std::next(gradfn->arg_begin())->setName("dx");
+      IRBuilder<> GB(BasicBlock::Create(M.getContext(), "entry", gradfn));
+      CallInst *call = GB.CreateCall(
+          grad->getFunctionType(), grad,
+          {gradfn->arg_begin(), std::next(gradfn->arg_begin()),
+           ConstantFP::get(T, 1.0)});
+      GB.CreateRetVoid();
+      InlineFunctionInfo IFI;
+#if LLVM_VERSION_MAJOR >= 11
+      InlineFunction(*call, IFI);
+#else
+      InlineFunction(call, IFI);
+#endif
+    }
+
+    IRBuilder<> B(CI);
+    Type *I64 = B.getInt64Ty();
+    x = B.CreatePointerCast(x, PT);
+    vals = B.CreatePointerCast(vals, PT);
+    n = B.CreateZExtOrTrunc(n, I64);
+    capacity = B.CreateZExtOrTrunc(capacity, I64);
+
+    BasicBlock *pre = CI->getParent();
+    BasicBlock *post = pre->splitBasicBlock(CI, "hessian.done");
+    pre->getTerminator()->eraseFromParent();
+    B.SetInsertPoint(pre);
+    Instruction *ZeroMem = nullptr;
+    Value *dx = CreateAllocation(B, T, n, "hessian.gradient",
+                                 /*caller*/ nullptr, &ZeroMem);
+    Value *nnz = emitSparseJacobian(B, CI, gradfn, T, x, dx, n, n, rows, cols,
+                                    vals, capacity, width, widthGiven, csr);
+    CreateDealloc(B, dx);
+
+    if (CI->getType()->isIntegerTy())
+      CI->replaceAllUsesWith(B.CreateZExtOrTrunc(nnz, CI->getType()));
+    else if (!CI->getType()->isVoidTy())
+      CI->replaceAllUsesWith(UndefValue::get(CI->getType()));
+    B.CreateBr(post);
+    CI->eraseFromParent();
+    return true;
+  }
+
+  /// Lower __enzyme_hvp(fn, args...) to the product of the Hessian of fn
+  /// with a direction, where fn returns a scalar or stores its results through
+  /// pointer arguments. Each pointer argument not marked enzyme_const is
+  /// followed by its direction v, a shadow receiving the gradient and a shadow
+  /// receiving the Hessian-vector product, both accumulated into. All other
+  /// arguments are constant.
+  ///
+  /// This is a convenience over nesting __enzyme_fwddiff around a function
+  /// calling __enzyme_autodiff, and generates the same code once optimized.
+  /// The gradient of fn is generated in combined reverse mode and then
+  /// differentiated in forward mode like any other function. Tangents are
+  /// not fused into its sweeps: the caches of the gradient are differentiated
+  /// as ordinary memory, so a cache of values depending on the active
+  /// arguments gets a shadow cache holding their tangents, while activity
+  /// analysis leaves caches of inactive values, such as loop bounds, without
+  /// one.
+  bool HandleHVP(CallInst *CI) {
+    Function *fn;
+    auto parsedFunction = parseFunctionParameter(CI);
+    if (parsedFunction.hasValue()) {
+      fn = parsedFunction.getValue();
+    } else {
+      return false;
+    }
+    FunctionType *FT = fn->getFunctionType();
+    Type *retTy = FT->getReturnType();
+    if (!retTy->isVoidTy() && !retTy->isFPOrFPVectorTy()) {
+      EmitFailure("IllegalHVPFunction", CI->getDebugLoc(), CI,
+                  "__enzyme_hvp needs a function returning a floating point "
+                  "value or void, found ",
+                  *FT, " in ", *CI);
+      return false;
+    }
+
+#if LLVM_VERSION_MAJOR >= 14
+    unsigned numArgs = CI->arg_size();
+#else
+    unsigned numArgs = CI->getNumArgOperands();
+#endif
+    IRBuilder<> B(CI);
+    std::vector<DIFFE_TYPE> constants;
+    std::vector<DIFFE_TYPE> gradConstants;
+    SmallVector<Value *, 8> args;
+    unsigned i = 1;
+    for (unsigned truei = 0; truei < FT->getNumParams(); ++truei) {
+      Type *PTy = FT->getParamType(truei);
+      bool isConst = !PTy->isPointerTy();
+      if (i < numArgs) {
+        auto MDName = getMetadataName(CI->getArgOperand(i));
+        if (MDName && *MDName == "enzyme_const") {
+          isConst = true;
+          ++i;
+        }
+      }
+      unsigned needed = isConst ? 1 : 4;
+      if (i + needed > numArgs) {
+        EmitFailure("MissingArgShadow", CI->getDebugLoc(), CI,
+                    "__enzyme_hvp is missing values for argument ", truei,
+                    " of type ", *PTy, " in ", *CI);
+        return false;
+      }
+      for (unsigned end = i + needed; i < end; ++i) {
+        Value *arg = CI->getArgOperand(i);
+        if (arg->getType() != PTy) {
+          if (!arg->getType()->canLosslesslyBitCastTo(PTy)) {
+            EmitFailure("IllegalArgCast", CI->getDebugLoc(), CI,
+                        "Cannot cast __enzyme_hvp argument ", i, ", found ",
+                        *arg, ", type ", *arg->getType(), " - to arg ", truei,
+                        " ", *PTy);
+            return false;
+          }
+          arg = B.CreateBitCast(arg, PTy);
+        }
+        args.push_back(arg);
+      }
+      constants.push_back(isConst ? DIFFE_TYPE::CONSTANT : DIFFE_TYPE::DUP_ARG);
+      // The gradient takes the argument and, if active, its shadow.
+      gradConstants.push_back(isConst ? DIFFE_TYPE::CONSTANT
+                                      : DIFFE_TYPE::DUP_ARG);
+      if (!isConst)
+        gradConstants.push_back(DIFFE_TYPE::DUP_ARG);
+    }
+    if (i != numArgs) {
+      EmitFailure("TooManyArgs", CI->getDebugLoc(), CI,
+                  "Had too many arguments to __enzyme_hvp", *CI,
+                  " - extra arg - ", *CI->getArgOperand(i));
+      return false;
+    }
+
+    DIFFE_TYPE retType =
+        retTy->isVoidTy() ? DIFFE_TYPE::CONSTANT : DIFFE_TYPE::OUT_DIFF;
+    std::map<Argument *, bool> volatile_args;
+    for (auto &a : fn->args())
+      volatile_args[&a] = false;
+
+    TypeAnalysis TA(Logic.PPC.FAM);
+    FnTypeInfo type_args =
+        TA.analyzeFunction(getArgumentTypeInfo(fn)).getAnalyzedTypeInfo();
+
+    // As for nested calls, the gradient is optimized before it is
+    // differentiated again.
+    bool PostOpt = Logic.PostOpt;
+    Logic.PostOpt = true;
+    Function *grad = Logic.CreatePrimalAndGradient(
+        (ReverseCacheKey){.todiff = fn,
+                          .retType = retType,
+                          .constant_args = constants,
+                          .uncacheable_args = volatile_args,
+                          .returnUsed = false,
+                          .shadowReturnUsed = false,
+                          .mode = DerivativeMode::ReverseModeCombined,
+                          .width = 1,
+                          .freeMemory = true,
+                          .AtomicAdd = false,
+                          .additionalType = nullptr,
+                          .typeInfo = type_args},
+        TA, /*augmented*/ nullptr);
+    Logic.PostOpt = PostOpt;
+    if (!grad)
+      return false;
+
+    // The seed of the returned value is constant.
+    if (retType == DIFFE_TYPE::OUT_DIFF) {
+      gradConstants.push_back(DIFFE_TYPE::CONSTANT);
+      args.push_back(ConstantFP::get(retTy, 1.0));
+    }
+    assert(gradConstants.size() == grad->arg_size());
+
+    std::map<Argument *, bool> grad_volatile_args;
+    for (auto &a : grad->args())
+      grad_volatile_args[&a] = true;
+    FnTypeInfo grad_type_args =
+        TA.analyzeFunction(getArgumentTypeInfo(grad)).getAnalyzedTypeInfo();
+    Function *hvp = Logic.CreateForwardDiff(
+        grad, DIFFE_TYPE::CONSTANT, gradConstants, TA,
+        /*should return*/ false, DerivativeMode::ForwardMode,
+        /*freeMemory*/ true, /*width*/ 1, /*addedType*/ nullptr,
+        grad_type_args, grad_volatile_args, /*augmented*/ nullptr);
+    if (!hvp)
+      return false;
+
+    B.CreateCall(hvp->getFunctionType(), hvp, args);
+    if (!CI->getType()->isVoidTy())
+      CI->replaceAllUsesWith(UndefValue::get(CI->getType()));
+    CI->eraseFromParent();
+    return true;
+  }
+
   /// Return whether successful
   bool HandleAutoDiff(CallInst *CI, TargetLibraryInfo &TLI, DerivativeMode mode,
                       bool sizeOnly) {
@@ -1164,6 +2491,7 @@ public:
     llvm::Value *tape = nullptr;
     bool tapeIsPointer = false;
     int allocatedTapeSize = -1;
+    llvm::Value *workspace = nullptr;
     unsigned byRefSize = 0;
 
 #if LLVM_VERSION_MAJOR >= 14
@@ -1265,6 +2593,16 @@ public:
           assert(!sizeOnly);
           freeMemory = false;
           continue;
+        } else if (*metaString == "enzyme_workspace") {
+          ++i;
+          workspace = CI->getArgOperand(i);
+          if (!workspace->getType()->isPointerTy()) {
+            EmitFailure("IllegalWorkspace", CI->getDebugLoc(), CI,
+                        "enzyme_workspace must be followed by a pointer ",
+                        *workspace, " in", *CI);
+            return false;
+          }
+          continue;
         } else if (*metaString == "enzyme_width") {
           ++i;
           continue;
@@ -1490,33 +2828,20 @@ public:
     }
 
     std::map<Argument *, bool> volatile_args;
-    FnTypeInfo type_args(fn);
-    for (auto &a : type_args.Function->args()) {
+    for (auto &a : fn->args())
       volatile_args[&a] = !(mode == DerivativeMode::ReverseModeCombined);
-      TypeTree dt;
-      if (a.getType()->isFPOrFPVectorTy()) {
-        dt = ConcreteType(a.getType()->getScalarType());
-      } else if (a.getType()->isPointerTy()) {
-        auto et = a.getType()->getPointerElementType();
-        if (et->isFPOrFPVectorTy()) {
-          dt = TypeTree(ConcreteType(et->getScalarType())).Only(-1);
-        } else if (et->isPointerTy()) {
-          dt = TypeTree(ConcreteType(BaseType::Pointer)).Only(-1);
-        }
-        dt.insert({}, BaseType::Pointer);
-      } else if (a.getType()->isIntOrIntVectorTy()) {
-        dt = ConcreteType(BaseType::Integer);
-      }
-      type_args.Arguments.insert(
-          std::pair<Argument *, TypeTree>(&a, dt.Only(-1)));
-      // TODO note that here we do NOT propagate constants in type info (and
-      // should consider whether we should)
-      type_args.KnownValues.insert(
-          std::pair<Argument *, std::set<int64_t>>(&a, {}));
-    }
 
-    TypeAnalysis TA(Logic.PPC.FAM);
-    type_args = TA.analyzeFunction(type_args).getAnalyzedTypeInfo();
+    std::unique_ptr<TypeAnalysis> TAOwner;
+    auto foundTA = PrecomputedTypeAnalyses.find(std::make_pair(CI, fn));
+    if (foundTA != PrecomputedTypeAnalyses.end()) {
+      TAOwner = std::move(foundTA->second);
+      PrecomputedTypeAnalyses.erase(foundTA);
+    } else {
+      TAOwner.reset(new TypeAnalysis(Logic.PPC.FAM));
+    }
+    TypeAnalysis &TA = *TAOwner;
+    FnTypeInfo type_args =
+        TA.analyzeFunction(getArgumentTypeInfo(fn)).getAnalyzedTypeInfo();
 
     // differentiate fn
     Function *newFunc = nullptr;
@@ -1729,6 +3054,57 @@ public:
       return false;
     }
     assert(args.size() == newFunc->getFunctionType()->getNumParams());
+
+    for (unsigned i = 0; i < args.size(); ++i) {
+      Type *PT = newFunc->getFunctionType()->getParamType(i);
+      if (PT->isVectorTy() && isa<ArrayType>(args[i]->getType()))
+        args[i] = convertShadowLayout(Builder, args[i], PT);
+    }
+
+    // Memory allocated by the derivative is served from the workspace for the
+    // duration of the call
+    Value *prevWorkspace = nullptr;
+    GlobalVariable *workspaceGV = nullptr;
+    Value *workspaceUsed = nullptr;
+    Value *workspaceMark = nullptr;
+    if (workspace) {
+      workspaceGV = getOrInsertWorkspace(*CI->getModule());
+#if LLVM_VERSION_MAJOR > 7
+      prevWorkspace = Builder.CreateLoad(workspaceGV->getValueType(),
+                                         workspaceGV, "prevworkspace");
+#else
+      prevWorkspace = Builder.CreateLoad(workspaceGV, "prevworkspace");
+#endif
+      Builder.CreateStore(
+          Builder.CreatePointerCast(workspace, workspaceGV->getValueType()),
+          workspaceGV);
+
+      auto &DL = CI->getModule()->getDataLayout();
+      Type *SizeT = DL.getIntPtrType(CI->getContext());
+      Type *types[] = {workspaceGV->getValueType(), SizeT, SizeT, SizeT};
+      auto WT = StructType::get(CI->getContext(), types, /*isPacked*/ false);
+      Value *ws =
+          Builder.CreatePointerCast(workspace, PointerType::getUnqual(WT));
+#if LLVM_VERSION_MAJOR > 7
+      workspaceUsed = Builder.CreateStructGEP(WT, ws, 2);
+#else
+      workspaceUsed = Builder.CreateStructGEP(ws, 2);
+#endif
+      // Calls which do not hand memory back to the caller release everything
+      // they allocated on return, including within enclosing derivatives
+      // sharing the workspace.
+      if (mode == DerivativeMode::ForwardMode ||
+          mode == DerivativeMode::ForwardModeSplit ||
+          mode == DerivativeMode::ReverseModeCombined) {
+#if LLVM_VERSION_MAJOR > 7
+        workspaceMark =
+            Builder.CreateLoad(SizeT, workspaceUsed, "workspacemark");
+#else
+        workspaceMark = Builder.CreateLoad(workspaceUsed, "workspacemark");
+#endif
+      }
+    }
+
     CallInst *diffretc = cast<CallInst>(Builder.CreateCall(newFunc, args));
     diffretc->setCallingConv(CI->getCallingConv());
     diffretc->setDebugLoc(CI->getDebugLoc());
@@ -1739,6 +3115,21 @@ public:
           Attribute::getWithByValType(diffretc->getContext(), pair.second));
     }
 #endif
+
+    if (workspace) {
+      // The tape of an augmented forward pass stays live in the workspace
+      // until a reverse pass given the same workspace completes, which then
+      // resets it for the next call rather than freeing anything.
+      if (workspaceMark)
+        Builder.CreateStore(workspaceMark, workspaceUsed);
+      else if (mode == DerivativeMode::ReverseModeGradient)
+        Builder.CreateStore(
+            ConstantInt::get(
+                CI->getModule()->getDataLayout().getIntPtrType(CI->getContext()),
+                0),
+            workspaceUsed);
+      Builder.CreateStore(prevWorkspace, workspaceGV);
+    }
     Value *diffret = diffretc;
     if (mode == DerivativeMode::ReverseModePrimal && tape) {
       if (aug->returns.find(AugmentedStruct::Tape) != aug->returns.end()) {
@@ -1778,6 +3169,32 @@ public:
       }
     }
 
+    // Return vector shadows as arrays, like the shadows passed in.
+    if (width > 1 && (mode == DerivativeMode::ForwardMode ||
+                      mode == DerivativeMode::ForwardModeSplit)) {
+      Type *retTy = fn->getReturnType();
+      Type *vecTy = GradientUtils::getShadowType(retTy, width, mode);
+      Type *arrTy = GradientUtils::getShadowType(retTy, width);
+      if (diffret->getType() == vecTy && vecTy != arrTy) {
+        diffret = convertShadowLayout(Builder, diffret, arrTy);
+      } else if (auto ST = dyn_cast<StructType>(diffret->getType())) {
+        if (vecTy != arrTy && llvm::is_contained(ST->elements(), vecTy)) {
+          SmallVector<Type *, 2> tys;
+          for (auto ty : ST->elements())
+            tys.push_back(ty == vecTy ? arrTy : ty);
+          Value *out = UndefValue::get(StructType::get(ST->getContext(), tys));
+          for (unsigned i = 0; i < tys.size(); i++)
+            out = Builder.CreateInsertValue(
+                out,
+                convertShadowLayout(Builder,
+                                    Builder.CreateExtractValue(diffret, {i}),
+                                    tys[i]),
+                {i});
+          diffret = out;
+        }
+      }
+    }
+
     // Adapt the returned vector type to the struct type expected by our calling
     // convention.
     if (width > 1 && !diffret->getType()->isEmptyTy() &&
@@ -1898,7 +3315,11 @@ public:
               Fn->getName().contains("__enzyme_augmentfwd") ||
               Fn->getName().contains("__enzyme_augmentsize") ||
               Fn->getName().contains("__enzyme_reverse") ||
-              Fn->getName().contains("__enzyme_batch")))
+              Fn->getName().contains("__enzyme_batch") ||
+              Fn->getName().contains("__enzyme_jacobian") ||
+              Fn->getName().contains("__enzyme_sparse_jacobian") ||
+              Fn->getName().contains("__enzyme_sparse_hessian") ||
+              Fn->getName().contains("__enzyme_hvp")))
           continue;
 
         SmallVector<Value *, 16> CallArgs(II->arg_begin(), II->arg_end());
@@ -1931,6 +3352,53 @@ public:
         Changed = true;
       }
 
+    // Jacobians and sparse Hessians are lowered to loops of __enzyme_fwddiff
+    // or __enzyme_autodiff calls, which are then handled below.
+    SmallVector<CallInst *, 1> toJacobian;
+    for (BasicBlock &BB : F)
+      for (Instruction &I : BB)
+        if (auto CI = dyn_cast<CallInst>(&I))
+          if (Function *Fn = getFunctionFromCall(CI))
+            if (Fn->getName().contains("__enzyme_jacobian") ||
+                Fn->getName().contains("__enzyme_sparse_jacobian") ||
+                Fn->getName().contains("__enzyme_sparse_hessian"))
+              toJacobian.push_back(CI);
+    for (auto CI : toJacobian) {
+      StringRef Name = getFunctionFromCall(CI)->getName();
+      if (Name.contains("__enzyme_sparse_jacobian"))
+        successful &= HandleSparseJacobian(CI);
+      else if (Name.contains("__enzyme_sparse_hessian"))
+        successful &= HandleSparseHessian(CI);
+      else
+        successful &= HandleJacobian(CI);
+      Changed = true;
+      if (!successful)
+        return Changed;
+    }
+
+    SmallVector<CallInst *, 1> toHVP;
+    for (BasicBlock &BB : F)
+      for (Instruction &I : BB)
+        if (auto CI = dyn_cast<CallInst>(&I))
+          if (Function *Fn = getFunctionFromCall(CI))
+            if (Fn->getName().contains("__enzyme_hvp"))
+              toHVP.push_back(CI);
+    for (auto CI : toHVP) {
+      // The function is differentiated twice here, so any derivative calls
+      // it contains are lowered first.
+      if (auto fn = dyn_cast<Function>(
+              CI->getArgOperand(0)->stripPointerCasts())) {
+        bool tmp = Logic.PostOpt;
+        Logic.PostOpt = true;
+        Changed |= lowerEnzymeCalls(*fn, successful, done);
+        Logic.PostOpt = tmp;
+      }
+      successful &= HandleHVP(CI);
+      Changed = true;
+      if (!successful)
+        return Changed;
+    }
+
     MapVector<CallInst *, DerivativeMode> toLower;
     MapVector<CallInst *, DerivativeMode> toVirtual;
     MapVector<CallInst *, DerivativeMode> toSize;
@@ -2370,6 +3838,84 @@ public:
     return Changed;
   }
 
+  /// Analyze the types of the functions differentiated by the calls in M
+  /// concurrently, ahead of lowering the calls. Functions which themselves
+  /// contain calls to Enzyme, and thus change as calls are lowered, are
+  /// analyzed when their call is lowered instead.
+  void precomputeTypeAnalyses(Module &M) {
+    auto isLowered = [](Function *Fn) {
+      for (auto name :
+           {"__enzyme_autodiff", "__enzyme_fwddiff", "__enzyme_fwdsplit",
+            "__enzyme_augmentfwd", "__enzyme_augmentsize", "__enzyme_reverse"})
+        if (Fn->getName().contains(name))
+          return true;
+      return false;
+    };
+    // Whether the functions reachable from fn reference Enzyme functions other
+    // than the type annotations, which are only removed after lowering
+    std::map<Function *, bool> independent;
+    auto isIndependent = [&](Function *fn) {
+      auto found = independent.find(fn);
+      if (found != independent.end())
+        return found->second;
+      SmallPtrSet<Function *, 8> seen;
+      SmallVector<Function *, 8> todo = {fn};
+      seen.insert(fn);
+      bool result = true;
+      while (result && !todo.empty()) {
+        Function *F = todo.pop_back_val();
+        if (F->getName().contains("__enzyme_") &&
+            !F->getName().contains("__enzyme_float") &&
+            !F->getName().contains("__enzyme_double") &&
+            !F->getName().contains("__enzyme_integer") &&
+            !F->getName().contains("__enzyme_pointer")) {
+          result = false;
+          break;
+        }
+        for (auto &I : instructions(F))
+          for (auto &Op : I.operands())
+            if (auto F2 = dyn_cast<Function>(Op->stripPointerCasts()))
+              if (seen.insert(F2).second)
+                todo.push_back(F2);
+      }
+      independent[fn] = result;
+      return result;
+    };
+
+    SmallVector<std::pair<CallInst *, Function *>, 4> calls;
+    for (Function &F : M)
+      for (auto &I : instructions(F)) {
+        auto CI = dyn_cast<CallInst>(&I);
+        if (!CI)
+          continue;
+        Function *Fn = getFunctionFromCall(CI);
+#if LLVM_VERSION_MAJOR >= 14
+        size_t num_args = CI->arg_size();
+#else
+        size_t num_args = CI->getNumArgOperands();
+#endif
+        if (!Fn || !isLowered(Fn) || num_args == 0)
+          continue;
+        Value *fn = CI->getArgOperand(0);
+        if (CI->hasStructRetAttr() && num_args > 1)
+          fn = CI->getArgOperand(1);
+        fn = fn->stripPointerCasts();
+        if (auto F2 = dyn_cast<Function>(fn))
+          if (!F2->empty() && isIndependent(F2))
+            calls.push_back(std::make_pair(CI, F2));
+      }
+    if (calls.size() < 2)
+      return;
+
+    std::vector<std::pair<TypeAnalysis *, FnTypeInfo>> work;
+    for (auto &pair : calls) {
+      auto &TA = PrecomputedTypeAnalyses[pair];
+      TA.reset(new TypeAnalysis(Logic.PPC.FAM));
+      work.emplace_back(TA.get(), getArgumentTypeInfo(pair.second));
+    }
+    analyzeFunctionsInParallel(work);
+  }
+
   bool runOnModule(Module &M) override {
     constexpr static const char gradient_handler_name[] =
         "__enzyme_register_gradient";
@@ -2425,6 +3971,17 @@ public:
                   F = fn;
                 }
             }
+            // Derivatives are redirected to the workspace allocator only
+            // once it exists, so it must be created before any is generated
+            if (F && F->getName().startswith("__enzyme_")) {
+              for (auto &arg : CI->args()) {
+                auto MS = getMetadataName(arg);
+                if (MS && *MS == "enzyme_workspace") {
+                  getOrInsertWorkspace(M);
+                  break;
+                }
+              }
+            }
             if (F && F->getName() == "f90_mzero8") {
               toErase.push_back(CI);
               IRBuilder<> B(CI);
@@ -2467,6 +4024,9 @@ public:
     }
 #endif
 
+    if (EnzymeTypeAnalysisThreads > 1)
+      precomputeTypeAnalyses(M);
+
     std::set<Function *> done;
     for (Function &F : M) {
       if (F.empty())
@@ -2483,8 +4043,10 @@ public:
              << F.getName()));
       }
     }
+    PrecomputedTypeAnalyses.clear();
 
     SmallVector<CallInst *, 4> toErase;
+    SmallVector<CallInst *, 4> checkpoints;
     for (Function &F : M) {
       if (F.empty())
         continue;
@@ -2515,11 +4077,45 @@ public:
                 CI->replaceAllUsesWith(CI->getArgOperand(0));
                 toErase.push_back(CI);
               }
+              if (F->getName() == "__enzyme_checkpoint") {
+                checkpoints.push_back(CI);
+              }
             }
           }
         }
       }
     }
+    // Checkpointed loops which were not differentiated simply run the loop.
+    for (auto CI : checkpoints) {
+      Function *step =
+          dyn_cast<Function>(CI->getArgOperand(0)->stripPointerCasts());
+#if LLVM_VERSION_MAJOR >= 14
+      size_t num_args = CI->arg_size();
+#else
+      size_t num_args = CI->getNumArgOperands();
+#endif
+      if (!step || step->arg_size() == 0 ||
+          !step->getFunctionType()->getParamType(0)->isPointerTy() ||
+          num_args != step->arg_size() + 3) {
+        EmitFailure("InvalidCheckpoint", CI->getDebugLoc(), CI,
+                    "__enzyme_checkpoint requires a step function taking the "
+                    "state pointer and the trailing arguments ",
+                    *CI);
+        continue;
+      }
+      IRBuilder<> B(CI);
+      SmallVector<Value *, 4> args = {
+          castCheckpointArgument(B, CI->getArgOperand(1), B.getInt64Ty())};
+      for (auto &arg : step->args())
+        args.push_back(castCheckpointArgument(
+            B,
+            CI->getArgOperand(arg.getArgNo() == 0 ? 2 : arg.getArgNo() + 3),
+            arg.getType()));
+      B.CreateCall(getOrInsertCheckpointLoop(M, step), args);
+      if (!CI->getType()->isVoidTy())
+        CI->replaceAllUsesWith(UndefValue::get(CI->getType()));
+      toErase.push_back(CI);
+    }
     for (auto I : toErase) {
       I->eraseFromParent();
       changed = true;
@@ -2527,9 +4123,40 @@ public:
 
     for (const auto &pair : Logic.PPC.cache)
       pair.second->eraseFromParent();
+    if (EnzymePrintCacheStats) {
+      auto print = [](const char *Name,
+                      const EnzymeLogic::CacheStatistics &Stats) {
+        llvm::errs() << Name << " cache: hits=" << Stats.Hits
+                     << " misses=" << Stats.Misses
+                     << " persistent=" << Stats.PersistentHits << "\n";
+      };
+      print("augmented", Logic.AugmentedCacheStats);
+      print("reverse", Logic.ReverseCacheStats);
+      print("forward", Logic.ForwardCacheStats);
+    }
     Logic.clear();
 
+    // Define the cache report for programs printing it on demand, which
+    // may declare it without a prototype
+    if (EnzymeCacheInstrument && !M.getFunction("__enzyme_cache_report")) {
+      getOrInsertCacheReport(M);
+      changed = true;
+    } else if (Function *report = M.getFunction("__enzyme_cache_report")) {
+      if (report->empty()) {
+        auto FT = FunctionType::get(Type::getVoidTy(M.getContext()), {}, false);
+        if (report->getFunctionType() != FT) {
+          report->setName("");
+          report->replaceAllUsesWith(ConstantExpr::getPointerCast(
+              getOrInsertCacheReport(M), report->getType()));
+          report->eraseFromParent();
+        } else
+          getOrInsertCacheReport(M);
+        changed = true;
+      }
+    }
+
     if (changed && Logic.PostOpt) {
+      EnzymeTimeRegion timer(EnzymePhase::PostOpt);
       PassBuilder PB;
       LoopAnalysisManager LAM;
       FunctionAnalysisManager FAM;
@@ -2562,6 +4189,7 @@ public:
       }
 #endif
     }
+    printEnzymeTimeReport(M.getModuleIdentifier());
     return changed;
   }
 };
@@ -56,10 +56,13 @@
 
 #include "llvm/Support/AMDGPUMetadata.h"
 
+#include "DerivativeCache.h"
 #include "FunctionUtils.h"
 #include "GradientUtils.h"
 #include "InstructionBatcher.h"
 #include "LibraryFuncs.h"
+#include "MaskedControlFlow.h"
+#include "TimeReport.h"
 #include "Utils.h"
 
 #if LLVM_VERSION_MAJOR >= 14
@@ -90,6 +93,11 @@ cl::opt<bool> nonmarkedglobals_inactiveloads(
 cl::opt<bool> EnzymeJuliaAddrLoad(
     "enzyme-julia-addr-load", cl::init(false), cl::Hidden,
     cl::desc("Mark all loads resulting in an addr(13)* to be legal to redo"));
+
+cl::opt<bool> EnzymeBatchVectorize(
+    "enzyme-batch-vectorize", cl::init(false), cl::Hidden,
+    cl::desc("Lower lane-wise batched instructions to vector instructions "
+             "instead of one copy per lane"));
 }
 
 struct CacheAnalysis {
@@ -1722,8 +1730,10 @@ const AugmentedReturn &EnzymeLogic::CreateAugmentedPrimal(
 
   auto found = AugmentedCachedFunctions.find(tup);
   if (found != AugmentedCachedFunctions.end()) {
+    AugmentedCacheStats.Hits++;
     return found->second;
   }
+  AugmentedCacheStats.Misses++;
   TargetLibraryInfo &TLI = PPC.FAM.getResult<TargetLibraryAnalysis>(*todiff);
 
   // TODO make default typing (not just constant)
@@ -1826,12 +1836,14 @@ const AugmentedReturn &EnzymeLogic::CreateAugmentedPrimal(
       else
         bb.CreateRet(cal);
 
-      return insert_or_assign<AugmentedCacheKey, AugmentedReturn>(
-                 AugmentedCachedFunctions, tup,
-                 AugmentedReturn(NewF, aug.tapeType, aug.tapeIndices,
-                                 aug.returns, aug.uncacheable_args_map,
-                                 aug.can_modref_map))
-          ->second;
+      auto &res = insert_or_assign<AugmentedCacheKey, AugmentedReturn>(
+                      AugmentedCachedFunctions, tup,
+                      AugmentedReturn(NewF, aug.tapeType, aug.tapeIndices,
+                                      aug.returns, aug.uncacheable_args_map,
+                                      aug.can_modref_map))
+                      ->second;
+      res.instrumentedTapeCaches = aug.instrumentedTapeCaches;
+      return res;
     }
 
     if (foundcalled->hasStructRetAttr() && !todiff->hasStructRetAttr()) {
@@ -2055,6 +2067,9 @@ const AugmentedReturn &EnzymeLogic::CreateAugmentedPrimal(
   }
   std::map<AugmentedStruct, int> returnMapping;
 
+  EnzymeTimeRegion fnTimer(todiff->getName(),
+                           to_string(DerivativeMode::ReverseModePrimal));
+  EnzymeTimeRegion timer(EnzymePhase::Synthesis);
   GradientUtils *gutils = GradientUtils::CreateFromClone(
       *this, width, todiff, TLI, TA, oldTypeInfo, retType, constant_args,
       /*returnUsed*/ returnUsed, /*shadowReturnUsed*/ shadowReturnUsed,
@@ -2237,6 +2252,27 @@ const AugmentedReturn &EnzymeLogic::CreateAugmentedPrimal(
       }
   }
 
+  // Memory on the tape may have been served from an enzyme_workspace, which
+  // must also release it even if the reverse pass is called without one, so
+  // the workspace current at this call is recorded alongside it.
+  if (gutils->getTapeValues().size() &&
+      gutils->newFunc->getParent()->getGlobalVariable("__enzyme_workspace",
+                                                      /*AllowInternal*/ true)) {
+    auto GV = getOrInsertWorkspace(*gutils->newFunc->getParent());
+    auto entry = cast<BasicBlock>(
+        gutils->getNewFromOriginal(&gutils->oldFunc->getEntryBlock()));
+    IRBuilder<> BuilderZ(entry, entry->getFirstInsertionPt());
+#if LLVM_VERSION_MAJOR > 7
+    Value *ws = BuilderZ.CreateLoad(GV->getValueType(), GV, "workspace");
+#else
+    Value *ws = BuilderZ.CreateLoad(GV, "workspace");
+#endif
+    gutils->cacheForReverse(
+        BuilderZ, ws,
+        getIndex(gutils->oldFunc->getEntryBlock().getTerminator(),
+                 CacheType::Allocator));
+  }
+
   auto nf = gutils->newFunc;
 
   while (gutils->inversionAllocs->size() > 0) {
@@ -2341,6 +2377,13 @@ const AugmentedReturn &EnzymeLogic::CreateAugmentedPrimal(
     }
   }
 
+  // The reverse pass must release the instrumented caches it reads from the
+  // tape through the cache runtime
+  for (auto &pair : gutils->InstrumentedTapeCaches)
+    AugmentedCachedFunctions.find(tup)
+        ->second.instrumentedTapeCaches[removeTapeStruct ? -1 : pair.first] =
+        pair.second;
+
   bool recursive =
       AugmentedCachedFunctions.find(tup)->second.fn->getNumUses() > 0 ||
       forceAnonymousTape;
@@ -3211,6 +3254,41 @@ void createInvertedTerminator(DiffeGradientUtils *gutils,
   }
 }
 
+/// Description of the fields of a derivative's cache key, other than the
+/// function differentiated, for the persistent derivative cache.
+static std::string
+describeCacheKey(Function *todiff, DIFFE_TYPE retType,
+                 ArrayRef<DIFFE_TYPE> constant_args,
+                 const std::map<Argument *, bool> &uncacheable_args,
+                 DerivativeMode mode, unsigned width, bool returnUsed,
+                 bool shadowReturnUsed, bool freeMemory, bool AtomicAdd,
+                 bool PostOpt, const FnTypeInfo &typeInfo) {
+  std::string str;
+  raw_string_ostream ss(str);
+  ss << to_string(mode) << " width=" << width << " ret=" << to_string(retType)
+     << " returnUsed=" << returnUsed << " shadowReturnUsed=" << shadowReturnUsed
+     << " freeMemory=" << freeMemory << " atomicAdd=" << AtomicAdd
+     << " postopt=" << PostOpt << "\n";
+  for (auto ty : constant_args)
+    ss << to_string(ty) << " ";
+  ss << "\n";
+  for (auto &arg : todiff->args()) {
+    auto found = uncacheable_args.find(&arg);
+    ss << "arg " << arg.getArgNo() << " uncacheable="
+       << (found != uncacheable_args.end() && found->second);
+    auto types = typeInfo.Arguments.find(&arg);
+    if (types != typeInfo.Arguments.end())
+      ss << " type=" << types->second.str();
+    auto values = typeInfo.KnownValues.find(&arg);
+    if (values != typeInfo.KnownValues.end())
+      for (auto v : values->second)
+        ss << " " << v;
+    ss << "\n";
+  }
+  ss << "return type=" << typeInfo.Return.str() << "\n";
+  return ss.str();
+}
+
 Function *EnzymeLogic::CreatePrimalAndGradient(
     const ReverseCacheKey &&key, TypeAnalysis &TA,
     const AugmentedReturn *augmenteddata, bool omp) {
@@ -3224,13 +3302,16 @@ Function *EnzymeLogic::CreatePrimalAndGradient(
     assert(!key.todiff->getReturnType()->isVoidTy());
 
   Function *prevFunction = nullptr;
-  if (ReverseCachedFunctions.find(key) != ReverseCachedFunctions.end()) {
-    prevFunction = ReverseCachedFunctions.find(key)->second;
-    if (!hasMetadata(prevFunction, "enzyme_placeholder"))
-      return prevFunction;
-    if (augmenteddata && !augmenteddata->isComplete)
+  auto found = ReverseCachedFunctions.find(key);
+  if (found != ReverseCachedFunctions.end()) {
+    prevFunction = found->second;
+    if (!hasMetadata(prevFunction, "enzyme_placeholder") ||
+        (augmenteddata && !augmenteddata->isComplete)) {
+      ReverseCacheStats.Hits++;
       return prevFunction;
+    }
   }
+  ReverseCacheStats.Misses++;
 
   if (key.returnUsed)
     assert(key.mode == DerivativeMode::ReverseModeCombined);
@@ -3634,12 +3715,36 @@ Function *EnzymeLogic::CreatePrimalAndGradient(
 
   bool diffeReturnArg = key.retType == DIFFE_TYPE::OUT_DIFF;
 
+  // Derivatives complete in a single function may be reused across
+  // compilations.
+  std::string persistentKey;
+  if (key.mode == DerivativeMode::ReverseModeCombined && !augmenteddata &&
+      !key.additionalType && !omp) {
+    persistentKey = getPersistentCacheKey(
+        key.todiff,
+        describeCacheKey(key.todiff, key.retType, key.constant_args,
+                         key.uncacheable_args, key.mode, key.width,
+                         key.returnUsed, key.shadowReturnUsed, key.freeMemory,
+                         key.AtomicAdd, PostOpt, key.typeInfo),
+        TA);
+    if (auto F = loadPersistentDerivative(*key.todiff->getParent(),
+                                          persistentKey)) {
+      ReverseCacheStats.PersistentHits++;
+      return insert_or_assign2<ReverseCacheKey, Function *>(
+                 ReverseCachedFunctions, key, F)
+          ->second;
+    }
+  }
+
+  EnzymeTimeRegion fnTimer(key.todiff->getName(), to_string(key.mode));
+  EnzymeTimeRegion timer(EnzymePhase::Synthesis);
   DiffeGradientUtils *gutils = DiffeGradientUtils::CreateFromClone(
       *this, key.mode, key.width, key.todiff, TLI, TA, oldTypeInfo, key.retType,
       diffeReturnArg, key.constant_args, retVal, key.additionalType, omp);
 
   gutils->AtomicAdd = key.AtomicAdd;
   gutils->FreeMemory = key.freeMemory;
+  gutils->privatizeShadows();
   insert_or_assign2<ReverseCacheKey, Function *>(ReverseCachedFunctions, key,
                                                  gutils->newFunc);
 
@@ -3698,8 +3803,10 @@ Function *EnzymeLogic::CreatePrimalAndGradient(
   gutils->can_modref_map = &can_modref_map;
 
   std::map<std::pair<Instruction *, CacheType>, int> mapping;
-  if (augmenteddata)
+  if (augmenteddata) {
     mapping = augmenteddata->tapeIndices;
+    gutils->InstrumentedTapeCaches = augmenteddata->instrumentedTapeCaches;
+  }
 
   auto getIndex = [&](Instruction *I, CacheType u) -> unsigned {
     return gutils->getIndex(std::make_pair(I, u), mapping);
@@ -3719,6 +3826,29 @@ Function *EnzymeLogic::CreatePrimalAndGradient(
   calculateUnusedStoresInFunction(*gutils->oldFunc, unnecessaryStores,
                                   unnecessaryInstructions, gutils, TLI);
 
+  // The enzyme_workspace which served the memory on the tape, if recorded,
+  // is made current for the reverse pass, and the caller's one restored on
+  // return.
+  Value *prevWorkspace = nullptr;
+  auto installWorkspace = [&](IRBuilder<> &BuilderZ, Value *tape) {
+    auto found = mapping.find(
+        std::make_pair(gutils->oldFunc->getEntryBlock().getTerminator(),
+                       CacheType::Allocator));
+    if (found == mapping.end())
+      return;
+    auto GV = getOrInsertWorkspace(*gutils->newFunc->getParent());
+#if LLVM_VERSION_MAJOR > 7
+    prevWorkspace = BuilderZ.CreateLoad(GV->getValueType(), GV, "prevworkspace");
+#else
+    prevWorkspace = BuilderZ.CreateLoad(GV, "prevworkspace");
+#endif
+    Value *ws = BuilderZ.CreateExtractValue(tape, {(unsigned)found->second},
+                                            "workspace");
+    BuilderZ.CreateStore(
+        BuilderZ.CreateSelect(BuilderZ.CreateIsNull(ws), prevWorkspace, ws),
+        GV);
+  };
+
   Value *additionalValue = nullptr;
   if (key.additionalType) {
     auto v = gutils->newFunc->arg_end();
@@ -3745,6 +3875,7 @@ Function *EnzymeLogic::CreatePrimalAndGradient(
 #endif
         truetape->setMetadata("enzyme_mustcache",
                               MDNode::get(truetape->getContext(), {}));
+        installWorkspace(BuilderZ, truetape);
 
         if (!omp && gutils->FreeMemory) {
           CreateDealloc(BuilderZ, additionalValue);
@@ -3756,6 +3887,9 @@ Function *EnzymeLogic::CreatePrimalAndGradient(
         }
         additionalValue = UndefValue::get(augmenteddata->tapeType);
       }
+    } else if (additionalValue->getType()->isStructTy()) {
+      IRBuilder<> BuilderZ(gutils->inversionAllocs);
+      installWorkspace(BuilderZ, additionalValue);
     }
 
     // TODO here finish up making recursive structs simply pass in i8*
@@ -3921,7 +4055,18 @@ Function *EnzymeLogic::CreatePrimalAndGradient(
   if (key.mode == DerivativeMode::ReverseModeGradient)
     restoreCache(gutils, mapping, guaranteedUnreachable);
 
+  gutils->placeDeferredFrees();
+  gutils->finalizeCoalescedCaches();
+
+  if (prevWorkspace) {
+    auto GV = getOrInsertWorkspace(*gutils->newFunc->getParent());
+    for (auto &BB : *gutils->newFunc)
+      if (auto RI = dyn_cast_or_null<ReturnInst>(BB.getTerminator()))
+        IRBuilder<>(RI).CreateStore(prevWorkspace, GV);
+  }
+
   gutils->eraseFictiousPHIs();
+  gutils->reducePrivatizedShadows();
 
   BasicBlock *entry = &gutils->newFunc->getEntryBlock();
 
@@ -4046,6 +4191,7 @@ Function *EnzymeLogic::CreatePrimalAndGradient(
   if (EnzymePrint) {
     llvm::errs() << *nf << "\n";
   }
+  storePersistentDerivative(nf, key.todiff, persistentKey);
   return nf;
 }
 
@@ -4076,9 +4222,12 @@ Function *EnzymeLogic::CreateForwardDiff(
                          additionalArg,
                          oldTypeInfo};
 
-  if (ForwardCachedFunctions.find(tup) != ForwardCachedFunctions.end()) {
-    return ForwardCachedFunctions.find(tup)->second;
+  auto found = ForwardCachedFunctions.find(tup);
+  if (found != ForwardCachedFunctions.end()) {
+    ForwardCacheStats.Hits++;
+    return found->second;
   }
+  ForwardCacheStats.Misses++;
 
   TargetLibraryInfo &TLI = PPC.FAM.getResult<TargetLibraryAnalysis>(*todiff);
 
@@ -4260,6 +4409,24 @@ Function *EnzymeLogic::CreateForwardDiff(
 
   bool diffeReturnArg = false;
 
+  std::string persistentKey;
+  if (mode == DerivativeMode::ForwardMode && !augmenteddata &&
+      !additionalArg && !omp) {
+    persistentKey = getPersistentCacheKey(
+        todiff, describeCacheKey(todiff, retType, constant_args,
+                                 _uncacheable_args, mode, width, returnUsed,
+                                 /*shadowReturnUsed*/ false, freeMemory,
+                                 /*AtomicAdd*/ false, PostOpt, oldTypeInfo),
+        TA);
+    if (auto F =
+            loadPersistentDerivative(*todiff->getParent(), persistentKey)) {
+      ForwardCacheStats.PersistentHits++;
+      return ForwardCachedFunctions[tup] = F;
+    }
+  }
+
+  EnzymeTimeRegion fnTimer(todiff->getName(), to_string(mode));
+  EnzymeTimeRegion timer(EnzymePhase::Synthesis);
   DiffeGradientUtils *gutils = DiffeGradientUtils::CreateFromClone(
       *this, mode, width, todiff, TLI, TA, oldTypeInfo, retType, diffeReturnArg,
       constant_args, retVal, additionalArg, omp);
@@ -4479,80 +4646,15 @@ Function *EnzymeLogic::CreateForwardDiff(
   if (EnzymePrint) {
     llvm::errs() << *nf << "\n";
   }
+  storePersistentDerivative(nf, todiff, persistentKey);
   return nf;
 }
 
-llvm::Function *EnzymeLogic::CreateBatch(Function *tobatch, unsigned width,
-                                         ArrayRef<BATCH_TYPE> arg_types,
-                                         BATCH_TYPE ret_type) {
-
-  BatchCacheKey tup = std::make_tuple(tobatch, width, arg_types, ret_type);
-  if (BatchCachedFunctions.find(tup) != BatchCachedFunctions.end()) {
-    return BatchCachedFunctions.find(tup)->second;
-  }
-
-  FunctionType *orig_FTy = tobatch->getFunctionType();
-  SmallVector<Type *, 4> params;
-  unsigned long numVecParams =
-      std::count(arg_types.begin(), arg_types.end(), BATCH_TYPE::VECTOR);
-
-  for (unsigned i = 0; i < orig_FTy->getNumParams(); ++i) {
-    if (arg_types[i] == BATCH_TYPE::VECTOR) {
-      Type *ty = GradientUtils::getShadowType(orig_FTy->getParamType(i), width);
-      params.push_back(ty);
-    } else {
-      params.push_back(orig_FTy->getParamType(i));
-    }
-  }
-
-  Type *NewTy = GradientUtils::getShadowType(tobatch->getReturnType(), width);
-
-  FunctionType *FTy = FunctionType::get(NewTy, params, tobatch->isVarArg());
-  Function *NewF =
-      Function::Create(FTy, tobatch->getLinkage(),
-                       "batch_" + tobatch->getName(), tobatch->getParent());
-
-  NewF->setLinkage(Function::LinkageTypes::InternalLinkage);
-
-  ValueToValueMapTy originalToNewFn;
-
-  // Create placeholder for the old arguments
-  BasicBlock *placeholderBB =
-      BasicBlock::Create(NewF->getContext(), "placeholders", NewF);
-
-  IRBuilder<> PlaceholderBuilder(placeholderBB);
-  PlaceholderBuilder.SetCurrentDebugLocation(DebugLoc());
-  ValueToValueMapTy vmap;
-  auto DestArg = NewF->arg_begin();
-  auto SrcArg = tobatch->arg_begin();
-
-  for (unsigned i = 0; i < orig_FTy->getNumParams(); ++i) {
-    Argument *arg = SrcArg;
-    if (arg_types[i] == BATCH_TYPE::VECTOR) {
-      auto placeholder = PlaceholderBuilder.CreatePHI(
-          arg->getType(), 0, "placeholder." + arg->getName());
-      vmap[arg] = placeholder;
-    } else {
-      vmap[arg] = DestArg;
-    }
-    DestArg->setName(arg->getName());
-    DestArg++;
-    SrcArg++;
-  }
-
-  SmallVector<ReturnInst *, 4> Returns;
-#if LLVM_VERSION_MAJOR >= 13
-  CloneFunctionInto(NewF, tobatch, vmap,
-                    CloneFunctionChangeType::LocalChangesOnly, Returns, "",
-                    nullptr);
-#else
-  CloneFunctionInto(NewF, tobatch, vmap, true, Returns, "", nullptr);
-#endif
-
-  NewF->setLinkage(Function::LinkageTypes::InternalLinkage);
-
-  // find instructions to vectorize (going up / overestimation)
-  SmallPtrSet<Value *, 32> toVectorize;
+/// Collect the arguments and instructions of tobatch that may hold a
+/// different value in each lane (going up / overestimation).
+static void findBatchedValues(Function *tobatch, ArrayRef<BATCH_TYPE> arg_types,
+                              BATCH_TYPE ret_type,
+                              SmallPtrSetImpl<Value *> &toVectorize) {
   SetVector<llvm::Value *, std::deque<llvm::Value *>> refinelist;
 
   for (unsigned i = 0; i < tobatch->getFunctionType()->getNumParams(); i++) {
@@ -4584,6 +4686,13 @@ llvm::Function *EnzymeLogic::CreateBatch(Function *tobatch, unsigned width,
     }
 
     if (auto call_inst = dyn_cast<CallInst>(todo)) {
+      // Whether any lane of a mask is set is the same for all lanes.
+      if (isBatchAny(call_inst)) {
+        if (toVectorize.erase(todo))
+          for (auto user : call_inst->users())
+            refinelist.insert(user);
+        continue;
+      }
       if (call_inst->getFunctionType()->isVoidTy() &&
           call_inst->getFunctionType()->getNumParams() == 0)
         toVectorize.erase(todo);
@@ -4630,6 +4739,114 @@ llvm::Function *EnzymeLogic::CreateBatch(Function *tobatch, unsigned width,
             refinelist.insert(user);
     }
   }
+}
+
+llvm::Function *EnzymeLogic::CreateBatch(Function *tobatch, unsigned width,
+                                         ArrayRef<BATCH_TYPE> arg_types,
+                                         BATCH_TYPE ret_type,
+                                         ArrayRef<uint64_t> arg_strides) {
+
+  BatchCacheKey tup =
+      std::make_tuple(tobatch, width, arg_types, ret_type, arg_strides);
+  if (BatchCachedFunctions.find(tup) != BatchCachedFunctions.end()) {
+    return BatchCachedFunctions.find(tup)->second;
+  }
+
+  SmallPtrSet<Value *, 32> toVectorize;
+  findBatchedValues(tobatch, arg_types, ret_type, toVectorize);
+
+  // Branches on batched values are masked in a copy of the function, which
+  // is batched in its place.
+  if (hasDivergentControlFlow(*tobatch, toVectorize)) {
+    ValueToValueMapTy VMap;
+    Function *masked = CloneFunction(tobatch, VMap);
+    masked->setName(tobatch->getName() + ".masked");
+    masked->setLinkage(Function::LinkageTypes::InternalLinkage);
+    SmallPtrSet<Value *, 32> divergent;
+    for (auto val : toVectorize)
+      divergent.insert(VMap[val]);
+
+    // Selects joining masked paths may make further branches divergent.
+    bool legal = true;
+    while (legal && hasDivergentControlFlow(*masked, divergent)) {
+      legal = maskDivergentControlFlow(*masked, divergent);
+      divergent.clear();
+      findBatchedValues(masked, arg_types, ret_type, divergent);
+    }
+
+    Function *NewF = nullptr;
+    if (legal) {
+      NewF = CreateBatch(masked, width, arg_types, ret_type, arg_strides);
+      NewF->setName("batch_" + tobatch->getName());
+    }
+    Module *M = tobatch->getParent();
+    masked->eraseFromParent();
+    if (auto any = M->getFunction(BatchAnyName))
+      if (any->use_empty())
+        any->eraseFromParent();
+    if (NewF)
+      return NewF;
+  }
+
+  FunctionType *orig_FTy = tobatch->getFunctionType();
+  SmallVector<Type *, 4> params;
+  unsigned long numVecParams =
+      std::count(arg_types.begin(), arg_types.end(), BATCH_TYPE::VECTOR);
+
+  for (unsigned i = 0; i < orig_FTy->getNumParams(); ++i) {
+    if (arg_types[i] == BATCH_TYPE::VECTOR) {
+      Type *ty = GradientUtils::getShadowType(orig_FTy->getParamType(i), width);
+      params.push_back(ty);
+    } else {
+      params.push_back(orig_FTy->getParamType(i));
+    }
+  }
+
+  Type *NewTy = GradientUtils::getShadowType(tobatch->getReturnType(), width);
+
+  FunctionType *FTy = FunctionType::get(NewTy, params, tobatch->isVarArg());
+  Function *NewF =
+      Function::Create(FTy, tobatch->getLinkage(),
+                       "batch_" + tobatch->getName(), tobatch->getParent());
+
+  NewF->setLinkage(Function::LinkageTypes::InternalLinkage);
+
+  ValueToValueMapTy originalToNewFn;
+
+  // Create placeholder for the old arguments
+  BasicBlock *placeholderBB =
+      BasicBlock::Create(NewF->getContext(), "placeholders", NewF);
+
+  IRBuilder<> PlaceholderBuilder(placeholderBB);
+  PlaceholderBuilder.SetCurrentDebugLocation(DebugLoc());
+  ValueToValueMapTy vmap;
+  auto DestArg = NewF->arg_begin();
+  auto SrcArg = tobatch->arg_begin();
+
+  for (unsigned i = 0; i < orig_FTy->getNumParams(); ++i) {
+    Argument *arg = SrcArg;
+    if (arg_types[i] == BATCH_TYPE::VECTOR) {
+      auto placeholder = PlaceholderBuilder.CreatePHI(
+          arg->getType(), 0, "placeholder." + arg->getName());
+      vmap[arg] = placeholder;
+    } else {
+      vmap[arg] = DestArg;
+    }
+    DestArg->setName(arg->getName());
+    DestArg++;
+    SrcArg++;
+  }
+
+  SmallVector<ReturnInst *, 4> Returns;
+#if LLVM_VERSION_MAJOR >= 13
+  CloneFunctionInto(NewF, tobatch, vmap,
+                    CloneFunctionChangeType::LocalChangesOnly, Returns, "",
+                    nullptr);
+#else
+  CloneFunctionInto(NewF, tobatch, vmap, true, Returns, "", nullptr);
+#endif
+
+  NewF->setLinkage(Function::LinkageTypes::InternalLinkage);
 
   // unwrap arguments
   ValueMap<const Value *, std::vector<Value *>> vectorizedValues;
@@ -4685,6 +4902,33 @@ llvm::Function *EnzymeLogic::CreateBatch(Function *tobatch, unsigned width,
     }
   }
 
+  // The lanes of a buffer argument are recomputed from its first lane, which
+  // lets the batcher recognise accesses to consecutive lanes.
+  for (unsigned i = 0; i < arg_strides.size(); ++i) {
+    Argument *orig_arg = tobatch->arg_begin() + i;
+    if (width < 2 || arg_strides[i] == 0 ||
+        arg_types[i] != BATCH_TYPE::VECTOR ||
+        !orig_arg->getType()->isPointerTy())
+      continue;
+    auto &lanes = vectorizedValues[orig_arg];
+    IRBuilder<> Builder2(cast<Instruction>(lanes[width - 1])->getNextNode());
+    Builder2.SetCurrentDebugLocation(DebugLoc());
+    Type *i8 = Type::getInt8Ty(NewF->getContext());
+    Value *base = Builder2.CreatePointerCast(
+        lanes[0],
+        PointerType::get(i8, orig_arg->getType()->getPointerAddressSpace()));
+    for (unsigned j = 1; j < width; ++j) {
+      Value *lane = Builder2.CreateInBoundsGEP(
+          i8, base, ConstantInt::get(Type::getInt64Ty(NewF->getContext()),
+                                     j * arg_strides[i]));
+      lane = Builder2.CreatePointerCast(lane, orig_arg->getType());
+      cast<Instruction>(lanes[j])->eraseFromParent();
+      lanes[j] = lane;
+      if (orig_arg->hasName())
+        lane->setName("unwrap." + orig_arg->getName() + Twine(j));
+    }
+  }
+
   // create placeholders for vector instructions 1..<n
   for (BasicBlock &BB : *tobatch) {
     for (Instruction &I : BB) {
@@ -4714,10 +4958,19 @@ llvm::Function *EnzymeLogic::CreateBatch(Function *tobatch, unsigned width,
       new InstructionBatcher(tobatch, NewF, width, vectorizedValues,
                              originalToNewFn, toVectorize, *this);
 
-  for (auto val : toVectorize) {
-    if (auto inst = dyn_cast<Instruction>(val))
-      batcher->visit(inst);
-  }
+  // Visit in program order, so that the batcher sees the final lanes of the
+  // operands defined earlier.
+  for (BasicBlock &BB : *tobatch)
+    for (Instruction &I : BB)
+      if (toVectorize.count(&I) != 0)
+        batcher->visit(&I);
+
+  for (auto &BB : *tobatch)
+    for (auto &I : BB)
+      if (isBatchAny(&I))
+        batcher->visitBatchAny(cast<CallInst>(I));
+
+  batcher->finalize();
 
   if (llvm::verifyFunction(*NewF, &llvm::errs())) {
     llvm::errs() << *tobatch << "\n";
@@ -4734,4 +4987,7 @@ void EnzymeLogic::clear() {
   PPC.clear();
   AugmentedCachedFunctions.clear();
   ReverseCachedFunctions.clear();
+  AugmentedCacheStats = CacheStatistics();
+  ReverseCacheStats = CacheStatistics();
+  ForwardCacheStats = CacheStatistics();
 }
@@ -32,6 +32,7 @@
 
 #include <algorithm>
 #include <set>
+#include <unordered_map>
 #include <utility>
 
 #include "SCEV/ScalarEvolutionExpander.h"
@@ -44,6 +45,7 @@
 
 #include "llvm/Analysis/AliasAnalysis.h"
 
+#include "llvm/ADT/Hashing.h"
 #include "llvm/ADT/SmallVector.h"
 
 #include "ActivityAnalysis.h"
@@ -75,7 +77,7 @@ static inline llvm::raw_ostream &operator<<(llvm::raw_ostream &o,
   return o << str(c);
 }
 
-enum class CacheType { Self, Shadow, Tape };
+enum class CacheType { Self, Shadow, Tape, Allocator };
 
 static inline std::string str(CacheType c) {
   switch (c) {
@@ -85,6 +87,8 @@ static inline std::string str(CacheType c) {
     return "shadow";
   case CacheType::Tape:
     return "tape";
+  case CacheType::Allocator:
+    return "allocator";
   default:
     llvm_unreachable("unknown cache type");
   }
@@ -117,6 +121,10 @@ public:
 
   std::set<ssize_t> tapeIndiciesToFree;
 
+  //! Chunks of the loop caches on the tape allocated through the cache
+  //! runtime, by tape index
+  std::map<int, std::set<int>> instrumentedTapeCaches;
+
   bool isComplete;
 
   AugmentedReturn(
@@ -131,6 +139,25 @@ public:
         can_modref_map(can_modref_map), isComplete(false) {}
 };
 
+static inline llvm::hash_code
+hashUncacheableArgs(const std::map<llvm::Argument *, bool> &uncacheable_args) {
+  llvm::hash_code H = llvm::hash_value(uncacheable_args.size());
+  for (auto &pair : uncacheable_args)
+    H = llvm::hash_combine(H, pair.first, pair.second);
+  return H;
+}
+
+/// Hash functor for the derivative caches. A key's hash is computed once and
+/// kept in the key, so that the repeated lookups of one derivative only
+/// compare keys for equality.
+struct CacheKeyHash {
+  template <typename K> size_t operator()(const K &key) const {
+    if (key.hash == 0)
+      key.hash = key.computeHash();
+    return key.hash;
+  }
+};
+
 struct ReverseCacheKey {
   llvm::Function *todiff;
   DIFFE_TYPE retType;
@@ -145,94 +172,26 @@ struct ReverseCacheKey {
   llvm::Type *additionalType;
   const FnTypeInfo typeInfo;
 
-  /*
-  inline bool operator==(const ReverseCacheKey& rhs) const {
-      return todiff == rhs.todiff &&
-             retType == rhs.retType &&
-             constant_args == rhs.constant_args &&
-             uncacheable_args == rhs.uncacheable_args &&
-             returnUsed == rhs.returnUsed &&
-             shadowReturnUsed == rhs.shadowReturnUsed &&
-             mode == rhs.mode &&
-             freeMemory == rhs.freeMemory &&
-             AtomicAdd == rhs.AtomicAdd &&
-             additionalType == rhs.additionalType &&
-             typeInfo == rhs.typeInfo;
+  /// Hash of this key, computed on the first lookup
+  mutable size_t hash = 0;
+
+  inline bool operator==(const ReverseCacheKey &rhs) const {
+    return todiff == rhs.todiff && retType == rhs.retType &&
+           constant_args == rhs.constant_args &&
+           uncacheable_args == rhs.uncacheable_args &&
+           returnUsed == rhs.returnUsed &&
+           shadowReturnUsed == rhs.shadowReturnUsed && mode == rhs.mode &&
+           width == rhs.width && freeMemory == rhs.freeMemory &&
+           AtomicAdd == rhs.AtomicAdd && additionalType == rhs.additionalType &&
+           typeInfo == rhs.typeInfo;
   }
-  */
-
-  inline bool operator<(const ReverseCacheKey &rhs) const {
-    if (todiff < rhs.todiff)
-      return true;
-    if (rhs.todiff < todiff)
-      return false;
-
-    if (retType < rhs.retType)
-      return true;
-    if (rhs.retType < retType)
-      return false;
-
-    if (std::lexicographical_compare(constant_args.begin(), constant_args.end(),
-                                     rhs.constant_args.begin(),
-                                     rhs.constant_args.end()))
-      return true;
-    if (std::lexicographical_compare(
-            rhs.constant_args.begin(), rhs.constant_args.end(),
-            constant_args.begin(), constant_args.end()))
-      return false;
-
-    for (auto &arg : todiff->args()) {
-      auto foundLHS = uncacheable_args.find(&arg);
-      assert(foundLHS != uncacheable_args.end());
-      auto foundRHS = rhs.uncacheable_args.find(&arg);
-      assert(foundRHS != rhs.uncacheable_args.end());
-      if (foundLHS->second < foundRHS->second)
-        return true;
-      if (foundRHS->second < foundLHS->second)
-        return false;
-    }
 
-    if (returnUsed < rhs.returnUsed)
-      return true;
-    if (rhs.returnUsed < returnUsed)
-      return false;
-
-    if (shadowReturnUsed < rhs.shadowReturnUsed)
-      return true;
-    if (rhs.shadowReturnUsed < shadowReturnUsed)
-      return false;
-
-    if (mode < rhs.mode)
-      return true;
-    if (rhs.mode < mode)
-      return false;
-
-    if (width < rhs.width)
-      return true;
-    if (rhs.width < width)
-      return false;
-
-    if (freeMemory < rhs.freeMemory)
-      return true;
-    if (rhs.freeMemory < freeMemory)
-      return false;
-
-    if (AtomicAdd < rhs.AtomicAdd)
-      return true;
-    if (rhs.AtomicAdd < AtomicAdd)
-      return false;
-
-    if (additionalType < rhs.additionalType)
-      return true;
-    if (rhs.additionalType < additionalType)
-      return false;
-
-    if (typeInfo < rhs.typeInfo)
-      return true;
-    if (rhs.typeInfo < typeInfo)
-      return false;
-    // equal
-    return false;
+  llvm::hash_code computeHash() const {
+    return llvm::hash_combine(
+        todiff, retType,
+        llvm::hash_combine_range(constant_args.begin(), constant_args.end()),
+        hashUncacheableArgs(uncacheable_args), returnUsed, shadowReturnUsed,
+        mode, width, freeMemory, AtomicAdd, additionalType, typeInfo);
   }
 };
 
@@ -246,6 +205,18 @@ public:
 
   EnzymeLogic(bool PostOpt) : PostOpt(PostOpt) {}
 
+  /// Lookups in one of the derivative caches since this EnzymeLogic was
+  /// created or last cleared. Derivatives reloaded from the persistent cache are misses of
+  /// the in-memory cache which are also counted as PersistentHits.
+  struct CacheStatistics {
+    uint64_t Hits = 0;
+    uint64_t Misses = 0;
+    uint64_t PersistentHits = 0;
+  };
+  CacheStatistics AugmentedCacheStats;
+  CacheStatistics ReverseCacheStats;
+  CacheStatistics ForwardCacheStats;
+
   struct AugmentedCacheKey {
     llvm::Function *fn;
     DIFFE_TYPE retType;
@@ -259,78 +230,31 @@ public:
     bool omp;
     unsigned width;
 
-    inline bool operator<(const AugmentedCacheKey &rhs) const {
-      if (fn < rhs.fn)
-        return true;
-      if (rhs.fn < fn)
-        return false;
-
-      if (retType < rhs.retType)
-        return true;
-      if (rhs.retType < retType)
-        return false;
-
-      if (std::lexicographical_compare(
-              constant_args.begin(), constant_args.end(),
-              rhs.constant_args.begin(), rhs.constant_args.end()))
-        return true;
-      if (std::lexicographical_compare(
-              rhs.constant_args.begin(), rhs.constant_args.end(),
-              constant_args.begin(), constant_args.end()))
-        return false;
-
-      for (auto &arg : fn->args()) {
-        auto foundLHS = uncacheable_args.find(&arg);
-        assert(foundLHS != uncacheable_args.end());
-        auto foundRHS = rhs.uncacheable_args.find(&arg);
-        assert(foundRHS != rhs.uncacheable_args.end());
-        if (foundLHS->second < foundRHS->second)
-          return true;
-        if (foundRHS->second < foundLHS->second)
-          return false;
-      }
-
-      if (returnUsed < rhs.returnUsed)
-        return true;
-      if (rhs.returnUsed < returnUsed)
-        return false;
-
-      if (shadowReturnUsed < rhs.shadowReturnUsed)
-        return true;
-      if (rhs.shadowReturnUsed < shadowReturnUsed)
-        return false;
-
-      if (freeMemory < rhs.freeMemory)
-        return true;
-      if (rhs.freeMemory < freeMemory)
-        return false;
-
-      if (AtomicAdd < rhs.AtomicAdd)
-        return true;
-      if (rhs.AtomicAdd < AtomicAdd)
-        return false;
-
-      if (omp < rhs.omp)
-        return true;
-      if (rhs.omp < omp)
-        return false;
-
-      if (typeInfo < rhs.typeInfo)
-        return true;
-      if (rhs.typeInfo < typeInfo)
-        return false;
-
-      if (width < rhs.width)
-        return true;
-      if (rhs.width < width)
-        return false;
-
-      // equal
-      return false;
+    /// Hash of this key, computed on the first lookup
+    mutable size_t hash = 0;
+
+    inline bool operator==(const AugmentedCacheKey &rhs) const {
+      return fn == rhs.fn && retType == rhs.retType &&
+             constant_args == rhs.constant_args &&
+             uncacheable_args == rhs.uncacheable_args &&
+             returnUsed == rhs.returnUsed &&
+             shadowReturnUsed == rhs.shadowReturnUsed &&
+             typeInfo == rhs.typeInfo && freeMemory == rhs.freeMemory &&
+             AtomicAdd == rhs.AtomicAdd && omp == rhs.omp &&
+             width == rhs.width;
+    }
+
+    llvm::hash_code computeHash() const {
+      return llvm::hash_combine(
+          fn, retType,
+          llvm::hash_combine_range(constant_args.begin(), constant_args.end()),
+          hashUncacheableArgs(uncacheable_args), returnUsed, shadowReturnUsed,
+          typeInfo, freeMemory, AtomicAdd, omp, width);
     }
   };
 
-  std::map<AugmentedCacheKey, AugmentedReturn> AugmentedCachedFunctions;
+  std::unordered_map<AugmentedCacheKey, AugmentedReturn, CacheKeyHash>
+      AugmentedCachedFunctions;
 
   /// Create an augmented forward pass.
   ///  \p todiff is the function to differentiate
@@ -351,7 +275,8 @@ public:
       bool forceAnonymousTape, unsigned width, bool AtomicAdd,
       bool omp = false);
 
-  std::map<ReverseCacheKey, llvm::Function *> ReverseCachedFunctions;
+  std::unordered_map<ReverseCacheKey, llvm::Function *, CacheKeyHash>
+      ReverseCachedFunctions;
 
   struct ForwardCacheKey {
     llvm::Function *todiff;
@@ -364,68 +289,33 @@ public:
     llvm::Type *additionalType;
     const FnTypeInfo typeInfo;
 
-    inline bool operator<(const ForwardCacheKey &rhs) const {
-      if (todiff < rhs.todiff)
-        return true;
-      if (rhs.todiff < todiff)
-        return false;
-
-      if (retType < rhs.retType)
-        return true;
-      if (rhs.retType < retType)
-        return false;
-
-      if (std::lexicographical_compare(
-              constant_args.begin(), constant_args.end(),
-              rhs.constant_args.begin(), rhs.constant_args.end()))
-        return true;
-      if (std::lexicographical_compare(
-              rhs.constant_args.begin(), rhs.constant_args.end(),
-              constant_args.begin(), constant_args.end()))
-        return false;
-
-      for (auto &arg : todiff->args()) {
-        auto foundLHS = uncacheable_args.find(&arg);
-        auto foundRHS = rhs.uncacheable_args.find(&arg);
-        if (foundLHS->second < foundRHS->second)
-          return true;
-        if (foundRHS->second < foundLHS->second)
-          return false;
-      }
-
-      if (returnUsed < rhs.returnUsed)
-        return true;
-      if (rhs.returnUsed < returnUsed)
-        return false;
-
-      if (mode < rhs.mode)
-        return true;
-      if (rhs.mode < mode)
-        return false;
-
-      if (width < rhs.width)
-        return true;
-      if (rhs.width < width)
-        return false;
-
-      if (additionalType < rhs.additionalType)
-        return true;
-      if (rhs.additionalType < additionalType)
-        return false;
-
-      if (typeInfo < rhs.typeInfo)
-        return true;
-      if (rhs.typeInfo < typeInfo)
-        return false;
-      // equal
-      return false;
+    /// Hash of this key, computed on the first lookup
+    mutable size_t hash = 0;
+
+    inline bool operator==(const ForwardCacheKey &rhs) const {
+      return todiff == rhs.todiff && retType == rhs.retType &&
+             constant_args == rhs.constant_args &&
+             uncacheable_args == rhs.uncacheable_args &&
+             returnUsed == rhs.returnUsed && mode == rhs.mode &&
+             width == rhs.width && additionalType == rhs.additionalType &&
+             typeInfo == rhs.typeInfo;
+    }
+
+    llvm::hash_code computeHash() const {
+      return llvm::hash_combine(
+          todiff, retType,
+          llvm::hash_combine_range(constant_args.begin(), constant_args.end()),
+          hashUncacheableArgs(uncacheable_args), returnUsed, mode, width,
+          additionalType, typeInfo);
     }
   };
 
-  std::map<ForwardCacheKey, llvm::Function *> ForwardCachedFunctions;
+  std::unordered_map<ForwardCacheKey, llvm::Function *, CacheKeyHash>
+      ForwardCachedFunctions;
 
-  using BatchCacheKey = std::tuple<llvm::Function *, unsigned,
-                                   std::vector<BATCH_TYPE>, BATCH_TYPE>;
+  using BatchCacheKey =
+      std::tuple<llvm::Function *, unsigned, std::vector<BATCH_TYPE>,
+                 BATCH_TYPE, std::vector<uint64_t>>;
   std::map<BatchCacheKey, llvm::Function *> BatchCachedFunctions;
 
   /// Create the derivative function itself.
@@ -455,9 +345,14 @@ public:
                     const std::map<llvm::Argument *, bool> _uncacheable_args,
                     const AugmentedReturn *augmented, bool omp = false);
 
+  /// Create a function computing \p width calls of \p tobatch at once.
+  ///  \p arg_types is whether each argument differs between the calls
+  ///  \p arg_strides is, for batched pointer arguments whose lanes are a
+  ///  fixed number of bytes apart (enzyme_buffer), that distance, or 0
   llvm::Function *CreateBatch(llvm::Function *tobatch, unsigned width,
                               llvm::ArrayRef<BATCH_TYPE> arg_types,
-                              BATCH_TYPE ret_type);
+                              BATCH_TYPE ret_type,
+                              llvm::ArrayRef<uint64_t> arg_strides = {});
 
   void clear();
 };
@@ -465,6 +360,9 @@ public:
 extern "C" {
 extern llvm::cl::opt<bool> looseTypeAnalysis;
 extern llvm::cl::opt<bool> nonmarkedglobals_inactiveloads;
+/// Lower lane-wise instructions of __enzyme_batch to <width x T> vector
+/// instructions rather than replicating them per lane.
+extern llvm::cl::opt<bool> EnzymeBatchVectorize;
 };
 
 class GradientUtils;
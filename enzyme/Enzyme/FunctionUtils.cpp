@@ -27,6 +27,7 @@
 #include "EnzymeLogic.h"
 #include "GradientUtils.h"
 #include "LibraryFuncs.h"
+#include "TimeReport.h"
 
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/DebugInfoMetadata.h"
@@ -133,7 +134,7 @@ cl::opt<bool> EnzymeCoalese("enzyme-coalese", cl::init(false), cl::Hidden,
                             cl::desc("Whether to coalese memory allocations"));
 
 #if LLVM_VERSION_MAJOR >= 8
-static cl::opt<bool> EnzymePHIRestructure(
+cl::opt<bool> EnzymePHIRestructure(
     "enzyme-phi-restructure", cl::init(false), cl::Hidden,
     cl::desc("Whether to restructure phi's to have better unwrap behavior"));
 #endif
@@ -412,9 +413,12 @@ UpgradeAllocasToMallocs(Function *NewF, DerivativeMode mode,
     auto i64 = Type::getInt64Ty(NewF->getContext());
     IRBuilder<> B(insertBefore);
     CallInst *CI = nullptr;
+    // The promoted allocation is differentiated like any other malloc, so it
+    // must not be redirected into an enzyme_workspace
     auto rep = CreateAllocation(B, AI->getAllocatedType(),
                                 B.CreateZExtOrTrunc(AI->getArraySize(), i64),
-                                nam, &CI);
+                                nam, &CI, /*ZeroMem*/ nullptr,
+                                /*isDefault*/ false, /*Workspace*/ false);
 #if LLVM_VERSION_MAJOR > 10
     auto align = AI->getAlign().value();
 #else
@@ -1093,6 +1097,23 @@ void RemoveRedundantPHI(Function *F, FunctionAnalysisManager &FAM) {
   }
 }
 
+/// Give a name to every unnamed argument, block and value of F
+static void nameInstructions(Function *F) {
+  for (auto &Arg : F->args()) {
+    if (!Arg.hasName())
+      Arg.setName("arg");
+  }
+  for (BasicBlock &BB : *F) {
+    if (!BB.hasName())
+      BB.setName("bb");
+
+    for (Instruction &I : BB) {
+      if (!I.hasName() && !I.getType()->isVoidTy())
+        I.setName("i");
+    }
+  }
+}
+
 PreProcessCache::PreProcessCache() {
   MAM.registerPass([&] { return FunctionAnalysisManagerModuleProxy(FAM); });
   FAM.registerPass([&] { return ModuleAnalysisManagerFunctionProxy(MAM); });
@@ -1190,6 +1211,7 @@ void setFullWillReturn(Function *NewF) {
 
 Function *PreProcessCache::preprocessForClone(Function *F,
                                               DerivativeMode mode) {
+  EnzymeTimeRegion timer(EnzymePhase::Preprocess);
 
   if (mode == DerivativeMode::ReverseModeGradient)
     mode = DerivativeMode::ReverseModePrimal;
@@ -1198,11 +1220,22 @@ Function *PreProcessCache::preprocessForClone(Function *F,
 
   // If we've already processed this, return the previous version
   // and derive aliasing information
-  if (cache.find(std::make_pair(F, mode)) != cache.end()) {
-    Function *NewF = cache[std::make_pair(F, mode)];
-    return NewF;
-  }
+  auto found = cache.find(std::make_pair(F, mode));
+  if (found != cache.end())
+    return found->second;
+
+  // The preprocessing pipeline does not depend on the mode and is run once,
+  // its result being the clone used in forward mode. Reverse modes use a copy
+  // of it with their own changes applied.
+  found = cache.find(std::make_pair(F, DerivativeMode::ForwardMode));
+  Function *Canonical =
+      found != cache.end() ? found->second : preprocessCanonical(F);
+  if (mode == DerivativeMode::ForwardMode)
+    return Canonical;
+  return specializeForMode(Canonical, F, mode);
+}
 
+Function *PreProcessCache::preprocessCanonical(Function *F) {
   Function *NewF =
       Function::Create(F->getFunctionType(), F->getLinkage(),
                        "preprocess_" + F->getName(), F->getParent());
@@ -1685,15 +1718,6 @@ Function *PreProcessCache::preprocessForClone(Function *F,
 
   ReplaceReallocs(NewF);
 
-  if (mode == DerivativeMode::ReverseModePrimal ||
-      mode == DerivativeMode::ReverseModeGradient ||
-      mode == DerivativeMode::ReverseModeCombined) {
-    // For subfunction calls upgrade stack allocations to mallocs
-    // to ensure availability in the reverse pass
-    auto unreachable = getGuaranteedUnreachable(NewF);
-    UpgradeAllocasToMallocs(NewF, mode, unreachable);
-  }
-
   CanonicalizeLoops(NewF, FAM);
   RemoveRedundantPHI(NewF, FAM);
 
@@ -1735,21 +1759,8 @@ Function *PreProcessCache::preprocessForClone(Function *F,
 #endif
     FAM.invalidate(*NewF, PA);
 
-    if (EnzymeNameInstructions) {
-      for (auto &Arg : NewF->args()) {
-        if (!Arg.hasName())
-          Arg.setName("arg");
-      }
-      for (BasicBlock &BB : *NewF) {
-        if (!BB.hasName())
-          BB.setName("bb");
-
-        for (Instruction &I : BB) {
-          if (!I.hasName() && !I.getType()->isVoidTy())
-            I.setName("i");
-        }
-      }
-    }
+    if (EnzymeNameInstructions)
+      nameInstructions(NewF);
   }
 
 #if LLVM_VERSION_MAJOR >= 8
@@ -1876,6 +1887,60 @@ Function *PreProcessCache::preprocessForClone(Function *F,
   }
 #endif
 
+  if (EnzymePrint)
+    llvm::errs() << "after simplification :\n" << *NewF << "\n";
+
+  if (llvm::verifyFunction(*NewF, &llvm::errs())) {
+    llvm::errs() << *NewF << "\n";
+    report_fatal_error("function failed verification (1)");
+  }
+  cache[std::make_pair(F, DerivativeMode::ForwardMode)] = NewF;
+  return NewF;
+}
+
+Function *PreProcessCache::specializeForMode(Function *Canonical, Function *F,
+                                             DerivativeMode mode) {
+  assert(mode == DerivativeMode::ReverseModePrimal ||
+         mode == DerivativeMode::ReverseModeCombined);
+
+  // Distinct names avoid renaming, which would shift the suffixes given to
+  // later globals
+  Function *NewF = Function::Create(
+      Canonical->getFunctionType(), Canonical->getLinkage(),
+      Canonical->getName() + (mode == DerivativeMode::ReverseModePrimal
+                                  ? "_primal"
+                                  : "_combined"),
+      F->getParent());
+
+  ValueToValueMapTy VMap;
+  for (auto i = Canonical->arg_begin(), j = NewF->arg_begin();
+       i != Canonical->arg_end(); ++i, ++j) {
+    VMap[i] = j;
+    j->setName(i->getName());
+  }
+
+  SmallVector<ReturnInst *, 4> Returns;
+#if LLVM_VERSION_MAJOR >= 13
+  CloneFunctionInto(
+      NewF, Canonical, VMap,
+      /*ModuleLevelChanges*/ CloneFunctionChangeType::LocalChangesOnly, Returns,
+      "", nullptr);
+#else
+  CloneFunctionInto(NewF, Canonical, VMap,
+                    /*ModuleLevelChanges*/ Canonical->getSubprogram() != nullptr,
+                    Returns, "", nullptr);
+#endif
+  CloneOrigin[NewF] = F;
+  NewF->setAttributes(Canonical->getAttributes());
+
+  // For subfunction calls upgrade stack allocations to mallocs
+  // to ensure availability in the reverse pass
+  auto unreachable = getGuaranteedUnreachable(NewF);
+  UpgradeAllocasToMallocs(NewF, mode, unreachable);
+
+  if (EnzymeNameInstructions)
+    nameInstructions(NewF);
+
   if (EnzymePrint)
     llvm::errs() << "after simplification :\n" << *NewF << "\n";
 
@@ -1897,7 +1962,7 @@ FunctionType *getFunctionTypeForClone(
     if (returnType != DIFFE_TYPE::CONSTANT &&
         returnType != DIFFE_TYPE::OUT_DIFF) {
       RetTypes.push_back(
-          GradientUtils::getShadowType(FTy->getReturnType(), width));
+          GradientUtils::getShadowType(FTy->getReturnType(), width, mode));
     } else {
       RetTypes.push_back(FTy->getReturnType());
     }
@@ -1907,7 +1972,7 @@ FunctionType *getFunctionTypeForClone(
     if (returnType != DIFFE_TYPE::CONSTANT &&
         returnType != DIFFE_TYPE::OUT_DIFF) {
       RetTypes.push_back(
-          GradientUtils::getShadowType(FTy->getReturnType(), width));
+          GradientUtils::getShadowType(FTy->getReturnType(), width, mode));
     } else {
       RetTypes.push_back(FTy->getReturnType());
     }
@@ -1922,9 +1987,9 @@ FunctionType *getFunctionTypeForClone(
     ArgTypes.push_back(I);
     if (constant_args[argno] == DIFFE_TYPE::DUP_ARG ||
         constant_args[argno] == DIFFE_TYPE::DUP_NONEED) {
-      ArgTypes.push_back(GradientUtils::getShadowType(I, width));
+      ArgTypes.push_back(GradientUtils::getShadowType(I, width, mode));
     } else if (constant_args[argno] == DIFFE_TYPE::OUT_DIFF) {
-      RetTypes.push_back(GradientUtils::getShadowType(I, width));
+      RetTypes.push_back(GradientUtils::getShadowType(I, width, mode));
     }
     ++argno;
   }
@@ -1932,7 +1997,7 @@ FunctionType *getFunctionTypeForClone(
   if (diffeReturnArg) {
     assert(!FTy->getReturnType()->isVoidTy());
     ArgTypes.push_back(
-        GradientUtils::getShadowType(FTy->getReturnType(), width));
+        GradientUtils::getShadowType(FTy->getReturnType(), width, mode));
   }
   if (additionalArg) {
     ArgTypes.push_back(additionalArg);
@@ -1946,12 +2011,12 @@ FunctionType *getFunctionTypeForClone(
     if (returnValue == ReturnType::TapeAndTwoReturns) {
       RetTypes.push_back(FTy->getReturnType());
       RetTypes.push_back(
-          GradientUtils::getShadowType(FTy->getReturnType(), width));
+          GradientUtils::getShadowType(FTy->getReturnType(), width, mode));
     } else if (returnValue == ReturnType::TapeAndReturn) {
       if (returnType != DIFFE_TYPE::CONSTANT &&
           returnType != DIFFE_TYPE::OUT_DIFF)
         RetTypes.push_back(
-            GradientUtils::getShadowType(FTy->getReturnType(), width));
+            GradientUtils::getShadowType(FTy->getReturnType(), width, mode));
       else
         RetTypes.push_back(FTy->getReturnType());
     }
@@ -2240,6 +2305,7 @@ void ReplaceFunctionImplementation(Module &M) {
 }
 
 void PreProcessCache::optimizeIntermediate(Function *F) {
+  EnzymeTimeRegion timer(EnzymePhase::PostOpt);
   PromotePass().run(*F, FAM);
 #if LLVM_VERSION_MAJOR >= 14 && !defined(FLANG)
   GVNPass().run(*F, FAM);
@@ -43,6 +43,18 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/Transforms/Utils/ValueMapper.h"
 
+extern "C" {
+extern llvm::cl::opt<bool> EnzymePreopt;
+extern llvm::cl::opt<bool> EnzymeInline;
+extern llvm::cl::opt<bool> EnzymeNoAlias;
+extern llvm::cl::opt<bool> EnzymeLowerGlobals;
+extern llvm::cl::opt<bool> EnzymeCoalese;
+#if LLVM_VERSION_MAJOR >= 8
+extern llvm::cl::opt<bool> EnzymePHIRestructure;
+#endif
+extern llvm::cl::opt<bool> EnzymeSelectOpt;
+}
+
 //;
 
 class PreProcessCache {
@@ -57,6 +69,14 @@ public:
 
   llvm::Function *preprocessForClone(llvm::Function *F, DerivativeMode mode);
 
+  /// Clone F and run the preprocessing pipeline shared by all modes on it
+  llvm::Function *preprocessCanonical(llvm::Function *F);
+
+  /// Copy Canonical, the mode-independent preprocessed clone of F, applying
+  /// the changes needed by the reverse mode \p mode
+  llvm::Function *specializeForMode(llvm::Function *Canonical,
+                                    llvm::Function *F, DerivativeMode mode);
+
   llvm::AAResults &getAAResultsFromFunction(llvm::Function *NewF);
 
   llvm::Function *CloneFunctionWithReturns(
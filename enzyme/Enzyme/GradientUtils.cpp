@@ -41,6 +41,7 @@
 #include "llvm/IR/Constants.h"
 
 #include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Analysis/VectorUtils.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/Support/AMDGPUMetadata.h"
 #include "llvm/Transforms/Utils/SimplifyIndVar.h"
@@ -105,9 +106,20 @@ llvm::cl::opt<bool>
                         cl::desc("Rematerialize allocations/shadows in the "
                                  "reverse rather than caching"));
 
+llvm::cl::opt<unsigned> EnzymePrivatizeShadows(
+    "enzyme-privatize-shadows", cl::init(0), cl::Hidden,
+    cl::desc("Accumulate the shadow of shared OpenMP arguments with a "
+             "load-only footprint up to this many bytes in a thread-private "
+             "buffer rather than with atomics (0 disables)"));
+
 llvm::cl::opt<bool>
     EnzymeVectorSplitPhi("enzyme-vector-split-phi", cl::init(true), cl::Hidden,
                          cl::desc("Split phis according to vector size"));
+
+llvm::cl::opt<bool> EnzymeVectorShadows(
+    "enzyme-vector-shadows", cl::init(false), cl::Hidden,
+    cl::desc("Represent the shadows of floating point scalars in vector mode "
+             "as vectors, computing the derivatives with vector instructions"));
 }
 
 SmallVector<unsigned int, 9> MD_ToCopy = {
@@ -119,6 +131,192 @@ SmallVector<unsigned int, 9> MD_ToCopy = {
     LLVMContext::MD_dereferenceable,
     LLVMContext::MD_dereferenceable_or_null};
 
+Value *GradientUtils::packShadowLanes(IRBuilder<> &Builder,
+                                      ArrayRef<Value *> lanes) {
+  unsigned W = lanes.size();
+  auto getVectorTy = [&](Type *ty) -> Type * {
+#if LLVM_VERSION_MAJOR >= 11
+    return FixedVectorType::get(ty, W);
+#else
+    return VectorType::get(ty, W);
+#endif
+  };
+
+  // Scalar instructions replaced by vector ones, erased once unused.
+  SmallSetVector<Instruction *, 16> folded;
+
+  // Whether lanes compute the same lane-wise operation, with operands that
+  // are used by nothing else (users are the lanes using them, if any).
+  auto combinable = [&](ArrayRef<Value *> lanes, ArrayRef<Value *> users) {
+    auto I0 = dyn_cast<Instruction>(lanes[0]);
+    if (!I0 || !VectorType::isValidElementType(I0->getType()))
+      return false;
+    if (!isa<BinaryOperator>(I0) && !isa<CastInst>(I0) && !isa<CmpInst>(I0) &&
+        !isa<SelectInst>(I0) && !isa<IntrinsicInst>(I0)
+#if LLVM_VERSION_MAJOR >= 10
+        && !isa<UnaryOperator>(I0)
+#endif
+    )
+      return false;
+    for (auto &op : I0->operands())
+      if (!VectorType::isValidElementType(op->getType()))
+        return false;
+    if (auto II = dyn_cast<IntrinsicInst>(I0)) {
+      auto ID = II->getIntrinsicID();
+      if (!isTriviallyVectorizable(ID))
+        return false;
+#if LLVM_VERSION_MAJOR >= 14
+      for (unsigned j = 0; j < II->arg_size(); ++j)
+#else
+      for (unsigned j = 0; j < II->getNumArgOperands(); ++j)
+#endif
+        if (hasVectorInstrinsicScalarOpd(ID, j))
+          return false;
+    }
+    for (unsigned i = 0; i < W; ++i) {
+      auto I = dyn_cast<Instruction>(lanes[i]);
+      if (!I || I->getOpcode() != I0->getOpcode() ||
+          I->getType() != I0->getType() ||
+          I->getNumOperands() != I0->getNumOperands())
+        return false;
+      for (unsigned j = 0; j < i; ++j)
+        if (lanes[j] == I)
+          return false;
+      if (auto Cmp = dyn_cast<CmpInst>(I))
+        if (Cmp->getPredicate() != cast<CmpInst>(I0)->getPredicate())
+          return false;
+      if (auto II = dyn_cast<IntrinsicInst>(I))
+        if (II->getCalledFunction() != cast<IntrinsicInst>(I0)->getCalledFunction())
+          return false;
+      for (User *U : I->users())
+        if (users.empty() || U != users[i])
+          return false;
+    }
+    return true;
+  };
+
+  std::function<Value *(ArrayRef<Value *>, ArrayRef<Value *>)> pack =
+      [&](ArrayRef<Value *> lanes, ArrayRef<Value *> users) -> Value * {
+    Type *vecTy = getVectorTy(lanes[0]->getType());
+
+    // Lanes read from a single vector.
+    if (auto E0 = dyn_cast<ExtractElementInst>(lanes[0])) {
+      Value *V = E0->getVectorOperand();
+      bool same = V->getType() == vecTy;
+      for (unsigned i = 0; same && i < W; ++i) {
+        auto E = dyn_cast<ExtractElementInst>(lanes[i]);
+        auto Idx = E ? dyn_cast<ConstantInt>(E->getIndexOperand()) : nullptr;
+        same = Idx && E->getVectorOperand() == V && Idx->getZExtValue() == i;
+      }
+      if (same) {
+        for (auto lane : lanes)
+          folded.insert(cast<Instruction>(lane));
+        return V;
+      }
+    }
+
+    // The same value in every lane.
+    if (llvm::all_of(lanes, [&](Value *lane) { return lane == lanes[0]; })) {
+      if (auto C = dyn_cast<Constant>(lanes[0]))
+#if LLVM_VERSION_MAJOR >= 11
+        return ConstantVector::getSplat(ElementCount::getFixed(W), C);
+#else
+        return ConstantVector::getSplat(W, C);
+#endif
+      return Builder.CreateVectorSplat(W, lanes[0]);
+    }
+
+    if (llvm::all_of(lanes, [](Value *lane) { return isa<Constant>(lane); })) {
+      SmallVector<Constant *, 4> elems;
+      for (auto lane : lanes)
+        elems.push_back(cast<Constant>(lane));
+      return ConstantVector::get(elems);
+    }
+
+    Function *vecIntrinsic = nullptr;
+    bool combine = combinable(lanes, users);
+    if (combine)
+      if (auto II = dyn_cast<IntrinsicInst>(lanes[0])) {
+        SmallVector<Type *, 4> params;
+        for (auto &op : II->args())
+          params.push_back(getVectorTy(op->getType()));
+        vecIntrinsic = Intrinsic::getDeclaration(
+            II->getModule(), II->getIntrinsicID(), {vecTy});
+        combine = vecIntrinsic->getReturnType() == vecTy &&
+                  vecIntrinsic->getFunctionType()->params() ==
+                      ArrayRef<Type *>(params);
+      }
+
+    if (!combine) {
+      Value *res = UndefValue::get(vecTy);
+      for (unsigned i = 0; i < W; ++i)
+        res = Builder.CreateInsertElement(res, lanes[i], i);
+      return res;
+    }
+
+    auto I0 = cast<Instruction>(lanes[0]);
+    auto column = [&](unsigned j) {
+      SmallVector<Value *, 4> ops;
+      for (auto lane : lanes)
+        ops.push_back(cast<Instruction>(lane)->getOperand(j));
+      return ops;
+    };
+
+    Value *vec;
+    if (auto BO = dyn_cast<BinaryOperator>(I0)) {
+      vec = Builder.CreateBinOp(BO->getOpcode(), pack(column(0), lanes),
+                                pack(column(1), lanes));
+#if LLVM_VERSION_MAJOR >= 10
+    } else if (auto UO = dyn_cast<UnaryOperator>(I0)) {
+      vec = Builder.CreateUnOp(UO->getOpcode(), pack(column(0), lanes));
+#endif
+    } else if (auto CI = dyn_cast<CastInst>(I0)) {
+      vec = Builder.CreateCast(CI->getOpcode(), pack(column(0), lanes), vecTy);
+    } else if (auto Cmp = dyn_cast<CmpInst>(I0)) {
+      Value *lhs = pack(column(0), lanes);
+      Value *rhs = pack(column(1), lanes);
+      vec = isa<FCmpInst>(Cmp) ? Builder.CreateFCmp(Cmp->getPredicate(), lhs, rhs)
+                               : Builder.CreateICmp(Cmp->getPredicate(), lhs, rhs);
+    } else if (isa<SelectInst>(I0)) {
+      // A condition shared by all lanes selects between whole vectors.
+      auto conds = column(0);
+      Value *cond =
+          llvm::all_of(conds, [&](Value *c) { return c == conds[0]; })
+              ? conds[0]
+              : pack(conds, lanes);
+      vec = Builder.CreateSelect(cond, pack(column(1), lanes),
+                                 pack(column(2), lanes));
+    } else {
+      SmallVector<Value *, 4> args;
+#if LLVM_VERSION_MAJOR >= 14
+      for (unsigned j = 0; j < cast<CallInst>(I0)->arg_size(); ++j)
+#else
+      for (unsigned j = 0; j < cast<CallInst>(I0)->getNumArgOperands(); ++j)
+#endif
+        args.push_back(pack(column(j), lanes));
+      vec = Builder.CreateCall(vecIntrinsic, args);
+    }
+
+    if (auto vecInst = dyn_cast<Instruction>(vec)) {
+      vecInst->copyIRFlags(I0);
+      for (auto lane : lanes)
+        vecInst->andIRFlags(cast<Instruction>(lane));
+      vecInst->setDebugLoc(I0->getDebugLoc());
+    }
+    for (auto lane : lanes)
+      folded.insert(cast<Instruction>(lane));
+    return vec;
+  };
+
+  Value *res = pack(lanes, {});
+
+  // Users are folded after their operands, so erase in reverse.
+  for (auto I = folded.rbegin(); I != folded.rend(); ++I)
+    if ((*I)->use_empty())
+      erase(*I);
+  return res;
+}
+
 Value *GradientUtils::unwrapM(Value *const val, IRBuilder<> &BuilderM,
                               const ValueToValueMapTy &available,
                               UnwrapMode unwrapMode, BasicBlock *scope,
@@ -1905,12 +2103,11 @@ Value *GradientUtils::cacheForReverse(IRBuilder<> &BuilderQ, Value *malloc,
 
       Type *innerType = ret->getType();
       for (size_t i = 0,
-                  limit = getSubLimits(
-                              /*inForwardPass*/ true, nullptr,
-                              LimitContext(
-                                  /*ReverseLimit*/ reverseBlocks.size() > 0,
-                                  BuilderQ.GetInsertBlock()))
-                              .size();
+                  limit = getCacheDepth(getSubLimits(
+                      /*inForwardPass*/ true, nullptr,
+                      LimitContext(
+                          /*ReverseLimit*/ reverseBlocks.size() > 0,
+                          BuilderQ.GetInsertBlock())));
            i < limit; ++i) {
         if (!isa<PointerType>(innerType)) {
           llvm::errs() << "mod: "
@@ -1953,9 +2150,13 @@ Value *GradientUtils::cacheForReverse(IRBuilder<> &BuilderQ, Value *malloc,
 
       LimitContext lctx(/*ReverseLimit*/ reverseBlocks.size() > 0,
                         BuilderQ.GetInsertBlock());
+      auto sites = InstrumentedTapeCaches.find(idx);
+      TapeCacheSites =
+          sites == InstrumentedTapeCaches.end() ? nullptr : &sites->second;
       AllocaInst *cache =
           createCacheForScope(lctx, innerType, "mdyncache_fromtape",
                               ((DiffeGradientUtils *)this)->FreeMemory, false);
+      TapeCacheSites = nullptr;
       assert(malloc);
       bool isi1 = !ignoreType && malloc->getType()->isIntegerTy() &&
                   cast<IntegerType>(malloc->getType())->getBitWidth() == 1;
@@ -2215,6 +2416,11 @@ Value *GradientUtils::cacheForReverse(IRBuilder<> &BuilderQ, Value *malloc,
     assert(found2 != scopeMap.end());
     assert(found2->second.first);
 
+    auto sites = CacheSites.find(found2->second.first);
+    if (sites != CacheSites.end())
+      for (auto &pair : sites->second)
+        InstrumentedTapeCaches[idx].insert(pair.first);
+
     Value *toadd;
     toadd = scopeAllocs[found2->second.first][0];
     for (auto u : toadd->users()) {
@@ -2228,11 +2434,10 @@ Value *GradientUtils::cacheForReverse(IRBuilder<> &BuilderQ, Value *malloc,
     Type *innerType = toadd->getType();
     for (size_t
              i = 0,
-             limit = getSubLimits(
-                         /*inForwardPass*/ true, nullptr,
-                         LimitContext(/*ReverseLimit*/ reverseBlocks.size() > 0,
-                                      BuilderQ.GetInsertBlock()))
-                         .size();
+             limit = getCacheDepth(getSubLimits(
+                 /*inForwardPass*/ true, nullptr,
+                 LimitContext(/*ReverseLimit*/ reverseBlocks.size() > 0,
+                              BuilderQ.GetInsertBlock())));
          i < limit; ++i) {
       innerType = innerType->getPointerElementType();
     }
@@ -2587,7 +2792,7 @@ BasicBlock *GradientUtils::getReverseOrLatchMerge(BasicBlock *BB,
                         Value *array =
                             UndefValue::get(getShadowType(val->getType()));
                         for (unsigned i = 0; i < getWidth(); ++i) {
-                          array = NB.CreateInsertValue(array, val, {i});
+                          array = insertMeta(NB, array, val, i);
                         }
                         valueop = array;
                       }
@@ -3599,6 +3804,179 @@ DiffeGradientUtils *DiffeGradientUtils::CreateFromClone(
   return res;
 }
 
+/// Byte footprint of a pointer argument only ever loaded from, as a single
+/// floating point type, at offsets bounded by its dereferenceable size, or 0
+/// if the argument is not of this form.
+static uint64_t privateShadowFootprint(Argument *arg, Type *&elemTy) {
+  auto &DL = arg->getParent()->getParent()->getDataLayout();
+  uint64_t deref = arg->getDereferenceableBytes();
+  if (deref == 0)
+    return 0;
+  elemTy = nullptr;
+  uint64_t footprint = 0;
+  // Pointer derived from the argument, its byte offset and, if it indexes an
+  // array at a variable position, the size of that array.
+  SmallVector<std::tuple<Value *, uint64_t, uint64_t>, 4> todo;
+  todo.emplace_back(arg, 0, 0);
+  while (todo.size()) {
+    Value *ptr;
+    uint64_t off, extent;
+    std::tie(ptr, off, extent) = todo.pop_back_val();
+    for (auto U : ptr->users()) {
+      if (isa<BitCastInst>(U) || isa<AddrSpaceCastInst>(U)) {
+        todo.emplace_back(U, off, extent);
+        continue;
+      }
+      if (auto gep = dyn_cast<GetElementPtrInst>(U)) {
+        if (extent)
+          return 0;
+        APInt ai(DL.getIndexSizeInBits(gep->getPointerAddressSpace()), 0);
+        if (gep->accumulateConstantOffset(DL, ai)) {
+          if (ai.isNegative())
+            return 0;
+          todo.emplace_back(gep, off + ai.getZExtValue(), 0);
+          continue;
+        }
+        auto idx0 = dyn_cast<ConstantInt>(gep->getOperand(1));
+        if (!gep->isInBounds() || !idx0 || !idx0->isZero() ||
+            gep->getNumIndices() != 2 ||
+            !isa<ArrayType>(gep->getSourceElementType()))
+          return 0;
+        todo.emplace_back(gep, off,
+                          DL.getTypeAllocSize(gep->getSourceElementType()));
+        continue;
+      }
+      if (auto LI = dyn_cast<LoadInst>(U)) {
+        if (!LI->isSimple() || !LI->getType()->isFloatingPointTy())
+          return 0;
+        if (elemTy && elemTy != LI->getType())
+          return 0;
+        elemTy = LI->getType();
+        uint64_t size = DL.getTypeAllocSize(elemTy);
+        if (off % size != 0 || extent % size != 0)
+          return 0;
+        footprint = std::max(footprint, off + (extent ? extent : size));
+        continue;
+      }
+      return 0;
+    }
+  }
+  if (footprint > deref)
+    return 0;
+  return footprint;
+}
+
+void DiffeGradientUtils::privatizeShadows() {
+  if (!omp || !AtomicAdd || EnzymePrivatizeShadows == 0 || getWidth() != 1)
+    return;
+  IRBuilder<> B(inversionAllocs);
+  for (auto &arg : oldFunc->args()) {
+    if (ArgDiffeTypes[arg.getArgNo()] != DIFFE_TYPE::DUP_ARG)
+      continue;
+    if (!arg.getType()->isPointerTy() ||
+        arg.getType()->getPointerAddressSpace() != 0)
+      continue;
+    Type *elemTy = nullptr;
+    uint64_t size = privateShadowFootprint(&arg, elemTy);
+    if (size == 0 || size > EnzymePrivatizeShadows)
+      continue;
+    auto found = invertedPointers.find(&arg);
+    if (found == invertedPointers.end())
+      continue;
+    Value *shared = &*found->second;
+
+    auto &DL = newFunc->getParent()->getDataLayout();
+    auto arrayTy = ArrayType::get(elemTy, size / DL.getTypeAllocSize(elemTy));
+    auto buffer = B.CreateAlloca(arrayTy, nullptr, arg.getName() + "'priv");
+#if LLVM_VERSION_MAJOR >= 10
+    buffer->setAlignment(Align(16));
+#else
+    buffer->setAlignment(16);
+#endif
+    B.CreateStore(Constant::getNullValue(arrayTy), buffer);
+    Value *priv = B.CreatePointerCast(buffer, arg.getType());
+
+    invertedPointers.erase(found);
+    invertedPointers.insert(
+        std::make_pair((const Value *)&arg, InvertedPointerVH(this, priv)));
+    privatizedShadows[&arg] = PrivateShadow{buffer, shared, elemTy, size};
+  }
+}
+
+void DiffeGradientUtils::reducePrivatizedShadows() {
+  if (privatizedShadows.empty())
+    return;
+  SmallVector<ReturnInst *, 1> rets;
+  for (auto &pair : reverseBlocks)
+    if (auto RI = dyn_cast_or_null<ReturnInst>(
+            pair.second.back()->getTerminator()))
+      rets.push_back(RI);
+
+  auto &DL = newFunc->getParent()->getDataLayout();
+  auto i64 = Type::getInt64Ty(newFunc->getContext());
+  for (auto RI : rets) {
+    for (auto &pair : privatizedShadows) {
+      auto &PS = pair.second;
+      auto elemSize = DL.getTypeAllocSize(PS.elemTy);
+      auto count = PS.size / elemSize;
+
+      // Fold the non-zero entries of the private buffer into the shared
+      // shadow, one atomic per entry rather than one per update.
+      BasicBlock *pre = RI->getParent();
+      BasicBlock *exit =
+          pre->splitBasicBlock(RI, pre->getName() + "_privend");
+      BasicBlock *header = BasicBlock::Create(
+          newFunc->getContext(), pre->getName() + "_privred", newFunc);
+      BasicBlock *add = BasicBlock::Create(
+          newFunc->getContext(), pre->getName() + "_privadd", newFunc);
+      BasicBlock *latch = BasicBlock::Create(
+          newFunc->getContext(), pre->getName() + "_privinc", newFunc);
+      pre->getTerminator()->setSuccessor(0, header);
+
+      IRBuilder<> HB(header);
+      auto idx = HB.CreatePHI(i64, 2);
+      idx->addIncoming(ConstantInt::get(i64, 0), pre);
+      Value *Idxs[] = {ConstantInt::get(i64, 0), idx};
+#if LLVM_VERSION_MAJOR > 7
+      Value *privptr =
+          HB.CreateInBoundsGEP(PS.buffer->getAllocatedType(), PS.buffer, Idxs);
+      Value *val = HB.CreateLoad(PS.elemTy, privptr);
+#else
+      Value *privptr = HB.CreateInBoundsGEP(PS.buffer, Idxs);
+      Value *val = HB.CreateLoad(privptr);
+#endif
+      HB.CreateCondBr(HB.CreateFCmpUNE(val, Constant::getNullValue(PS.elemTy)),
+                      add, latch);
+
+      IRBuilder<> AB(add);
+      Value *sharedptr =
+          AB.CreatePointerCast(PS.shared, PointerType::getUnqual(PS.elemTy));
+#if LLVM_VERSION_MAJOR > 7
+      sharedptr = AB.CreateInBoundsGEP(PS.elemTy, sharedptr, idx);
+#else
+      sharedptr = AB.CreateInBoundsGEP(sharedptr, idx);
+#endif
+#if LLVM_VERSION_MAJOR >= 13
+      AB.CreateAtomicRMW(AtomicRMWInst::FAdd, sharedptr, val,
+                         MaybeAlign(elemSize), AtomicOrdering::Monotonic,
+                         SyncScope::System);
+#elif LLVM_VERSION_MAJOR >= 9
+      AB.CreateAtomicRMW(AtomicRMWInst::FAdd, sharedptr, val,
+                         AtomicOrdering::Monotonic, SyncScope::System);
+#else
+      llvm_unreachable("privatized shadows require atomic fadd");
+#endif
+      AB.CreateBr(latch);
+
+      IRBuilder<> LB(latch);
+      auto next = LB.CreateAdd(idx, ConstantInt::get(i64, 1), "", true, true);
+      idx->addIncoming(next, latch);
+      LB.CreateCondBr(LB.CreateICmpEQ(next, ConstantInt::get(i64, count)),
+                      exit, header);
+    }
+  }
+}
+
 Constant *GradientUtils::GetOrCreateShadowConstant(
     EnzymeLogic &Logic, TargetLibraryInfo &TLI, TypeAnalysis &TA,
     Constant *oval, DerivativeMode mode, unsigned width, bool AtomicAdd) {
@@ -4780,7 +5158,9 @@ Value *GradientUtils::invertPointerM(Value *const oval, IRBuilder<> &BuilderM,
         bb.SetInsertPoint(bb.GetInsertBlock(), bb.GetInsertBlock()->begin());
       }
 
-      if (EnzymeVectorSplitPhi && width > 1) {
+      // Vector shadows are carried by a single vector phi
+      if (EnzymeVectorSplitPhi && width > 1 &&
+          !getShadowType(phi->getType())->isVectorTy()) {
         IRBuilder<> postPhi(NewV->getParent()->getFirstNonPHI());
         Type *shadowTy = getShadowType(phi->getType());
         PHINode *tmp = bb.CreatePHI(shadowTy, phi->getNumIncomingValues());
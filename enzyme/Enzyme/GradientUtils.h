@@ -97,10 +97,19 @@ extern std::map<
     customFwdCallHandlers;
 
 extern "C" {
+extern llvm::cl::opt<bool> EnzymeMinCutCache;
+extern llvm::cl::opt<bool> EnzymeLoopInvariantCache;
 extern llvm::cl::opt<bool> EnzymeRuntimeActivityCheck;
 extern llvm::cl::opt<bool> EnzymeInactiveDynamic;
 extern llvm::cl::opt<bool> EnzymeFreeInternalAllocations;
 extern llvm::cl::opt<bool> EnzymeRematerialize;
+/// Largest shadow footprint in bytes, of a shared argument to an OpenMP
+/// parallel region, accumulated into a thread-private buffer rather than
+/// with atomics (0 disables)
+extern llvm::cl::opt<unsigned> EnzymePrivatizeShadows;
+/// Represent the shadows of floating point scalars in vector mode as
+/// <width x T> vectors rather than [width x T] arrays
+extern llvm::cl::opt<bool> EnzymeVectorShadows;
 }
 extern llvm::SmallVector<unsigned int, 9> MD_ToCopy;
 
@@ -425,6 +434,17 @@ public:
     return red;
   }
 
+  bool canCoalesceCaches() const override {
+    // Caches are only stored to a tape outside of the combined mode, which
+    // requires each to be a distinct allocation
+    return mode == DerivativeMode::ReverseModeCombined && !omp;
+  }
+
+  bool canNarrowCaches() const override {
+    // A cache read back from a tape must keep the type of its values
+    return mode == DerivativeMode::ReverseModeCombined;
+  }
+
   bool assumeDynamicLoopOfSizeOne(llvm::Loop *L) const override {
     if (!EnzymeInactiveDynamic)
       return false;
@@ -1664,9 +1684,21 @@ public:
 
     LimitContext lctx(/*ReverseLimit*/ reverseBlocks.size() > 0, scope);
 
-    AllocaInst *cache =
-        createCacheForScope(lctx, inst->getType(), inst->getName(), shouldFree);
+    // Integers of a known small range, and floats when reduced precision is
+    // requested, may be stored in a narrower type
+    NarrowedCache narrowed;
+    Type *narrowTy =
+        canNarrowCaches() ? getNarrowCacheType(inst, narrowed) : nullptr;
+
+    AllocaInst *cache = createCacheForScope(
+        lctx, narrowTy ? narrowTy : inst->getType(), inst->getName(),
+        shouldFree);
     assert(cache);
+    if (narrowTy) {
+      narrowed.type = inst->getType();
+      narrowed.stored = narrowTy;
+      NarrowedCaches[cache] = narrowed;
+    }
     Value *Val = inst;
     insert_or_assign(
         scopeMap, Val,
@@ -1886,10 +1918,46 @@ public:
     }
   }
 
-  Type *getShadowType(Type *ty) { return getShadowType(ty, width); }
+  /// The shadow type of ty for a derivative in the given mode, which in
+  /// forward mode with EnzymeVectorShadows is a vector for floating point ty
+  static Type *getShadowType(Type *ty, unsigned width, DerivativeMode mode) {
+    if (width > 1 && EnzymeVectorShadows && ty->isFloatingPointTy() &&
+        (mode == DerivativeMode::ForwardMode ||
+         mode == DerivativeMode::ForwardModeSplit))
+#if LLVM_VERSION_MAJOR >= 11
+      return FixedVectorType::get(ty, width);
+#else
+      return VectorType::get(ty, width);
+#endif
+    return getShadowType(ty, width);
+  }
+
+  Type *getShadowType(Type *ty) { return getShadowType(ty, width, mode); }
+
+  /// The number of lanes of a vector mode shadow of type ty
+  static unsigned getShadowWidth(Type *ty) {
+    if (auto AT = dyn_cast<ArrayType>(ty))
+      return AT->getNumElements();
+#if LLVM_VERSION_MAJOR >= 11
+    return cast<FixedVectorType>(ty)->getNumElements();
+#else
+    return cast<VectorType>(ty)->getNumElements();
+#endif
+  }
 
   static inline Value *extractMeta(IRBuilder<> &Builder, Value *Agg,
                                    unsigned off) {
+    if (Agg->getType()->isVectorTy()) {
+      while (auto Ins = dyn_cast<InsertElementInst>(Agg)) {
+        auto Idx = dyn_cast<ConstantInt>(Ins->getOperand(2));
+        if (!Idx)
+          break;
+        if (Idx->getZExtValue() == off)
+          return Ins->getOperand(1);
+        Agg = Ins->getOperand(0);
+      }
+      return Builder.CreateExtractElement(Agg, off);
+    }
     while (auto Ins = dyn_cast<InsertValueInst>(Agg)) {
       if (Ins->getNumIndices() != 1)
         break;
@@ -1901,6 +1969,29 @@ public:
     return Builder.CreateExtractValue(Agg, {off});
   }
 
+  /// Set lane off of the vector mode shadow Agg to Val.
+  static inline Value *insertMeta(IRBuilder<> &Builder, Value *Agg, Value *Val,
+                                  unsigned off) {
+    if (Agg->getType()->isVectorTy())
+      return Builder.CreateInsertElement(Agg, Val, off);
+    return Builder.CreateInsertValue(Agg, Val, {off});
+  }
+
+  /// Combine the lanes of a shadow, computed one at a time, into a single
+  /// <width x T> value. Lanes computing the same operation on the
+  /// corresponding lanes of their operands are rebuilt as one vector
+  /// instruction, and the scalar instructions left unused are erased.
+  Value *packShadowLanes(IRBuilder<> &Builder, ArrayRef<Value *> lanes);
+
+  /// Lane off of the vector mode shadow Agg, without looking through the
+  /// instructions that built it.
+  static inline Value *extractLane(IRBuilder<> &Builder, Value *Agg,
+                                   unsigned off) {
+    if (Agg->getType()->isVectorTy())
+      return Builder.CreateExtractElement(Agg, off);
+    return Builder.CreateExtractValue(Agg, {off});
+  }
+
   /// Unwraps a vector derivative from its internal representation and applies a
   /// function f to each element. Return values of f are collected and wrapped.
   template <typename Func, typename... Args>
@@ -1912,17 +2003,22 @@ public:
 
       for (size_t i = 0; i < size; ++i)
         if (vals[i])
-          assert(cast<ArrayType>(vals[i]->getType())->getNumElements() ==
-                 width);
+          assert(getShadowWidth(vals[i]->getType()) == width);
 
-      Type *wrappedType = ArrayType::get(diffType, width);
+      Type *wrappedType = getShadowType(diffType);
       Value *res = UndefValue::get(wrappedType);
+      SmallVector<Value *, 4> lanes;
       for (unsigned int i = 0; i < getWidth(); ++i) {
         auto tup = std::tuple<Args...>{
             (args ? extractMeta(Builder, args, i) : nullptr)...};
         auto diff = std::apply(rule, std::move(tup));
-        res = Builder.CreateInsertValue(res, diff, {i});
+        if (wrappedType->isVectorTy())
+          lanes.push_back(diff);
+        else
+          res = Builder.CreateInsertValue(res, diff, {i});
       }
+      if (wrappedType->isVectorTy())
+        return packShadowLanes(Builder, lanes);
       return res;
     } else {
       return rule(args...);
@@ -1939,8 +2035,7 @@ public:
 
       for (size_t i = 0; i < size; ++i)
         if (vals[i])
-          assert(cast<ArrayType>(vals[i]->getType())->getNumElements() ==
-                 width);
+          assert(getShadowWidth(vals[i]->getType()) == width);
 
       for (unsigned int i = 0; i < getWidth(); ++i) {
         auto tup = std::tuple<Args...>{
@@ -1960,9 +2055,9 @@ public:
     if (width > 1) {
       for (auto diff : diffs) {
         assert(diff);
-        assert(cast<ArrayType>(diff->getType())->getNumElements() == width);
+        assert(getShadowWidth(diff->getType()) == width);
       }
-      Type *wrappedType = ArrayType::get(diffType, width);
+      Type *wrappedType = getShadowType(diffType);
       Value *res = UndefValue::get(wrappedType);
       for (unsigned int i = 0; i < getWidth(); ++i) {
         SmallVector<Constant *, 3> extracted_diffs;
@@ -1971,7 +2066,7 @@ public:
               cast<Constant>(extractMeta(Builder, diff, i)));
         }
         auto diff = rule(extracted_diffs);
-        res = Builder.CreateInsertValue(res, diff, {i});
+        res = insertMeta(Builder, res, diff, i);
       }
       return res;
     } else {
@@ -2012,7 +2107,20 @@ class DiffeGradientUtils final : public GradientUtils {
 public:
   // Whether to free memory in reverse pass or split forward.
   bool FreeMemory;
+  // Releases of segmented cache blocks and coalesced cache records, and the
+  // forward block whose reverse they must end
+  SmallVector<std::pair<BasicBlock *, WeakTrackingVH>, 0> deferredFrees;
   ValueMap<const Value *, TrackingVH<AllocaInst>> differentials;
+  // Shared arguments of a parallel region whose shadow is accumulated in a
+  // thread-private buffer, mapped to that buffer, the shared shadow, and the
+  // scalar type accumulated.
+  struct PrivateShadow {
+    AllocaInst *buffer;
+    Value *shared;
+    Type *elemTy;
+    uint64_t size;
+  };
+  std::map<const Value *, PrivateShadow> privatizedShadows;
   static DiffeGradientUtils *
   CreateFromClone(EnzymeLogic &Logic, DerivativeMode mode, unsigned width,
                   Function *todiff, TargetLibraryInfo &TLI, TypeAnalysis &TA,
@@ -2419,14 +2527,95 @@ public:
 #endif
 
     CallInst *ci = CreateDealloc(tbuild, forfree);
+    // Statically sized chunks are file backed, whereas segmented chunks free
+    // their table here and their blocks below
+    if (ci && EnzymeFileTape && sublimits[i].second.back().first.maxLimit)
+      RedirectToFileTape(ci);
+    if (ci && isInstrumentedCache(alloc, i))
+      InstrumentCacheDealloc(ci);
     if (ci) {
       if (newFunc->getSubprogram())
         ci->setDebugLoc(DILocation::get(newFunc->getContext(), 0, 0,
                                         newFunc->getSubprogram(), 0));
       scopeFrees[alloc].insert(ci);
+      // A coalesced record is shared by caches created after this one, whose
+      // lookups may be emitted into the same reverse block later on
+      if (CoalescedMembers.count(alloc))
+        deferredFrees.emplace_back(forwardPreheader, ci);
+    }
+
+    // The blocks of a segmented cache are each released at the end of the
+    // reverse iteration which first stored into them.
+    if (auto segment = getSegmentSize(sublimits, i)) {
+      const auto &lc = sublimits[i].second.back().first;
+      assert(reverseBlocks.find(lc.header) != reverseBlocks.end());
+      IRBuilder<> sbuild(reverseBlocks[lc.header].back());
+      if (sbuild.GetInsertBlock()->size() &&
+          sbuild.GetInsertBlock()->getTerminator())
+        sbuild.SetInsertPoint(sbuild.GetInsertBlock()->getTerminator());
+
+      ValueToValueMapTy segmap;
+      for (int j = sublimits.size() - 1; j >= i; j--) {
+        for (auto &riter : sublimits[j].second) {
+          const auto &idx = riter.first;
+          if (idx.var) {
+#if LLVM_VERSION_MAJOR > 7
+            segmap[idx.var] =
+                sbuild.CreateLoad(idx.var->getType(), idx.antivaralloc);
+#else
+            segmap[idx.var] = sbuild.CreateLoad(idx.antivaralloc);
+#endif
+          }
+        }
+      }
+      Value *metatable =
+          unwrapM(storeInto, sbuild, segmap, UnwrapMode::LegalFullUnwrap);
+#if LLVM_VERSION_MAJOR > 7
+      LoadInst *table = sbuild.CreateLoad(
+          metatable->getType()->getPointerElementType(), metatable);
+#else
+      LoadInst *table = sbuild.CreateLoad(metatable);
+#endif
+      table->setMetadata(LLVMContext::MD_invariant_group, InvariantMD);
+#if LLVM_VERSION_MAJOR >= 10
+      table->setAlignment(Align(align));
+#else
+      table->setAlignment(align);
+#endif
+      CallInst *sci =
+          CreateSegmentDealloc(sbuild, table, segmap.find(lc.var)->second,
+                               segment, EnzymeFileTape);
+      if (newFunc->getSubprogram())
+        sci->setDebugLoc(DILocation::get(newFunc->getContext(), 0, 0,
+                                         newFunc->getSubprogram(), 0));
+      scopeFrees[alloc].insert(sci);
+      deferredFrees.emplace_back(lc.header, sci);
     }
   }
 
+  /// Move each deferred release after any reverse code emitted into its
+  /// block since the release was created.
+  void placeDeferredFrees() {
+    for (auto &pair : deferredFrees) {
+      auto ci = cast_or_null<CallInst>(pair.second);
+      if (!ci)
+        continue;
+      auto term = reverseBlocks[pair.first].back()->getTerminator();
+      assert(term);
+      ci->moveBefore(term);
+    }
+    deferredFrees.clear();
+  }
+
+  /// Within an OpenMP region, redirect the shadow of shared arguments with a
+  /// small, statically bounded, load-only footprint to a zeroed
+  /// thread-private buffer so their adjoints need not be atomic.
+  void privatizeShadows();
+
+  /// Fold each thread-private shadow buffer into the shared shadow before
+  /// every return of the reverse pass.
+  void reducePrivatizedShadows();
+
 //! align is the alignment that should be specified for load/store to pointer
 #if LLVM_VERSION_MAJOR >= 10
   void addToInvertedPtrDiffe(Instruction *orig, Type *addingType,
@@ -2594,6 +2783,9 @@ public:
     // all additional parallelism in this function is outlined.
     if (backwardsOnlyShadows.find(TmpOrig) != backwardsOnlyShadows.end())
       Atomic = false;
+    // Thread-private shadows are folded into the shared one once at the end.
+    if (privatizedShadows.count(TmpOrig))
+      Atomic = false;
 
     if (Atomic) {
       // For amdgcn constant AS is 4 and if the primal is in it we need to cast
@@ -26,6 +26,8 @@
 
 #include "llvm/IR/InstVisitor.h"
 
+#include "llvm/Analysis/VectorUtils.h"
+
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/SmallVector.h"
 
@@ -33,12 +35,15 @@
 
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/IR/Value.h"
 
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/Transforms/Utils/ValueMapper.h"
 
+#include "EnzymeLogic.h"
 #include "GradientUtils.h"
 
 using namespace llvm;
@@ -60,6 +65,17 @@ private:
   unsigned width;
   EnzymeLogic &Logic;
 
+  /// The <width x T> value holding all lanes of a batched value, for values
+  /// lowered to a single vector instruction (EnzymeBatchVectorize).
+  ValueMap<const Value *, Value *> vectorForms;
+  /// Vectors assembled element by element from the lanes of a value, which
+  /// are replaced once the value itself is lowered to a vector.
+  SmallVector<WeakVH, 8> gathers;
+  /// Lanes extracted from vector forms, erased again if left unused.
+  SmallVector<WeakVH, 8> extracts;
+  /// Batched PHI nodes whose vector form is created in finalize.
+  SmallVector<PHINode *, 4> vectorPHIs;
+
 private:
   Value *getNewOperand(unsigned int i, llvm::Value *op) {
     if (auto meta = dyn_cast<MetadataAsValue>(op)) {
@@ -74,8 +90,9 @@ private:
       return op;
     } else if (isa<Function>(op)) {
       return op;
-    } else if (isa<GlobalValue>(op)) {
-      // TODO: !!!
+    } else if (isa<Constant>(op)) {
+      // Globals and constant expressions are shared by all lanes.
+      return op;
     } else if (toVectorize.count(op) != 0) {
       auto found = vectorizedValues.find(op);
       assert(found != vectorizedValues.end());
@@ -87,8 +104,416 @@ private:
     }
   }
 
+  static Type *getVectorType(Type *ty, unsigned width) {
+#if LLVM_VERSION_MAJOR >= 11
+    return FixedVectorType::get(ty, width);
+#else
+    return VectorType::get(ty, width);
+#endif
+  }
+
+  /// Return all lanes of the original value op as one <width x T> value,
+  /// splatting values that are not batched.
+  Value *getVectorOperand(IRBuilder<> &Builder, Value *op) {
+    if (toVectorize.count(op) == 0) {
+      Value *scalar = getNewOperand(0, op);
+      if (auto C = dyn_cast<Constant>(scalar))
+#if LLVM_VERSION_MAJOR >= 11
+        return ConstantVector::getSplat(ElementCount::getFixed(width), C);
+#else
+        return ConstantVector::getSplat(width, C);
+#endif
+      return Builder.CreateVectorSplat(width, scalar);
+    }
+
+    auto found = vectorForms.find(op);
+    if (found != vectorForms.end())
+      return found->second;
+
+    // Assemble the vector once, right after the last lane is defined, so that
+    // it dominates every use of op.
+    auto lanes = vectorizedValues.find(op);
+    assert(lanes != vectorizedValues.end());
+    auto last = cast<Instruction>(lanes->second[width - 1]);
+    IRBuilder<> Builder2(last->getNextNode());
+    if (isa<PHINode>(last->getNextNode()))
+      Builder2.SetInsertPoint(last->getParent()->getFirstNonPHI());
+    Builder2.SetCurrentDebugLocation(DebugLoc());
+    Value *vec = UndefValue::get(getVectorType(op->getType(), width));
+    for (unsigned i = 0; i < width; ++i)
+      vec = Builder2.CreateInsertElement(vec, lanes->second[i], i);
+    if (isa<Argument>(op) && op->hasName())
+      vec->setName(op->getName() + ".vec");
+    vectorForms[op] = vec;
+    gathers.push_back(vec);
+    return vec;
+  }
+
+  /// Whether inst computes each lane independently from the same lane of its
+  /// operands, so that all lanes can be computed by one vector instruction.
+  bool isLaneWise(Instruction &inst) {
+    if (!VectorType::isValidElementType(inst.getType()))
+      return false;
+    // Addresses stay per lane, so that accesses to consecutive lanes can be
+    // recognised by hasLaneStride.
+    if (inst.getType()->isPointerTy() && !isa<SelectInst>(inst))
+      return false;
+    for (auto &op : inst.operands())
+      if (toVectorize.count(op) != 0 &&
+          !VectorType::isValidElementType(op->getType()))
+        return false;
+
+    if (isa<BinaryOperator>(inst) || isa<CastInst>(inst) ||
+        isa<CmpInst>(inst) || isa<SelectInst>(inst))
+      return true;
+#if LLVM_VERSION_MAJOR >= 10
+    if (isa<UnaryOperator>(inst))
+      return true;
+#endif
+    if (auto II = dyn_cast<IntrinsicInst>(&inst)) {
+      auto ID = II->getIntrinsicID();
+      if (!isTriviallyVectorizable(ID))
+        return false;
+#if LLVM_VERSION_MAJOR >= 14
+      for (unsigned j = 0; j < II->arg_size(); ++j)
+#else
+      for (unsigned j = 0; j < II->getNumArgOperands(); ++j)
+#endif
+        if (hasVectorInstrinsicScalarOpd(ID, j) &&
+            toVectorize.count(II->getArgOperand(j)) != 0)
+          return false;
+      return true;
+    }
+    return false;
+  }
+
+  /// Return the vector variant of the lane-wise intrinsic call, or nullptr
+  /// if it has no variant of the expected type.
+  Function *getVectorIntrinsic(IntrinsicInst &II) {
+    auto ID = II.getIntrinsicID();
+    SmallVector<Type *, 2> tys = {getVectorType(II.getType(), width)};
+    SmallVector<Type *, 4> params;
+#if LLVM_VERSION_MAJOR >= 14
+    for (unsigned j = 0; j < II.arg_size(); ++j) {
+#else
+    for (unsigned j = 0; j < II.getNumArgOperands(); ++j) {
+#endif
+      Type *ty = II.getArgOperand(j)->getType();
+      if (hasVectorInstrinsicScalarOpd(ID, j)) {
+#if LLVM_VERSION_MAJOR >= 10
+        if (hasVectorInstrinsicOverloadedScalarOpd(ID, j))
+          tys.push_back(ty);
+#endif
+        params.push_back(ty);
+      } else {
+        params.push_back(getVectorType(ty, width));
+      }
+    }
+    Function *F = Intrinsic::getDeclaration(II.getModule(), ID, tys);
+    if (F->getReturnType() != tys[0] ||
+        F->getFunctionType()->params() != ArrayRef<Type *>(params))
+      return nullptr;
+    return F;
+  }
+
+  /// Whether B points Diff bytes after A, when both are computed the same
+  /// way from pointers a constant distance apart.
+  static bool getLaneDistance(const DataLayout &DL, Value *A, Value *B,
+                              int64_t &Diff) {
+    APInt OffA(DL.getIndexTypeSizeInBits(A->getType()), 0);
+    APInt OffB(DL.getIndexTypeSizeInBits(B->getType()), 0);
+#if LLVM_VERSION_MAJOR >= 10
+    A = A->stripAndAccumulateConstantOffsets(DL, OffA,
+                                             /*AllowNonInbounds*/ true);
+    B = B->stripAndAccumulateConstantOffsets(DL, OffB,
+                                             /*AllowNonInbounds*/ true);
+#else
+    A = A->stripAndAccumulateInBoundsConstantOffsets(DL, OffA);
+    B = B->stripAndAccumulateInBoundsConstantOffsets(DL, OffB);
+#endif
+    if (OffA.getBitWidth() != OffB.getBitWidth())
+      return false;
+    if (A == B) {
+      Diff = (OffB - OffA).getSExtValue();
+      return true;
+    }
+
+    // The same variable offset applied to both sides.
+    auto GA = dyn_cast<GEPOperator>(A);
+    auto GB = dyn_cast<GEPOperator>(B);
+    if (!GA || !GB || GA->getSourceElementType() != GB->getSourceElementType() ||
+        GA->getNumIndices() != GB->getNumIndices())
+      return false;
+    for (unsigned j = 1; j < GA->getNumOperands(); ++j)
+      if (GA->getOperand(j) != GB->getOperand(j))
+        return false;
+    if (!getLaneDistance(DL, GA->getPointerOperand(), GB->getPointerOperand(),
+                         Diff))
+      return false;
+    Diff += (OffB - OffA).getSExtValue();
+    return true;
+  }
+
+  /// Whether lane i of the batched pointer op lies i * stride bytes after
+  /// its first lane.
+  bool hasLaneStride(Value *op, uint64_t stride) {
+    if (toVectorize.count(op) == 0 || !op->getType()->isPointerTy())
+      return false;
+    Value *first = getNewOperand(0, op);
+    auto I = dyn_cast<Instruction>(first);
+    auto A = dyn_cast<Argument>(first);
+    if (!I && !A)
+      return false;
+    const DataLayout &DL = I ? I->getModule()->getDataLayout()
+                             : A->getParent()->getParent()->getDataLayout();
+    for (unsigned i = 1; i < width; ++i) {
+      int64_t diff;
+      if (!getLaneDistance(DL, first, getNewOperand(i, op), diff) ||
+          diff != (int64_t)(i * stride))
+        return false;
+    }
+    return true;
+  }
+
+  /// Make the lanes of inst extracts of its vector form vec, replacing the
+  /// scalar lanes and placeholders created for it.
+  void replaceLanes(Instruction &inst, Value *vec, IRBuilder<> &Builder) {
+    // Replace a vector previously assembled from the lanes of inst.
+    auto found = vectorForms.find(&inst);
+    if (found != vectorForms.end())
+      found->second->replaceAllUsesWith(vec);
+    vectorForms[&inst] = vec;
+    auto &lanes = vectorizedValues[&inst];
+    assert(lanes.size() == width);
+    SmallVector<Instruction *, 4> old;
+    for (unsigned i = 0; i < width; ++i) {
+      Value *lane = Builder.CreateExtractElement(vec, i);
+      extracts.push_back(lane);
+      old.push_back(cast<Instruction>(lanes[i]));
+      lanes[i] = lane;
+    }
+    // The builder may insert before the old lanes, so erase them last.
+    for (unsigned i = 0; i < width; ++i) {
+      old[i]->replaceAllUsesWith(lanes[i]);
+      old[i]->eraseFromParent();
+      if (inst.hasName())
+        lanes[i]->setName(inst.getName() + Twine(i));
+    }
+  }
+
+  /// Lower a lane-wise instruction to a single vector instruction, returning
+  /// false if it has to be replicated per lane instead.
+  bool visitLaneWise(Instruction &inst) {
+    if (!isLaneWise(inst))
+      return false;
+
+    Function *vecIntrinsic = nullptr;
+    if (auto II = dyn_cast<IntrinsicInst>(&inst)) {
+      vecIntrinsic = getVectorIntrinsic(*II);
+      if (!vecIntrinsic)
+        return false;
+    }
+
+    Instruction *placeholder = cast<Instruction>(vectorizedValues[&inst][0]);
+    IRBuilder<> Builder2(placeholder);
+    Builder2.SetCurrentDebugLocation(DebugLoc());
+
+    Value *vec = nullptr;
+    if (auto BO = dyn_cast<BinaryOperator>(&inst)) {
+      vec = Builder2.CreateBinOp(BO->getOpcode(),
+                                 getVectorOperand(Builder2, BO->getOperand(0)),
+                                 getVectorOperand(Builder2, BO->getOperand(1)));
+#if LLVM_VERSION_MAJOR >= 10
+    } else if (auto UO = dyn_cast<UnaryOperator>(&inst)) {
+      vec = Builder2.CreateUnOp(UO->getOpcode(),
+                                getVectorOperand(Builder2, UO->getOperand(0)));
+#endif
+    } else if (auto CI = dyn_cast<CastInst>(&inst)) {
+      vec = Builder2.CreateCast(CI->getOpcode(),
+                                getVectorOperand(Builder2, CI->getOperand(0)),
+                                getVectorType(CI->getType(), width));
+    } else if (auto Cmp = dyn_cast<CmpInst>(&inst)) {
+      Value *lhs = getVectorOperand(Builder2, Cmp->getOperand(0));
+      Value *rhs = getVectorOperand(Builder2, Cmp->getOperand(1));
+      vec = isa<FCmpInst>(Cmp)
+                ? Builder2.CreateFCmp(Cmp->getPredicate(), lhs, rhs)
+                : Builder2.CreateICmp(Cmp->getPredicate(), lhs, rhs);
+    } else if (auto Sel = dyn_cast<SelectInst>(&inst)) {
+      // A condition shared by all lanes selects between whole vectors.
+      Value *cond = toVectorize.count(Sel->getCondition())
+                        ? getVectorOperand(Builder2, Sel->getCondition())
+                        : getNewOperand(0, Sel->getCondition());
+      vec = Builder2.CreateSelect(
+          cond, getVectorOperand(Builder2, Sel->getTrueValue()),
+          getVectorOperand(Builder2, Sel->getFalseValue()));
+    } else {
+      auto II = cast<IntrinsicInst>(&inst);
+      SmallVector<Value *, 4> args;
+#if LLVM_VERSION_MAJOR >= 14
+      for (unsigned j = 0; j < II->arg_size(); ++j) {
+#else
+      for (unsigned j = 0; j < II->getNumArgOperands(); ++j) {
+#endif
+        Value *op = II->getArgOperand(j);
+        args.push_back(hasVectorInstrinsicScalarOpd(II->getIntrinsicID(), j)
+                           ? getNewOperand(0, op)
+                           : getVectorOperand(Builder2, op));
+      }
+      vec = Builder2.CreateCall(vecIntrinsic, args);
+    }
+
+    if (auto vecInst = dyn_cast<Instruction>(vec)) {
+      vecInst->copyIRFlags(&inst);
+      vecInst->setDebugLoc(placeholder->getDebugLoc());
+      if (inst.hasName())
+        vecInst->setName(inst.getName() + ".vec");
+    }
+
+    replaceLanes(inst, vec, Builder2);
+    return true;
+  }
+
+  /// Lower a load or store through a batched pointer to one vector access if
+  /// the lanes address consecutive elements, or to a gather or scatter
+  /// otherwise. Returns false if it has to be replicated per lane instead.
+  bool visitVectorMemory(Instruction &inst) {
+#if LLVM_VERSION_MAJOR >= 11
+    auto load = dyn_cast<LoadInst>(&inst);
+    auto store = dyn_cast<StoreInst>(&inst);
+    if (!load && !store)
+      return false;
+    if (load ? !load->isSimple() : !store->isSimple())
+      return false;
+    Value *ptr = load ? load->getPointerOperand() : store->getPointerOperand();
+    Type *ty = load ? load->getType() : store->getValueOperand()->getType();
+    Align align = load ? load->getAlign() : store->getAlign();
+    if (toVectorize.count(ptr) == 0 || !VectorType::isValidElementType(ty))
+      return false;
+
+    Instruction *placeholder = cast<Instruction>(vectorizedValues[&inst][0]);
+    IRBuilder<> Builder2(placeholder);
+    Builder2.SetCurrentDebugLocation(DebugLoc());
+
+    Type *vecTy = getVectorType(ty, width);
+    const DataLayout &DL = inst.getModule()->getDataLayout();
+    Value *vecPtr = nullptr;
+    if (hasLaneStride(ptr, DL.getTypeAllocSize(ty).getFixedSize()))
+      vecPtr = Builder2.CreatePointerCast(
+          getNewOperand(0, ptr),
+          PointerType::get(vecTy, ptr->getType()->getPointerAddressSpace()));
+
+    Instruction *vec;
+    if (load) {
+      if (vecPtr)
+        vec = Builder2.CreateAlignedLoad(vecTy, vecPtr, align);
+      else
+#if LLVM_VERSION_MAJOR >= 13
+        vec = Builder2.CreateMaskedGather(
+            vecTy, getVectorOperand(Builder2, ptr), align);
+#else
+        vec = Builder2.CreateMaskedGather(getVectorOperand(Builder2, ptr),
+                                          align);
+#endif
+    } else {
+      Value *val = getVectorOperand(Builder2, store->getValueOperand());
+      if (vecPtr)
+        vec = Builder2.CreateAlignedStore(val, vecPtr, align);
+      else
+        // Lanes storing to the same address are written in lane order.
+        vec = Builder2.CreateMaskedScatter(
+            val, getVectorOperand(Builder2, ptr), align);
+    }
+    vec->setDebugLoc(placeholder->getDebugLoc());
+
+    if (load) {
+      if (inst.hasName())
+        vec->setName(inst.getName() + ".vec");
+      replaceLanes(inst, vec, Builder2);
+    } else {
+      placeholder->eraseFromParent();
+      vectorizedValues[&inst][0] = vec;
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+
 public:
+  /// Complete the vector forms once every instruction has been visited:
+  /// create the batched PHI nodes and erase the vectors assembled from lanes
+  /// and the lanes extracted from vectors that ended up unused.
+  void finalize() {
+    for (PHINode *phi : vectorPHIs) {
+      PHINode *placeholder = cast<PHINode>(vectorizedValues[phi][0]);
+      IRBuilder<> Builder2(placeholder);
+      Builder2.SetCurrentDebugLocation(DebugLoc());
+      PHINode *vec = Builder2.CreatePHI(getVectorType(phi->getType(), width),
+                                        phi->getNumIncomingValues());
+      vec->setDebugLoc(placeholder->getDebugLoc());
+      if (phi->hasName())
+        vec->setName(phi->getName() + ".vec");
+      Builder2.SetInsertPoint(placeholder->getParent()->getFirstNonPHI());
+      replaceLanes(*phi, vec, Builder2);
+    }
+
+    for (PHINode *phi : vectorPHIs) {
+      PHINode *vec = cast<PHINode>(vectorForms[phi]);
+      for (unsigned j = 0; j < phi->getNumIncomingValues(); ++j) {
+        BasicBlock *new_block =
+            cast<BasicBlock>(originalToNewFn[phi->getIncomingBlock(j)]);
+        IRBuilder<> Builder2(new_block->getTerminator());
+        Builder2.SetCurrentDebugLocation(DebugLoc());
+        vec->addIncoming(getVectorOperand(Builder2, phi->getIncomingValue(j)),
+                         new_block);
+      }
+    }
+
+    for (auto &gather : gathers) {
+      for (Value *V = gather; V && !isa<UndefValue>(V);) {
+        auto IE = dyn_cast<InsertElementInst>(V);
+        if (!IE || !IE->use_empty())
+          break;
+        V = IE->getOperand(0);
+        IE->eraseFromParent();
+      }
+    }
+
+    for (auto &lane : extracts)
+      if (auto EE = dyn_cast_or_null<Instruction>(lane))
+        if (EE->use_empty())
+          EE->eraseFromParent();
+  }
+
+  /// Replace a call to __enzyme_batch_any with whether its argument is set
+  /// in any lane.
+  void visitBatchAny(llvm::CallInst &call) {
+    Instruction *new_call = cast<Instruction>(originalToNewFn[&call]);
+    IRBuilder<> Builder2(new_call);
+    Builder2.SetCurrentDebugLocation(new_call->getDebugLoc());
+    Value *op = call.getArgOperand(0);
+    Value *any;
+    if (toVectorize.count(op) == 0) {
+      any = getNewOperand(0, op);
+    } else if (EnzymeBatchVectorize) {
+      any = Builder2.CreateOrReduce(getVectorOperand(Builder2, op));
+    } else {
+      any = getNewOperand(0, op);
+      for (unsigned i = 1; i < width; ++i)
+        any = Builder2.CreateOr(any, getNewOperand(i, op));
+    }
+    if (toVectorize.count(op))
+      any->takeName(new_call);
+    new_call->replaceAllUsesWith(any);
+    new_call->eraseFromParent();
+    originalToNewFn[&call] = any;
+  }
+
   void visitInstruction(llvm::Instruction &inst) {
+    if (EnzymeBatchVectorize &&
+        (visitLaneWise(inst) || visitVectorMemory(inst)))
+      return;
+
     auto found = vectorizedValues.find(&inst);
     assert(found != vectorizedValues.end());
     auto placeholders = found->second;
@@ -102,16 +527,6 @@ public:
       for (unsigned j = 0; j < inst.getNumOperands(); ++j) {
         Value *op = inst.getOperand(j);
 
-        // Don't allow writing vectors to global memory, loading and splatting a
-        // global is fine though.
-        if (isa<GlobalValue>(op) && !isa<ConstantData>(op) &&
-            inst.mayWriteToMemory() && toVectorize.count(op) != 0) {
-          // TODO: handle buffer access
-          EmitFailure("GlobalValueCannotBeVectorized", inst.getDebugLoc(),
-                      &inst, "global variables have to be scalar values", inst);
-          llvm_unreachable("vectorized control flow is not allowed");
-        }
-
         if (auto meta = dyn_cast<MetadataAsValue>(op))
           if (!isa<ValueAsMetadata>(meta->getMetadata()))
             continue;
@@ -131,12 +546,11 @@ public:
         // Instructions which don't return a value
         assert(placeholder->getType()->isVoidTy());
 
-        Instruction *insertionPoint = placeholder->getNextNode()
-                                          ? placeholder->getNextNode()
-                                          : placeholder;
-        IRBuilder<> Builder2(insertionPoint);
-        Builder2.SetCurrentDebugLocation(DebugLoc());
-        Builder2.Insert(new_inst);
+        // Emit the lanes in order, so that the last lane's write to memory
+        // shared by all lanes is the one that remains.
+        new_inst->insertAfter(
+            cast<Instruction>(vectorizedValues[&inst].back()));
+        new_inst->setDebugLoc(DebugLoc());
         vectorizedValues[&inst].push_back(new_inst);
       } else {
         llvm_unreachable("Unexpected number of values in mapping");
@@ -149,7 +563,44 @@ public:
     }
   }
 
+  void visitMemIntrinsic(llvm::MemIntrinsic &MI) {
+    // Lanes filling consecutive ranges of the same length are covered by
+    // widening the call of the first lane.
+    auto len = dyn_cast<ConstantInt>(MI.getLength());
+    bool contiguous = EnzymeBatchVectorize && len && !MI.isVolatile() &&
+                      hasLaneStride(MI.getRawDest(), len->getZExtValue());
+    if (auto MT = dyn_cast<MemTransferInst>(&MI)) {
+      // The lanes run one after another, so a lane may read what an earlier
+      // one wrote. A single transfer is only equivalent if no lane reads
+      // memory written by any lane.
+      contiguous = contiguous &&
+                   hasLaneStride(MT->getRawSource(), len->getZExtValue());
+      if (contiguous) {
+        const DataLayout &DL = MI.getModule()->getDataLayout();
+        int64_t diff;
+        contiguous =
+            getLaneDistance(DL, getNewOperand(0, MT->getRawDest()),
+                            getNewOperand(0, MT->getRawSource()), diff) &&
+            (uint64_t)std::abs(diff) >= len->getZExtValue() * width;
+      }
+    } else
+      contiguous =
+          contiguous && toVectorize.count(cast<MemSetInst>(MI).getValue()) == 0;
+    if (!contiguous)
+      return visitCallInst(MI);
+
+    auto first = cast<MemIntrinsic>(vectorizedValues[&MI][0]);
+    first->setLength(
+        ConstantInt::get(len->getType(), len->getZExtValue() * width));
+  }
+
   void visitPHINode(PHINode &phi) {
+    if (EnzymeBatchVectorize &&
+        VectorType::isValidElementType(phi.getType())) {
+      vectorPHIs.push_back(&phi);
+      return;
+    }
+
     PHINode *placeholder = cast<PHINode>(vectorizedValues[&phi][0]);
 
     for (unsigned i = 1; i < width; ++i) {
@@ -229,12 +680,14 @@ public:
 
     SmallVector<Value *, 4> args;
     SmallVector<BATCH_TYPE, 4> arg_types;
+    SmallVector<uint64_t, 4> arg_strides;
 #if LLVM_VERSION_MAJOR >= 14
     for (unsigned j = 0; j < call.arg_size(); ++j) {
 #else
     for (unsigned j = 0; j < call.getNumArgOperands(); ++j) {
 #endif
       Value *op = call.getArgOperand(j);
+      arg_strides.push_back(0);
 
       if (toVectorize.count(op) != 0) {
         Type *aggTy = GradientUtils::getShadowType(op->getType(), width);
@@ -243,11 +696,20 @@ public:
           auto found = vectorizedValues.find(op);
           assert(found != vectorizedValues.end());
           Value *new_op = found->second[i];
-          Builder2.CreateInsertValue(agg, new_op, {i});
+          agg = Builder2.CreateInsertValue(agg, new_op, {i});
         }
         args.push_back(agg);
         arg_types.push_back(BATCH_TYPE::VECTOR);
-      } else if (isa<ConstantData>(op)) {
+
+        // Keep the distance between lanes known to the callee.
+        int64_t stride;
+        if (width > 1 && op->getType()->isPointerTy() &&
+            getLaneDistance(call.getModule()->getDataLayout(),
+                            getNewOperand(0, op), getNewOperand(1, op),
+                            stride) &&
+            stride > 0 && hasLaneStride(op, stride))
+          arg_strides.back() = stride;
+      } else if (isa<Constant>(op)) {
         args.push_back(op);
         arg_types.push_back(BATCH_TYPE::SCALAR);
       } else {
@@ -264,7 +726,7 @@ public:
                               : BATCH_TYPE::VECTOR;
 
     Function *new_func =
-        Logic.CreateBatch(orig_func, width, arg_types, ret_type);
+        Logic.CreateBatch(orig_func, width, arg_types, ret_type, arg_strides);
     CallInst *new_call = Builder2.CreateCall(new_func->getFunctionType(),
                                              new_func, args, call.getName());
 
@@ -0,0 +1,493 @@
+//===- JacobianSparsity.cpp - Sparsity patterns of Jacobians -------------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the derivation and coloring of Jacobian sparsity
+// patterns, see JacobianSparsity.h.
+//
+//===----------------------------------------------------------------------===//
+
+#include "JacobianSparsity.h"
+
+#include "TypeAnalysis/TypeAnalysis.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SparseBitVector.h"
+
+#include "llvm/Analysis/ValueTracking.h"
+
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include <map>
+
+using namespace llvm;
+
+/// The inputs a value, or the current content of an output, depends on.
+using DepSet = SparseBitVector<>;
+
+/// The object Ptr points into.
+static Value *getObject(const DataLayout &DL, Value *Ptr) {
+#if LLVM_VERSION_MAJOR >= 12
+  return getUnderlyingObject(Ptr, 100);
+#else
+  return GetUnderlyingObject(Ptr, DL, 100);
+#endif
+}
+
+/// Whether Ptr points to element Idx < Size of the T array Base.
+static bool getElementIndex(const DataLayout &DL, Value *Ptr, Value *Base,
+                            Type *T, uint64_t Size, uint64_t &Idx) {
+  APInt Offset(DL.getIndexTypeSizeInBits(Ptr->getType()), 0);
+#if LLVM_VERSION_MAJOR >= 10
+  Ptr = Ptr->stripAndAccumulateConstantOffsets(DL, Offset,
+                                               /*AllowNonInbounds*/ true);
+#else
+  Ptr = Ptr->stripAndAccumulateInBoundsConstantOffsets(DL, Offset);
+#endif
+  if (Ptr != Base || Offset.isNegative())
+    return false;
+  uint64_t ElemSize = DL.getTypeAllocSize(T);
+  if (Offset.getZExtValue() % ElemSize != 0)
+    return false;
+  Idx = Offset.getZExtValue() / ElemSize;
+  return Idx < Size;
+}
+
+bool getStaticJacobianSparsity(Function &F, uint64_t n, uint64_t m,
+                               SparsityPattern &Rows) {
+  if (F.empty() || F.arg_size() != 2)
+    return false;
+  Argument *X = F.arg_begin();
+  Argument *Y = std::next(F.arg_begin());
+  Type *T = X->getType()->getPointerElementType();
+  const DataLayout &DL = F.getParent()->getDataLayout();
+
+  // Blocks are visited once, after all their predecessors, which needs an
+  // acyclic control flow graph.
+  ReversePostOrderTraversal<Function *> RPOT(&F);
+  DenseMap<BasicBlock *, unsigned> Order;
+  for (BasicBlock *BB : RPOT)
+    Order[BB] = Order.size();
+  for (BasicBlock *BB : RPOT)
+    for (BasicBlock *Succ : successors(BB))
+      if (Order[Succ] <= Order[BB])
+        return false;
+
+  DenseMap<Value *, DepSet> Deps;
+  auto operandDeps = [&](Instruction &I) {
+    DepSet Res;
+    for (Value *Op : I.operands()) {
+      auto Found = Deps.find(Op);
+      if (Found != Deps.end())
+        Res |= Found->second;
+    }
+    return Res;
+  };
+
+  // For each output written so far, the inputs its content depends on. At
+  // joins the contents of all incoming paths are merged.
+  using OutputState = std::map<uint64_t, DepSet>;
+  DenseMap<BasicBlock *, OutputState> Out;
+  OutputState Final;
+
+  for (BasicBlock *BB : RPOT) {
+    OutputState State;
+    for (BasicBlock *Pred : predecessors(BB))
+      for (auto &Entry : Out[Pred])
+        State[Entry.first] |= Entry.second;
+
+    for (Instruction &I : *BB) {
+      uint64_t Idx;
+      if (auto LI = dyn_cast<LoadInst>(&I)) {
+        Value *Ptr = LI->getPointerOperand();
+        Value *Obj = getObject(DL, Ptr);
+        if (Obj == X || Obj == Y) {
+          if (LI->getType() != T)
+            return false;
+          if (Obj == X && getElementIndex(DL, Ptr, X, T, n, Idx))
+            Deps[LI].set(Idx);
+          else if (Obj == Y && getElementIndex(DL, Ptr, Y, T, m, Idx))
+            Deps[LI] = State[Idx];
+          else
+            return false;
+        }
+        // Other memory is never written by F, so it does not depend on x.
+        continue;
+      }
+      if (auto SI = dyn_cast<StoreInst>(&I)) {
+        if (SI->getValueOperand()->getType() != T ||
+            !getElementIndex(DL, SI->getPointerOperand(), Y, T, m, Idx))
+          return false;
+        auto Found = Deps.find(SI->getValueOperand());
+        State[Idx] = Found == Deps.end() ? DepSet() : Found->second;
+        continue;
+      }
+      if (auto CI = dyn_cast<CallInst>(&I)) {
+        if (isa<DbgInfoIntrinsic>(CI))
+          continue;
+        if (auto II = dyn_cast<IntrinsicInst>(CI))
+          if (II->getIntrinsicID() == Intrinsic::lifetime_start ||
+              II->getIntrinsicID() == Intrinsic::lifetime_end)
+            continue;
+        Function *Callee = CI->getCalledFunction();
+        if (!CI->doesNotAccessMemory() &&
+            !(Callee && isMemFreeLibMFunction(Callee->getName())))
+          return false;
+        Deps[CI] = operandDeps(*CI);
+        continue;
+      }
+      if (isa<ReturnInst>(&I)) {
+        for (auto &Entry : State)
+          Final[Entry.first] |= Entry.second;
+        continue;
+      }
+      if (I.mayReadOrWriteMemory() || isa<AllocaInst>(&I))
+        return false;
+      DepSet Res = operandDeps(I);
+      if (!Res.empty())
+        Deps[&I] = std::move(Res);
+    }
+    Out[BB] = std::move(State);
+  }
+
+  Rows.assign(m, {});
+  for (auto &Entry : Final)
+    for (unsigned j : Entry.second)
+      Rows[Entry.first].push_back(j);
+  return true;
+}
+
+/// Whether Ty is or holds floating point values.
+static bool containsFP(Type *Ty) {
+  if (Ty->isFPOrFPVectorTy())
+    return true;
+  if (auto ST = dyn_cast<StructType>(Ty)) {
+    for (Type *E : ST->elements())
+      if (containsFP(E))
+        return true;
+    return false;
+  }
+  if (auto AT = dyn_cast<ArrayType>(Ty))
+    return containsFP(AT->getElementType());
+  if (auto VT = dyn_cast<VectorType>(Ty))
+    return containsFP(VT->getElementType());
+  return false;
+}
+
+/// Add to F, a clone of a void(T *x, T *y) with the masks dx and dy of x
+/// and y as extra arguments, the propagation of the mask of each value of
+/// type T. Returns false if a value may flow where it is not tracked.
+static bool propagateDependencies(Function &F, Type *T, IntegerType *MaskTy,
+                                  Argument *DX, Argument *DY) {
+  Module &M = *F.getParent();
+  const DataLayout &DL = M.getDataLayout();
+  auto &Ctx = F.getContext();
+  Argument *X = F.arg_begin();
+  Argument *Y = std::next(F.arg_begin());
+  Type *I8Ptr = Type::getInt8PtrTy(Ctx);
+  Type *IntPtr = DL.getIntPtrType(Ctx);
+  Constant *Zero = ConstantInt::get(MaskTy, 0);
+
+  // Memory holding values of type T is shadowed by memory of the same layout
+  // holding their masks. No other memory ever holds a value depending on x.
+  DenseMap<Value *, Value *> Shadow = {{X, DX}, {Y, DY}};
+  DenseMap<Value *, Value *> Masks;
+  auto getMask = [&](Value *V) -> Value * {
+    auto Found = Masks.find(V);
+    return Found == Masks.end() ? Zero : Found->second;
+  };
+  auto orMasks = [&](IRBuilder<> &B, Instruction &I) -> Value * {
+    Value *Res = Zero;
+    for (Value *Op : I.operands()) {
+      if (Op->getType() != T)
+        continue;
+      Value *Mask = getMask(Op);
+      Res = Res == Zero ? Mask : Mask == Zero ? Res : B.CreateOr(Res, Mask);
+    }
+    return Res;
+  };
+  // Whether Ptr is known to point into shadowed memory (Shadowed) or into
+  // memory that never holds values of type T depending on x.
+  auto classify = [&](Value *Ptr, bool &Shadowed) {
+    Value *Obj = getObject(DL, Ptr);
+    Shadowed = Shadow.count(Obj);
+    return Shadowed || isa<GlobalVariable>(Obj) || isa<LoadInst>(Obj);
+  };
+  auto shadowOf = [&](IRBuilder<> &B, Value *Ptr) {
+    Value *Obj = getObject(DL, Ptr);
+    Value *Res = B.CreatePointerCast(Shadow[Obj], I8Ptr);
+    if (Ptr != Obj)
+      Res = B.CreateGEP(Type::getInt8Ty(Ctx), Res,
+                        B.CreateSub(B.CreatePtrToInt(Ptr, IntPtr),
+                                    B.CreatePtrToInt(Obj, IntPtr)));
+    return B.CreatePointerCast(Res, MaskTy->getPointerTo());
+  };
+  // Only values of type T carry dependencies.
+  auto isTracked = [&](Type *Ty) { return Ty == T || !containsFP(Ty); };
+
+  ReversePostOrderTraversal<Function *> RPOT(&F);
+  SmallVector<std::pair<PHINode *, PHINode *>, 4> PHIs;
+  for (BasicBlock *BB : RPOT)
+    for (PHINode &PN : BB->phis())
+      if (PN.getType() == T) {
+        auto MP = PHINode::Create(MaskTy, PN.getNumIncomingValues(),
+                                  PN.getName() + "'deps", PN.getNextNode());
+        Masks[&PN] = MP;
+        PHIs.emplace_back(&PN, MP);
+      }
+
+  for (BasicBlock *BB : RPOT) {
+    SmallVector<Instruction *, 16> Insts;
+    for (Instruction &I : *BB)
+      Insts.push_back(&I);
+    for (Instruction *I : Insts) {
+      if (!isTracked(I->getType()))
+        return false;
+      if (isa<PHINode>(I) || isa<DbgInfoIntrinsic>(I))
+        continue;
+      for (Value *Op : I->operands())
+        if (!isTracked(Op->getType()))
+          return false;
+      IRBuilder<> B(BB, std::next(I->getIterator()));
+      bool Shadowed;
+
+      if (auto LI = dyn_cast<LoadInst>(I)) {
+        if (!classify(LI->getPointerOperand(), Shadowed) ||
+            (Shadowed && LI->getType() != T))
+          return false;
+        if (Shadowed) {
+          Value *Ptr = shadowOf(B, LI->getPointerOperand());
+#if LLVM_VERSION_MAJOR > 7
+          LoadInst *Mask = B.CreateLoad(MaskTy, Ptr, LI->getName() + "'deps");
+#else
+          LoadInst *Mask = B.CreateLoad(Ptr, LI->getName() + "'deps");
+#endif
+#if LLVM_VERSION_MAJOR >= 11
+          Mask->setAlignment(LI->getAlign());
+#elif LLVM_VERSION_MAJOR >= 10
+          Mask->setAlignment(MaybeAlign(LI->getAlignment()));
+#else
+          Mask->setAlignment(LI->getAlignment());
+#endif
+          Masks[LI] = Mask;
+        }
+        continue;
+      }
+      if (auto SI = dyn_cast<StoreInst>(I)) {
+        // Pointers to shadowed memory must not escape.
+        if (SI->getValueOperand()->getType()->isPointerTy() ||
+            !classify(SI->getPointerOperand(), Shadowed))
+          return false;
+        if (SI->getValueOperand()->getType() == T && !Shadowed)
+          return false;
+        if (Shadowed) {
+          if (SI->getValueOperand()->getType() != T)
+            return false;
+          StoreInst *Mask = B.CreateStore(getMask(SI->getValueOperand()),
+                                          shadowOf(B, SI->getPointerOperand()));
+#if LLVM_VERSION_MAJOR >= 11
+          Mask->setAlignment(SI->getAlign());
+#elif LLVM_VERSION_MAJOR >= 10
+          Mask->setAlignment(MaybeAlign(SI->getAlignment()));
+#else
+          Mask->setAlignment(SI->getAlignment());
+#endif
+        }
+        continue;
+      }
+      if (auto AI = dyn_cast<AllocaInst>(I)) {
+        if (!containsFP(AI->getAllocatedType()))
+          continue;
+        AllocaInst *S = B.CreateAlloca(AI->getAllocatedType(),
+                                       AI->getArraySize(),
+                                       AI->getName() + "'deps");
+#if LLVM_VERSION_MAJOR >= 11
+        S->setAlignment(AI->getAlign());
+#elif LLVM_VERSION_MAJOR >= 10
+        S->setAlignment(MaybeAlign(AI->getAlignment()));
+#else
+        S->setAlignment(AI->getAlignment());
+#endif
+        Value *Size = ConstantInt::get(
+            IntPtr, DL.getTypeAllocSize(AI->getAllocatedType()));
+        if (AI->isArrayAllocation())
+          Size = B.CreateMul(Size,
+                             B.CreateZExtOrTrunc(AI->getArraySize(), IntPtr));
+        B.CreateMemSet(S, B.getInt8(0), Size,
+#if LLVM_VERSION_MAJOR >= 11
+                       AI->getAlign());
+#elif LLVM_VERSION_MAJOR >= 10
+                       MaybeAlign(AI->getAlignment()));
+#else
+                       AI->getAlignment());
+#endif
+        Shadow[AI] = S;
+        continue;
+      }
+      if (auto MS = dyn_cast<MemSetInst>(I)) {
+        if (!classify(MS->getRawDest(), Shadowed))
+          return false;
+        if (Shadowed) {
+          auto C = cast<MemSetInst>(MS->clone());
+          C->setDest(shadowOf(B, MS->getRawDest()));
+          C->setValue(B.getInt8(0));
+          B.Insert(C);
+        }
+        continue;
+      }
+      if (auto MT = dyn_cast<MemTransferInst>(I)) {
+        bool SrcShadowed;
+        if (!classify(MT->getRawDest(), Shadowed) ||
+            !classify(MT->getRawSource(), SrcShadowed) ||
+            (SrcShadowed && !Shadowed))
+          return false;
+        if (Shadowed && SrcShadowed) {
+          auto C = cast<MemTransferInst>(MT->clone());
+          C->setDest(shadowOf(B, MT->getRawDest()));
+          C->setSource(shadowOf(B, MT->getRawSource()));
+          B.Insert(C);
+        } else if (Shadowed) {
+          B.CreateMemSet(shadowOf(B, MT->getRawDest()), B.getInt8(0),
+                         MT->getLength(),
+#if LLVM_VERSION_MAJOR >= 11
+                         MT->getDestAlign());
+#elif LLVM_VERSION_MAJOR >= 10
+                         MaybeAlign(MT->getDestAlignment()));
+#else
+                         MT->getDestAlignment());
+#endif
+        }
+        continue;
+      }
+      if (auto CI = dyn_cast<CallInst>(I)) {
+        if (auto II = dyn_cast<IntrinsicInst>(CI))
+          if (II->getIntrinsicID() == Intrinsic::lifetime_start ||
+              II->getIntrinsicID() == Intrinsic::lifetime_end)
+            continue;
+        Function *Callee = CI->getCalledFunction();
+        if (!CI->doesNotAccessMemory() &&
+            !(Callee && isMemFreeLibMFunction(Callee->getName())))
+          return false;
+        for (Value *Arg : CI->args())
+          if (Arg->getType()->isPointerTy())
+            return false;
+        if (CI->getType() == T)
+          Masks[CI] = orMasks(B, *CI);
+        continue;
+      }
+      if (I->mayReadOrWriteMemory() || isa<IntToPtrInst>(I))
+        return false;
+      if (auto SI = dyn_cast<SelectInst>(I)) {
+        if (SI->getType() == T)
+          Masks[SI] = B.CreateSelect(SI->getCondition(),
+                                     getMask(SI->getTrueValue()),
+                                     getMask(SI->getFalseValue()),
+                                     SI->getName() + "'deps");
+        continue;
+      }
+      if (I->getType() == T)
+        Masks[I] = orMasks(B, *I);
+    }
+  }
+
+  for (auto &Entry : PHIs)
+    for (unsigned i = 0; i < Entry.first->getNumIncomingValues(); ++i)
+      Entry.second->addIncoming(getMask(Entry.first->getIncomingValue(i)),
+                                Entry.first->getIncomingBlock(i));
+  return true;
+}
+
+Function *createJacobianDependencies(Function &F) {
+  if (F.empty() || F.arg_size() != 2)
+    return nullptr;
+  Module &M = *F.getParent();
+  const DataLayout &DL = M.getDataLayout();
+  FunctionType *FT = F.getFunctionType();
+  Type *T = FT->getParamType(0)->getPointerElementType();
+  // Masks share the layout of the values they describe.
+  if (DL.getTypeSizeInBits(T) != DL.getTypeAllocSizeInBits(T))
+    return nullptr;
+  auto MaskTy = IntegerType::get(F.getContext(), DL.getTypeSizeInBits(T));
+
+  Type *Params[] = {FT->getParamType(0), FT->getParamType(1),
+                    MaskTy->getPointerTo(), MaskTy->getPointerTo()};
+  Function *NewF = Function::Create(
+      FunctionType::get(FT->getReturnType(), Params, /*isVarArg*/ false),
+      GlobalValue::InternalLinkage, "jacobian_deps_" + F.getName(), &M);
+  ValueToValueMapTy VMap;
+  auto NewArg = NewF->arg_begin();
+  for (Argument &A : F.args()) {
+    NewArg->setName(A.getName());
+    VMap[&A] = NewArg++;
+  }
+  Argument *DX = NewArg++;
+  Argument *DY = NewArg;
+  DX->setName("dx");
+  DY->setName("dy");
+  SmallVector<ReturnInst *, 4> Returns;
+#if LLVM_VERSION_MAJOR >= 13
+  CloneFunctionInto(NewF, &F, VMap, CloneFunctionChangeType::LocalChangesOnly,
+                    Returns);
+#else
+  CloneFunctionInto(NewF, &F, VMap, /*ModuleLevelChanges*/ false, Returns);
+#endif
+  // Cloning copies the linkage-related attributes of F.
+  NewF->setLinkage(GlobalValue::InternalLinkage);
+  NewF->setVisibility(GlobalValue::DefaultVisibility);
+
+  if (!propagateDependencies(*NewF, T, MaskTy, DX, DY)) {
+    NewF->eraseFromParent();
+    return nullptr;
+  }
+  return NewF;
+}
+
+unsigned colorJacobianColumns(const SparsityPattern &Rows, uint64_t n,
+                              std::vector<unsigned> &Colors) {
+  std::vector<std::vector<uint64_t>> ColumnRows(n);
+  for (uint64_t i = 0; i < Rows.size(); ++i)
+    for (uint64_t j : Rows[i])
+      ColumnRows[j].push_back(i);
+
+  Colors.assign(n, NoColor);
+  // Forbidden[c] == j when color c is taken by a neighbour of column j.
+  std::vector<uint64_t> Forbidden;
+  for (uint64_t j = 0; j < n; ++j) {
+    if (ColumnRows[j].empty())
+      continue;
+    for (uint64_t i : ColumnRows[j])
+      for (uint64_t k : Rows[i])
+        if (Colors[k] != NoColor)
+          Forbidden[Colors[k]] = j;
+    unsigned Color = 0;
+    while (Color < Forbidden.size() && Forbidden[Color] == j)
+      ++Color;
+    if (Color == Forbidden.size())
+      Forbidden.push_back(n);
+    Colors[j] = Color;
+  }
+  return Forbidden.size();
+}
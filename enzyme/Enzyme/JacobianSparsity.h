@@ -0,0 +1,65 @@
+//===- JacobianSparsity.h - Sparsity patterns of Jacobians ---------------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the derivation of the sparsity pattern of the Jacobian
+// of a function void(T *x, T *y) from the flow of values through it, and the
+// coloring of the columns of such a pattern used to compress the Jacobian
+// into as few forward mode seeds as there are colors.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef ENZYME_JACOBIAN_SPARSITY_H
+#define ENZYME_JACOBIAN_SPARSITY_H
+
+#include "llvm/IR/Function.h"
+
+#include <vector>
+
+/// For each output of a Jacobian, the sorted inputs it may depend on.
+using SparsityPattern = std::vector<std::vector<uint64_t>>;
+
+/// Color of the columns of a pattern that have no entry.
+constexpr unsigned NoColor = ~0u;
+
+/// Derive the sparsity pattern of the Jacobian of F, a void(T *x, T *y)
+/// computing the m outputs y from the n inputs x. Returns false if the
+/// pattern cannot be derived statically: F accesses x or y at non-constant
+/// offsets, writes memory other than y, or contains a loop. Loops are
+/// rejected even with constant trip counts, as the pattern is found by
+/// visiting each block once.
+bool getStaticJacobianSparsity(llvm::Function &F, uint64_t n, uint64_t m,
+                               SparsityPattern &Rows);
+
+/// Create a function void(T *x, T *y, iN *dx, iN *dy) computing F, a
+/// void(T *x, T *y), that also propagates which inputs each value depends
+/// on, as a mask of N bits, the size of T. Input j is in the mask of x[j]
+/// stored in dx[j], and the masks of the outputs are stored in dy. Unlike
+/// the static pattern, this handles loops and computed offsets. It follows
+/// the control flow taken for the given x, and which operands a select
+/// picks. Returns nullptr if values of type T may pass through memory other
+/// than x, y and F's stack, or through calls that access memory.
+llvm::Function *createJacobianDependencies(llvm::Function &F);
+
+/// Greedily color the n columns of Rows so that no two columns of the same
+/// color have an entry in the same row, and return the number of colors.
+unsigned colorJacobianColumns(const SparsityPattern &Rows, uint64_t n,
+                              std::vector<unsigned> &Colors);
+
+#endif
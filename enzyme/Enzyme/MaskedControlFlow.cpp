@@ -0,0 +1,641 @@
+//===- MaskedControlFlow.cpp - Masking of divergent control flow --------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the rewrite that removes branches on batched values
+// before a function is batched, see MaskedControlFlow.h.
+//
+//===----------------------------------------------------------------------===//
+
+#include "MaskedControlFlow.h"
+
+#include "TypeAnalysis/TypeAnalysis.h"
+#include "Utils.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/PostDominators.h"
+
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+
+#include "llvm/Transforms/Utils/LoopSimplify.h"
+
+#include <functional>
+
+using namespace llvm;
+
+bool isBatchAny(const Value *V) {
+  if (auto CI = dyn_cast<CallInst>(V))
+    if (auto F = CI->getCalledFunction())
+      return F->getName() == BatchAnyName;
+  return false;
+}
+
+static bool isDivergent(const Instruction *Term,
+                        const SmallPtrSetImpl<Value *> &Divergent) {
+  if (auto BI = dyn_cast<BranchInst>(Term))
+    return BI->isConditional() && Divergent.count(BI->getCondition());
+  if (auto SI = dyn_cast<SwitchInst>(Term))
+    return Divergent.count(SI->getCondition());
+  return false;
+}
+
+bool hasDivergentControlFlow(const Function &F,
+                             const SmallPtrSetImpl<Value *> &Divergent) {
+  for (auto &BB : F)
+    if (isDivergent(BB.getTerminator(), Divergent))
+      return true;
+  return false;
+}
+
+namespace {
+class ControlFlowMasker {
+  Function &F;
+  const SmallPtrSetImpl<Value *> &Divergent;
+  LLVMContext &Ctx;
+
+  /// Lanes running each block, for the blocks not run by all lanes.
+  DenseMap<BasicBlock *, Value *> BlockMask;
+  /// The lanes still iterating each masked loop, with the preheader of the
+  /// loop whose lanes it starts from.
+  SmallVector<std::pair<PHINode *, BasicBlock *>, 2> LoopMasks;
+  /// Slots accessed in place of memory by the lanes switched off.
+  DenseMap<Type *, AllocaInst *> Scratch;
+
+public:
+  ControlFlowMasker(Function &F, const SmallPtrSetImpl<Value *> &Divergent)
+      : F(F), Divergent(Divergent), Ctx(F.getContext()) {}
+
+  bool run() {
+    for (auto &BB : F)
+      if (auto SI = dyn_cast<SwitchInst>(BB.getTerminator()))
+        if (Divergent.count(SI->getCondition())) {
+          EmitFailure("SwitchConditionCannotBeVectorized", SI->getDebugLoc(),
+                      SI, "switch conditions have to be scalar values", *SI);
+          return false;
+        }
+
+    unifyReturns();
+
+    {
+      DominatorTree DT(F);
+      LoopInfo LI(DT);
+      for (auto L : LI.getLoopsInPreorder())
+#if LLVM_VERSION_MAJOR >= 9
+        simplifyLoop(L, &DT, &LI, nullptr, nullptr, nullptr,
+                     /*PreserveLCSSA*/ false);
+#else
+        simplifyLoop(L, &DT, &LI, nullptr, nullptr, /*PreserveLCSSA*/ false);
+#endif
+    }
+
+    // Loops whose exit differs between lanes, innermost first.
+    while (true) {
+      DominatorTree DT(F);
+      LoopInfo LI(DT);
+      Loop *Found = nullptr;
+      BranchInst *Exit = nullptr;
+      auto Loops = LI.getLoopsInPreorder();
+      for (auto L = Loops.rbegin(); L != Loops.rend() && !Found; ++L) {
+        SmallVector<BasicBlock *, 4> Exiting;
+        (*L)->getExitingBlocks(Exiting);
+        for (auto BB : Exiting)
+          if (isDivergent(BB->getTerminator(), Divergent)) {
+            Found = *L;
+            Exit = cast<BranchInst>(BB->getTerminator());
+            break;
+          }
+      }
+      if (!Found)
+        break;
+      if (!maskLoop(Found, Exit, DT))
+        return false;
+    }
+
+    // Acyclic regions below the remaining divergent branches, outermost
+    // first.
+    while (true) {
+      DominatorTree DT(F);
+      PostDominatorTree PDT(F);
+      LoopInfo LI(DT);
+      BranchInst *Found = nullptr;
+      ReversePostOrderTraversal<Function *> RPOT(&F);
+      for (auto BB : RPOT)
+        if (isDivergent(BB->getTerminator(), Divergent)) {
+          Found = cast<BranchInst>(BB->getTerminator());
+          break;
+        }
+      if (!Found)
+        break;
+      if (!maskRegion(Found, DT, PDT, LI))
+        return false;
+    }
+
+    for (auto &BB : F) {
+      auto found = BlockMask.find(&BB);
+      if (found == BlockMask.end() || isa<Constant>(found->second))
+        continue;
+      SmallVector<Instruction *, 16> Insts;
+      for (auto &I : BB)
+        Insts.push_back(&I);
+      for (auto I : Insts)
+        if (!maskInstruction(I, found->second))
+          return false;
+    }
+
+    for (auto &LM : LoopMasks) {
+      PHINode *Active = LM.first;
+      for (unsigned i = 0; i < Active->getNumIncomingValues(); ++i)
+        if (isa<Constant>(Active->getIncomingValue(i)))
+          Active->setIncomingValue(i, getMask(LM.second));
+    }
+    return true;
+  }
+
+private:
+  Value *getMask(BasicBlock *BB) {
+    auto found = BlockMask.find(BB);
+    if (found != BlockMask.end())
+      return found->second;
+    return ConstantInt::getTrue(Ctx);
+  }
+
+  /// The lanes in mask M for which C holds.
+  static Value *lanesWhere(IRBuilder<> &Builder, Value *C, Value *M,
+                         const Twine &Name) {
+    if (auto CI = dyn_cast<ConstantInt>(M))
+      if (CI->isOne())
+        return C;
+    return Builder.CreateAnd(C, M, Name);
+  }
+
+  /// Make all returns branch to a single return, so that every branch has a
+  /// point where its paths rejoin.
+  void unifyReturns() {
+    SmallVector<ReturnInst *, 4> Returns;
+    for (auto &BB : F)
+      if (auto RI = dyn_cast<ReturnInst>(BB.getTerminator()))
+        Returns.push_back(RI);
+    if (Returns.size() < 2)
+      return;
+
+    BasicBlock *Ret = BasicBlock::Create(Ctx, "masked.return", &F);
+    PHINode *PN = nullptr;
+    if (!F.getReturnType()->isVoidTy())
+      PN = PHINode::Create(F.getReturnType(), Returns.size(), "retval", Ret);
+    ReturnInst::Create(Ctx, PN, Ret)->setDebugLoc(Returns[0]->getDebugLoc());
+    for (auto RI : Returns) {
+      if (PN)
+        PN->addIncoming(RI->getReturnValue(), RI->getParent());
+      BranchInst::Create(Ret, RI->getParent())->setDebugLoc(RI->getDebugLoc());
+      RI->eraseFromParent();
+    }
+  }
+
+  Function *getBatchAny() {
+    Module &M = *F.getParent();
+    Type *BoolTy = Type::getInt1Ty(Ctx);
+    FunctionType *FT = FunctionType::get(BoolTy, {BoolTy}, false);
+#if LLVM_VERSION_MAJOR >= 9
+    Function *Any =
+        cast<Function>(M.getOrInsertFunction(BatchAnyName, FT).getCallee());
+#else
+    Function *Any = cast<Function>(M.getOrInsertFunction(BatchAnyName, FT));
+#endif
+    Any->setDoesNotAccessMemory();
+    Any->setDoesNotThrow();
+    return Any;
+  }
+
+  /// Keep iterating L until it has been left by every lane, tracking the lanes
+  /// still running in a mask and the value each lane had when it left.
+  bool maskLoop(Loop *L, BranchInst *Exit, DominatorTree &DT) {
+    BasicBlock *Preheader = L->getLoopPreheader();
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *Latch = L->getLoopLatch();
+    BasicBlock *Exiting = L->getExitingBlock();
+    BasicBlock *ExitBB = L->getUniqueExitBlock();
+    if (!Preheader || !Latch || Exiting != Exit->getParent() || !ExitBB ||
+        !DT.dominates(Exiting, Latch) ||
+        (Exiting != Latch &&
+         cast<BranchInst>(Latch->getTerminator())->isConditional())) {
+      EmitFailure("DivergentLoopCannotBeMasked", Exit->getDebugLoc(), Exit,
+                  "loops whose exit differs between lanes must leave from a "
+                  "single block on the path to their latch: ",
+                  *Exit);
+      return false;
+    }
+
+    // Values used after the loop are taken from the iteration in which each
+    // lane left it.
+    SmallVector<Instruction *, 8> Escaping;
+    for (auto BB : L->blocks())
+      for (auto &I : *BB)
+        for (auto U : I.users())
+          if (!L->contains(cast<Instruction>(U)->getParent())) {
+            if (!DT.dominates(&I, Exit)) {
+              EmitFailure("DivergentLoopCannotBeMasked", I.getDebugLoc(), &I,
+                          "value used after a loop whose exit differs between "
+                          "lanes is not available when leaving it: ",
+                          I);
+              return false;
+            }
+            Escaping.push_back(&I);
+            break;
+          }
+
+    bool ExitOnTrue = !L->contains(Exit->getSuccessor(0));
+    BasicBlock *Next = Exit->getSuccessor(ExitOnTrue ? 1 : 0);
+    Value *Cond = Exit->getCondition();
+
+    IRBuilder<> HB(&Header->front());
+    HB.SetCurrentDebugLocation(DebugLoc());
+    PHINode *Active =
+        HB.CreatePHI(Type::getInt1Ty(Ctx), 2, Header->getName() + ".active");
+    Active->addIncoming(ConstantInt::getTrue(Ctx), Preheader);
+
+    IRBuilder<> EB(Exit);
+    EB.SetCurrentDebugLocation(DebugLoc());
+    Value *Not = EB.CreateNot(Cond, Cond->getName() + ".not");
+    Value *Leave = ExitOnTrue ? Cond : Not;
+    Value *Stay = ExitOnTrue ? Not : Cond;
+    Value *ActiveNext =
+        EB.CreateAnd(Stay, Active, Header->getName() + ".active.next");
+    Value *Leaving = EB.CreateAnd(Leave, Active, Header->getName() + ".leave");
+    Active->addIncoming(ActiveNext, Latch);
+
+    for (auto I : Escaping) {
+      PHINode *Last = HB.CreatePHI(I->getType(), 2, I->getName() + ".exit");
+      Value *LastNext =
+          EB.CreateSelect(Leaving, I, Last, I->getName() + ".exit.next");
+      Last->addIncoming(UndefValue::get(I->getType()), Preheader);
+      Last->addIncoming(LastNext, Latch);
+      SmallVector<Use *, 4> Uses;
+      for (auto &U : I->uses())
+        if (!L->contains(cast<Instruction>(U.getUser())->getParent()))
+          Uses.push_back(&U);
+      for (auto U : Uses)
+        U->set(LastNext);
+    }
+
+    BranchInst::Create(Next, Exiting)->setDebugLoc(Exit->getDebugLoc());
+    DebugLoc Loc = Exit->getDebugLoc();
+    Exit->eraseFromParent();
+
+    Instruction *LatchTerm = Latch->getTerminator();
+    IRBuilder<> LB(LatchTerm);
+    LB.SetCurrentDebugLocation(Loc);
+    Value *Any = LB.CreateCall(getBatchAny(), {ActiveNext},
+                               Header->getName() + ".any");
+    LB.CreateCondBr(Any, Header, ExitBB);
+    LatchTerm->eraseFromParent();
+
+    if (Exiting != Latch)
+      for (auto &PN : ExitBB->phis())
+        for (unsigned i = 0; i < PN.getNumIncomingValues(); ++i)
+          if (PN.getIncomingBlock(i) == Exiting)
+            PN.setIncomingBlock(i, Latch);
+
+    // The blocks after the exit only run for the lanes that stayed.
+    for (auto BB : L->blocks())
+      if (!BlockMask.count(BB))
+        BlockMask[BB] = (BB != Exiting && DT.dominates(Exiting, BB))
+                            ? ActiveNext
+                            : (Value *)Active;
+    LoopMasks.emplace_back(Active, Preheader);
+    return true;
+  }
+
+  /// If-convert the region between Br and the block where its paths rejoin,
+  /// laying out its blocks one after another under the mask of lanes taking
+  /// them. Loops inside the region are kept whole and run under the mask of
+  /// the lanes entering them.
+  bool maskRegion(BranchInst *Br, DominatorTree &DT, PostDominatorTree &PDT,
+                  LoopInfo &LI) {
+    BasicBlock *B = Br->getParent();
+    auto PNode = PDT.getNode(B);
+    BasicBlock *J = PNode && PNode->getIDom() ? PNode->getIDom()->getBlock()
+                                              : nullptr;
+    if (!J) {
+      EmitFailure("DivergentBranchCannotBeMasked", Br->getDebugLoc(), Br,
+                  "branches on values that differ between lanes must rejoin "
+                  "before the function returns: ",
+                  *Br);
+      return false;
+    }
+
+    // Each block of the region belongs to a node, either itself or the loop
+    // containing it, entered at the first block and left from the second.
+    DenseMap<BasicBlock *, BasicBlock *> NodeOf;
+    DenseMap<BasicBlock *, BasicBlock *> TailOf;
+    NodeOf[B] = B;
+    TailOf[B] = B;
+    SmallVector<BasicBlock *, 16> Worklist(succ_begin(B), succ_end(B));
+    while (!Worklist.empty()) {
+      BasicBlock *BB = Worklist.pop_back_val();
+      if (BB == J || NodeOf.count(BB))
+        continue;
+      if (!DT.dominates(B, BB)) {
+        EmitFailure("DivergentBranchCannotBeMasked", Br->getDebugLoc(), Br,
+                    "the paths of a branch on values that differ between "
+                    "lanes must not be entered from elsewhere: ",
+                    *Br);
+        return false;
+      }
+      Loop *Outer = nullptr;
+      for (Loop *L = LI.getLoopFor(BB); L && !L->contains(B);
+           L = L->getParentLoop())
+        Outer = L;
+      BasicBlock *Tail = BB;
+      if (Outer) {
+        Tail = Outer->getUniqueExitBlock();
+        if (!Tail || Tail == J || !Outer->hasDedicatedExits()) {
+          EmitFailure("DivergentBranchCannotBeMasked", Br->getDebugLoc(), Br,
+                      "loops below a branch on values that differ between "
+                      "lanes must leave to a single block: ",
+                      *Br);
+          return false;
+        }
+        for (auto LBB : Outer->blocks())
+          NodeOf[LBB] = BB;
+        NodeOf[Tail] = BB;
+      } else {
+        NodeOf[BB] = BB;
+      }
+      TailOf[BB] = Tail;
+      Worklist.append(succ_begin(Tail), succ_end(Tail));
+    }
+
+    // Order the nodes so that each comes after all of its predecessors.
+    SmallVector<BasicBlock *, 16> Order;
+    DenseMap<BasicBlock *, bool> Done;
+    std::function<bool(BasicBlock *)> visit = [&](BasicBlock *N) {
+      auto found = Done.find(N);
+      if (found != Done.end())
+        return found->second;
+      Done[N] = false;
+      for (auto S : successors(TailOf[N]))
+        if (S != J && !visit(NodeOf[S]))
+          return false;
+      Done[N] = true;
+      Order.push_back(N);
+      return true;
+    };
+    if (!visit(B)) {
+      EmitFailure("DivergentBranchCannotBeMasked", Br->getDebugLoc(), Br,
+                  "the paths of a branch on values that differ between lanes "
+                  "must not form a cycle: ",
+                  *Br);
+      return false;
+    }
+    std::reverse(Order.begin(), Order.end());
+
+    // Compute the lanes taking each node and each edge leaving a node.
+    Value *Enclosing = BlockMask.lookup(B);
+    DenseMap<BasicBlock *, Value *> NodeMask;
+    DenseMap<std::pair<BasicBlock *, BasicBlock *>, Value *> EdgeMask;
+    DenseMap<BasicBlock *, SmallVector<Value *, 2>> Incoming;
+    NodeMask[B] = getMask(B);
+    for (auto N : Order) {
+      if (N != B) {
+        auto &In = Incoming[N];
+        IRBuilder<> Builder(&*N->getFirstInsertionPt());
+        Builder.SetCurrentDebugLocation(DebugLoc());
+        Value *M = In[0];
+        for (unsigned i = 1; i < In.size(); ++i)
+          M = Builder.CreateOr(M, In[i], N->getName() + ".mask");
+        NodeMask[N] = M;
+      }
+
+      Value *M = NodeMask[N];
+      BasicBlock *Tail = TailOf[N];
+      Instruction *Term = Tail->getTerminator();
+      IRBuilder<> Builder(Term);
+      Builder.SetCurrentDebugLocation(DebugLoc());
+      SmallVector<std::pair<BasicBlock *, Value *>, 2> Edges;
+      auto BI = dyn_cast<BranchInst>(Term);
+      if (!BI) {
+        EmitFailure("DivergentBranchCannotBeMasked", Term->getDebugLoc(), Term,
+                    "only branches can be masked below a branch on values "
+                    "that differ between lanes: ",
+                    *Term);
+        return false;
+      }
+      if (BI->isUnconditional() || BI->getSuccessor(0) == BI->getSuccessor(1)) {
+        Edges.emplace_back(BI->getSuccessor(0), M);
+      } else {
+        Value *C = BI->getCondition();
+        Edges.emplace_back(BI->getSuccessor(0),
+                           lanesWhere(Builder, C, M, Tail->getName() + ".true"));
+        Edges.emplace_back(
+            BI->getSuccessor(1),
+            lanesWhere(Builder, Builder.CreateNot(C, C->getName() + ".not"), M,
+                     Tail->getName() + ".false"));
+      }
+      for (auto &E : Edges) {
+        EdgeMask[std::make_pair(Tail, E.first)] = E.second;
+        Incoming[E.first == J ? J : NodeOf[E.first]].push_back(E.second);
+      }
+    }
+
+    // Turn the PHI nodes joining the paths into selects on the edge masks.
+    auto select = [&](IRBuilder<> &Builder, PHINode &PN,
+                      BasicBlock *To) -> Value * {
+      Value *V = nullptr;
+      SmallPtrSet<BasicBlock *, 4> Seen;
+      for (unsigned i = 0; i < PN.getNumIncomingValues(); ++i) {
+        BasicBlock *From = PN.getIncomingBlock(i);
+        auto found = EdgeMask.find(std::make_pair(From, To));
+        if (found == EdgeMask.end() || !Seen.insert(From).second)
+          continue;
+        V = V ? Builder.CreateSelect(found->second, PN.getIncomingValue(i), V,
+                                     PN.getName())
+              : PN.getIncomingValue(i);
+      }
+      return V;
+    };
+
+    for (auto N : Order) {
+      if (N == B || TailOf[N] != N)
+        continue;
+      IRBuilder<> Builder(&*N->getFirstInsertionPt());
+      Builder.SetCurrentDebugLocation(DebugLoc());
+      SmallVector<PHINode *, 4> PHIs;
+      for (auto &PN : N->phis())
+        PHIs.push_back(&PN);
+      for (auto PN : PHIs) {
+        PN->replaceAllUsesWith(select(Builder, *PN, N));
+        PN->eraseFromParent();
+      }
+    }
+
+    BasicBlock *Join =
+        BasicBlock::Create(Ctx, J->getName() + ".join", &F, J);
+    IRBuilder<> JB(Join);
+    JB.SetCurrentDebugLocation(DebugLoc());
+    for (auto &PN : J->phis()) {
+      Value *V = select(JB, PN, J);
+      for (int i = PN.getNumIncomingValues() - 1; i >= 0; --i)
+        if (EdgeMask.count(std::make_pair(PN.getIncomingBlock(i), J)))
+          PN.removeIncomingValue(i, /*DeletePHIIfEmpty*/ false);
+      PN.addIncoming(V, Join);
+    }
+    JB.CreateBr(J);
+    if (Enclosing)
+      BlockMask[Join] = Enclosing;
+
+    // Lay out the nodes in order, every one running under its mask.
+    for (unsigned i = 0; i < Order.size(); ++i) {
+      BasicBlock *N = Order[i];
+      BasicBlock *Tail = TailOf[N];
+      BasicBlock *Next = i + 1 < Order.size() ? Order[i + 1] : Join;
+      Instruction *Term = Tail->getTerminator();
+      BranchInst::Create(Next, Tail)->setDebugLoc(Term->getDebugLoc());
+      Term->eraseFromParent();
+
+      if (N == B)
+        continue;
+      if (Tail == N) {
+        BlockMask[N] = NodeMask[N];
+        continue;
+      }
+      // The preheader of a loop need not precede it directly anymore.
+      for (auto &PN : N->phis())
+        for (unsigned j = 0; j < PN.getNumIncomingValues(); ++j)
+          if (!DT.dominates(N, PN.getIncomingBlock(j)))
+            PN.setIncomingBlock(j, TailOf[Order[i - 1]]);
+      for (auto &BB : F)
+        if (NodeOf.lookup(&BB) == N) {
+          auto &M = BlockMask[&BB];
+          if (M == Enclosing)
+            M = NodeMask[N];
+        }
+    }
+    return true;
+  }
+
+  /// Redirect the accesses of pointer Ptr to a scratch slot for the lanes
+  /// not in mask M.
+  Value *maskPointer(IRBuilder<> &Builder, Value *Ptr, Type *Ty, Value *M) {
+    AllocaInst *&Slot = Scratch[Ty];
+    if (!Slot) {
+      IRBuilder<> EB(&*F.getEntryBlock().getFirstInsertionPt());
+      EB.SetCurrentDebugLocation(DebugLoc());
+      Slot = EB.CreateAlloca(Ty, nullptr, "masked.scratch");
+    }
+    Value *S = Builder.CreatePointerBitCastOrAddrSpaceCast(Slot,
+                                                           Ptr->getType());
+    return Builder.CreateSelect(M, Ptr, S, Ptr->getName() + ".masked");
+  }
+
+  /// Make I, which runs for every lane, have no effect for the lanes not in
+  /// mask M.
+  bool maskInstruction(Instruction *I, Value *M) {
+    IRBuilder<> Builder(I);
+    Builder.SetCurrentDebugLocation(I->getDebugLoc());
+    if (auto LI = dyn_cast<LoadInst>(I)) {
+      if (!LI->isSimple())
+        return failMask(I);
+      // Loading a stack slot is safe for every lane.
+      if (isa<AllocaInst>(LI->getPointerOperand()->stripPointerCasts()))
+        return true;
+      LI->setOperand(LI->getPointerOperandIndex(),
+                     maskPointer(Builder, LI->getPointerOperand(),
+                                 LI->getType(), M));
+      return true;
+    }
+    if (auto SI = dyn_cast<StoreInst>(I)) {
+      if (!SI->isSimple())
+        return failMask(I);
+      SI->setOperand(SI->getPointerOperandIndex(),
+                     maskPointer(Builder, SI->getPointerOperand(),
+                                 SI->getValueOperand()->getType(), M));
+      return true;
+    }
+    if (auto BO = dyn_cast<BinaryOperator>(I)) {
+      switch (BO->getOpcode()) {
+      case Instruction::UDiv:
+      case Instruction::SDiv:
+      case Instruction::URem:
+      case Instruction::SRem: {
+        Value *D = BO->getOperand(1);
+        if (auto C = dyn_cast<ConstantInt>(D))
+          if (!C->isZero() && !C->isMinusOne())
+            return true;
+        BO->setOperand(
+            1, Builder.CreateSelect(M, D, ConstantInt::get(D->getType(), 1)));
+        return true;
+      }
+      default:
+        return true;
+      }
+    }
+    if (auto MI = dyn_cast<MemIntrinsic>(I)) {
+      Value *Len = MI->getLength();
+      MI->setLength(
+          Builder.CreateSelect(M, Len, ConstantInt::get(Len->getType(), 0)));
+      return true;
+    }
+    if (auto CI = dyn_cast<CallInst>(I)) {
+      if (isBatchAny(CI) || isa<DbgInfoIntrinsic>(CI))
+        return true;
+      if (auto II = dyn_cast<IntrinsicInst>(CI)) {
+        switch (II->getIntrinsicID()) {
+        case Intrinsic::lifetime_start:
+        case Intrinsic::lifetime_end:
+        case Intrinsic::assume:
+          return true;
+        default:
+          break;
+        }
+      }
+      if (CI->doesNotAccessMemory())
+        return true;
+      if (auto Fn = CI->getCalledFunction())
+        if (isMemFreeLibMFunction(Fn->getName()))
+          return true;
+      return failMask(I);
+    }
+    if (I->mayReadOrWriteMemory() || I->isEHPad() || isa<InvokeInst>(I))
+      return failMask(I);
+    return true;
+  }
+
+  bool failMask(Instruction *I) {
+    EmitFailure("InstructionCannotBeMasked", I->getDebugLoc(), I,
+                "instruction cannot run under control flow that differs "
+                "between lanes: ",
+                *I);
+    return false;
+  }
+};
+} // namespace
+
+bool maskDivergentControlFlow(Function &F,
+                              const SmallPtrSetImpl<Value *> &Divergent) {
+  return ControlFlowMasker(F, Divergent).run();
+}
@@ -0,0 +1,56 @@
+//===- MaskedControlFlow.h - Masking of divergent control flow ----------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the rewrite that removes branches on batched values
+// before a function is batched. Acyclic regions below such a branch are
+// if-converted: their blocks are laid out one after the other, guarded by
+// per-lane masks, with PHI nodes turned into selects. Loops whose exit
+// depends on a batched value keep a per-lane mask of the lanes still running
+// and iterate until no lane is left. Memory accesses in masked blocks are
+// redirected to a scratch slot for the lanes that are switched off.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef ENZYME_MASKED_CONTROL_FLOW_H
+#define ENZYME_MASKED_CONTROL_FLOW_H
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/Function.h"
+
+/// Name of the function through which masked code asks whether its i1
+/// argument is set in any lane. Called with a single lane it is the
+/// identity; the batcher lowers it to a reduction over the lanes.
+constexpr char BatchAnyName[] = "__enzyme_batch_any";
+
+/// Whether V is a call to __enzyme_batch_any
+bool isBatchAny(const llvm::Value *V);
+
+/// Whether a branch or switch of F depends on a value in Divergent
+bool hasDivergentControlFlow(
+    const llvm::Function &F,
+    const llvm::SmallPtrSetImpl<llvm::Value *> &Divergent);
+
+/// Rewrite F so that no branch depends on a value in Divergent, the values
+/// that may differ between lanes. Returns false, after emitting a failure, if
+/// F contains divergent control flow that cannot be masked.
+bool maskDivergentControlFlow(
+    llvm::Function &F, const llvm::SmallPtrSetImpl<llvm::Value *> &Divergent);
+
+#endif
@@ -0,0 +1,232 @@
+//===- TimeReport.cpp - Compile time spent in each phase of Enzyme -------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the regions timed by -enzyme-time-report, printed as
+// LLVM timer groups and optionally written as JSON for aggregation across
+// builds.
+//
+//===----------------------------------------------------------------------===//
+
+#include "TimeReport.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <memory>
+#include <string>
+
+using namespace llvm;
+
+extern "C" {
+llvm::cl::opt<bool> EnzymeTimeReport(
+    "enzyme-time-report", cl::init(false), cl::Hidden,
+    cl::desc("Report the time spent in each phase of Enzyme and on each "
+             "differentiated function"));
+
+llvm::cl::opt<std::string> EnzymeTimeReportJSON(
+    "enzyme-time-report-json", cl::init(""), cl::Hidden,
+    cl::desc("Write the Enzyme time report as JSON to the given file"));
+}
+
+struct EnzymeTimeRecord {
+  Timer timer;
+  // Number of regions entered on this record, nested or not
+  uint64_t calls = 0;
+  // Largest heap usage observed on entering or leaving a region
+  size_t peakMemory = 0;
+  // Whether this record times a differentiated function rather than a phase
+  bool function;
+  EnzymeTimeRecord(StringRef name, StringRef desc, TimerGroup &TG,
+                   bool function)
+      : timer(name, desc, TG), function(function) {}
+};
+
+namespace {
+const char *PhaseNames[NumEnzymePhases] = {
+    "preprocess", "typeanalysis", "activityanalysis",
+    "mincut",     "synthesis",    "postopt"};
+const char *PhaseDescriptions[NumEnzymePhases] = {
+    "Preprocess for clone", "Type analysis",        "Activity analysis",
+    "Cache min-cut",        "Derivative synthesis", "Post optimization"};
+
+struct TimeReport {
+  TimerGroup phaseGroup;
+  TimerGroup functionGroup;
+  std::unique_ptr<EnzymeTimeRecord> phases[NumEnzymePhases];
+  std::map<std::string, std::unique_ptr<EnzymeTimeRecord>> functions;
+  // Records of the live regions, innermost last
+  SmallVector<EnzymeTimeRecord *, 8> phaseStack;
+  SmallVector<EnzymeTimeRecord *, 8> functionStack;
+  TimeReport()
+      : phaseGroup("enzyme-phases", "Enzyme time per phase"),
+        functionGroup("enzyme-functions", "Enzyme time per function") {
+    for (unsigned i = 0; i < NumEnzymePhases; i++)
+      phases[i].reset(new EnzymeTimeRecord(
+          PhaseNames[i], PhaseDescriptions[i], phaseGroup, false));
+  }
+};
+
+TimeReport &getTimeReport() {
+  static TimeReport TR;
+  return TR;
+}
+
+bool timeReportEnabled() {
+  return EnzymeTimeReport || !EnzymeTimeReportJSON.empty();
+}
+
+void sampleMemory(EnzymeTimeRecord *rec) {
+  rec->peakMemory = std::max(rec->peakMemory, sys::Process::GetMallocUsage());
+}
+
+void enterRegion(EnzymeTimeRecord *rec) {
+  auto &TR = getTimeReport();
+  auto &stack = rec->function ? TR.functionStack : TR.phaseStack;
+  rec->calls++;
+  if (stack.empty() || stack.back() != rec) {
+    if (!stack.empty())
+      stack.back()->timer.stopTimer();
+    sampleMemory(rec);
+    rec->timer.startTimer();
+  }
+  stack.push_back(rec);
+}
+
+void exitRegion(EnzymeTimeRecord *rec) {
+  auto &TR = getTimeReport();
+  auto &stack = rec->function ? TR.functionStack : TR.phaseStack;
+  assert(stack.size() && stack.back() == rec);
+  stack.pop_back();
+  if (stack.empty() || stack.back() != rec) {
+    rec->timer.stopTimer();
+    sampleMemory(rec);
+    if (!stack.empty())
+      stack.back()->timer.startTimer();
+  }
+}
+
+void writeJSONString(raw_ostream &OS, StringRef str) {
+  OS << '"';
+  for (unsigned char c : str) {
+    if (c == '"' || c == '\\')
+      OS << '\\' << c;
+    else if (c < 0x20)
+      OS << format("\\u%04x", c);
+    else
+      OS << c;
+  }
+  OS << '"';
+}
+
+void writeJSONRecord(raw_ostream &OS, StringRef name,
+                     const EnzymeTimeRecord &rec) {
+  auto time = rec.timer.getTotalTime();
+  OS << "    ";
+  writeJSONString(OS, name);
+  OS << ": {\"wall\": " << format("%.6f", time.getWallTime())
+     << ", \"user\": " << format("%.6f", time.getUserTime())
+     << ", \"system\": " << format("%.6f", time.getSystemTime())
+     << ", \"calls\": " << rec.calls
+     << ", \"peak_malloc_bytes\": " << rec.peakMemory << "}";
+}
+} // namespace
+
+EnzymeTimeRegion::EnzymeTimeRegion(EnzymePhase phase) : record(nullptr) {
+  if (!timeReportEnabled())
+    return;
+  record = getTimeReport().phases[(unsigned)phase].get();
+  enterRegion(record);
+}
+
+EnzymeTimeRegion::EnzymeTimeRegion(StringRef fn, StringRef mode)
+    : record(nullptr) {
+  if (!timeReportEnabled())
+    return;
+  auto &TR = getTimeReport();
+  std::string name = (fn + " (" + mode + ")").str();
+  auto &found = TR.functions[name];
+  if (!found)
+    found.reset(new EnzymeTimeRecord(name, name, TR.functionGroup, true));
+  record = found.get();
+  enterRegion(record);
+}
+
+EnzymeTimeRegion::~EnzymeTimeRegion() {
+  if (record)
+    exitRegion(record);
+}
+
+void printEnzymeTimeReport(StringRef module) {
+  if (!timeReportEnabled())
+    return;
+  auto &TR = getTimeReport();
+  assert(TR.phaseStack.empty() && TR.functionStack.empty());
+
+  if (!EnzymeTimeReportJSON.empty()) {
+    std::error_code EC;
+#if LLVM_VERSION_MAJOR >= 9
+    raw_fd_ostream OS(EnzymeTimeReportJSON, EC, sys::fs::OF_Text);
+#else
+    raw_fd_ostream OS(EnzymeTimeReportJSON, EC, sys::fs::F_Text);
+#endif
+    if (EC) {
+      errs() << "could not open " << EnzymeTimeReportJSON << ": "
+             << EC.message() << "\n";
+    } else {
+      OS << "{\n  \"module\": ";
+      writeJSONString(OS, module);
+      OS << ",\n  \"phases\": {\n";
+      for (unsigned i = 0; i < NumEnzymePhases; i++) {
+        if (i != 0)
+          OS << ",\n";
+        writeJSONRecord(OS, PhaseNames[i], *TR.phases[i]);
+      }
+      OS << "\n  },\n  \"functions\": {\n";
+      bool first = true;
+      for (auto &pair : TR.functions) {
+        if (!first)
+          OS << ",\n";
+        first = false;
+        writeJSONRecord(OS, pair.first, *pair.second);
+      }
+      OS << "\n  }\n}\n";
+    }
+  }
+
+  if (EnzymeTimeReport) {
+    auto OS = CreateInfoOutputFile();
+    TR.phaseGroup.print(*OS);
+    TR.functionGroup.print(*OS);
+  }
+
+  TR.phaseGroup.clear();
+  TR.functionGroup.clear();
+  for (auto &rec : TR.phases) {
+    rec->calls = 0;
+    rec->peakMemory = 0;
+  }
+  TR.functions.clear();
+}
@@ -0,0 +1,71 @@
+//===- TimeReport.h - Compile time spent in each phase of Enzyme ---------===//
+//
+//                             Enzyme Project
+//
+// Part of the Enzyme Project, under the Apache License v2.0 with LLVM
+// Exceptions. See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// If using this code in an academic setting, please cite the following:
+// @incollection{enzymeNeurips,
+// title = {Instead of Rewriting Foreign Code for Machine Learning,
+//          Automatically Synthesize Fast Gradients},
+// author = {Moses, William S. and Churavy, Valentin},
+// booktitle = {Advances in Neural Information Processing Systems 33},
+// year = {2020},
+// note = {To appear in},
+// }
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the regions timed by -enzyme-time-report, which records
+// the time, number of entries and peak heap usage of each phase of derivative
+// generation and of each differentiated function.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef ENZYME_TIME_REPORT_H
+#define ENZYME_TIME_REPORT_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+
+extern "C" {
+/// Record time spent in each phase and each differentiated function
+extern llvm::cl::opt<bool> EnzymeTimeReport;
+/// File to which the time report is also written as JSON
+extern llvm::cl::opt<std::string> EnzymeTimeReportJSON;
+}
+
+enum class EnzymePhase {
+  Preprocess,
+  TypeAnalysis,
+  ActivityAnalysis,
+  MinCut,
+  Synthesis,
+  PostOpt,
+};
+constexpr unsigned NumEnzymePhases = (unsigned)EnzymePhase::PostOpt + 1;
+
+struct EnzymeTimeRecord;
+
+/// Time attributed to a phase, or to a differentiated function, while this
+/// object is live. Regions nest: time is only attributed to the innermost
+/// region of each kind, so the phases of a report add up to the total.
+class EnzymeTimeRegion {
+  EnzymeTimeRecord *record;
+
+public:
+  EnzymeTimeRegion(EnzymePhase phase);
+  /// Time attributed to generating the derivative of `fn` in `mode`.
+  EnzymeTimeRegion(llvm::StringRef fn, llvm::StringRef mode);
+  ~EnzymeTimeRegion();
+  EnzymeTimeRegion(const EnzymeTimeRegion &) = delete;
+  EnzymeTimeRegion &operator=(const EnzymeTimeRegion &) = delete;
+};
+
+/// Print the time report accumulated while differentiating `module`, write
+/// it to the JSON file if requested, and reset it.
+void printEnzymeTimeReport(llvm::StringRef module);
+
+#endif
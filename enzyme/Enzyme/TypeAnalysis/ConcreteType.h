@@ -30,6 +30,7 @@
 
 #include <string>
 
+#include "llvm/ADT/Hashing.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Type.h"
 #include "llvm/Support/ErrorHandling.h"
@@ -509,4 +510,9 @@ public:
 // Convert ConcreteType to string
 static inline std::string to_string(const ConcreteType dt) { return dt.str(); }
 
+/// Hash concrete types for use in hash tables
+static inline llvm::hash_code hash_value(const ConcreteType dt) {
+  return llvm::hash_combine(dt.SubTypeEnum, dt.SubType);
+}
+
 #endif
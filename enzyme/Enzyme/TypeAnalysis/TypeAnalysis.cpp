@@ -24,6 +24,7 @@
 //===----------------------------------------------------------------------===//
 #include <cstdint>
 #include <deque>
+#include <mutex>
 
 #include <llvm/Config/llvm-config.h>
 
@@ -38,6 +39,7 @@
 #include "llvm/IR/InstIterator.h"
 
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 
 #include "llvm/ADT/SmallSet.h"
@@ -49,6 +51,7 @@
 
 #include "../FunctionUtils.h"
 #include "../LibraryFuncs.h"
+#include "../TimeReport.h"
 
 #include "RustDebugInfo.h"
 #include "TBAA.h"
@@ -70,6 +73,10 @@ llvm::cl::opt<bool> RustTypeRules("enzyme-rust-type", cl::init(false),
 llvm::cl::opt<bool> EnzymeStrictAliasing(
     "enzyme-strict-aliasing", cl::init(true), cl::Hidden,
     cl::desc("Assume strict aliasing of types / type stability"));
+
+llvm::cl::opt<unsigned> EnzymeTypeAnalysisThreads(
+    "enzyme-type-analysis-threads", cl::init(1), cl::Hidden,
+    cl::desc("Number of threads analyzing independent functions"));
 }
 
 const std::map<std::string, llvm::Intrinsic::ID> LIBM_FUNCTIONS = {
@@ -177,6 +184,19 @@ const std::map<std::string, llvm::Intrinsic::ID> LIBM_FUNCTIONS = {
 #endif
 };
 
+/// Whether several threads are analyzing functions, in which case the state
+/// they share through the LLVMContext and the analysis manager must only be
+/// used while holding SharedStateMutex.
+static bool ParallelTypeAnalysis = false;
+static std::mutex SharedStateMutex;
+
+/// Lock the state shared by concurrent analyses, if there are any
+static std::unique_lock<std::mutex> lockSharedState() {
+  if (!ParallelTypeAnalysis)
+    return std::unique_lock<std::mutex>();
+  return std::unique_lock<std::mutex>(SharedStateMutex);
+}
+
 TypeAnalyzer::TypeAnalyzer(const FnTypeInfo &fn, TypeAnalysis &TA,
                            uint8_t direction)
     : notForAnalysis(getGuaranteedUnreachable(fn.Function)), intseen(),
@@ -222,6 +242,37 @@ TypeAnalyzer::TypeAnalyzer(
          fntypeinfo.Function->getFunctionType()->getNumParams());
 }
 
+/// Byte offset of indexing an object of type Ty with the constant indices Idx,
+/// as a getelementptr would compute it. Unlike creating a temporary
+/// getelementptr, this does not create any constants or instructions in the
+/// context, allowing functions to be analyzed concurrently.
+static int64_t getConstantOffset(const DataLayout &DL, Type *Ty,
+                                 ArrayRef<int64_t> Idx) {
+  assert(Idx.size() != 0);
+  int64_t Off = Idx[0] * (int64_t)(DL.getTypeAllocSizeInBits(Ty) / 8);
+  for (auto I : Idx.drop_front()) {
+    if (auto ST = dyn_cast<StructType>(Ty)) {
+      Off += DL.getStructLayout(ST)->getElementOffset(I);
+      Ty = ST->getElementType(I);
+    } else {
+      if (auto AT = dyn_cast<ArrayType>(Ty))
+        Ty = AT->getElementType();
+      else
+        Ty = cast<VectorType>(Ty)->getElementType();
+      Off += I * (int64_t)(DL.getTypeAllocSizeInBits(Ty) / 8);
+    }
+  }
+  return Off;
+}
+
+/// Byte offset of a getelementptr whose indices are all constant integers
+static int64_t getConstantOffset(const DataLayout &DL, GEPOperator *GEP) {
+  SmallVector<int64_t, 4> Idx;
+  for (auto &Ind : GEP->indices())
+    Idx.push_back(cast<ConstantInt>(Ind)->getSExtValue());
+  return getConstantOffset(DL, GEP->getSourceElementType(), Idx);
+}
+
 /// Given a constant value, deduce any type information applicable
 void getConstantAnalysis(Constant *Val, TypeAnalyzer &TA,
                          std::map<llvm::Value *, TypeTree> &analysis) {
@@ -303,24 +354,7 @@ void getConstantAnalysis(Constant *Val, TypeAnalyzer &TA,
                       7) /
                      8;
 
-      Value *vec[2] = {
-          ConstantInt::get(Type::getInt64Ty(Val->getContext()), 0),
-          ConstantInt::get(Type::getInt32Ty(Val->getContext()), i),
-      };
-      auto g2 = GetElementPtrInst::Create(
-          Val->getType(),
-          UndefValue::get(PointerType::getUnqual(Val->getType())), vec);
-#if LLVM_VERSION_MAJOR > 6
-      APInt ai(DL.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-#else
-      APInt ai(DL.getPointerSize(g2->getPointerAddressSpace()) * 8, 0);
-#endif
-      g2->accumulateConstantOffset(DL, ai);
-      // Using destructor rather than eraseFromParent
-      //   as g2 has no parent
-      delete g2;
-
-      int Off = (int)ai.getLimitedValue();
+      int Off = (int)getConstantOffset(DL, Val->getType(), {0, (int64_t)i});
 
       getConstantAnalysis(Op, TA, analysis);
       auto mid = analysis[Op];
@@ -357,24 +391,7 @@ void getConstantAnalysis(Constant *Val, TypeAnalyzer &TA,
                       7) /
                      8;
 
-      Value *vec[2] = {
-          ConstantInt::get(Type::getInt64Ty(Val->getContext()), 0),
-          ConstantInt::get(Type::getInt32Ty(Val->getContext()), i),
-      };
-      auto g2 = GetElementPtrInst::Create(
-          Val->getType(),
-          UndefValue::get(PointerType::getUnqual(Val->getType())), vec);
-#if LLVM_VERSION_MAJOR > 6
-      APInt ai(DL.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-#else
-      APInt ai(DL.getPointerSize(g2->getPointerAddressSpace()) * 8, 0);
-#endif
-      g2->accumulateConstantOffset(DL, ai);
-      // Using destructor rather than eraseFromParent
-      //   as g2 has no parent
-      delete g2;
-
-      int Off = (int)ai.getLimitedValue();
+      int Off = (int)getConstantOffset(DL, Val->getType(), {0, (int64_t)i});
 
       getConstantAnalysis(Op, TA, analysis);
       auto mid = analysis[Op];
@@ -413,18 +430,7 @@ void getConstantAnalysis(Constant *Val, TypeAnalyzer &TA,
     if (CE->getOpcode() == Instruction::GetElementPtr &&
         llvm::all_of(CE->operand_values(),
                      [](Value *v) { return isa<ConstantInt>(v); })) {
-      auto g2 = cast<GetElementPtrInst>(CE->getAsInstruction());
-#if LLVM_VERSION_MAJOR > 6
-      APInt ai(DL.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-#else
-      APInt ai(DL.getPointerSize(g2->getPointerAddressSpace()) * 8, 0);
-#endif
-      g2->accumulateConstantOffset(DL, ai);
-      // Using destructor rather than eraseFromParent
-      //   as g2 has no parent
-      delete g2;
-
-      int off = (int)ai.getLimitedValue();
+      int off = (int)getConstantOffset(DL, cast<GEPOperator>(CE));
 
       // TODO also allow negative offsets
       if (off < 0) {
@@ -687,6 +693,8 @@ void TypeAnalyzer::updateAnalysis(Value *Val, TypeTree Data, Value *Origin) {
         analysis[Val] = Data;
       }
     }
+    analysis[Val].intern();
+
     // Add val so it can explicitly propagate this new info, if able to
     if (Val != Origin)
       addToWorkList(Val);
@@ -1152,25 +1160,14 @@ void TypeAnalyzer::visitConstantExpr(ConstantExpr &CE) {
                    [](Value *v) { return isa<ConstantInt>(v); })) {
 
     auto &DL = fntypeinfo.Function->getParent()->getDataLayout();
-    auto g2 = cast<GetElementPtrInst>(CE.getAsInstruction());
-#if LLVM_VERSION_MAJOR > 6
-    APInt ai(DL.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-#else
-    APInt ai(DL.getPointerSize(g2->getPointerAddressSpace()) * 8, 0);
-#endif
-    g2->accumulateConstantOffset(DL, ai);
-    // Using destructor rather than eraseFromParent
-    //   as g2 has no parent
-
+    auto gep = cast<GEPOperator>(&CE);
     int maxSize = -1;
     if (cast<ConstantInt>(CE.getOperand(1))->getLimitedValue() == 0) {
       maxSize =
-          DL.getTypeAllocSizeInBits(g2->getType()->getPointerElementType()) / 8;
+          DL.getTypeAllocSizeInBits(CE.getType()->getPointerElementType()) / 8;
     }
 
-    delete g2;
-
-    int off = (int)ai.getLimitedValue();
+    int off = (int)getConstantOffset(DL, gep);
 
     // TODO also allow negative offsets
     if (off < 0) {
@@ -1428,16 +1425,19 @@ void TypeAnalyzer::visitGetElementPtrInst(GetElementPtrInst &gep) {
     updateAnalysis(gep.getPointerOperand(),
                    TypeTree(getAnalysis(&gep).Inner0()).Only(-1), &gep);
 
-  SmallVector<std::set<Value *>, 4> idnext;
+  SmallVector<std::set<int64_t>, 4> idnext;
 
   for (auto &a : gep.indices()) {
     auto iset = fntypeinfo.knownIntegralValues(a, DT, intseen, SE);
-    std::set<Value *> vset;
+    std::set<int64_t> vset;
     for (auto i : iset) {
       // Don't consider negative indices of gep
       if (i < 0)
         continue;
-      vset.insert(ConstantInt::get(a->getType(), i));
+      // Indices are truncated to the width of their operand
+      vset.insert(
+          APInt(a->getType()->getScalarSizeInBits(), (uint64_t)i)
+              .getSExtValue());
     }
     idnext.push_back(vset);
     if (idnext.back().size() == 0)
@@ -1457,28 +1457,15 @@ void TypeAnalyzer::visitGetElementPtrInst(GetElementPtrInst &gep) {
 
   bool seenIdx = false;
 
-  for (auto vec : getSet<Value *>(idnext, idnext.size() - 1)) {
-    auto g2 = GetElementPtrInst::Create(gep.getSourceElementType(),
-                                        gep.getOperand(0), vec);
-#if LLVM_VERSION_MAJOR > 6
-    APInt ai(DL.getIndexSizeInBits(gep.getPointerAddressSpace()), 0);
-#else
-    APInt ai(DL.getPointerSize(gep.getPointerAddressSpace()) * 8, 0);
-#endif
-    bool valid = g2->accumulateConstantOffset(DL, ai);
-    assert(valid);
-    // Using destructor rather than eraseFromParent
-    //   as g2 has no parent
-    delete g2;
-
-    int off = (int)ai.getLimitedValue();
+  for (auto vec : getSet<int64_t>(idnext, idnext.size() - 1)) {
+    int off = (int)getConstantOffset(DL, gep.getSourceElementType(), vec);
 
     // TODO also allow negative offsets
     if (off < 0)
       continue;
 
     int maxSize = -1;
-    if (cast<ConstantInt>(vec[0])->getLimitedValue() == 0) {
+    if (vec[0] == 0) {
       maxSize =
           DL.getTypeAllocSizeInBits(gep.getType()->getPointerElementType()) / 8;
     }
@@ -2005,21 +1992,8 @@ void TypeAnalyzer::visitShuffleVectorInst(ShuffleVectorInst &I) {
   for (size_t i = 0; i < mask.size(); ++i) {
     int newOff;
     {
-      Value *vec[2] = {ConstantInt::get(Type::getInt64Ty(I.getContext()), 0),
-                       ConstantInt::get(Type::getInt64Ty(I.getContext()), i)};
-      auto ud =
-          UndefValue::get(PointerType::getUnqual(I.getOperand(0)->getType()));
-      auto g2 = GetElementPtrInst::Create(I.getOperand(0)->getType(), ud, vec);
-#if LLVM_VERSION_MAJOR > 6
-      APInt ai(dl.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-#else
-      APInt ai(dl.getPointerSize(g2->getPointerAddressSpace()) * 8, 0);
-#endif
-      g2->accumulateConstantOffset(dl, ai);
-      // Using destructor rather than eraseFromParent
-      //   as g2 has no parent
-      delete g2;
-      newOff = (int)ai.getLimitedValue();
+      newOff = (int)getConstantOffset(dl, I.getOperand(0)->getType(),
+                                      {0, (int64_t)i});
       // there is a bug in LLVM, this is the correct offset
       if (cast<VectorType>(I.getOperand(lhs)->getType())
               ->getElementType()
@@ -2040,29 +2014,14 @@ void TypeAnalyzer::visitShuffleVectorInst(ShuffleVectorInst &I) {
       }
     } else {
       if ((size_t)mask[i] < numFirst) {
-        Value *vec[2] = {
-            ConstantInt::get(Type::getInt64Ty(I.getContext()), 0),
-            ConstantInt::get(Type::getInt64Ty(I.getContext()), mask[i])};
-        auto ud =
-            UndefValue::get(PointerType::getUnqual(I.getOperand(0)->getType()));
-        auto g2 =
-            GetElementPtrInst::Create(I.getOperand(0)->getType(), ud, vec);
-#if LLVM_VERSION_MAJOR > 6
-        APInt ai(dl.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-#else
-        APInt ai(dl.getPointerSize(g2->getPointerAddressSpace()) * 8, 0);
-#endif
-        g2->accumulateConstantOffset(dl, ai);
-        // Using destructor rather than eraseFromParent
-        //   as g2 has no parent
-        int oldOff = (int)ai.getLimitedValue();
+        int oldOff = (int)getConstantOffset(dl, I.getOperand(0)->getType(),
+                                            {0, (int64_t)mask[i]});
         // there is a bug in LLVM, this is the correct offset
         if (cast<VectorType>(I.getOperand(lhs)->getType())
                 ->getElementType()
                 ->isIntegerTy(1)) {
           oldOff = mask[i] / 8;
         }
-        delete g2;
         if (direction & UP) {
           updateAnalysis(I.getOperand(lhs),
                          getAnalysis(&I).ShiftIndices(dl, newOff, size, oldOff),
@@ -2073,29 +2032,15 @@ void TypeAnalyzer::visitShuffleVectorInst(ShuffleVectorInst &I) {
                         .ShiftIndices(dl, oldOff, size, newOff);
         }
       } else {
-        Value *vec[2] = {ConstantInt::get(Type::getInt64Ty(I.getContext()), 0),
-                         ConstantInt::get(Type::getInt64Ty(I.getContext()),
-                                          mask[i] - numFirst)};
-        auto ud =
-            UndefValue::get(PointerType::getUnqual(I.getOperand(0)->getType()));
-        auto g2 =
-            GetElementPtrInst::Create(I.getOperand(0)->getType(), ud, vec);
-#if LLVM_VERSION_MAJOR > 6
-        APInt ai(dl.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-#else
-        APInt ai(dl.getPointerSize(g2->getPointerAddressSpace()) * 8, 0);
-#endif
-        g2->accumulateConstantOffset(dl, ai);
-        // Using destructor rather than eraseFromParent
-        //   as g2 has no parent
-        int oldOff = (int)ai.getLimitedValue();
+        int oldOff =
+            (int)getConstantOffset(dl, I.getOperand(0)->getType(),
+                                   {0, (int64_t)(mask[i] - numFirst)});
         // there is a bug in LLVM, this is the correct offset
         if (cast<VectorType>(I.getOperand(lhs)->getType())
                 ->getElementType()
                 ->isIntegerTy(1)) {
           oldOff = (mask[i] - numFirst) / 8;
         }
-        delete g2;
         if (direction & UP) {
           updateAnalysis(I.getOperand(rhs),
                          getAnalysis(&I).ShiftIndices(dl, newOff, size, oldOff),
@@ -2116,24 +2061,11 @@ void TypeAnalyzer::visitShuffleVectorInst(ShuffleVectorInst &I) {
 
 void TypeAnalyzer::visitExtractValueInst(ExtractValueInst &I) {
   auto &dl = fntypeinfo.Function->getParent()->getDataLayout();
-  SmallVector<Value *, 4> vec;
-  vec.push_back(ConstantInt::get(Type::getInt64Ty(I.getContext()), 0));
+  SmallVector<int64_t, 4> vec = {0};
   for (auto ind : I.indices()) {
-    vec.push_back(ConstantInt::get(Type::getInt32Ty(I.getContext()), ind));
+    vec.push_back(ind);
   }
-  auto ud = UndefValue::get(PointerType::getUnqual(I.getOperand(0)->getType()));
-  auto g2 = GetElementPtrInst::Create(I.getOperand(0)->getType(), ud, vec);
-#if LLVM_VERSION_MAJOR > 6
-  APInt ai(dl.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-#else
-  APInt ai(dl.getPointerSize(g2->getPointerAddressSpace()) * 8, 0);
-#endif
-  g2->accumulateConstantOffset(dl, ai);
-  // Using destructor rather than eraseFromParent
-  //   as g2 has no parent
-  delete g2;
-
-  int off = (int)ai.getLimitedValue();
+  int off = (int)getConstantOffset(dl, I.getOperand(0)->getType(), vec);
   int size = dl.getTypeSizeInBits(I.getType()) / 8;
 
   if (direction & DOWN)
@@ -2149,24 +2081,11 @@ void TypeAnalyzer::visitExtractValueInst(ExtractValueInst &I) {
 
 void TypeAnalyzer::visitInsertValueInst(InsertValueInst &I) {
   auto &dl = fntypeinfo.Function->getParent()->getDataLayout();
-  SmallVector<Value *, 4> vec = {
-      ConstantInt::get(Type::getInt64Ty(I.getContext()), 0)};
+  SmallVector<int64_t, 4> vec = {0};
   for (auto ind : I.indices()) {
-    vec.push_back(ConstantInt::get(Type::getInt32Ty(I.getContext()), ind));
+    vec.push_back(ind);
   }
-  auto ud = UndefValue::get(PointerType::getUnqual(I.getOperand(0)->getType()));
-  auto g2 = GetElementPtrInst::Create(I.getOperand(0)->getType(), ud, vec);
-#if LLVM_VERSION_MAJOR > 6
-  APInt ai(dl.getIndexSizeInBits(g2->getPointerAddressSpace()), 0);
-#else
-  APInt ai(dl.getPointerSize(g2->getPointerAddressSpace()) * 8, 0);
-#endif
-  g2->accumulateConstantOffset(dl, ai);
-  // Using destructor rather than eraseFromParent
-  //   as g2 has no parent
-  delete g2;
-
-  int off = (int)ai.getLimitedValue();
+  int off = (int)getConstantOffset(dl, I.getOperand(0)->getType(), vec);
 
   int agg_size = dl.getTypeSizeInBits(I.getType()) / 8;
   int ins_size =
@@ -4504,7 +4423,8 @@ FnTypeInfo::knownIntegralValues(llvm::Value *val, const DominatorTree &DT,
     }
   }
   if (auto pn = dyn_cast<PHINode>(val)) {
-    if (SE.isSCEVable(pn->getType()))
+    // ScalarEvolution lazily computes and caches its results
+    if (auto lock = lockSharedState(); SE.isSCEVable(pn->getType()))
       if (auto S = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(pn))) {
         if (auto StartC = dyn_cast<SCEVConstant>(S->getStart())) {
           auto L = S->getLoop();
@@ -4694,7 +4614,13 @@ bool TypeAnalyzer::mustRemainInteger(Value *val, bool *returned) {
   seen[val] = std::make_pair(true, false);
   for (auto u : val->users()) {
     if (auto SI = dyn_cast<StoreInst>(u)) {
-      if (parseTBAA(*SI, DL).Inner0().isIntegral())
+      bool integral;
+      {
+        // Parsing TBAA may create metadata in the context
+        auto lock = lockSharedState();
+        integral = parseTBAA(*SI, DL).Inner0().isIntegral();
+      }
+      if (integral)
         continue;
       seen[val].first = false;
       continue;
@@ -4879,6 +4805,7 @@ void TypeAnalyzer::visitIPOCall(CallInst &call, Function &fn) {
 }
 
 TypeResults TypeAnalysis::analyzeFunction(const FnTypeInfo &fn) {
+  EnzymeTimeRegion timer(EnzymePhase::TypeAnalysis);
   assert(fn.KnownValues.size() ==
          fn.Function->getFunctionType()->getNumParams());
   assert(fn.Function);
@@ -4896,7 +4823,13 @@ TypeResults TypeAnalysis::analyzeFunction(const FnTypeInfo &fn) {
     return TypeResults(analysis);
   }
 
-  auto res = analyzedFunctions.emplace(fn, new TypeAnalyzer(fn, *this));
+  TypeAnalyzer *analyzer;
+  {
+    // The analysis manager is shared by concurrent analyses
+    auto lock = lockSharedState();
+    analyzer = new TypeAnalyzer(fn, *this);
+  }
+  auto res = analyzedFunctions.emplace(fn, analyzer);
   auto &analysis = *res.first->second;
 
   if (EnzymePrintType) {
@@ -4914,10 +4847,14 @@ TypeResults TypeAnalysis::analyzeFunction(const FnTypeInfo &fn) {
   }
 
   analysis.prepareArgs();
-  if (RustTypeRules) {
-    analysis.considerRustDebugInfo();
+  {
+    // Parsing type metadata may create metadata in the context
+    auto lock = lockSharedState();
+    if (RustTypeRules) {
+      analysis.considerRustDebugInfo();
+    }
+    analysis.considerTBAA();
   }
-  analysis.considerTBAA();
   analysis.run();
 
   if (analysis.fntypeinfo.Function != fn.Function) {
@@ -5132,3 +5069,154 @@ std::set<int64_t> TypeAnalyzer::knownIntegralValues(Value *val) {
 }
 
 void TypeAnalysis::clear() { analyzedFunctions.clear(); }
+
+/// Prepare the functions reachable from the functions of Work to be analyzed
+/// concurrently, computing the analyses, data layouts, constants and metadata
+/// kinds that their analysis would otherwise lazily create in shared state.
+/// Returns false if analyzing them requires temporarily inserting
+/// instructions, which is not possible while other threads read the module.
+static bool prepareConcurrentAnalysis(
+    FunctionAnalysisManager &FAM,
+    ArrayRef<std::pair<TypeAnalysis *, FnTypeInfo>> Work) {
+  auto &DL = Work[0].second.Function->getParent()->getDataLayout();
+  auto &Ctx = Work[0].second.Function->getContext();
+  SmallPtrSet<Function *, 16> seenFunctions;
+  SmallPtrSet<Constant *, 16> seenConstants;
+  SmallPtrSet<Type *, 16> seenTypes;
+  SmallVector<Function *, 16> todo;
+
+  std::function<void(Type *)> prepareType = [&](Type *T) {
+    if (!seenTypes.insert(T).second)
+      return;
+    if (auto ST = dyn_cast<StructType>(T))
+      if (!ST->isOpaque() && ST->isSized())
+        DL.getStructLayout(ST);
+    for (auto sub : T->subtypes())
+      prepareType(sub);
+  };
+
+  std::function<bool(Value *)> prepareValue = [&](Value *V) {
+    prepareType(V->getType());
+    if (auto F = dyn_cast<Function>(V)) {
+      if (!F->empty() && seenFunctions.insert(F).second)
+        todo.push_back(F);
+      return true;
+    }
+    auto C = dyn_cast<Constant>(V);
+    if (!C || !seenConstants.insert(C).second)
+      return true;
+    if (auto CE = dyn_cast<ConstantExpr>(C)) {
+      // Other constant expressions are analyzed as temporary instructions
+      if (CE->getOpcode() == Instruction::GetElementPtr &&
+          llvm::all_of(CE->operand_values(),
+                       [](Value *v) { return isa<ConstantInt>(v); }))
+        prepareType(cast<GEPOperator>(CE)->getSourceElementType());
+      else if (!CE->isCast())
+        return false;
+    }
+    if (auto GV = dyn_cast<GlobalVariable>(C)) {
+      prepareType(GV->getValueType());
+      if (GV->hasInitializer())
+        return prepareValue(GV->getInitializer());
+      return true;
+    }
+    if (auto CD = dyn_cast<ConstantDataSequential>(C)) {
+      for (unsigned i = 0, size = CD->getNumElements(); i < size; ++i)
+        CD->getElementAsConstant(i);
+      return true;
+    }
+    for (auto &Op : C->operands())
+      if (!prepareValue(Op))
+        return false;
+    return true;
+  };
+
+  for (auto &pair : Work)
+    prepareValue(pair.second.Function);
+
+  while (!todo.empty()) {
+    Function *F = todo.pop_back_val();
+    FAM.getResult<TargetLibraryAnalysis>(*F);
+    // Dominance queries otherwise lazily number the trees
+    FAM.getResult<DominatorTreeAnalysis>(*F).updateDFSNumbers();
+    FAM.getResult<PostDominatorTreeAnalysis>(*F).updateDFSNumbers();
+    FAM.getResult<LoopAnalysis>(*F);
+    FAM.getResult<ScalarEvolutionAnalysis>(*F);
+    for (auto &arg : F->args())
+      prepareType(arg.getType());
+    for (BasicBlock &BB : *F) {
+#if LLVM_VERSION_MAJOR >= 11
+      // As does ordering instructions within a block
+      BB.renumberInstructions();
+#endif
+      for (Instruction &I : BB) {
+        // Invokes are analyzed as temporary calls
+        if (isa<InvokeInst>(&I))
+          return false;
+        prepareType(I.getType());
+        if (auto gep = dyn_cast<GetElementPtrInst>(&I))
+          prepareType(gep->getSourceElementType());
+        if (auto AI = dyn_cast<AllocaInst>(&I))
+          prepareType(AI->getAllocatedType());
+        if (auto call = dyn_cast<CallBase>(&I))
+          prepareType(call->getFunctionType());
+        for (auto &Op : I.operands())
+          if (!prepareValue(Op))
+            return false;
+      }
+    }
+  }
+
+  Ctx.getMDKindID("enzyme_gradient");
+  Ctx.getMDKindID("enzyme_derivative");
+  return true;
+}
+
+void analyzeFunctionsInParallel(
+    ArrayRef<std::pair<TypeAnalysis *, FnTypeInfo>> Work) {
+  unsigned threads =
+      std::min((size_t)EnzymeTypeAnalysisThreads.getValue(), Work.size());
+  // Printing, timing and custom error handlers are not thread-safe
+  bool serial = threads <= 1 || EnzymePrintType || EnzymeTimeReport ||
+                !EnzymeTimeReportJSON.empty() || CustomErrorHandler;
+  if (!serial) {
+    for (auto &pair : Work)
+      if (&pair.first->FAM != &Work[0].first->FAM) {
+        serial = true;
+        break;
+      }
+  }
+  if (serial || !prepareConcurrentAnalysis(Work[0].first->FAM, Work)) {
+    for (auto &pair : Work)
+      pair.first->analyzeFunction(pair.second);
+    return;
+  }
+
+  // Warnings of each function, buffered so that they are not interleaved
+  std::vector<std::string> Warnings(Work.size());
+  ParallelTypeAnalysis = true;
+  {
+#if LLVM_VERSION_MAJOR >= 10
+    ThreadPool pool(hardware_concurrency(threads));
+#else
+    ThreadPool pool(threads);
+#endif
+    for (size_t i = 0; i < Work.size(); i++) {
+      TypeAnalysis *TA = Work[i].first;
+      const FnTypeInfo *fn = &Work[i].second;
+      std::string *warnings = &Warnings[i];
+      pool.async([TA, fn, warnings]() {
+        raw_string_ostream ss(*warnings);
+        TypeWarningStream = &ss;
+        TA->analyzeFunction(*fn);
+        TypeWarningStream = nullptr;
+        ss.flush();
+      });
+    }
+    pool.wait();
+  }
+  ParallelTypeAnalysis = false;
+  // Print the warnings in the order the functions were given
+  for (auto &warnings : Warnings)
+    errs() << warnings;
+}
@@ -46,10 +46,22 @@
 #include "llvm/Analysis/PostDominators.h"
 #include "llvm/IR/Dominators.h"
 
+#include "llvm/Support/CommandLine.h"
+
 #include "TypeTree.h"
 
 extern const std::map<std::string, llvm::Intrinsic::ID> LIBM_FUNCTIONS;
 
+extern "C" {
+/// Maximum offset for type trees to keep
+extern llvm::cl::opt<int> MaxIntOffset;
+extern llvm::cl::opt<bool> RustTypeRules;
+/// Assume strict aliasing of types / type stability
+extern llvm::cl::opt<bool> EnzymeStrictAliasing;
+/// Number of threads analyzing independent functions, serially if 1
+extern llvm::cl::opt<unsigned> EnzymeTypeAnalysisThreads;
+}
+
 static inline bool isMemFreeLibMFunction(llvm::StringRef str,
                                          llvm::Intrinsic::ID *ID = nullptr) {
   if (str.startswith("__") && str.endswith("_finite")) {
@@ -141,6 +153,23 @@ static inline bool operator<(const FnTypeInfo &lhs, const FnTypeInfo &rhs) {
   return false;
 }
 
+static inline bool operator==(const FnTypeInfo &lhs, const FnTypeInfo &rhs) {
+  return lhs.Function == rhs.Function && lhs.Return == rhs.Return &&
+         lhs.Arguments == rhs.Arguments && lhs.KnownValues == rhs.KnownValues;
+}
+
+/// Hash a FnTypeInfo for use in hash tables, consistent with operator==
+static inline llvm::hash_code hash_value(const FnTypeInfo &info) {
+  llvm::hash_code H = llvm::hash_combine(info.Function, info.Return);
+  for (auto &pair : info.Arguments)
+    H = llvm::hash_combine(H, pair.first, pair.second);
+  for (auto &pair : info.KnownValues)
+    H = llvm::hash_combine(
+        H, pair.first,
+        llvm::hash_combine_range(pair.second.begin(), pair.second.end()));
+  return H;
+}
+
 class TypeAnalyzer;
 class TypeAnalysis;
 
@@ -377,4 +406,12 @@ public:
   void clear();
 };
 
+/// Analyze each function of Work with the corresponding TypeAnalysis, which
+/// must all be distinct and share one analysis manager, using up to
+/// EnzymeTypeAnalysisThreads threads. The results are the same as analyzing
+/// the functions one after another, which is done instead if the functions
+/// cannot be analyzed concurrently.
+void analyzeFunctionsInParallel(
+    llvm::ArrayRef<std::pair<TypeAnalysis *, FnTypeInfo>> Work);
+
 #endif
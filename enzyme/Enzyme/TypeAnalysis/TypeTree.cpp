@@ -33,6 +33,9 @@
 
 #include "llvm/Support/CommandLine.h"
 
+#include <mutex>
+#include <unordered_map>
+
 #include "TypeTree.h"
 
 using namespace llvm;
@@ -46,3 +49,68 @@ llvm::cl::opt<bool> EnzymeTypeWarning("enzyme-type-warning", cl::init(true),
                                       cl::Hidden,
                                       cl::desc("Print Type Depth Warning"));
 }
+
+thread_local llvm::raw_ostream *TypeWarningStream = nullptr;
+
+/// Table of interned TypeTree contents, by hash. Entries are weak so that
+/// contents no longer used by any tree are freed.
+static std::unordered_map<size_t,
+                          llvm::SmallVector<std::weak_ptr<TypeTreeStorage>, 1>>
+    InternedTypeTrees;
+static std::mutex InternedTypeTreesMutex;
+/// Number of interned contents since expired entries were last removed
+static size_t InternedSinceSweep = 0;
+
+void TypeTree::intern() {
+  if (!data || data->interned)
+    return;
+
+  size_t hash = hash_value(data->mapping);
+  auto &minIndices = data->minIndices;
+  size_t key = hash_combine(
+      hash, hash_combine_range(minIndices.begin(), minIndices.end()));
+
+  std::lock_guard<std::mutex> lock(InternedTypeTreesMutex);
+  auto &bucket = InternedTypeTrees[key];
+  for (auto it = bucket.begin(); it != bucket.end();) {
+    auto other = it->lock();
+    if (!other) {
+      it = bucket.erase(it);
+      continue;
+    }
+    if (other->mapping == data->mapping &&
+        other->minIndices == data->minIndices) {
+      data = other;
+      return;
+    }
+    ++it;
+  }
+
+  // Other trees may still be reading these contents, so intern a copy rather
+  // than modifying contents that are shared.
+  if (data.use_count() != 1) {
+    auto copy = new TypeTreeStorage();
+    copy->mapping = data->mapping;
+    copy->minIndices = data->minIndices;
+    data.reset(copy);
+  }
+  data->hash = hash;
+  data->interned = true;
+  bucket.push_back(data);
+
+  if (++InternedSinceSweep >= 4 * InternedTypeTrees.size() + 1024) {
+    InternedSinceSweep = 0;
+    for (auto it = InternedTypeTrees.begin(); it != InternedTypeTrees.end();) {
+      auto &entries = it->second;
+      entries.erase(llvm::remove_if(entries,
+                                    [](std::weak_ptr<TypeTreeStorage> &W) {
+                                      return W.expired();
+                                    }),
+                    entries.end());
+      if (entries.empty())
+        it = InternedTypeTrees.erase(it);
+      else
+        ++it;
+    }
+  }
+}
@@ -27,13 +27,21 @@
 // In the future this should be modified to better represent recursive types
 // rather than limiting the depth.
 //
+// The mapping is kept as an array sorted by offsets, which copies of a
+// TypeTree share until one of them is modified. The trees computed by Type
+// Analysis are additionally interned, so identical trees share their storage.
+//
 //===----------------------------------------------------------------------===//
 #ifndef ENZYME_TYPE_ANALYSIS_TYPE_TREE_H
 #define ENZYME_TYPE_ANALYSIS_TYPE_TREE_H 1
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
@@ -48,8 +56,18 @@ extern llvm::cl::opt<bool> EnzymeTypeWarning;
 constexpr int EnzymeMaxTypeDepth = 6;
 }
 
-/// Helper function to print a vector of ints to a string
-static inline std::string to_string(const std::vector<int> x) {
+/// Stream type depth warnings are printed to on this thread, or null for
+/// errs(). Concurrent type analyses each set a buffer of their own, so that
+/// their warnings are not interleaved.
+extern thread_local llvm::raw_ostream *TypeWarningStream;
+
+/// Stream to print type depth warnings to
+static inline llvm::raw_ostream &typeWarnings() {
+  return TypeWarningStream ? *TypeWarningStream : llvm::errs();
+}
+
+/// Helper function to print a sequence of ints to a string
+static inline std::string to_string(llvm::ArrayRef<int> x) {
   std::string out = "[";
   for (unsigned i = 0; i < x.size(); ++i) {
     if (i != 0)
@@ -60,34 +78,147 @@ static inline std::string to_string(const std::vector<int> x) {
   return out;
 }
 
-class TypeTree;
+/// Sequence of offsets leading to a ConcreteType in a TypeTree. As trees are
+/// never more than EnzymeMaxTypeDepth lookups deep, these are stored inline.
+typedef llvm::SmallVector<int, EnzymeMaxTypeDepth> TypeTreeIndices;
 
-typedef std::shared_ptr<const TypeTree> TypeResult;
-typedef std::map<const std::vector<int>, ConcreteType> ConcreteTypeMapType;
-typedef std::map<const std::vector<int>, const TypeResult> TypeTreeMapType;
+/// Map of offset sequences to ConcreteTypes, stored as an array sorted by the
+/// offsets rather than as a node-based map
+class ConcreteTypeMapType {
+public:
+  typedef std::pair<TypeTreeIndices, ConcreteType> value_type;
+  typedef std::vector<value_type>::iterator iterator;
+  typedef std::vector<value_type>::const_iterator const_iterator;
 
-/// Class representing the underlying types of values as
-/// sequences of offsets to a ConcreteType
-class TypeTree : public std::enable_shared_from_this<TypeTree> {
 private:
+  std::vector<value_type> elems;
+
+  static bool lessThan(const value_type &elem, llvm::ArrayRef<int> key) {
+    return std::lexicographical_compare(elem.first.begin(), elem.first.end(),
+                                        key.begin(), key.end());
+  }
+
+public:
+  iterator begin() { return elems.begin(); }
+  iterator end() { return elems.end(); }
+  const_iterator begin() const { return elems.begin(); }
+  const_iterator end() const { return elems.end(); }
+  size_t size() const { return elems.size(); }
+  bool empty() const { return elems.empty(); }
+  void clear() { elems.clear(); }
+
+  iterator find(llvm::ArrayRef<int> key) {
+    auto found = std::lower_bound(elems.begin(), elems.end(), key, lessThan);
+    if (found != elems.end() && llvm::ArrayRef<int>(found->first) == key)
+      return found;
+    return elems.end();
+  }
+  const_iterator find(llvm::ArrayRef<int> key) const {
+    auto found = std::lower_bound(elems.begin(), elems.end(), key, lessThan);
+    if (found != elems.end() && llvm::ArrayRef<int>(found->first) == key)
+      return found;
+    return elems.end();
+  }
+
+  /// Map key to CT unless key is already mapped, returning if inserted
+  bool insert(llvm::ArrayRef<int> key, ConcreteType CT) {
+    auto found = std::lower_bound(elems.begin(), elems.end(), key, lessThan);
+    if (found != elems.end() && llvm::ArrayRef<int>(found->first) == key)
+      return false;
+    elems.emplace(found, TypeTreeIndices(key.begin(), key.end()), CT);
+    return true;
+  }
+
+  /// Remove the mapping of key, returning if there was one
+  bool erase(llvm::ArrayRef<int> key) {
+    auto found = find(key);
+    if (found == elems.end())
+      return false;
+    elems.erase(found);
+    return true;
+  }
+
+  bool operator==(const ConcreteTypeMapType &RHS) const {
+    return elems == RHS.elems;
+  }
+  bool operator<(const ConcreteTypeMapType &RHS) const {
+    return elems < RHS.elems;
+  }
+};
+
+/// Hash the mappings of a TypeTree
+static inline llvm::hash_code hash_value(const ConcreteTypeMapType &mapping) {
+  llvm::hash_code H = llvm::hash_value(mapping.size());
+  for (auto &pair : mapping)
+    H = llvm::hash_combine(
+        H, llvm::hash_combine_range(pair.first.begin(), pair.first.end()),
+        pair.second);
+  return H;
+}
+
+/// Contents of a TypeTree, shared by copies of the tree until one of them is
+/// modified
+struct TypeTreeStorage {
   // mapping of known indices to type if one exists
   ConcreteTypeMapType mapping;
-  std::vector<int> minIndices;
+  TypeTreeIndices minIndices;
+  /// Whether this is the canonical storage of its contents, which may be
+  /// shared with any other tree and thus never be modified
+  bool interned = false;
+  /// Hash of the mapping, computed once interned
+  size_t hash = 0;
+};
+
+/// Class representing the underlying types of values as
+/// sequences of offsets to a ConcreteType
+class TypeTree {
+private:
+  /// Contents of the tree, null if empty
+  std::shared_ptr<TypeTreeStorage> data;
+
+  const TypeTreeIndices &getMinIndices() const {
+    static const TypeTreeIndices empty;
+    return data ? data->minIndices : empty;
+  }
+
+  /// Contents of the tree that can be modified, copying them if they are
+  /// shared with another tree. This invalidates references previously
+  /// obtained from getMapping.
+  TypeTreeStorage &mut() {
+    if (!data)
+      data.reset(new TypeTreeStorage());
+    else if (data->interned || data.use_count() != 1) {
+      auto copy = new TypeTreeStorage();
+      copy->mapping = data->mapping;
+      copy->minIndices = data->minIndices;
+      data.reset(copy);
+    }
+    return *data;
+  }
 
 public:
   TypeTree() {}
   TypeTree(ConcreteType dat) {
     if (dat != ConcreteType(BaseType::Unknown)) {
-      mapping.insert(std::pair<const std::vector<int>, ConcreteType>({}, dat));
+      mut().mapping.insert({}, dat);
     }
   }
 
   /// Utility helper to lookup the mapping
-  const ConcreteTypeMapType &getMapping() const { return mapping; }
+  const ConcreteTypeMapType &getMapping() const {
+    static const ConcreteTypeMapType empty;
+    return data ? data->mapping : empty;
+  }
+
+  /// Share storage with every other interned tree of the same contents. Trees
+  /// are interned once stored as the result of analyzing a value, which both
+  /// deduplicates the many identical trees and makes comparing them cheap.
+  void intern();
 
   /// Lookup the underlying ConcreteType at a given offset sequence
   /// or Unknown if none exists
-  ConcreteType operator[](const std::vector<int> Seq) const {
+  ConcreteType operator[](llvm::ArrayRef<int> Seq) const {
+    auto &mapping = getMapping();
     auto Found0 = mapping.find(Seq);
     if (Found0 != mapping.end())
       return Found0->second;
@@ -95,7 +226,7 @@ public:
     if (Len == 0)
       return BaseType::Unknown;
 
-    std::vector<std::vector<int>> todo[2];
+    llvm::SmallVector<TypeTreeIndices, 4> todo[2];
     todo[0].push_back({});
     int parity = 0;
     for (size_t i = 0, Len = Seq.size(); i < Len - 1; ++i) {
@@ -132,7 +263,8 @@ public:
   // Return true if this type tree is fully known (i.e. there
   // is no more information which could be added).
   bool IsFullyDetermined() const {
-    std::vector<int> offsets = {-1};
+    auto &mapping = getMapping();
+    TypeTreeIndices offsets = {-1};
     while (1) {
       auto found = mapping.find(offsets);
       if (found == mapping.end())
@@ -144,29 +276,28 @@ public:
   }
 
   /// Return if changed
-  bool insert(const std::vector<int> Seq, ConcreteType CT,
+  bool insert(llvm::ArrayRef<int> Seq, ConcreteType CT,
               bool intsAreLegalSubPointer = false) {
     size_t SeqSize = Seq.size();
     if (SeqSize > EnzymeMaxTypeDepth) {
       if (EnzymeTypeWarning)
-        llvm::errs() << "not handling more than " << EnzymeMaxTypeDepth
+        typeWarnings() << "not handling more than " << EnzymeMaxTypeDepth
                      << " pointer lookups deep dt:" << str()
                      << " adding v: " << to_string(Seq) << ": " << CT.str()
                      << "\n";
       return false;
     }
     if (SeqSize == 0) {
-      mapping.insert(std::pair<const std::vector<int>, ConcreteType>(Seq, CT));
+      mut().mapping.insert(Seq, CT);
       return true;
     }
 
     // check types at lower pointer offsets are either pointer or
     // anything. Don't insert into an anything
     {
-      std::vector<int> tmp(Seq);
-      while (tmp.size() > 0) {
-        tmp.erase(tmp.end() - 1);
-        auto found = mapping.find(tmp);
+      auto &mapping = getMapping();
+      for (size_t len = SeqSize - 1;; --len) {
+        auto found = mapping.find(Seq.take_front(len));
         if (found != mapping.end()) {
           if (found->second == BaseType::Anything)
             return false;
@@ -177,14 +308,18 @@ public:
           }
           assert(found->second == BaseType::Pointer);
         }
+        if (len == 0)
+          break;
       }
     }
 
+    auto &mapping = mut().mapping;
+    auto &minIndices = data->minIndices;
     bool changed = false;
 
     // if this is a ending -1, remove other elems if no more info
     if (Seq.back() == -1) {
-      std::set<std::vector<int>> toremove;
+      llvm::SmallVector<TypeTreeIndices, 4> toremove;
       for (const auto &pair : mapping) {
         if (pair.first.size() != SeqSize)
           continue;
@@ -197,15 +332,14 @@ public:
         }
         if (!matches)
           continue;
-
         if (intsAreLegalSubPointer && pair.second == BaseType::Integer &&
             CT == BaseType::Pointer) {
-          toremove.insert(pair.first);
+          toremove.push_back(pair.first);
         } else {
           if (CT == pair.second) {
             // previous equivalent values or values overwritten by
             // an anything are removed
-            toremove.insert(pair.first);
+            toremove.push_back(pair.first);
           } else if (pair.second != BaseType::Anything) {
             llvm::errs() << "inserting into : " << str() << " with "
                          << to_string(Seq) << " of " << CT.str() << "\n";
@@ -222,7 +356,7 @@ public:
 
     // if this is a starting -1, remove other -1's
     if (Seq[0] == -1) {
-      std::set<std::vector<int>> toremove;
+      llvm::SmallVector<TypeTreeIndices, 4> toremove;
       for (const auto &pair : mapping) {
         if (pair.first.size() != SeqSize)
           continue;
@@ -237,12 +371,12 @@ public:
           continue;
         if (intsAreLegalSubPointer && pair.second == BaseType::Integer &&
             CT == BaseType::Pointer) {
-          toremove.insert(pair.first);
+          toremove.push_back(pair.first);
         } else {
           if (CT == pair.second) {
             // previous equivalent values or values overwritten by
             // an anything are removed
-            toremove.insert(pair.first);
+            toremove.push_back(pair.first);
           } else if (pair.second != BaseType::Anything) {
             llvm::errs() << "inserting into : " << str() << " with "
                          << to_string(Seq) << " of " << CT.str() << "\n";
@@ -275,7 +409,7 @@ public:
     }
 
     if (possibleDeletion) {
-      std::vector<std::vector<int>> toErase;
+      llvm::SmallVector<TypeTreeIndices, 4> toErase;
       for (const auto &pair : mapping) {
         size_t i = 0;
         bool mustKeep = false;
@@ -295,7 +429,7 @@ public:
         }
       }
 
-      for (auto vec : toErase) {
+      for (auto &vec : toErase) {
         mapping.erase(vec);
         changed = true;
       }
@@ -316,26 +450,28 @@ public:
     }
     if (considerErase && !keep)
       return changed;
-    mapping.insert(std::pair<const std::vector<int>, ConcreteType>(Seq, CT));
+    mapping.insert(Seq, CT);
     return true;
   }
 
   /// How this TypeTree compares with another
-  bool operator<(const TypeTree &vd) const { return mapping < vd.mapping; }
+  bool operator<(const TypeTree &vd) const {
+    return getMapping() < vd.getMapping();
+  }
 
   /// Whether this TypeTree contains any information
   bool isKnown() const {
-    for (const auto &pair : mapping) {
+    for (const auto &pair : getMapping()) {
       // we should assert here as we shouldn't keep any unknown maps for
       // efficiency
       assert(pair.second.isKnown());
     }
-    return mapping.size() != 0;
+    return getMapping().size() != 0;
   }
 
   /// Whether this TypeTree knows any non-pointer information
   bool isKnownPastPointer() const {
-    for (auto &pair : mapping) {
+    for (auto &pair : getMapping()) {
       // we should assert here as we shouldn't keep any unknown maps for
       // efficiency
       assert(pair.second.isKnown());
@@ -352,7 +488,7 @@ public:
   /// Select only the Integer ConcreteTypes
   TypeTree JustInt() const {
     TypeTree vd;
-    for (auto &pair : mapping) {
+    for (auto &pair : getMapping()) {
       if (pair.second == BaseType::Integer) {
         vd.insert(pair.first, pair.second);
       }
@@ -364,29 +500,27 @@ public:
   /// Prepend an offset to all mappings
   TypeTree Only(int Off) const {
     TypeTree Result;
-    Result.minIndices.reserve(1 + minIndices.size());
-    Result.minIndices.push_back(Off);
-    for (auto midx : minIndices)
-      Result.minIndices.push_back(midx);
-
-    if (Result.minIndices.size() > EnzymeMaxTypeDepth) {
-      Result.minIndices.pop_back();
+    auto &Storage = Result.mut();
+    Storage.minIndices.reserve(1 + getMinIndices().size());
+    Storage.minIndices.push_back(Off);
+    for (auto midx : getMinIndices())
+      Storage.minIndices.push_back(midx);
+
+    if (Storage.minIndices.size() > EnzymeMaxTypeDepth) {
+      Storage.minIndices.pop_back();
       if (EnzymeTypeWarning)
-        llvm::errs() << "not handling more than " << EnzymeMaxTypeDepth
+        typeWarnings() << "not handling more than " << EnzymeMaxTypeDepth
                      << " pointer lookups deep dt:" << str() << " only(" << Off
                      << "): " << str() << "\n";
     }
 
-    for (const auto &pair : mapping) {
+    for (const auto &pair : getMapping()) {
       if (pair.first.size() == EnzymeMaxTypeDepth)
         continue;
-      std::vector<int> Vec;
-      Vec.reserve(pair.first.size() + 1);
+      TypeTreeIndices Vec;
       Vec.push_back(Off);
-      for (auto Val : pair.first)
-        Vec.push_back(Val);
-      Result.mapping.insert(
-          std::pair<const std::vector<int>, ConcreteType>(Vec, pair.second));
+      Vec.append(pair.first.begin(), pair.first.end());
+      Storage.mapping.insert(Vec, pair.second);
     }
     return Result;
   }
@@ -395,27 +529,27 @@ public:
   TypeTree Data0() const {
     TypeTree Result;
 
-    for (const auto &pair : mapping) {
+    for (const auto &pair : getMapping()) {
       if (pair.first.size() == 0) {
         llvm::errs() << str() << "\n";
       }
       assert(pair.first.size() != 0);
 
       if (pair.first[0] == -1) {
-        std::vector<int> next(pair.first.begin() + 1, pair.first.end());
-        Result.mapping.insert(
-            std::pair<const std::vector<int>, ConcreteType>(next, pair.second));
+        auto next = llvm::ArrayRef<int>(pair.first).drop_front();
+        auto &Storage = Result.mut();
+        Storage.mapping.insert(next, pair.second);
         for (size_t i = 0, Len = next.size(); i < Len; ++i) {
-          if (i == Result.minIndices.size())
-            Result.minIndices.push_back(next[i]);
-          else if (next[i] < Result.minIndices[i])
-            Result.minIndices[i] = next[i];
+          if (i == Storage.minIndices.size())
+            Storage.minIndices.push_back(next[i]);
+          else if (next[i] < Storage.minIndices[i])
+            Storage.minIndices[i] = next[i];
         }
       }
     }
-    for (const auto &pair : mapping) {
+    for (const auto &pair : getMapping()) {
       if (pair.first[0] == 0) {
-        std::vector<int> next(pair.first.begin() + 1, pair.first.end());
+        auto next = llvm::ArrayRef<int>(pair.first).drop_front();
         // We do insertion like this to force an error
         // on the orIn operation if there is an incompatible
         // merge. The insert operation does not error.
@@ -442,7 +576,7 @@ public:
     // to force an error if there is an incompatible
     // merge. The insert operation does not error.
 
-    for (const auto &pair : mapping) {
+    for (const auto &pair : getMapping()) {
       assert(pair.first.size() != 0);
 
       if (pair.first[0] == -1) {
@@ -475,9 +609,9 @@ public:
   TypeTree Lookup(size_t len, const llvm::DataLayout &dl) const {
 
     // Map of indices[1:] => ( End => possible Index[0] )
-    std::map<std::vector<int>, std::map<ConcreteType, std::set<int>>> staging;
+    std::map<TypeTreeIndices, std::map<ConcreteType, std::set<int>>> staging;
 
-    for (const auto &pair : mapping) {
+    for (const auto &pair : getMapping()) {
       assert(pair.first.size() != 0);
 
       // Pointer is at offset 0 from this object
@@ -496,7 +630,7 @@ public:
           continue;
       }
 
-      std::vector<int> next(pair.first.begin() + 2, pair.first.end());
+      TypeTreeIndices next(pair.first.begin() + 2, pair.first.end());
 
       staging[next][pair.second].insert(pair.first[1]);
     }
@@ -542,11 +676,9 @@ public:
           }
         }
 
-        std::vector<int> next;
-        next.reserve(pnext.size() + 1);
+        TypeTreeIndices next;
         next.push_back(-1);
-        for (auto v : pnext)
-          next.push_back(v);
+        next.append(pnext.begin(), pnext.end());
 
         if (legalCombine) {
           Result.insert(next, dt, /*intsAreLegalPointerSub*/ true);
@@ -566,7 +698,7 @@ public:
   /// canonicalize this, creating -1's where possible
   void CanonicalizeInPlace(size_t len, const llvm::DataLayout &dl) {
     bool canonicalized = true;
-    for (const auto &pair : mapping) {
+    for (const auto &pair : getMapping()) {
       assert(pair.first.size() != 0);
       if (pair.first[0] != -1) {
         canonicalized = false;
@@ -577,12 +709,11 @@ public:
       return;
 
     // Map of indices[1:] => ( End => possible Index[0] )
-    std::map<const std::vector<int>, std::map<ConcreteType, std::set<int>>>
-        staging;
+    std::map<TypeTreeIndices, std::map<ConcreteType, std::set<int>>> staging;
 
-    for (const auto &pair : mapping) {
+    for (const auto &pair : getMapping()) {
 
-      std::vector<int> next(pair.first.begin() + 1, pair.first.end());
+      TypeTreeIndices next(pair.first.begin() + 1, pair.first.end());
       if (pair.first[0] != -1) {
         if ((size_t)pair.first[0] >= len) {
           llvm::errs() << str() << "\n";
@@ -593,7 +724,7 @@ public:
       staging[next][pair.second].insert(pair.first[0]);
     }
 
-    mapping.clear();
+    mut().mapping.clear();
 
     for (auto &pair : staging) {
       auto &pnext = pair.first;
@@ -638,11 +769,9 @@ public:
           }
         }
 
-        std::vector<int> next;
-        next.reserve(pnext.size() + 1);
+        TypeTreeIndices next;
         next.push_back(-1);
-        for (auto v : pnext)
-          next.push_back(v);
+        next.append(pnext.begin(), pnext.end());
 
         if (legalCombine) {
           insert(next, dt, /*intsAreLegalPointerSub*/ true);
@@ -660,7 +789,7 @@ public:
   TypeTree KeepMinusOne(bool &legal) const {
     TypeTree dat;
 
-    for (const auto &pair : mapping) {
+    for (const auto &pair : getMapping()) {
 
       assert(pair.first.size() != 0);
 
@@ -726,7 +855,7 @@ public:
                         const int maxSize, size_t addOffset = 0) const {
     TypeTree Result;
 
-    for (const auto &pair : mapping) {
+    for (const auto &pair : getMapping()) {
       if (pair.first.size() == 0) {
         if (pair.second == BaseType::Pointer ||
             pair.second == BaseType::Anything) {
@@ -739,7 +868,7 @@ public:
         llvm_unreachable("ShiftIndices called on a nonpointer/anything");
       }
 
-      std::vector<int> next(pair.first);
+      TypeTreeIndices next(pair.first);
 
       if (next[0] == -1) {
         if (maxSize == -1) {
@@ -803,16 +932,16 @@ public:
   /// Keep only mappings where the type is not an `Anything`
   TypeTree PurgeAnything() const {
     TypeTree Result;
-    Result.minIndices.reserve(minIndices.size());
-    for (const auto &pair : mapping) {
+    for (const auto &pair : getMapping()) {
       if (pair.second == ConcreteType(BaseType::Anything))
         continue;
-      Result.mapping.insert(pair);
+      auto &Storage = Result.mut();
+      Storage.mapping.insert(pair.first, pair.second);
       for (size_t i = 0, Len = pair.first.size(); i < Len; ++i) {
-        if (i == Result.minIndices.size())
-          Result.minIndices.push_back(pair.first[i]);
-        else if (pair.first[i] < Result.minIndices[i])
-          Result.minIndices[i] = pair.first[i];
+        if (i == Storage.minIndices.size())
+          Storage.minIndices.push_back(pair.first[i]);
+        else if (pair.first[i] < Storage.minIndices[i])
+          Storage.minIndices[i] = pair.first[i];
       }
     }
     return Result;
@@ -821,10 +950,10 @@ public:
   /// Replace -1 with 0
   TypeTree ReplaceMinus() const {
     TypeTree dat;
-    for (const auto &pair : mapping) {
+    for (const auto &pair : getMapping()) {
       if (pair.second == ConcreteType(BaseType::Anything))
         continue;
-      std::vector<int> nex = pair.first;
+      TypeTreeIndices nex = pair.first;
       for (auto &v : nex)
         if (v == -1)
           v = 0;
@@ -835,7 +964,12 @@ public:
 
   /// Replace all integer subtypes with anything
   void ReplaceIntWithAnything() {
-    for (auto &pair : mapping) {
+    if (llvm::none_of(getMapping(), [](const ConcreteTypeMapType::value_type
+                                           &pair) {
+          return pair.second == BaseType::Integer;
+        }))
+      return;
+    for (auto &pair : mut().mapping) {
       if (pair.second == BaseType::Integer) {
         pair.second = BaseType::Anything;
       }
@@ -845,7 +979,7 @@ public:
   /// Keep only mappings where the type is an `Anything`
   TypeTree JustAnything() const {
     TypeTree dat;
-    for (const auto &pair : mapping) {
+    for (const auto &pair : getMapping()) {
       if (pair.second != ConcreteType(BaseType::Anything))
         continue;
       dat.insert(pair.first, pair.second);
@@ -854,21 +988,25 @@ public:
   }
 
   /// Chceck equality of two TypeTrees
-  bool operator==(const TypeTree &RHS) const { return mapping == RHS.mapping; }
+  bool operator==(const TypeTree &RHS) const {
+    return data == RHS.data || getMapping() == RHS.getMapping();
+  }
 
   /// Set this to another TypeTree, returning if this was changed
   bool operator=(const TypeTree &RHS) {
-    if (*this == RHS)
+    if (data == RHS.data)
+      return false;
+    if (*this == RHS) {
+      // Share the contents if they are entirely equal
+      if (getMinIndices() == RHS.getMinIndices())
+        data = RHS.data;
       return false;
-    minIndices = RHS.minIndices;
-    mapping.clear();
-    for (const auto &elems : RHS.mapping) {
-      mapping.emplace(elems);
     }
+    data = RHS.data;
     return true;
   }
 
-  bool checkedOrIn(const std::vector<int> &Seq, ConcreteType RHS,
+  bool checkedOrIn(llvm::ArrayRef<int> Seq, ConcreteType RHS,
                    bool PointerIntSame, bool &LegalOr) {
     assert(RHS != BaseType::Unknown);
     ConcreteType CT = operator[](Seq);
@@ -882,9 +1020,8 @@ public:
     if (Seq.size() > 0) {
       // check pointer abilities from before
       {
-        std::vector<int> tmp(Seq.begin(), Seq.end() - 1);
-        auto found = mapping.find(tmp);
-        if (found != mapping.end()) {
+        auto found = getMapping().find(Seq.drop_back());
+        if (found != getMapping().end()) {
           if (!(found->second == BaseType::Pointer ||
                 found->second == BaseType::Anything)) {
             LegalOr = false;
@@ -895,8 +1032,8 @@ public:
 
       // if this is a ending -1, remove other elems if no more info
       if (Seq.back() == -1) {
-        std::set<std::vector<int>> toremove;
-        for (const auto &pair : mapping) {
+        llvm::SmallVector<TypeTreeIndices, 4> toremove;
+        for (const auto &pair : getMapping()) {
           if (pair.first.size() == Seq.size()) {
             bool matches = true;
             for (unsigned i = 0; i < pair.first.size() - 1; ++i) {
@@ -911,7 +1048,7 @@ public:
             if (CT == BaseType::Anything || CT == pair.second) {
               // previous equivalent values or values overwritten by
               // an anything are removed
-              toremove.insert(pair.first);
+              toremove.push_back(pair.first);
             } else if (CT != BaseType::Anything &&
                        pair.second == BaseType::Anything) {
               // keep lingering anythings if not being overwritten
@@ -921,15 +1058,18 @@ public:
             }
           }
         }
-        for (const auto &val : toremove) {
-          mapping.erase(val);
+        if (!toremove.empty()) {
+          auto &mapping = mut().mapping;
+          for (const auto &val : toremove) {
+            mapping.erase(val);
+          }
         }
       }
 
       // if this is a starting -1, remove other -1's
       if (Seq[0] == -1) {
-        std::set<std::vector<int>> toremove;
-        for (const auto &pair : mapping) {
+        llvm::SmallVector<TypeTreeIndices, 4> toremove;
+        for (const auto &pair : getMapping()) {
           if (pair.first.size() == Seq.size()) {
             bool matches = true;
             for (unsigned i = 1; i < pair.first.size(); ++i) {
@@ -944,7 +1084,7 @@ public:
             if (CT == BaseType::Anything || CT == pair.second) {
               // previous equivalent values or values overwritten by
               // an anything are removed
-              toremove.insert(pair.first);
+              toremove.push_back(pair.first);
             } else if (CT != BaseType::Anything &&
                        pair.second == BaseType::Anything) {
               // keep lingering anythings if not being overwritten
@@ -955,8 +1095,11 @@ public:
           }
         }
 
-        for (const auto &val : toremove) {
-          mapping.erase(val);
+        if (!toremove.empty()) {
+          auto &mapping = mut().mapping;
+          for (const auto &val : toremove) {
+            mapping.erase(val);
+          }
         }
       }
     }
@@ -964,22 +1107,21 @@ public:
     return insert(Seq, CT);
   }
 
-  bool orIn(const std::vector<int> &Seq, ConcreteType RHS,
-            bool PointerIntSame = false) {
-    bool LegalOr = true;
-    bool Result = checkedOrIn(Seq, RHS, PointerIntSame, LegalOr);
-    assert(LegalOr);
-    return Result;
-  }
-
   /// Set this to the logical or of itself and RHS, returning whether this value
   /// changed Setting `PointerIntSame` considers pointers and integers as
   /// equivalent If this is an illegal operation, `LegalOr` will be set to false
   bool checkedOrIn(const TypeTree &RHS, bool PointerIntSame, bool &LegalOr) {
     // TODO detect recursive merge and simplify
 
+    // Merging an empty tree, or a tree with itself, never changes it
+    if (!RHS.data || data == RHS.data)
+      return false;
+
+    // Iterate over a reference to RHS' contents, which remain alive even if
+    // RHS is this tree
+    auto RHSData = RHS.data;
     bool changed = false;
-    for (auto &pair : RHS.mapping) {
+    for (auto &pair : RHSData->mapping) {
       changed |= checkedOrIn(pair.first, pair.second, PointerIntSame, LegalOr);
     }
     return changed;
@@ -1003,7 +1145,8 @@ public:
   /// Set this to the logical or of itself and RHS, returning whether this value
   /// changed Setting `PointerIntSame` considers pointers and integers as
   /// equivalent This function will error if doing an illegal Operation
-  bool orIn(const std::vector<int> Seq, ConcreteType CT, bool PointerIntSame) {
+  bool orIn(llvm::ArrayRef<int> Seq, ConcreteType CT,
+            bool PointerIntSame = false) {
     bool Legal = true;
     bool Result = checkedOrIn(Seq, CT, PointerIntSame, Legal);
     if (!Legal) {
@@ -1027,13 +1170,20 @@ public:
   /// value changed If this and RHS are incompatible at an index, the result
   /// will be BaseType::Unknown
   bool andIn(const TypeTree &RHS) {
+    // The logical and of a tree with itself is unchanged
+    if (data == RHS.data || !data)
+      return false;
+
     bool changed = false;
 
-    std::vector<std::vector<int>> keystodelete;
+    auto RHSData = RHS.data;
+    auto &RHSMapping = RHS.getMapping();
+    auto &mapping = mut().mapping;
+    llvm::SmallVector<TypeTreeIndices, 4> keystodelete;
     for (auto &pair : mapping) {
       ConcreteType other = BaseType::Unknown;
-      auto fd = RHS.mapping.find(pair.first);
-      if (fd != RHS.mapping.end()) {
+      auto fd = RHSMapping.find(pair.first);
+      if (fd != RHSMapping.end()) {
         other = fd->second;
       }
       changed = (pair.second &= other);
@@ -1060,8 +1210,11 @@ public:
   bool binopIn(const TypeTree &RHS, llvm::BinaryOperator::BinaryOps Op) {
     bool changed = false;
 
-    std::vector<std::vector<int>> toErase;
+    llvm::SmallVector<TypeTreeIndices, 4> toErase;
 
+    auto RHSData = RHS.data;
+    auto &RHSMapping = RHS.getMapping();
+    auto &mapping = mut().mapping;
     for (auto &pair : mapping) {
       // TODO propagate non-first level operands:
       // Special handling is necessary here because a pointer to an int
@@ -1076,8 +1229,8 @@ public:
       ConcreteType RightCT(BaseType::Unknown);
 
       // Mutual mappings
-      auto found = RHS.mapping.find(pair.first);
-      if (found != RHS.mapping.end()) {
+      auto found = RHSMapping.find(pair.first);
+      if (found != RHSMapping.end()) {
         RightCT = found->second;
       }
 
@@ -1090,7 +1243,7 @@ public:
     }
 
     // mapings just on the right
-    for (auto &pair : RHS.mapping) {
+    for (auto &pair : RHSMapping) {
       // TODO propagate non-first level operands:
       // Special handling is necessary here because a pointer to an int
       // binop with something should not apply the binop rules to the
@@ -1099,16 +1252,16 @@ public:
         continue;
       }
 
-      if (mapping.find(pair.first) == RHS.mapping.end()) {
+      if (mapping.find(pair.first) == RHSMapping.end()) {
         ConcreteType CT = BaseType::Unknown;
         changed |= CT.binopIn(pair.second, Op);
         if (CT != BaseType::Unknown) {
-          mapping.insert(std::make_pair(pair.first, CT));
+          mapping.insert(pair.first, CT);
         }
       }
     }
 
-    for (auto vec : toErase) {
+    for (auto &vec : toErase) {
       mapping.erase(vec);
     }
 
@@ -1119,7 +1272,7 @@ public:
   std::string str() const {
     std::string out = "{";
     bool first = true;
-    for (auto &pair : mapping) {
+    for (auto &pair : getMapping()) {
       if (!first) {
         out += ", ";
       }
@@ -1135,6 +1288,15 @@ public:
     out += "}";
     return out;
   }
+
+  friend llvm::hash_code hash_value(const TypeTree &TT);
 };
 
+/// Hash a TypeTree for use in hash tables
+inline llvm::hash_code hash_value(const TypeTree &TT) {
+  if (TT.data && TT.data->interned)
+    return TT.data->hash;
+  return hash_value(TT.getMapping());
+}
+
 #endif
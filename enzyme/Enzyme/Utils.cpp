@@ -34,8 +34,11 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
 #include "llvm-c/Core.h"
 
@@ -55,6 +58,22 @@ void (*CustomRuntimeInactiveError)(LLVMBuilderRef, LLVMValueRef,
 LLVMValueRef (*EnzymePostCacheStore)(LLVMValueRef, LLVMBuilderRef,
                                      LLVMValueRef *) = nullptr;
 LLVMTypeRef (*EnzymeDefaultTapeType)(LLVMContextRef) = nullptr;
+
+llvm::cl::opt<int> EnzymeCheckpointInterval(
+    "enzyme-checkpoint-interval", cl::init(0), cl::Hidden,
+    cl::desc("Number of iterations between stored states of a checkpointed "
+             "loop (0 uses the square root of the trip count)"));
+
+llvm::cl::opt<bool> EnzymeCheckpointRecompute(
+    "enzyme-checkpoint-recompute", cl::init(false), cl::Hidden,
+    cl::desc("Recompute every iteration of a checkpointed segment from its "
+             "stored state instead of holding the segment's states in "
+             "memory during the reverse pass"));
+
+llvm::cl::opt<int> EnzymeFileTapeMin(
+    "enzyme-file-tape-min", cl::init(1 << 20), cl::Hidden,
+    cl::desc("Smallest cache chunk, in bytes, mapped from a file by "
+             "-enzyme-file-tape; smaller chunks use the heap"));
 }
 
 llvm::SmallVector<llvm::Instruction *, 2> PostCacheStore(llvm::StoreInst *SI,
@@ -80,6 +99,7 @@ llvm::PointerType *getDefaultAnonymousTapeType(llvm::LLVMContext &C) {
 Function *getOrInsertExponentialAllocator(Module &M, Function *newFunc,
                                           bool ZeroInit, llvm::Type *RT) {
   bool custom = true;
+  bool workspace = false;
   llvm::PointerType *allocType;
   {
     auto i64 = Type::getInt64Ty(newFunc->getContext());
@@ -90,6 +110,7 @@ Function *getOrInsertExponentialAllocator(Module &M, Function *newFunc,
     CreateAllocation(B, RT, P, "tapemem", &malloccall, nullptr)->getType();
     if (auto F = getFunctionFromCall(malloccall)) {
       custom = F->getName() != "malloc";
+      workspace = F->getName() == "__enzyme_workspace_malloc";
       if (F->getName() == "julia.gc_alloc_obj" ||
           F->getName() == "jl_gc_alloc_typed" ||
           F->getName() == "ijl_gc_alloc_typed")
@@ -101,10 +122,16 @@ Function *getOrInsertExponentialAllocator(Module &M, Function *newFunc,
 
   Type *types[] = {allocType, Type::getInt64Ty(M.getContext()),
                    Type::getInt64Ty(M.getContext())};
+  // Workspace memory cannot be realloc'd, but is untyped like malloc's
+  if (workspace)
+    RT = Type::getInt8Ty(M.getContext());
+
   std::string name = "__enzyme_exponentialallocation";
   if (ZeroInit)
     name += "zero";
-  if (custom)
+  if (workspace)
+    name += ".workspace";
+  else if (custom)
     name += ".custom@" + std::to_string((size_t)RT);
 
   FunctionType *FT = FunctionType::get(allocType, types, false);
@@ -186,6 +213,10 @@ Function *getOrInsertExponentialAllocator(Module &M, Function *newFunc,
                    margs[2]->getType()};
     auto memsetF = Intrinsic::getDeclaration(&M, Intrinsic::memcpy, tys);
     B.CreateCall(memsetF, margs);
+
+    // The previous buffer is null on the first growth
+    if (workspace)
+      CreateDealloc(B, ptr)->removeParamAttr(0, Attribute::NonNull);
   }
 
   if (ZeroInit) {
@@ -245,9 +276,1179 @@ llvm::Value *CreateReAllocation(llvm::IRBuilder<> &B, llvm::Value *prev,
   return realloccall;
 }
 
+Function *getOrInsertSegmentedAllocator(Module &M, Function *newFunc,
+                                        bool ZeroInit, llvm::Type *RT,
+                                        bool FileTape) {
+  bool custom = true;
+  bool workspace = false;
+  llvm::PointerType *blockType;
+  llvm::PointerType *tableType;
+  {
+    auto i64 = Type::getInt64Ty(newFunc->getContext());
+    BasicBlock *BB = BasicBlock::Create(M.getContext(), "entry", newFunc);
+    IRBuilder<> B(BB);
+    auto P = B.CreatePHI(i64, 1);
+    CallInst *malloccall;
+    CreateAllocation(B, RT, P, "tapemem", &malloccall, nullptr);
+    if (auto F = getFunctionFromCall(malloccall)) {
+      custom = F->getName() != "malloc";
+      workspace = F->getName() == "__enzyme_workspace_malloc";
+      if (F->getName() == "julia.gc_alloc_obj" ||
+          F->getName() == "jl_gc_alloc_typed" ||
+          F->getName() == "ijl_gc_alloc_typed")
+        ZeroInit = false;
+    }
+    // Blocks from a custom allocator are never file backed
+    FileTape &= !custom || workspace;
+    // Blocks of a malloc'd cache are untyped bytes, sharing one helper
+    if (!custom || workspace)
+      RT = Type::getInt8Ty(M.getContext());
+    blockType = cast<PointerType>(CreateAllocation(B, RT, P)->getType());
+    tableType =
+        cast<PointerType>(CreateAllocation(B, blockType, P)->getType());
+    BB->eraseFromParent();
+  }
+
+  auto i64 = Type::getInt64Ty(M.getContext());
+  Type *types[] = {tableType, i64, i64, i64};
+  std::string name = "__enzyme_segmentedallocation";
+  if (ZeroInit)
+    name += "zero";
+  if (FileTape)
+    name += ".filetape";
+  else if (workspace)
+    name += ".workspace";
+  else if (custom)
+    name += ".custom@" + std::to_string((size_t)RT);
+
+  FunctionType *FT = FunctionType::get(tableType, types, false);
+
+#if LLVM_VERSION_MAJOR >= 9
+  Function *F = cast<Function>(M.getOrInsertFunction(name, FT).getCallee());
+#else
+  Function *F = cast<Function>(M.getOrInsertFunction(name, FT));
+#endif
+
+  if (!F->empty())
+    return F;
+
+  F->setLinkage(Function::LinkageTypes::InternalLinkage);
+  F->addFnAttr(Attribute::AlwaysInline);
+  F->addFnAttr(Attribute::NoUnwind);
+  BasicBlock *entry = BasicBlock::Create(M.getContext(), "entry", F);
+  BasicBlock *push = BasicBlock::Create(M.getContext(), "push", F);
+  BasicBlock *ok = BasicBlock::Create(M.getContext(), "ok", F);
+
+  IRBuilder<> B(entry);
+
+  Argument *table = F->arg_begin();
+  table->setName("table");
+  Argument *iter = table + 1;
+  iter->setName("iter");
+  Argument *segment = iter + 1;
+  segment->setName("segment");
+  Argument *size = segment + 1;
+  size->setName("size");
+
+  // A new block is required on the first iteration of every segment
+  B.CreateCondBr(B.CreateICmpEQ(B.CreateURem(iter, segment),
+                                ConstantInt::get(i64, 0)),
+                 push, ok);
+
+  B.SetInsertPoint(push);
+  Value *block = B.CreateUDiv(iter, segment);
+
+  // The table of blocks is small and grows exponentially, only the blocks
+  // themselves scale with the number of iterations
+  auto &DL = M.getDataLayout();
+  Function *grow = getOrInsertExponentialAllocator(M, newFunc,
+                                                   /*ZeroInit*/ false,
+                                                   blockType);
+  Value *growArgs[] = {
+      B.CreatePointerCast(table, grow->getFunctionType()->getParamType(0)),
+      B.CreateAdd(block, ConstantInt::get(i64, 1), "", true, true),
+      ConstantInt::get(i64, DL.getTypeAllocSizeInBits(blockType) / 8)};
+  Value *ntable = B.CreatePointerCast(B.CreateCall(grow, growArgs), tableType);
+
+  Value *count = size;
+  if (custom)
+    count = B.CreateUDiv(
+        size, ConstantInt::get(i64, DL.getTypeAllocSizeInBits(RT) / 8), "",
+        /*isExact*/ true);
+  Instruction *ZeroInst = nullptr;
+  CallInst *segcall = nullptr;
+  Value *seg = CreateAllocation(B, RT, count, "segment", &segcall,
+                                ZeroInit ? &ZeroInst : nullptr);
+  if (FileTape)
+    RedirectToFileTape(segcall);
+#if LLVM_VERSION_MAJOR > 7
+  B.CreateStore(seg, B.CreateInBoundsGEP(blockType, ntable, block));
+#else
+  B.CreateStore(seg, B.CreateInBoundsGEP(ntable, block));
+#endif
+  B.CreateBr(ok);
+
+  B.SetInsertPoint(ok);
+  auto phi = B.CreatePHI(tableType, 2);
+  phi->addIncoming(ntable, push);
+  phi->addIncoming(table, entry);
+  B.CreateRet(phi);
+  return F;
+}
+
+llvm::CallInst *CreateSegmentAllocation(llvm::IRBuilder<> &B, llvm::Value *prev,
+                                        llvm::Type *T, llvm::Value *Iter,
+                                        llvm::Value *Segment,
+                                        llvm::Value *InnerCount,
+                                        llvm::Twine Name, bool ZeroMem,
+                                        bool FileTape) {
+  auto newFunc = B.GetInsertBlock()->getParent();
+
+  Value *tsize = ConstantInt::get(
+      InnerCount->getType(),
+      newFunc->getParent()->getDataLayout().getTypeAllocSizeInBits(T) / 8);
+
+  auto F = getOrInsertSegmentedAllocator(*newFunc->getParent(), newFunc,
+                                         ZeroMem, T, FileTape);
+  Value *idxs[] = {
+      /*block table*/
+      B.CreatePointerCast(prev, F->getFunctionType()->getParamType(0)),
+      /*iteration being stored*/
+      Iter,
+      /*iterations per block*/
+      Segment,
+      /*block size (element x subloops x iterations per block)*/
+      B.CreateMul(tsize, InnerCount, "", /*NUW*/ true,
+                  /*NSW*/ true)};
+
+  return B.CreateCall(F, idxs, Name);
+}
+
+llvm::CallInst *CreateSegmentDealloc(llvm::IRBuilder<> &B, llvm::Value *table,
+                                     llvm::Value *Iter, llvm::Value *Segment,
+                                     bool FileTape) {
+  auto &M = *B.GetInsertBlock()->getParent()->getParent();
+  auto i64 = Type::getInt64Ty(M.getContext());
+
+  std::string name = "__enzyme_segmenteddeallocation";
+  auto tableType = cast<PointerType>(table->getType());
+  if (CustomDeallocator)
+    name += ".custom@" + std::to_string((size_t)tableType);
+  else
+    tableType = Type::getInt8PtrTy(M.getContext())->getPointerTo();
+  if (FileTape && !CustomDeallocator)
+    name += ".filetape";
+
+  Type *types[] = {tableType, i64, i64};
+  FunctionType *FT =
+      FunctionType::get(Type::getVoidTy(M.getContext()), types, false);
+
+#if LLVM_VERSION_MAJOR >= 9
+  Function *F = cast<Function>(M.getOrInsertFunction(name, FT).getCallee());
+#else
+  Function *F = cast<Function>(M.getOrInsertFunction(name, FT));
+#endif
+
+  if (F->empty()) {
+    F->setLinkage(Function::LinkageTypes::InternalLinkage);
+    F->addFnAttr(Attribute::AlwaysInline);
+    F->addFnAttr(Attribute::NoUnwind);
+    BasicBlock *entry = BasicBlock::Create(M.getContext(), "entry", F);
+    BasicBlock *release = BasicBlock::Create(M.getContext(), "release", F);
+    BasicBlock *end = BasicBlock::Create(M.getContext(), "end", F);
+
+    IRBuilder<> FB(entry);
+
+    Argument *ftable = F->arg_begin();
+    ftable->setName("table");
+    Argument *iter = ftable + 1;
+    iter->setName("iter");
+    Argument *segment = iter + 1;
+    segment->setName("segment");
+
+    // A block is released once the reverse pass has finished with the first
+    // iteration stored within it
+    FB.CreateCondBr(FB.CreateICmpEQ(FB.CreateURem(iter, segment),
+                                    ConstantInt::get(i64, 0)),
+                    release, end);
+
+    FB.SetInsertPoint(release);
+#if LLVM_VERSION_MAJOR > 7
+    Value *slot = FB.CreateInBoundsGEP(tableType->getPointerElementType(),
+                                       ftable, FB.CreateUDiv(iter, segment));
+    Value *block =
+        FB.CreateLoad(tableType->getPointerElementType(), slot, "segment");
+#else
+    Value *slot = FB.CreateInBoundsGEP(ftable, FB.CreateUDiv(iter, segment));
+    Value *block = FB.CreateLoad(slot, "segment");
+#endif
+    CallInst *blockfree = CreateDealloc(FB, block);
+    if (FileTape)
+      RedirectToFileTape(blockfree);
+    FB.CreateBr(end);
+
+    FB.SetInsertPoint(end);
+    FB.CreateRetVoid();
+  }
+
+  Value *args[] = {B.CreatePointerCast(table, tableType), Iter, Segment};
+  return B.CreateCall(F, args);
+}
+
+GlobalVariable *getOrInsertWorkspace(Module &M) {
+  constexpr static const char name[] = "__enzyme_workspace";
+  if (auto GV = M.getGlobalVariable(name, /*AllowInternal*/ true))
+    return GV;
+  auto PT = Type::getInt8PtrTy(M.getContext());
+  auto GV = new GlobalVariable(M, PT, /*isConstant*/ false,
+                               GlobalValue::InternalLinkage,
+                               ConstantPointerNull::get(PT), name);
+  GV->setThreadLocal(true);
+  return GV;
+}
+
+/// Alignment of every allocation served from an enzyme_workspace, that of
+/// max_align_t on the supported targets.
+constexpr static uint64_t WorkspaceAlignment = 16;
+
+/// Layout of an enzyme_workspace, using the size type of the allocator.
+static StructType *getWorkspaceType(Type *SizeT) {
+  auto &C = SizeT->getContext();
+  Type *types[] = {Type::getInt8PtrTy(C), SizeT, SizeT, SizeT};
+  return StructType::get(C, types, /*isPacked*/ false);
+}
+
+Function *getOrInsertWorkspaceAllocator(Module &M, FunctionType *MallocTy) {
+  std::string name = "__enzyme_workspace_malloc";
+#if LLVM_VERSION_MAJOR >= 9
+  Function *F =
+      cast<Function>(M.getOrInsertFunction(name, MallocTy).getCallee());
+#else
+  Function *F = cast<Function>(M.getOrInsertFunction(name, MallocTy));
+#endif
+
+  if (!F->empty())
+    return F;
+
+  F->setLinkage(Function::LinkageTypes::InternalLinkage);
+  F->addFnAttr(Attribute::AlwaysInline);
+  F->addFnAttr(Attribute::NoUnwind);
+  BasicBlock *entry = BasicBlock::Create(M.getContext(), "entry", F);
+  BasicBlock *arena = BasicBlock::Create(M.getContext(), "arena", F);
+  BasicBlock *bump = BasicBlock::Create(M.getContext(), "bump", F);
+  BasicBlock *fallback = BasicBlock::Create(M.getContext(), "fallback", F);
+
+  Argument *size = F->arg_begin();
+  size->setName("size");
+  Type *SizeT = size->getType();
+  auto WT = getWorkspaceType(SizeT);
+  auto GV = getOrInsertWorkspace(M);
+
+  IRBuilder<> B(entry);
+#if LLVM_VERSION_MAJOR > 7
+  Value *ws = B.CreateLoad(GV->getValueType(), GV, "ws");
+#else
+  Value *ws = B.CreateLoad(GV, "ws");
+#endif
+  B.CreateCondBr(B.CreateIsNull(ws), fallback, arena);
+
+  B.SetInsertPoint(arena);
+  ws = B.CreatePointerCast(ws, PointerType::getUnqual(WT));
+  Value *fields[4];
+  for (unsigned i = 0; i < 4; i++)
+#if LLVM_VERSION_MAJOR > 7
+    fields[i] = B.CreateStructGEP(WT, ws, i);
+#else
+    fields[i] = B.CreateStructGEP(ws, i);
+#endif
+#if LLVM_VERSION_MAJOR > 7
+  Value *base = B.CreateLoad(WT->getElementType(0), fields[0], "base");
+  Value *cap = B.CreateLoad(SizeT, fields[1], "cap");
+  Value *used = B.CreateLoad(SizeT, fields[2], "used");
+  Value *highwater = B.CreateLoad(SizeT, fields[3], "highwater");
+#else
+  Value *base = B.CreateLoad(fields[0], "base");
+  Value *cap = B.CreateLoad(fields[1], "cap");
+  Value *used = B.CreateLoad(fields[2], "used");
+  Value *highwater = B.CreateLoad(fields[3], "highwater");
+#endif
+
+  // Every allocation starts at an address aligned like malloc's, that of
+  // max_align_t, however the caller aligned the base of the workspace.
+  Value *align = ConstantInt::get(SizeT, WorkspaceAlignment - 1);
+  Value *mask = ConstantInt::get(SizeT, ~(uint64_t)(WorkspaceAlignment - 1));
+  Value *baseInt = B.CreatePtrToInt(base, SizeT);
+  Value *start = B.CreateSub(
+      B.CreateAnd(B.CreateAdd(B.CreateAdd(baseInt, used), align), mask),
+      baseInt, "start");
+
+  // Every request advances the workspace, even those that do not fit, so
+  // that the high-water mark is the size needed to serve all of them
+  Value *rounded = B.CreateAnd(B.CreateAdd(size, align), mask);
+  Value *end = B.CreateAdd(start, rounded, "end");
+  B.CreateStore(end, fields[2]);
+  B.CreateStore(B.CreateSelect(B.CreateICmpUGT(end, highwater), end, highwater),
+                fields[3]);
+  B.CreateCondBr(B.CreateICmpULE(end, cap), bump, fallback);
+
+  B.SetInsertPoint(bump);
+#if LLVM_VERSION_MAJOR > 7
+  B.CreateRet(B.CreateInBoundsGEP(B.getInt8Ty(), base, start));
+#else
+  B.CreateRet(B.CreateInBoundsGEP(base, start));
+#endif
+
+  B.SetInsertPoint(fallback);
+  auto mallocF = M.getOrInsertFunction("malloc", MallocTy);
+  B.CreateRet(B.CreateCall(mallocF, {size}));
+  return F;
+}
+
+Function *getOrInsertWorkspaceDeallocator(Module &M, FunctionType *FreeTy) {
+  std::string name = "__enzyme_workspace_free";
+#if LLVM_VERSION_MAJOR >= 9
+  Function *F = cast<Function>(M.getOrInsertFunction(name, FreeTy).getCallee());
+#else
+  Function *F = cast<Function>(M.getOrInsertFunction(name, FreeTy));
+#endif
+
+  if (!F->empty())
+    return F;
+
+  F->setLinkage(Function::LinkageTypes::InternalLinkage);
+  F->addFnAttr(Attribute::AlwaysInline);
+  F->addFnAttr(Attribute::NoUnwind);
+  BasicBlock *entry = BasicBlock::Create(M.getContext(), "entry", F);
+  BasicBlock *arena = BasicBlock::Create(M.getContext(), "arena", F);
+  BasicBlock *release = BasicBlock::Create(M.getContext(), "release", F);
+  BasicBlock *end = BasicBlock::Create(M.getContext(), "end", F);
+
+  Argument *ptr = F->arg_begin();
+  ptr->setName("ptr");
+  auto &DL = M.getDataLayout();
+  Type *SizeT = DL.getIntPtrType(M.getContext());
+  auto WT = getWorkspaceType(SizeT);
+  auto GV = getOrInsertWorkspace(M);
+
+  IRBuilder<> B(entry);
+#if LLVM_VERSION_MAJOR > 7
+  Value *ws = B.CreateLoad(GV->getValueType(), GV, "ws");
+#else
+  Value *ws = B.CreateLoad(GV, "ws");
+#endif
+  B.CreateCondBr(B.CreateIsNull(ws), release, arena);
+
+  // Memory served from the workspace is reclaimed when it is reset
+  B.SetInsertPoint(arena);
+  ws = B.CreatePointerCast(ws, PointerType::getUnqual(WT));
+#if LLVM_VERSION_MAJOR > 7
+  Value *base = B.CreateLoad(WT->getElementType(0),
+                             B.CreateStructGEP(WT, ws, 0), "base");
+  Value *cap = B.CreateLoad(SizeT, B.CreateStructGEP(WT, ws, 1), "cap");
+#else
+  Value *base = B.CreateLoad(B.CreateStructGEP(ws, 0), "base");
+  Value *cap = B.CreateLoad(B.CreateStructGEP(ws, 1), "cap");
+#endif
+  Value *offset = B.CreateSub(B.CreatePtrToInt(ptr, SizeT),
+                              B.CreatePtrToInt(base, SizeT));
+  B.CreateCondBr(B.CreateICmpULT(offset, cap), end, release);
+
+  B.SetInsertPoint(release);
+  auto freeF = M.getOrInsertFunction("free", FreeTy);
+  B.CreateCall(freeF, {ptr});
+  B.CreateBr(end);
+
+  B.SetInsertPoint(end);
+  B.CreateRetVoid();
+  return F;
+}
+
+/// Bytes preceding every block of the file tape, holding the length of its
+/// mapping or 0 for blocks served by the heap.
+constexpr static uint64_t FileTapeHeader = 16;
+
+Function *getOrInsertFileTapeAllocator(Module &M, FunctionType *MallocTy) {
+  std::string name = "__enzyme_file_tape_malloc";
+#if LLVM_VERSION_MAJOR >= 9
+  Function *F =
+      cast<Function>(M.getOrInsertFunction(name, MallocTy).getCallee());
+#else
+  Function *F = cast<Function>(M.getOrInsertFunction(name, MallocTy));
+#endif
+
+  if (!F->empty())
+    return F;
+
+  F->setLinkage(Function::LinkageTypes::InternalLinkage);
+  F->addFnAttr(Attribute::NoUnwind);
+  auto &C = M.getContext();
+  BasicBlock *entry = BasicBlock::Create(C, "entry", F);
+  BasicBlock *file = BasicBlock::Create(C, "file", F);
+  BasicBlock *resize = BasicBlock::Create(C, "resize", F);
+  BasicBlock *map = BasicBlock::Create(C, "map", F);
+  BasicBlock *unmapped = BasicBlock::Create(C, "unmapped", F);
+  BasicBlock *mapped = BasicBlock::Create(C, "mapped", F);
+  BasicBlock *heap = BasicBlock::Create(C, "heap", F);
+
+  Argument *size = F->arg_begin();
+  size->setName("size");
+  Type *SizeT = size->getType();
+  auto i8p = Type::getInt8PtrTy(C);
+  auto i32 = Type::getInt32Ty(C);
+  auto i64 = Type::getInt64Ty(C);
+
+  IRBuilder<> B(entry);
+  constexpr uint64_t pathSize = 4096;
+  auto path = B.CreateAlloca(ArrayType::get(Type::getInt8Ty(C), pathSize),
+                             nullptr, "path");
+  Value *total = B.CreateAdd(size, ConstantInt::get(SizeT, FileTapeHeader),
+                             "total", /*NUW*/ true, /*NSW*/ true);
+  B.CreateCondBr(
+      B.CreateICmpULT(size, ConstantInt::get(SizeT, EnzymeFileTapeMin)), heap,
+      file);
+
+  // Each block is backed by its own unlinked file in $ENZYME_TAPE_DIR, so the
+  // kernel writes it back rather than swapping when memory runs short, and
+  // nothing is left behind should the program exit early
+  B.SetInsertPoint(file);
+  auto getenvF =
+      M.getOrInsertFunction("getenv", FunctionType::get(i8p, {i8p}, false));
+  Value *dir = B.CreateCall(getenvF, {B.CreateGlobalStringPtr("ENZYME_TAPE_DIR")},
+                            "dir");
+  dir = B.CreateSelect(B.CreateIsNull(dir), B.CreateGlobalStringPtr("/tmp"),
+                       dir);
+  Value *pathp = B.CreatePointerCast(path, i8p);
+  auto snprintfF = M.getOrInsertFunction(
+      "snprintf", FunctionType::get(i32, {i8p, SizeT, i8p}, true));
+  B.CreateCall(snprintfF, {pathp, ConstantInt::get(SizeT, pathSize),
+                           B.CreateGlobalStringPtr("%s/enzyme_tape_XXXXXX"),
+                           dir});
+  auto mkstempF =
+      M.getOrInsertFunction("mkstemp", FunctionType::get(i32, {i8p}, false));
+  Value *fd = B.CreateCall(mkstempF, {pathp}, "fd");
+  B.CreateCondBr(B.CreateICmpSLT(fd, ConstantInt::get(i32, 0)), heap, resize);
+
+  B.SetInsertPoint(resize);
+  auto unlinkF =
+      M.getOrInsertFunction("unlink", FunctionType::get(i32, {i8p}, false));
+  B.CreateCall(unlinkF, {pathp});
+  auto ftruncateF = M.getOrInsertFunction(
+      "ftruncate", FunctionType::get(i32, {i32, i64}, false));
+  Value *resized =
+      B.CreateCall(ftruncateF, {fd, B.CreateZExtOrTrunc(total, i64)});
+  B.CreateCondBr(B.CreateICmpEQ(resized, ConstantInt::get(i32, 0)), map,
+                 unmapped);
+
+  // PROT_READ | PROT_WRITE and MAP_SHARED, as on Linux and the BSDs
+  B.SetInsertPoint(map);
+  auto mmapF = M.getOrInsertFunction(
+      "mmap",
+      FunctionType::get(i8p, {i8p, SizeT, i32, i32, i32, i64}, false));
+  Value *mem = B.CreateCall(
+      mmapF, {ConstantPointerNull::get(i8p), total, ConstantInt::get(i32, 3),
+              ConstantInt::get(i32, 1), fd, ConstantInt::get(i64, 0)},
+      "mem");
+  auto closeF =
+      M.getOrInsertFunction("close", FunctionType::get(i32, {i32}, false));
+  B.CreateCall(closeF, {fd});
+  Value *failed = B.CreateICmpEQ(
+      mem, B.CreateIntToPtr(ConstantInt::getSigned(SizeT, -1), i8p));
+  B.CreateCondBr(failed, heap, mapped);
+
+  B.SetInsertPoint(unmapped);
+  B.CreateCall(closeF, {fd});
+  B.CreateBr(heap);
+
+  B.SetInsertPoint(mapped);
+  B.CreateStore(total, B.CreatePointerCast(mem, PointerType::getUnqual(SizeT)));
+#if LLVM_VERSION_MAJOR > 7
+  B.CreateRet(B.CreateConstInBoundsGEP1_64(B.getInt8Ty(), mem, FileTapeHeader));
+#else
+  B.CreateRet(B.CreateConstInBoundsGEP1_64(mem, FileTapeHeader));
+#endif
+
+  B.SetInsertPoint(heap);
+  auto mallocF = M.getOrInsertFunction("malloc", MallocTy);
+  Value *alloc = B.CreateCall(mallocF, {total});
+  alloc = B.CreatePointerCast(alloc, i8p);
+  B.CreateStore(ConstantInt::get(SizeT, 0),
+                B.CreatePointerCast(alloc, PointerType::getUnqual(SizeT)));
+#if LLVM_VERSION_MAJOR > 7
+  Value *res =
+      B.CreateConstInBoundsGEP1_64(B.getInt8Ty(), alloc, FileTapeHeader);
+#else
+  Value *res = B.CreateConstInBoundsGEP1_64(alloc, FileTapeHeader);
+#endif
+  B.CreateRet(B.CreatePointerCast(res, MallocTy->getReturnType()));
+  return F;
+}
+
+Function *getOrInsertFileTapeDeallocator(Module &M, FunctionType *FreeTy) {
+  std::string name = "__enzyme_file_tape_free";
+#if LLVM_VERSION_MAJOR >= 9
+  Function *F = cast<Function>(M.getOrInsertFunction(name, FreeTy).getCallee());
+#else
+  Function *F = cast<Function>(M.getOrInsertFunction(name, FreeTy));
+#endif
+
+  if (!F->empty())
+    return F;
+
+  F->setLinkage(Function::LinkageTypes::InternalLinkage);
+  F->addFnAttr(Attribute::AlwaysInline);
+  F->addFnAttr(Attribute::NoUnwind);
+  auto &C = M.getContext();
+  BasicBlock *entry = BasicBlock::Create(C, "entry", F);
+  BasicBlock *unmap = BasicBlock::Create(C, "unmap", F);
+  BasicBlock *heap = BasicBlock::Create(C, "heap", F);
+
+  Argument *ptr = F->arg_begin();
+  ptr->setName("ptr");
+  auto &DL = M.getDataLayout();
+  Type *SizeT = DL.getIntPtrType(C);
+  auto i8p = Type::getInt8PtrTy(C);
+
+  IRBuilder<> B(entry);
+  Value *base = B.CreatePointerCast(ptr, i8p);
+#if LLVM_VERSION_MAJOR > 7
+  base = B.CreateConstInBoundsGEP1_64(B.getInt8Ty(), base,
+                                      -(int64_t)FileTapeHeader, "base");
+  Value *len = B.CreateLoad(
+      SizeT, B.CreatePointerCast(base, PointerType::getUnqual(SizeT)), "len");
+#else
+  base = B.CreateConstInBoundsGEP1_64(base, -(int64_t)FileTapeHeader, "base");
+  Value *len = B.CreateLoad(
+      B.CreatePointerCast(base, PointerType::getUnqual(SizeT)), "len");
+#endif
+  B.CreateCondBr(B.CreateICmpEQ(len, ConstantInt::get(SizeT, 0)), heap,
+                 unmap);
+
+  B.SetInsertPoint(unmap);
+  auto munmapF = M.getOrInsertFunction(
+      "munmap",
+      FunctionType::get(Type::getInt32Ty(C), {i8p, SizeT}, false));
+  B.CreateCall(munmapF, {base, len});
+  B.CreateRetVoid();
+
+  B.SetInsertPoint(heap);
+  auto freeF = M.getOrInsertFunction("free", FreeTy);
+  B.CreateCall(freeF, {B.CreatePointerCast(base, FreeTy->getParamType(0))});
+  B.CreateRetVoid();
+  return F;
+}
+
+Function *getOrInsertFileTapeReadahead(Module &M) {
+  auto &C = M.getContext();
+  auto i8p = Type::getInt8PtrTy(C);
+  FunctionType *FT =
+      FunctionType::get(Type::getVoidTy(C), {i8p, i8p}, false);
+  std::string name = "__enzyme_file_tape_readahead";
+#if LLVM_VERSION_MAJOR >= 9
+  Function *F = cast<Function>(M.getOrInsertFunction(name, FT).getCallee());
+#else
+  Function *F = cast<Function>(M.getOrInsertFunction(name, FT));
+#endif
+
+  if (!F->empty())
+    return F;
+
+  F->setLinkage(Function::LinkageTypes::InternalLinkage);
+  F->addFnAttr(Attribute::AlwaysInline);
+  F->addFnAttr(Attribute::NoUnwind);
+  BasicBlock *entry = BasicBlock::Create(C, "entry", F);
+  BasicBlock *advise = BasicBlock::Create(C, "advise", F);
+  BasicBlock *end = BasicBlock::Create(C, "end", F);
+
+  Argument *cur = F->arg_begin();
+  cur->setName("cur");
+  Argument *last = cur + 1;
+  last->setName("last");
+  auto &DL = M.getDataLayout();
+  Type *SizeT = DL.getIntPtrType(C);
+
+  // Windows of 1MB, a multiple of the page size on every supported target
+  constexpr uint64_t window = 1 << 20;
+  IRBuilder<> B(entry);
+  Value *curi = B.CreatePtrToInt(cur, SizeT);
+  Value *lasti = B.CreatePtrToInt(last, SizeT);
+  Value *shift = ConstantInt::get(SizeT, Log2_64(window));
+  B.CreateCondBr(
+      B.CreateICmpNE(B.CreateLShr(curi, shift), B.CreateLShr(lasti, shift)),
+      advise, end);
+
+  // Entering a window from above, ask for the window below it to be read in
+  // while this one is consumed. MADV_WILLNEED is 3 on Linux and the BSDs.
+  B.SetInsertPoint(advise);
+  Value *start =
+      B.CreateSub(B.CreateAnd(curi, ConstantInt::get(SizeT, ~(window - 1))),
+                  ConstantInt::get(SizeT, window));
+  auto madviseF = M.getOrInsertFunction(
+      "madvise", FunctionType::get(Type::getInt32Ty(C),
+                                   {i8p, SizeT, Type::getInt32Ty(C)}, false));
+  B.CreateCall(madviseF, {B.CreateIntToPtr(start, i8p),
+                          ConstantInt::get(SizeT, window),
+                          ConstantInt::get(Type::getInt32Ty(C), 3)});
+  B.CreateBr(end);
+
+  B.SetInsertPoint(end);
+  B.CreateRetVoid();
+  return F;
+}
+
+void RedirectToFileTape(CallInst *CI) {
+  auto F = getFunctionFromCall(CI);
+  if (!F)
+    return;
+  auto &M = *CI->getParent()->getParent()->getParent();
+  if (F->getName() == "malloc" || F->getName() == "__enzyme_workspace_malloc")
+    CI->setCalledFunction(
+        getOrInsertFileTapeAllocator(M, CI->getFunctionType()));
+  else if (F->getName() == "free" || F->getName() == "__enzyme_workspace_free")
+    CI->setCalledFunction(
+        getOrInsertFileTapeDeallocator(M, CI->getFunctionType()));
+}
+
+/// Runtime record of an instrumented cache site, laid out as
+/// { i8* name, i64 bytes, i64 live, i64 peak, i64 reallocs, i8* next,
+///   i64 reported }, where next links the sites registered with the runtime
+/// and reported is the last report the site was printed in.
+static StructType *getCacheSiteType(LLVMContext &C) {
+  auto i8p = Type::getInt8PtrTy(C);
+  auto i64 = Type::getInt64Ty(C);
+  Type *types[] = {i8p, i64, i64, i64, i64, i8p, i64};
+  return StructType::get(C, types, /*isPacked*/ false);
+}
+
+/// Bytes preceding every block of an instrumented cache, holding its size
+/// and the site it was allocated for.
+constexpr static uint64_t CacheSiteHeader = 16;
+
+static Value *getCacheSiteField(IRBuilder<> &B, Value *site, unsigned i) {
+  auto ST = getCacheSiteType(B.getContext());
+  site = B.CreatePointerCast(site, PointerType::getUnqual(ST));
+#if LLVM_VERSION_MAJOR > 7
+  return B.CreateStructGEP(ST, site, i);
+#else
+  return B.CreateStructGEP(site, i);
+#endif
+}
+
+static Value *loadCacheSiteField(IRBuilder<> &B, Value *site, unsigned i,
+                                 const Twine &Name = "") {
+  auto ST = getCacheSiteType(B.getContext());
+  Value *field = getCacheSiteField(B, site, i);
+#if LLVM_VERSION_MAJOR > 7
+  return B.CreateLoad(ST->getElementType(i), field, Name);
+#else
+  return B.CreateLoad(field, Name);
+#endif
+}
+
+static void atomicCacheSiteUpdate(IRBuilder<> &B, AtomicRMWInst::BinOp Op,
+                                  Value *site, unsigned i, Value *V) {
+#if LLVM_VERSION_MAJOR >= 13
+  B.CreateAtomicRMW(Op, getCacheSiteField(B, site, i), V, MaybeAlign(8),
+                    AtomicOrdering::Monotonic);
+#else
+  B.CreateAtomicRMW(Op, getCacheSiteField(B, site, i), V,
+                    AtomicOrdering::Monotonic);
+#endif
+}
+
+/// Account for a cache of site growing by delta bytes.
+static void recordCacheAllocation(IRBuilder<> &B, Value *site, Value *delta,
+                                  bool realloc) {
+  auto i64 = B.getInt64Ty();
+  atomicCacheSiteUpdate(B, AtomicRMWInst::Add, site, 1, delta);
+  Value *field = getCacheSiteField(B, site, 2);
+#if LLVM_VERSION_MAJOR >= 13
+  Value *live = B.CreateAtomicRMW(AtomicRMWInst::Add, field, delta,
+                                  MaybeAlign(8), AtomicOrdering::Monotonic);
+#else
+  Value *live = B.CreateAtomicRMW(AtomicRMWInst::Add, field, delta,
+                                  AtomicOrdering::Monotonic);
+#endif
+  atomicCacheSiteUpdate(B, AtomicRMWInst::UMax, site, 3,
+                        B.CreateAdd(live, delta));
+  if (realloc)
+    atomicCacheSiteUpdate(B, AtomicRMWInst::Add, site, 4,
+                          ConstantInt::get(i64, 1));
+}
+
+static GlobalVariable *getOrInsertCacheRuntimeGlobal(Module &M, StringRef name,
+                                                     Type *T) {
+  if (auto GV = M.getGlobalVariable(name, /*AllowInternal*/ true)) {
+    // Programs may refer to the runtime, e.g. to read the cache sites
+    if (GV->isDeclaration()) {
+      GV->setLinkage(GlobalValue::LinkOnceODRLinkage);
+      GV->setInitializer(Constant::getNullValue(T));
+    }
+    return GV;
+  }
+  return new GlobalVariable(M, T, /*isConstant*/ false,
+                            GlobalValue::LinkOnceODRLinkage,
+                            Constant::getNullValue(T), name);
+}
+
+/// Declare the runtime function name of type FT, returning nullptr if it is
+/// already defined. The runtime is shared by every module linked together.
+static Function *getCacheRuntimeDeclaration(Module &M, StringRef name,
+                                            FunctionType *FT) {
+#if LLVM_VERSION_MAJOR >= 9
+  Function *F = cast<Function>(M.getOrInsertFunction(name, FT).getCallee());
+#else
+  Function *F = cast<Function>(M.getOrInsertFunction(name, FT));
+#endif
+  if (!F->empty())
+    return nullptr;
+  F->setLinkage(Function::LinkageTypes::LinkOnceODRLinkage);
+  F->addFnAttr(Attribute::NoUnwind);
+  return F;
+}
+
+Function *getOrInsertCacheReport(Module &M) {
+  auto &C = M.getContext();
+  auto i8p = Type::getInt8PtrTy(C);
+  auto i32 = Type::getInt32Ty(C);
+  auto i64 = Type::getInt64Ty(C);
+  StringRef name = "__enzyme_cache_report";
+  auto F = getCacheRuntimeDeclaration(
+      M, name, FunctionType::get(Type::getVoidTy(C), {}, false));
+  if (!F)
+    return M.getFunction(name);
+
+  auto sites = getOrInsertCacheRuntimeGlobal(M, "__enzyme_cache_sites", i8p);
+  auto generation =
+      getOrInsertCacheRuntimeGlobal(M, "__enzyme_cache_report_generation", i64);
+
+  BasicBlock *entry = BasicBlock::Create(C, "entry", F);
+  BasicBlock *pick = BasicBlock::Create(C, "pick", F);
+  BasicBlock *scan = BasicBlock::Create(C, "scan", F);
+  BasicBlock *visit = BasicBlock::Create(C, "visit", F);
+  BasicBlock *found = BasicBlock::Create(C, "found", F);
+  BasicBlock *print = BasicBlock::Create(C, "print", F);
+  BasicBlock *end = BasicBlock::Create(C, "end", F);
+
+  IRBuilder<> B(entry);
+#if LLVM_VERSION_MAJOR > 7
+  Value *gen = B.CreateLoad(i64, generation);
+#else
+  Value *gen = B.CreateLoad(generation);
+#endif
+  gen = B.CreateAdd(gen, ConstantInt::get(i64, 1), "gen");
+  B.CreateStore(gen, generation);
+  auto dprintfF = M.getOrInsertFunction(
+      "dprintf", FunctionType::get(i32, {i32, i8p}, true));
+  Value *stderrFd = ConstantInt::get(i32, 2);
+  B.CreateCall(dprintfF, {stderrFd,
+                          B.CreateGlobalStringPtr(
+                              "enzyme cache report\n%20s %20s %14s  %s\n"),
+                          B.CreateGlobalStringPtr("cache bytes"),
+                          B.CreateGlobalStringPtr("peak live bytes"),
+                          B.CreateGlobalStringPtr("reallocations"),
+                          B.CreateGlobalStringPtr("site")});
+  B.CreateBr(pick);
+
+  // Sites are printed by decreasing bytes allocated, picking the largest
+  // site not yet printed by this report until only unused sites are left
+  B.SetInsertPoint(pick);
+#if LLVM_VERSION_MAJOR > 7
+  Value *head = B.CreateLoad(i8p, sites, "head");
+#else
+  Value *head = B.CreateLoad(sites, "head");
+#endif
+  B.CreateBr(scan);
+
+  B.SetInsertPoint(scan);
+  auto cur = B.CreatePHI(i8p, 2, "cur");
+  auto best = B.CreatePHI(i8p, 2, "best");
+  auto bestBytes = B.CreatePHI(i64, 2, "bestbytes");
+  cur->addIncoming(head, pick);
+  best->addIncoming(ConstantPointerNull::get(i8p), pick);
+  bestBytes->addIncoming(ConstantInt::get(i64, 0), pick);
+  B.CreateCondBr(B.CreateIsNull(cur), found, visit);
+
+  B.SetInsertPoint(visit);
+  Value *bytes = loadCacheSiteField(B, cur, 1, "bytes");
+  Value *better = B.CreateAnd(
+      B.CreateICmpNE(loadCacheSiteField(B, cur, 6), gen),
+      B.CreateICmpUGT(bytes, bestBytes));
+  cur->addIncoming(loadCacheSiteField(B, cur, 5, "next"), visit);
+  best->addIncoming(B.CreateSelect(better, cur, best), visit);
+  bestBytes->addIncoming(B.CreateSelect(better, bytes, bestBytes), visit);
+  B.CreateBr(scan);
+
+  B.SetInsertPoint(found);
+  B.CreateCondBr(B.CreateIsNull(best), end, print);
+
+  B.SetInsertPoint(print);
+  B.CreateStore(gen, getCacheSiteField(B, best, 6));
+  B.CreateCall(dprintfF,
+               {stderrFd, B.CreateGlobalStringPtr("%20llu %20llu %14llu  %s\n"),
+                bestBytes, loadCacheSiteField(B, best, 3),
+                loadCacheSiteField(B, best, 4),
+                loadCacheSiteField(B, best, 0)});
+  B.CreateBr(pick);
+
+  B.SetInsertPoint(end);
+  B.CreateRetVoid();
+  return F;
+}
+
+/// Runtime function registering a cache site, so it is listed by the report
+/// printed at exit.
+static Function *getOrInsertCacheRegister(Module &M) {
+  auto &C = M.getContext();
+  auto i8p = Type::getInt8PtrTy(C);
+  auto i8 = Type::getInt8Ty(C);
+  StringRef name = "__enzyme_cache_register";
+  auto F = getCacheRuntimeDeclaration(
+      M, name, FunctionType::get(Type::getVoidTy(C), {i8p}, false));
+  if (!F)
+    return M.getFunction(name);
+
+  auto sites = getOrInsertCacheRuntimeGlobal(M, "__enzyme_cache_sites", i8p);
+  auto registered =
+      getOrInsertCacheRuntimeGlobal(M, "__enzyme_cache_report_registered", i8);
+
+  BasicBlock *entry = BasicBlock::Create(C, "entry", F);
+  BasicBlock *first = BasicBlock::Create(C, "first", F);
+  BasicBlock *end = BasicBlock::Create(C, "end", F);
+
+  Argument *site = F->arg_begin();
+  site->setName("site");
+
+  // Sites are registered by constructors, before any thread is started
+  IRBuilder<> B(entry);
+#if LLVM_VERSION_MAJOR > 7
+  Value *head = B.CreateLoad(i8p, sites, "head");
+  Value *done = B.CreateLoad(i8, registered);
+#else
+  Value *head = B.CreateLoad(sites, "head");
+  Value *done = B.CreateLoad(registered);
+#endif
+  B.CreateStore(head, getCacheSiteField(B, site, 5));
+  B.CreateStore(site, sites);
+  B.CreateCondBr(B.CreateICmpEQ(done, ConstantInt::get(i8, 0)), first, end);
+
+  B.SetInsertPoint(first);
+  B.CreateStore(ConstantInt::get(i8, 1), registered);
+  auto report = getOrInsertCacheReport(M);
+  auto atexitF = M.getOrInsertFunction(
+      "atexit",
+      FunctionType::get(Type::getInt32Ty(C), {report->getType()}, false));
+  B.CreateCall(atexitF, {report});
+  B.CreateBr(end);
+
+  B.SetInsertPoint(end);
+  B.CreateRetVoid();
+  return F;
+}
+
+/// Runtime allocator prefixing each block with its size and site.
+static Function *getOrInsertCacheMalloc(Module &M) {
+  auto &C = M.getContext();
+  auto i8p = Type::getInt8PtrTy(C);
+  auto i64 = Type::getInt64Ty(C);
+  StringRef name = "__enzyme_cache_malloc";
+  auto F = getCacheRuntimeDeclaration(M, name,
+                                      FunctionType::get(i8p, {i8p, i64}, false));
+  if (!F)
+    return M.getFunction(name);
+
+  BasicBlock *entry = BasicBlock::Create(C, "entry", F);
+  BasicBlock *ok = BasicBlock::Create(C, "ok", F);
+  BasicBlock *fail = BasicBlock::Create(C, "fail", F);
+
+  Argument *site = F->arg_begin();
+  site->setName("site");
+  Argument *size = site + 1;
+  size->setName("size");
+
+  IRBuilder<> B(entry);
+  auto mallocF =
+      M.getOrInsertFunction("malloc", FunctionType::get(i8p, {i64}, false));
+  Value *mem = B.CreateCall(
+      mallocF, {B.CreateAdd(size, ConstantInt::get(i64, CacheSiteHeader), "",
+                            /*NUW*/ true, /*NSW*/ true)},
+      "mem");
+  B.CreateCondBr(B.CreateIsNull(mem), fail, ok);
+
+  B.SetInsertPoint(ok);
+  B.CreateStore(size, B.CreatePointerCast(mem, PointerType::getUnqual(i64)));
+#if LLVM_VERSION_MAJOR > 7
+  Value *sitep = B.CreateConstInBoundsGEP1_64(B.getInt8Ty(), mem, 8);
+  Value *res =
+      B.CreateConstInBoundsGEP1_64(B.getInt8Ty(), mem, CacheSiteHeader);
+#else
+  Value *sitep = B.CreateConstInBoundsGEP1_64(mem, 8);
+  Value *res = B.CreateConstInBoundsGEP1_64(mem, CacheSiteHeader);
+#endif
+  B.CreateStore(site, B.CreatePointerCast(sitep, PointerType::getUnqual(i8p)));
+  recordCacheAllocation(B, site, size, /*realloc*/ false);
+  B.CreateRet(res);
+
+  B.SetInsertPoint(fail);
+  B.CreateRet(mem);
+  return F;
+}
+
+/// Runtime reallocator for blocks of the cache allocator, counting the growth
+/// of the block and the reallocation.
+static Function *getOrInsertCacheRealloc(Module &M) {
+  auto &C = M.getContext();
+  auto i8p = Type::getInt8PtrTy(C);
+  auto i64 = Type::getInt64Ty(C);
+  StringRef name = "__enzyme_cache_realloc";
+  auto F = getCacheRuntimeDeclaration(
+      M, name, FunctionType::get(i8p, {i8p, i8p, i64}, false));
+  if (!F)
+    return M.getFunction(name);
+
+  BasicBlock *entry = BasicBlock::Create(C, "entry", F);
+  BasicBlock *fresh = BasicBlock::Create(C, "fresh", F);
+  BasicBlock *grow = BasicBlock::Create(C, "grow", F);
+  BasicBlock *ok = BasicBlock::Create(C, "ok", F);
+  BasicBlock *fail = BasicBlock::Create(C, "fail", F);
+
+  Argument *site = F->arg_begin();
+  site->setName("site");
+  Argument *ptr = site + 1;
+  ptr->setName("ptr");
+  Argument *size = ptr + 1;
+  size->setName("size");
+
+  IRBuilder<> B(entry);
+  B.CreateCondBr(B.CreateIsNull(ptr), fresh, grow);
+
+  B.SetInsertPoint(fresh);
+  B.CreateRet(B.CreateCall(getOrInsertCacheMalloc(M), {site, size}));
+
+  B.SetInsertPoint(grow);
+  auto sizep = PointerType::getUnqual(i64);
+#if LLVM_VERSION_MAJOR > 7
+  Value *base = B.CreateConstInBoundsGEP1_64(B.getInt8Ty(), ptr,
+                                             -(int64_t)CacheSiteHeader, "base");
+  Value *old = B.CreateLoad(i64, B.CreatePointerCast(base, sizep), "old");
+#else
+  Value *base =
+      B.CreateConstInBoundsGEP1_64(ptr, -(int64_t)CacheSiteHeader, "base");
+  Value *old = B.CreateLoad(B.CreatePointerCast(base, sizep), "old");
+#endif
+  auto reallocF = M.getOrInsertFunction(
+      "realloc", FunctionType::get(i8p, {i8p, i64}, false));
+  Value *mem = B.CreateCall(
+      reallocF,
+      {base, B.CreateAdd(size, ConstantInt::get(i64, CacheSiteHeader), "",
+                         /*NUW*/ true, /*NSW*/ true)},
+      "mem");
+  B.CreateCondBr(B.CreateIsNull(mem), fail, ok);
+
+  B.SetInsertPoint(ok);
+  B.CreateStore(size, B.CreatePointerCast(mem, sizep));
+  recordCacheAllocation(B, site, B.CreateSub(size, old), /*realloc*/ true);
+#if LLVM_VERSION_MAJOR > 7
+  B.CreateRet(B.CreateConstInBoundsGEP1_64(B.getInt8Ty(), mem, CacheSiteHeader));
+#else
+  B.CreateRet(B.CreateConstInBoundsGEP1_64(mem, CacheSiteHeader));
+#endif
+
+  B.SetInsertPoint(fail);
+  B.CreateRet(mem);
+  return F;
+}
+
+/// Runtime deallocator for blocks of the cache allocator.
+static Function *getOrInsertCacheFree(Module &M) {
+  auto &C = M.getContext();
+  auto i8p = Type::getInt8PtrTy(C);
+  auto i64 = Type::getInt64Ty(C);
+  StringRef name = "__enzyme_cache_free";
+  auto F = getCacheRuntimeDeclaration(
+      M, name, FunctionType::get(Type::getVoidTy(C), {i8p}, false));
+  if (!F)
+    return M.getFunction(name);
+
+  BasicBlock *entry = BasicBlock::Create(C, "entry", F);
+  BasicBlock *release = BasicBlock::Create(C, "release", F);
+  BasicBlock *end = BasicBlock::Create(C, "end", F);
+
+  Argument *ptr = F->arg_begin();
+  ptr->setName("ptr");
+
+  IRBuilder<> B(entry);
+  B.CreateCondBr(B.CreateIsNull(ptr), end, release);
+
+  B.SetInsertPoint(release);
+#if LLVM_VERSION_MAJOR > 7
+  Value *base = B.CreateConstInBoundsGEP1_64(B.getInt8Ty(), ptr,
+                                             -(int64_t)CacheSiteHeader, "base");
+  Value *size = B.CreateLoad(
+      i64, B.CreatePointerCast(base, PointerType::getUnqual(i64)), "size");
+  Value *site = B.CreateLoad(
+      i8p,
+      B.CreatePointerCast(B.CreateConstInBoundsGEP1_64(B.getInt8Ty(), base, 8),
+                          PointerType::getUnqual(i8p)),
+      "site");
+#else
+  Value *base =
+      B.CreateConstInBoundsGEP1_64(ptr, -(int64_t)CacheSiteHeader, "base");
+  Value *size = B.CreateLoad(
+      B.CreatePointerCast(base, PointerType::getUnqual(i64)), "size");
+  Value *site = B.CreateLoad(
+      B.CreatePointerCast(B.CreateConstInBoundsGEP1_64(base, 8),
+                          PointerType::getUnqual(i8p)),
+      "site");
+#endif
+  atomicCacheSiteUpdate(B, AtomicRMWInst::Sub, site, 2, size);
+  auto freeF = M.getOrInsertFunction(
+      "free", FunctionType::get(Type::getVoidTy(C), {i8p}, false));
+  B.CreateCall(freeF, {base});
+  B.CreateBr(end);
+
+  B.SetInsertPoint(end);
+  B.CreateRetVoid();
+  return F;
+}
+
+void SetCacheSiteName(GlobalVariable *site, StringRef name) {
+  auto &M = *site->getParent();
+  auto &C = M.getContext();
+  Constant *str = ConstantDataArray::getString(C, name);
+  auto strGV = new GlobalVariable(M, str->getType(), /*isConstant*/ true,
+                                  GlobalValue::PrivateLinkage, str,
+                                  site->getName() + ".name");
+  strGV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+
+  auto init = site->getInitializer();
+  auto ST = cast<StructType>(init->getType());
+  SmallVector<Constant *, 7> fields;
+  for (unsigned i = 0; i < ST->getNumElements(); i++)
+    fields.push_back(init->getAggregateElement(i));
+  auto prev = dyn_cast<GlobalVariable>(fields[0]->stripPointerCasts());
+  fields[0] = ConstantExpr::getPointerCast(strGV, Type::getInt8PtrTy(C));
+  site->setInitializer(ConstantStruct::get(ST, fields));
+  if (prev) {
+    prev->removeDeadConstantUsers();
+    if (prev->use_empty())
+      prev->eraseFromParent();
+  }
+}
+
+/// Create the record of a new cache site, registered with the runtime by a
+/// constructor of the module.
+static GlobalVariable *CreateCacheSite(Module &M, StringRef name) {
+  auto &C = M.getContext();
+  auto ST = getCacheSiteType(C);
+  auto site = new GlobalVariable(M, ST, /*isConstant*/ false,
+                                 GlobalValue::InternalLinkage,
+                                 Constant::getNullValue(ST),
+                                 "__enzyme_cache_site");
+#if LLVM_VERSION_MAJOR >= 10
+  site->setAlignment(Align(8));
+#else
+  site->setAlignment(8);
+#endif
+  SetCacheSiteName(site, name);
+
+  StringRef ctorName = "__enzyme_cache_register_sites";
+  Function *ctor = M.getFunction(ctorName);
+  if (!ctor) {
+    ctor = Function::Create(FunctionType::get(Type::getVoidTy(C), {}, false),
+                            GlobalValue::InternalLinkage, ctorName, &M);
+    ctor->addFnAttr(Attribute::NoUnwind);
+    IRBuilder<> B(BasicBlock::Create(C, "entry", ctor));
+    B.CreateRetVoid();
+    appendToGlobalCtors(M, ctor, /*Priority*/ 65535);
+  }
+  IRBuilder<> B(ctor->getEntryBlock().getTerminator());
+  B.CreateCall(getOrInsertCacheRegister(M),
+               {ConstantExpr::getPointerCast(site, Type::getInt8PtrTy(C))});
+  return site;
+}
+
+/// Per site wrapper of the cache allocator, of the type of the allocator it
+/// replaces.
+static Function *getOrInsertCacheSiteAllocator(GlobalVariable *site,
+                                               FunctionType *FT,
+                                               bool realloc) {
+  auto &M = *site->getParent();
+  auto &C = M.getContext();
+  auto i8p = Type::getInt8PtrTy(C);
+  auto i64 = Type::getInt64Ty(C);
+  auto F = Function::Create(FT, GlobalValue::InternalLinkage,
+                            site->getName() + (realloc ? ".realloc" : ".malloc"),
+                            &M);
+  F->addFnAttr(Attribute::AlwaysInline);
+  F->addFnAttr(Attribute::NoUnwind);
+  IRBuilder<> B(BasicBlock::Create(C, "entry", F));
+  SmallVector<Value *, 3> args = {ConstantExpr::getPointerCast(site, i8p)};
+  auto arg = F->arg_begin();
+  if (realloc) {
+    args.push_back(B.CreatePointerCast(arg, i8p));
+    arg++;
+  }
+  args.push_back(B.CreateZExtOrTrunc(arg, i64));
+  Value *res = B.CreateCall(
+      realloc ? getOrInsertCacheRealloc(M) : getOrInsertCacheMalloc(M), args);
+  B.CreateRet(B.CreatePointerCast(res, FT->getReturnType()));
+  return F;
+}
+
+GlobalVariable *InstrumentCacheAllocation(CallInst *CI, StringRef name) {
+  auto F = getFunctionFromCall(CI);
+  if (!F)
+    return nullptr;
+  auto &M = *CI->getParent()->getParent()->getParent();
+  if (F->getName() == "malloc") {
+    if (!CI->getType()->isPointerTy())
+      return nullptr;
+    auto site = CreateCacheSite(M, name);
+    CI->setCalledFunction(getOrInsertCacheSiteAllocator(
+        site, CI->getFunctionType(), /*realloc*/ false));
+    return site;
+  }
+
+  // The exponential allocator grows caches through realloc, unless it uses
+  // a custom allocator. Each site uses its own copy, calling the cache
+  // reallocator instead.
+  if (!F->getName().startswith("__enzyme_exponentialallocation") ||
+      F->empty())
+    return nullptr;
+  SmallVector<CallInst *, 1> reallocs;
+  for (auto &I : instructions(F))
+    if (auto call = dyn_cast<CallInst>(&I))
+      if (auto callee = getFunctionFromCall(call))
+        if (callee->getName() == "realloc")
+          reallocs.push_back(call);
+  if (reallocs.size() != 1)
+    return nullptr;
+
+  auto site = CreateCacheSite(M, name);
+  ValueToValueMapTy VMap;
+  Function *NF = CloneFunction(F, VMap);
+  NF->setName(F->getName() + "." + site->getName());
+  auto call = cast<CallInst>(VMap[reallocs[0]]);
+  call->setCalledFunction(getOrInsertCacheSiteAllocator(
+      site, call->getFunctionType(), /*realloc*/ true));
+  CI->setCalledFunction(NF);
+  return site;
+}
+
+void InstrumentCacheDealloc(CallInst *CI) {
+  auto F = getFunctionFromCall(CI);
+  if (!F || F->getName() != "free")
+    return;
+  auto &M = *CI->getParent()->getParent()->getParent();
+  auto freeF = getOrInsertCacheFree(M);
+  if (CI->getFunctionType() != freeF->getFunctionType())
+    return;
+  CI->setCalledFunction(freeF);
+}
+
 Value *CreateAllocation(IRBuilder<> &Builder, llvm::Type *T, Value *Count,
                         Twine Name, CallInst **caller, Instruction **ZeroMem,
-                        bool isDefault) {
+                        bool isDefault, bool Workspace) {
   Value *res;
   auto &M = *Builder.GetInsertBlock()->getParent()->getParent();
   auto AlignI = M.getDataLayout().getTypeAllocSizeInBits(T) / 8;
@@ -319,6 +1520,11 @@ Value *CreateAllocation(IRBuilder<> &Builder, llvm::Type *T, Value *Count,
     malloccall->addAttribute(AttributeList::ReturnIndex, Attribute::NoAlias);
     malloccall->addAttribute(AttributeList::ReturnIndex, Attribute::NonNull);
 #endif
+    // Serve the memory from the caller's enzyme_workspace, if any
+    if (Workspace && M.getGlobalVariable("__enzyme_workspace",
+                                         /*AllowInternal*/ true))
+      malloccall->setCalledFunction(
+          getOrInsertWorkspaceAllocator(M, malloccall->getFunctionType()));
   }
   if (caller) {
     *caller = malloccall;
@@ -372,6 +1578,10 @@ CallInst *CreateDealloc(llvm::IRBuilder<> &Builder, llvm::Value *ToFree) {
 #else
     res->addAttribute(AttributeList::FirstArgIndex, Attribute::NonNull);
 #endif
+    auto &M = *Builder.GetInsertBlock()->getParent()->getParent();
+    if (M.getGlobalVariable("__enzyme_workspace", /*AllowInternal*/ true))
+      res->setCalledFunction(
+          getOrInsertWorkspaceDeallocator(M, res->getFunctionType()));
   }
   return res;
 }
@@ -834,6 +2044,287 @@ llvm::Value *nextPowerOfTwo(llvm::IRBuilder<> &B, llvm::Value *V) {
   return V;
 }
 
+/// Emit a loop running count iterations at the end of B's block, calling body
+/// with the current index, ascending or descending from count - 1. B is left
+/// at the start of the exit block.
+static void
+emitCheckpointLoop(IRBuilder<> &B, Value *count, bool reverse,
+                   const Twine &name,
+                   function_ref<void(IRBuilder<> &, Value *)> body) {
+  Function *F = B.GetInsertBlock()->getParent();
+  LLVMContext &C = F->getContext();
+  Type *T = count->getType();
+  Value *zero = ConstantInt::get(T, 0);
+  Value *one = ConstantInt::get(T, 1);
+
+  BasicBlock *preheader = B.GetInsertBlock();
+  BasicBlock *header = BasicBlock::Create(C, name + ".body", F);
+  BasicBlock *exit = BasicBlock::Create(C, name + ".end", F);
+  B.CreateCondBr(B.CreateICmpSLE(count, zero), exit, header);
+
+  B.SetInsertPoint(header);
+  PHINode *iv = B.CreatePHI(T, 2, name + ".iv");
+  iv->addIncoming(zero, preheader);
+  Value *idx = reverse ? B.CreateSub(B.CreateSub(count, one), iv) : iv;
+  body(B, idx);
+  Value *next = B.CreateNUWAdd(iv, one, name + ".next");
+  iv->addIncoming(next, B.GetInsertBlock());
+  B.CreateCondBr(B.CreateICmpEQ(next, count), exit, header);
+
+  B.SetInsertPoint(exit);
+}
+
+/// Number of iterations between the states stored by a checkpointed loop,
+/// the fixed interval if one was requested and ceil(sqrt(n)) otherwise.
+static Value *getCheckpointInterval(IRBuilder<> &B, Value *n) {
+  Type *T = n->getType();
+  if (EnzymeCheckpointInterval > 0)
+    return ConstantInt::get(T, EnzymeCheckpointInterval);
+  Module &M = *B.GetInsertBlock()->getParent()->getParent();
+  Type *DT = B.getDoubleTy();
+  Function *sqrtF = Intrinsic::getDeclaration(&M, Intrinsic::sqrt, DT);
+  Value *K = B.CreateFPToUI(B.CreateCall(sqrtF, B.CreateSIToFP(n, DT)), T);
+  K = B.CreateSelect(B.CreateICmpSLT(B.CreateMul(K, K), n),
+                     B.CreateAdd(K, ConstantInt::get(T, 1)), K);
+  return B.CreateSelect(B.CreateICmpEQ(K, ConstantInt::get(T, 0)),
+                        ConstantInt::get(T, 1), K, "interval");
+}
+
+/// Number of iterations requested of a checkpointed loop, with negative counts
+/// treated as zero so they neither run nor reach the sqrt schedule.
+static Value *getCheckpointCount(IRBuilder<> &B, Value *n) {
+  Value *zero = ConstantInt::get(n->getType(), 0);
+  return B.CreateSelect(B.CreateICmpSLT(n, zero), zero, n, "count");
+}
+
+static void createCheckpointCopy(IRBuilder<> &B, Value *dst, Value *src,
+                                 Value *bytes) {
+#if LLVM_VERSION_MAJOR >= 10
+  B.CreateMemCpy(dst, MaybeAlign(1), src, MaybeAlign(1), bytes);
+#else
+  B.CreateMemCpy(dst, 1, src, 1, bytes);
+#endif
+}
+
+static Value *getCheckpointSlot(IRBuilder<> &B, Value *base, Value *idx,
+                                Value *bytes) {
+#if LLVM_VERSION_MAJOR > 7
+  return B.CreateInBoundsGEP(B.getInt8Ty(), base, B.CreateMul(idx, bytes));
+#else
+  return B.CreateInBoundsGEP(base, B.CreateMul(idx, bytes));
+#endif
+}
+
+Value *castCheckpointArgument(IRBuilder<> &B, Value *V, Type *T) {
+  if (V->getType() == T)
+    return V;
+  if (T->isPointerTy())
+    return B.CreatePointerCast(V, T);
+  if (T->isIntegerTy())
+    return B.CreateSExtOrTrunc(V, T);
+  if (T->isFloatingPointTy())
+    return B.CreateFPCast(V, T);
+  return B.CreateBitCast(V, T);
+}
+
+Function *getOrInsertCheckpointLoop(Module &M, Function *step) {
+  std::string name = ("__enzyme_checkpoint_loop." + step->getName()).str();
+  if (Function *F = M.getFunction(name))
+    return F;
+
+  LLVMContext &C = M.getContext();
+  Type *i64 = Type::getInt64Ty(C);
+  SmallVector<Type *, 4> types = {i64};
+  for (auto &arg : step->args())
+    types.push_back(arg.getType());
+  FunctionType *FT = FunctionType::get(Type::getVoidTy(C), types, false);
+  Function *F =
+      Function::Create(FT, Function::LinkageTypes::InternalLinkage, name, M);
+  F->addFnAttr(Attribute::NoUnwind);
+
+  auto n = F->arg_begin();
+  n->setName("n");
+  SmallVector<Value *, 4> args;
+  for (auto &arg : make_range(n + 1, F->arg_end()))
+    args.push_back(&arg);
+
+  IRBuilder<> B(BasicBlock::Create(C, "entry", F));
+  emitCheckpointLoop(B, n, /*reverse*/ false, "step",
+                     [&](IRBuilder<> &B, Value *) {
+                       B.CreateCall(step->getFunctionType(), step, args);
+                     });
+  B.CreateRetVoid();
+  return F;
+}
+
+Function *getOrInsertCheckpointForward(Module &M, Function *step) {
+  std::string name = ("__enzyme_checkpoint_fwd." + step->getName()).str();
+  if (Function *F = M.getFunction(name))
+    return F;
+
+  LLVMContext &C = M.getContext();
+  Type *i64 = Type::getInt64Ty(C);
+  SmallVector<Type *, 4> types = {i64, i64};
+  for (auto &arg : step->args())
+    types.push_back(arg.getType());
+  FunctionType *FT =
+      FunctionType::get(Type::getInt8PtrTy(C), types, false);
+  Function *F =
+      Function::Create(FT, Function::LinkageTypes::InternalLinkage, name, M);
+  F->addFnAttr(Attribute::NoUnwind);
+
+  auto n = F->arg_begin();
+  n->setName("n");
+  auto bytes = n + 1;
+  bytes->setName("bytes");
+  auto state = bytes + 1;
+  state->setName("state");
+  SmallVector<Value *, 4> args;
+  for (auto &arg : make_range(state, F->arg_end()))
+    args.push_back(&arg);
+
+  IRBuilder<> B(BasicBlock::Create(C, "entry", F));
+  Value *count = getCheckpointCount(B, n);
+  Value *K = getCheckpointInterval(B, count);
+  Value *nseg = B.CreateUDiv(B.CreateAdd(count, B.CreateSub(K, B.getInt64(1))),
+                             K, "nsegments");
+  nseg = B.CreateSelect(B.CreateICmpSGT(nseg, B.getInt64(0)), nseg,
+                        B.getInt64(1));
+  Value *snapshots = CreateAllocation(B, B.getInt8Ty(),
+                                      B.CreateMul(nseg, bytes), "checkpoints");
+  Value *src = B.CreatePointerCast(state, Type::getInt8PtrTy(C));
+
+  emitCheckpointLoop(
+      B, count, /*reverse*/ false, "step", [&](IRBuilder<> &B, Value *idx) {
+        BasicBlock *store = BasicBlock::Create(C, "store", F);
+        BasicBlock *run = BasicBlock::Create(C, "run", F);
+        B.CreateCondBr(
+            B.CreateICmpEQ(B.CreateURem(idx, K), B.getInt64(0)), store, run);
+        B.SetInsertPoint(store);
+        createCheckpointCopy(
+            B, getCheckpointSlot(B, snapshots, B.CreateUDiv(idx, K), bytes),
+            src, bytes);
+        B.CreateBr(run);
+        B.SetInsertPoint(run);
+        B.CreateCall(step->getFunctionType(), step, args);
+      });
+  B.CreateRet(snapshots);
+  return F;
+}
+
+Function *getOrInsertCheckpointReverse(Module &M, Function *step,
+                                       Function *grad,
+                                       ArrayRef<DIFFE_TYPE> constant_args) {
+  std::string name = ("__enzyme_checkpoint_rev." + grad->getName()).str();
+  if (EnzymeCheckpointRecompute)
+    name += ".recompute";
+  if (Function *F = M.getFunction(name))
+    return F;
+
+  LLVMContext &C = M.getContext();
+  Type *i64 = Type::getInt64Ty(C);
+  Type *i8p = Type::getInt8PtrTy(C);
+  // The primal state of the gradient is always a scratch copy owned by this
+  // function, so it is omitted from the signature.
+  SmallVector<Type *, 4> types = {i64, i64, i8p};
+  for (auto &arg : make_range(grad->arg_begin() + 1, grad->arg_end()))
+    types.push_back(arg.getType());
+  FunctionType *FT = FunctionType::get(Type::getVoidTy(C), types, false);
+  Function *F =
+      Function::Create(FT, Function::LinkageTypes::InternalLinkage, name, M);
+  F->addFnAttr(Attribute::NoUnwind);
+
+  auto n = F->arg_begin();
+  n->setName("n");
+  auto bytes = n + 1;
+  bytes->setName("bytes");
+  auto snapshots = bytes + 1;
+  snapshots->setName("checkpoints");
+
+  // Split the incoming arguments back into those of the primal step and those
+  // of the gradient, leaving a hole for the state in each.
+  SmallVector<Value *, 4> stepArgs = {nullptr};
+  SmallVector<Value *, 4> gradArgs = {nullptr};
+  auto cur = snapshots + 1;
+  for (size_t i = 0; i < constant_args.size(); ++i) {
+    if (i != 0) {
+      stepArgs.push_back(&*cur);
+      gradArgs.push_back(&*cur);
+      ++cur;
+    }
+    if (constant_args[i] == DIFFE_TYPE::DUP_ARG ||
+        constant_args[i] == DIFFE_TYPE::DUP_NONEED) {
+      gradArgs.push_back(&*cur);
+      ++cur;
+    }
+  }
+  assert(cur == F->arg_end());
+
+  Type *stateTy = step->getFunctionType()->getParamType(0);
+  auto callStep = [&](IRBuilder<> &B, Value *state) {
+    stepArgs[0] = B.CreatePointerCast(state, stateTy);
+    B.CreateCall(step->getFunctionType(), step, stepArgs);
+  };
+
+  IRBuilder<> B(BasicBlock::Create(C, "entry", F));
+  Value *count = getCheckpointCount(B, n);
+  Value *K = getCheckpointInterval(B, count);
+  Value *nseg = B.CreateUDiv(B.CreateAdd(count, B.CreateSub(K, B.getInt64(1))),
+                             K, "nsegments");
+
+  // States of the segment currently being reversed, either all of them or
+  // only the one being differentiated when recomputing.
+  Value *states = EnzymeCheckpointRecompute
+                      ? nullptr
+                      : CreateAllocation(B, B.getInt8Ty(),
+                                         B.CreateMul(K, bytes), "states");
+  Value *scratch = CreateAllocation(B, B.getInt8Ty(), bytes, "scratch");
+  gradArgs[0] = B.CreatePointerCast(scratch, stateTy);
+
+  emitCheckpointLoop(
+      B, nseg, /*reverse*/ true, "segment", [&](IRBuilder<> &B, Value *seg) {
+        Value *start = B.CreateMul(seg, K);
+        Value *rem = B.CreateSub(count, start);
+        Value *len =
+            B.CreateSelect(B.CreateICmpULT(rem, K), rem, K, "segment.len");
+        Value *snapshot = getCheckpointSlot(B, snapshots, seg, bytes);
+
+        if (states) {
+          createCheckpointCopy(B, states, snapshot, bytes);
+          emitCheckpointLoop(
+              B, B.CreateSub(len, B.getInt64(1)), /*reverse*/ false,
+              "recompute", [&](IRBuilder<> &B, Value *j) {
+                Value *next = getCheckpointSlot(
+                    B, states, B.CreateAdd(j, B.getInt64(1)), bytes);
+                createCheckpointCopy(
+                    B, next, getCheckpointSlot(B, states, j, bytes), bytes);
+                callStep(B, next);
+              });
+        }
+
+        emitCheckpointLoop(
+            B, len, /*reverse*/ true, "reverse",
+            [&](IRBuilder<> &B, Value *j) {
+              if (states) {
+                createCheckpointCopy(
+                    B, scratch, getCheckpointSlot(B, states, j, bytes), bytes);
+              } else {
+                createCheckpointCopy(B, scratch, snapshot, bytes);
+                emitCheckpointLoop(
+                    B, j, /*reverse*/ false, "recompute",
+                    [&](IRBuilder<> &B, Value *) { callStep(B, scratch); });
+              }
+              B.CreateCall(grad->getFunctionType(), grad, gradArgs);
+            });
+      });
+
+  if (states)
+    CreateDealloc(B, states);
+  CreateDealloc(B, scratch);
+  B.CreateRetVoid();
+  return F;
+}
+
 llvm::Function *getOrInsertDifferentialWaitallSave(llvm::Module &M,
                                                    ArrayRef<llvm::Type *> T,
                                                    PointerType *reqType) {
@@ -55,6 +55,7 @@
 
 #include <map>
 #include <set>
+#include <unordered_map>
 
 #include "llvm/IR/DiagnosticInfo.h"
 
@@ -76,8 +77,23 @@ enum class ErrorType {
 extern "C" {
 /// Print additional debug info relevant to performance
 extern llvm::cl::opt<bool> EnzymePrintPerf;
+/// Iterations between stored states of a checkpointed loop
+extern llvm::cl::opt<int> EnzymeCheckpointInterval;
+/// Recompute checkpointed segments rather than storing their states
+extern llvm::cl::opt<bool> EnzymeCheckpointRecompute;
+/// Smallest cache chunk mapped from a file by the file tape
+extern llvm::cl::opt<int> EnzymeFileTapeMin;
 extern void (*CustomErrorHandler)(const char *, LLVMValueRef, ErrorType,
                                   void *);
+extern LLVMValueRef (*CustomAllocator)(LLVMBuilderRef, LLVMTypeRef,
+                                       /*Count*/ LLVMValueRef,
+                                       /*Align*/ LLVMValueRef, uint8_t);
+extern LLVMValueRef (*CustomDeallocator)(LLVMBuilderRef, LLVMValueRef);
+extern void (*CustomRuntimeInactiveError)(LLVMBuilderRef, LLVMValueRef,
+                                          LLVMValueRef);
+extern LLVMValueRef (*EnzymePostCacheStore)(LLVMValueRef, LLVMBuilderRef,
+                                            LLVMValueRef *);
+extern LLVMTypeRef (*EnzymeDefaultTapeType)(LLVMContextRef);
 }
 
 llvm::SmallVector<llvm::Instruction *, 2> PostCacheStore(llvm::StoreInst *SI,
@@ -87,7 +103,7 @@ llvm::Value *CreateAllocation(llvm::IRBuilder<> &B, llvm::Type *T,
                               llvm::Value *Count, llvm::Twine Name = "",
                               llvm::CallInst **caller = nullptr,
                               llvm::Instruction **ZeroMem = nullptr,
-                              bool isDefault = false);
+                              bool isDefault = false, bool Workspace = true);
 llvm::CallInst *CreateDealloc(llvm::IRBuilder<> &B, llvm::Value *ToFree);
 
 llvm::Value *CreateReAllocation(llvm::IRBuilder<> &B, llvm::Value *prev,
@@ -96,6 +112,78 @@ llvm::Value *CreateReAllocation(llvm::IRBuilder<> &B, llvm::Value *prev,
                                 llvm::CallInst **caller = nullptr,
                                 bool ZeroMem = false);
 
+/// Ensure the block holding iteration Iter of a segmented cache exists,
+/// allocating a block of Segment x InnerCount elements of T on the first
+/// iteration of each segment. Returns the (possibly grown) table of blocks.
+/// Blocks come from the file tape allocator if FileTape is set.
+llvm::CallInst *CreateSegmentAllocation(llvm::IRBuilder<> &B, llvm::Value *prev,
+                                        llvm::Type *T, llvm::Value *Iter,
+                                        llvm::Value *Segment,
+                                        llvm::Value *InnerCount,
+                                        llvm::Twine Name = "",
+                                        bool ZeroMem = false,
+                                        bool FileTape = false);
+
+/// Release the block of a segmented cache if Iter is the first iteration
+/// stored within it.
+llvm::CallInst *CreateSegmentDealloc(llvm::IRBuilder<> &B, llvm::Value *table,
+                                     llvm::Value *Iter, llvm::Value *Segment,
+                                     bool FileTape = false);
+
+/// Thread-local pointer to the enzyme_workspace of the derivative call
+/// currently executing, or null if none. The workspace is laid out as
+/// { i8* base, size_t size, size_t used, size_t highwater }.
+llvm::GlobalVariable *getOrInsertWorkspace(llvm::Module &M);
+
+/// Allocator serving memory aligned to max_align_t from the current workspace,
+/// falling back to malloc when there is none or it is exhausted.
+llvm::Function *getOrInsertWorkspaceAllocator(llvm::Module &M,
+                                              llvm::FunctionType *MallocTy);
+
+/// Deallocator ignoring memory within the current workspace and calling free
+/// on everything else.
+llvm::Function *getOrInsertWorkspaceDeallocator(llvm::Module &M,
+                                                llvm::FunctionType *FreeTy);
+
+/// Allocator mapping each request of at least EnzymeFileTapeMin bytes from
+/// its own unlinked file in $ENZYME_TAPE_DIR (default /tmp), and serving
+/// smaller ones from malloc.
+llvm::Function *getOrInsertFileTapeAllocator(llvm::Module &M,
+                                             llvm::FunctionType *MallocTy);
+
+/// Deallocator for memory from the file tape allocator.
+llvm::Function *getOrInsertFileTapeDeallocator(llvm::Module &M,
+                                               llvm::FunctionType *FreeTy);
+
+/// Helper taking the cache entry about to be read in the reverse pass and the
+/// entry read before it, which asks the kernel to read ahead the next window
+/// of the tape once the reverse pass crosses into a new one.
+llvm::Function *getOrInsertFileTapeReadahead(llvm::Module &M);
+
+/// Serve the allocation or release made by CI from the file tape, unless it
+/// calls a custom allocator.
+void RedirectToFileTape(llvm::CallInst *CI);
+
+/// Route the cache allocation made by CI, a call to malloc or to the
+/// exponential allocator growing caches with realloc, through the cache
+/// runtime, which records the bytes allocated, peak live bytes and
+/// reallocations of the new site name. Returns the runtime record of the
+/// site, or nullptr if the allocation cannot be instrumented.
+llvm::GlobalVariable *InstrumentCacheAllocation(llvm::CallInst *CI,
+                                               llvm::StringRef name);
+
+/// Route the release of an instrumented cache made by CI through the cache
+/// runtime.
+void InstrumentCacheDealloc(llvm::CallInst *CI);
+
+/// Rename a cache site, e.g. once the source location it caches is known.
+void SetCacheSiteName(llvm::GlobalVariable *site, llvm::StringRef name);
+
+/// The runtime function __enzyme_cache_report, printing each instrumented
+/// cache site to stderr by decreasing bytes allocated. It is called at exit,
+/// and may also be called by the program.
+llvm::Function *getOrInsertCacheReport(llvm::Module &M);
+
 llvm::PointerType *getDefaultAnonymousTapeType(llvm::LLVMContext &C);
 
 extern std::map<std::string, std::function<llvm::Value *(
@@ -599,6 +687,30 @@ llvm::Function *getOrInsertDifferentialMPI_Wait(llvm::Module &M,
 /// Create function to computer nearest power of two
 llvm::Value *nextPowerOfTwo(llvm::IRBuilder<> &B, llvm::Value *V);
 
+/// Cast an argument of an __enzyme_checkpoint call to the type expected by
+/// the step function
+llvm::Value *castCheckpointArgument(llvm::IRBuilder<> &B, llvm::Value *V,
+                                    llvm::Type *T);
+
+/// Create function which runs the given step function of an
+/// __enzyme_checkpoint loop n times, taking n followed by the step arguments
+llvm::Function *getOrInsertCheckpointLoop(llvm::Module &M,
+                                          llvm::Function *step);
+
+/// Create function which runs a checkpointed loop forward, taking n, the size
+/// of the state and the step arguments, and returning a buffer holding the
+/// state at the start of every segment
+llvm::Function *getOrInsertCheckpointForward(llvm::Module &M,
+                                             llvm::Function *step);
+
+/// Create function which runs the reverse pass of a checkpointed loop from
+/// the buffer made by the forward function, recomputing each segment from
+/// its stored state before calling the combined gradient of the step on it
+llvm::Function *
+getOrInsertCheckpointReverse(llvm::Module &M, llvm::Function *step,
+                             llvm::Function *grad,
+                             llvm::ArrayRef<DIFFE_TYPE> constant_args);
+
 /// Insert into a map
 template <typename K, typename V>
 static inline typename std::map<K, V>::iterator
@@ -621,6 +733,28 @@ insert_or_assign2(std::map<K, V> &map, K key, V val) {
   return map.emplace(key, val).first;
 }
 
+/// Insert into a hash map
+template <typename K, typename V, typename H>
+static inline typename std::unordered_map<K, V, H>::iterator
+insert_or_assign(std::unordered_map<K, V, H> &map, K &key, V &&val) {
+  auto found = map.find(key);
+  if (found != map.end()) {
+    map.erase(found);
+  }
+  return map.emplace(key, val).first;
+}
+
+/// Insert into a hash map
+template <typename K, typename V, typename H>
+static inline typename std::unordered_map<K, V, H>::iterator
+insert_or_assign2(std::unordered_map<K, V, H> &map, K key, V val) {
+  auto found = map.find(key);
+  if (found != map.end()) {
+    map.erase(found);
+  }
+  return map.emplace(key, val).first;
+}
+
 template <typename K, typename V>
 static inline V *findInMap(std::map<K, V> &map, K key) {
   auto found = map.find(key);
@@ -0,0 +1,71 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../ReverseMode/harness/bench.h"
+
+struct Lanes {
+  double x[8];
+};
+
+extern Lanes __enzyme_batch(...);
+extern int enzyme_width;
+extern int enzyme_vector;
+
+// A lane-wise kernel: every lane runs the same iterations on its own input.
+static double kernel(double x) {
+  double acc = 1.0;
+  for (int i = 0; i < 32; i++) {
+    double t = acc * x + 0.5;
+    acc = sqrt(fabs(t)) + fmin(t, 2.0) * 0.25;
+  }
+  return acc;
+}
+
+__attribute__((noinline)) static Lanes kernel8(const double *x) {
+  return __enzyme_batch(kernel, enzyme_width, 8, enzyme_vector, x[0], x[1],
+                        x[2], x[3], x[4], x[5], x[6], x[7]);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    printf("usage %s tool n [n must be a multiple of 8]\n", argv[0]);
+    return 1;
+  }
+  const char *tool = argv[1];
+  unsigned N = atoi(argv[2]);
+  if (N % 8 != 0) {
+    printf("usage %s tool n [n must be a multiple of 8]\n", argv[0]);
+    return 1;
+  }
+
+  double *x = new double[N];
+  for (unsigned i = 0; i < N; i++)
+    x[i] = (i % 1000) * 1e-3;
+
+  // Check the batched kernel against the scalar one.
+  Lanes check = kernel8(x + 8);
+  for (unsigned i = 0; i < 8; i++) {
+    if (fabs(check.x[i] - kernel(x[8 + i])) > 1e-10) {
+      printf("lane %d mismatch: %f != %f\n", i, check.x[i], kernel(x[8 + i]));
+      return 1;
+    }
+  }
+
+  bench::init("batch-throughput");
+  for (unsigned n = N >> 4; n <= N; n *= 4) {
+    printf("n=%d\n", n);
+    bench::params("n=" + std::to_string(n));
+    bench::run(tool, "batch8", [&]() {
+      double sum = 0;
+      for (unsigned i = 0; i < n; i += 8) {
+        Lanes res = kernel8(x + i);
+        for (unsigned j = 0; j < 8; j++)
+          sum += res.x[j];
+      }
+      return sum;
+    });
+  }
+
+  delete[] x;
+}
@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+"""Generate synthetic modules that stress the compile time of Enzyme.
+
+Each family takes a single size parameter and grows one dimension of the
+input that feeds a part of the pass known to scale superlinearly:
+
+  structs     nesting depth of the struct read by the function (TypeTree)
+  callchain   length of a chain of calls that each need an augmented
+              forward pass (AugmentedCachedFunctions)
+  bigblock    number of instructions in a loop body whose values are
+              cached for the reverse pass (the cache min-cut)
+  loops       depth of a loop nest whose innermost values are cached
+              (getSubLimits)
+
+Every module defines @foo(double*, i64) and a caller that differentiates it
+through __enzyme_autodiff, so it can be passed to opt -enzyme directly.
+"""
+
+import argparse
+import sys
+
+
+def driver():
+    return """
+define void @dfoo(double* %x, double* %dx, i64 %n) {
+entry:
+  call void (...) @__enzyme_autodiff(void (double*, i64)* @foo, double* %x, double* %dx, i64 %n)
+  ret void
+}
+
+declare void @__enzyme_autodiff(...)
+"""
+
+
+def structs(depth):
+    """A struct nested `depth` times, copied and then read at every level."""
+    out = ["%s0 = type { double, i64, [2 x i32] }"]
+    for k in range(1, depth + 1):
+        out.append("%%s%d = type { double, %%s%d, [2 x i32], i64 }" % (k, k - 1))
+    top = "%%s%d" % depth
+    out.append("")
+    out.append("declare void @llvm.memcpy.p0i8.p0i8.i64(i8*, i8*, i64, i1)")
+    out.append("")
+    out.append("define void @foo(double* %xd, i64 %n) {")
+    out.append("entry:")
+    out.append("  %%tmp = alloca %s, align 8" % top)
+    out.append("  %%size = getelementptr %s, %s* null, i64 1" % (top, top))
+    out.append("  %%bytes = ptrtoint %s* %%size to i64" % top)
+    out.append("  %%dst = bitcast %s* %%tmp to i8*" % top)
+    out.append("  %src = bitcast double* %xd to i8*")
+    out.append("  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %dst, i8* %src, "
+               "i64 %bytes, i1 false)")
+    out.append("  %acc.0 = fadd double 0.000000e+00, 0.000000e+00")
+    path = ""
+    for k in range(depth + 1):
+        out.append("  %%p%d = getelementptr inbounds %s, %s* %%tmp, i64 0%s, "
+                   "i32 0" % (k, top, top, path))
+        out.append("  %%v%d = load double, double* %%p%d, align 8" % (k, k))
+        out.append("  %%m%d = fmul double %%v%d, %%v%d" % (k, k, k))
+        out.append("  %%acc.%d = fadd double %%acc.%d, %%m%d" % (k + 1, k, k))
+        path += ", i32 1"
+    out.append("  store double %%acc.%d, double* %%xd, align 8" % (depth + 1))
+    out.append("  ret void")
+    out.append("}")
+    return "\n".join(out) + "\n" + driver()
+
+
+def callchain(length):
+    """`length` functions, each overwriting memory around a call."""
+    out = []
+    for k in range(length + 1):
+        name = "@foo" if k == length else "@f%d" % k
+        out.append("define void %s(double* %%x, i64 %%n) noinline {" % name)
+        out.append("entry:")
+        out.append("  %a = load double, double* %x, align 8")
+        if k != 0:
+            out.append("  call void @f%d(double* %%x, i64 %%n)" % (k - 1))
+        out.append("  %b = load double, double* %x, align 8")
+        out.append("  %m = fmul double %a, %b")
+        out.append("  store double %m, double* %x, align 8")
+        out.append("  ret void")
+        out.append("}")
+        out.append("")
+    return "\n".join(out) + driver()
+
+
+def bigblock(size):
+    """A loop whose body is one block of `size` overwritten sin chains.
+
+    Each chain loads a value that is overwritten later, so it cannot be
+    recomputed, and feeds it through recomputable operations that the
+    reverse pass needs, leaving the min-cut to choose what to cache.
+    """
+    out = ["declare double @llvm.sin.f64(double)", ""]
+    out.append("define void @foo(double* %x, i64 %n) {")
+    out.append("entry:")
+    out.append("  br label %loop")
+    out.append("")
+    out.append("loop:")
+    out.append("  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]")
+    out.append("  %%base = mul i64 %%i, %d" % size)
+    for k in range(size):
+        out.append("  %%idx%d = add i64 %%base, %d" % (k, k))
+        out.append("  %%p%d = getelementptr inbounds double, double* %%x, "
+                   "i64 %%idx%d" % (k, k))
+        out.append("  %%v%d = load double, double* %%p%d, align 8" % (k, k))
+        out.append("  %%a%d = fmul double %%v%d, 3.000000e+00" % (k, k))
+        out.append("  %%b%d = fadd double %%a%d, 1.000000e+00" % (k, k))
+        out.append("  %%c%d = call double @llvm.sin.f64(double %%b%d)" % (k, k))
+        out.append("  store double %%c%d, double* %%p%d, align 8" % (k, k))
+    out.append("  %i.next = add nuw nsw i64 %i, 1")
+    out.append("  %cmp = icmp eq i64 %i.next, %n")
+    out.append("  br i1 %cmp, label %exit, label %loop")
+    out.append("")
+    out.append("exit:")
+    out.append("  ret void")
+    out.append("}")
+    return "\n".join(out) + "\n" + driver()
+
+
+def loops(depth):
+    """`depth` nested loops whose innermost body overwrites its input."""
+    out = ["define void @foo(double* %x, i64 %n) {", "entry:"]
+    out.append("  br label %header0")
+    for k in range(depth):
+        pred = "entry" if k == 0 else "header%d" % (k - 1)
+        out.append("")
+        out.append("header%d:" % k)
+        out.append("  %%i%d = phi i64 [ 0, %%%s ], [ %%i%d.next, %%latch%d ]" %
+                   (k, pred, k, k))
+        if k + 1 != depth:
+            out.append("  br label %%header%d" % (k + 1))
+            continue
+        idx = "%i0"
+        for j in range(1, depth):
+            out.append("  %%idx%d = add i64 %s, %%i%d" % (j, idx, j))
+            idx = "%%idx%d" % j
+        out.append("  %%ptr = getelementptr inbounds double, double* %%x, "
+                   "i64 %s" % idx)
+        out.append("  %v = load double, double* %ptr, align 8")
+        out.append("  %m = fmul double %v, %v")
+        out.append("  store double %m, double* %ptr, align 8")
+        out.append("  br label %%latch%d" % k)
+    for k in reversed(range(depth)):
+        exit = "exit" if k == 0 else "latch%d" % (k - 1)
+        out.append("")
+        out.append("latch%d:" % k)
+        out.append("  %%i%d.next = add nuw nsw i64 %%i%d, 1" % (k, k))
+        out.append("  %%cmp%d = icmp eq i64 %%i%d.next, %%n" % (k, k))
+        out.append("  br i1 %%cmp%d, label %%%s, label %%header%d" %
+                   (k, exit, k))
+    out.append("")
+    out.append("exit:")
+    out.append("  ret void")
+    out.append("}")
+    return "\n".join(out) + "\n" + driver()
+
+
+FAMILIES = {
+    "structs": structs,
+    "callchain": callchain,
+    "bigblock": bigblock,
+    "loops": loops,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("family", choices=sorted(FAMILIES))
+    parser.add_argument("size", type=int)
+    parser.add_argument("-o", dest="output", help="output file")
+    args = parser.parse_args()
+    module = FAMILIES[args.family](args.size)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(module)
+    else:
+        sys.stdout.write(module)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
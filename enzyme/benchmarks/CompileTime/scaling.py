@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+"""Time the Enzyme pass on generated modules of increasing size.
+
+For every family of gen.py and each of its sizes, the generated module is
+run through opt -enzyme a number of times with -enzyme-time-report-json. The
+time spent in the pass is the sum of the phases of the time report; the
+median over the trials is reported per size, together with the growth from
+the previous size and the exponent of a power law fitted to the curve.
+
+With --json, one record per family and size is appended in the format of
+the benchmark harness, so the results can be checked against a baseline with
+ReverseMode/harness/compare.py.
+"""
+
+import argparse
+import json
+import math
+import os
+import shlex
+import subprocess
+import sys
+import tempfile
+import time
+
+import gen
+
+SIZES = {
+    "structs": [16, 32, 64, 128],
+    "callchain": [6, 12, 24, 48],
+    "bigblock": [125, 250, 500, 1000],
+    "loops": [4, 8, 16, 32],
+}
+
+
+def percentile(values, p):
+    values = sorted(values)
+    pos = p * (len(values) - 1)
+    lo = int(math.floor(pos))
+    hi = min(lo + 1, len(values) - 1)
+    return values[lo] + (values[hi] - values[lo]) * (pos - lo)
+
+
+def run_opt(args, module, report):
+    """Run opt once, returning (exit status, wall seconds, peak RSS in kB)."""
+    cmd = [args.opt] + shlex.split(args.load) + [
+        "-enzyme", module, "-disable-output",
+        "-enzyme-time-report-json=" + report]
+    with tempfile.TemporaryFile() as log:
+        start = time.monotonic()
+        proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=log)
+        _, status, usage = os.wait4(proc.pid, 0)
+        wall = time.monotonic() - start
+        proc.returncode = os.waitstatus_to_exitcode(status)
+        if proc.returncode != 0 and args.verbose:
+            log.seek(0)
+            sys.stderr.write(log.read().decode(errors="replace"))
+    return proc.returncode, wall, usage.ru_maxrss
+
+
+def measure(args, family, size, tmpdir):
+    module = os.path.join(tmpdir, "%s-%d.ll" % (family, size))
+    report = os.path.join(tmpdir, "%s-%d.json" % (family, size))
+    with open(module, "w") as f:
+        f.write(gen.FAMILIES[family](size))
+
+    record = {
+        "benchmark": "compile-" + family,
+        "params": "n=%d" % size,
+        "tool": "Enzyme",
+        "variant": "compile",
+        "warmup": 0,
+        "trials": args.trials,
+        "tape_bytes": None,
+        "result": None,
+    }
+    totals, walls, phases, rss = [], [], {}, 0
+    for _ in range(args.trials):
+        status, wall, maxrss = run_opt(args, module, report)
+        if status != 0:
+            record.update(median=None, status=status)
+            return record
+        with open(report) as f:
+            data = json.load(f)
+        totals.append(sum(p["wall"] for p in data["phases"].values()))
+        walls.append(wall)
+        for name, p in data["phases"].items():
+            phases.setdefault(name, []).append(p["wall"])
+        rss = max(rss, maxrss)
+
+    record.update(
+        median=percentile(totals, 0.5),
+        p10=percentile(totals, 0.1),
+        p90=percentile(totals, 0.9),
+        min=min(totals),
+        max=max(totals),
+        mean=sum(totals) / len(totals),
+        peak_rss_kb=rss,
+        process=percentile(walls, 0.5),
+        phases={name: percentile(v, 0.5) for name, v in phases.items()},
+    )
+    return record
+
+
+def fit_exponent(points):
+    """Least squares slope of log(time) over log(size)."""
+    points = [(math.log(n), math.log(t)) for n, t in points if t > 0]
+    if len(points) < 2:
+        return None
+    mx = sum(x for x, _ in points) / len(points)
+    my = sum(y for _, y in points) / len(points)
+    sxx = sum((x - mx) ** 2 for x, _ in points)
+    if sxx == 0:
+        return None
+    return sum((x - mx) * (y - my) for x, y in points) / sxx
+
+
+def parse_sizes(specs):
+    sizes = dict(SIZES)
+    for spec in specs or []:
+        family, _, values = spec.partition("=")
+        if family not in gen.FAMILIES or not values:
+            sys.exit("bad --sizes %r, expected family=n,n,..." % spec)
+        sizes[family] = [int(v) for v in values.split(",")]
+    return sizes
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--opt", default="opt", help="opt binary")
+    parser.add_argument("--load", required=True,
+                        help="flags that load the Enzyme plugin into opt")
+    parser.add_argument("--families", default=",".join(sorted(SIZES)),
+                        help="comma separated families to run")
+    parser.add_argument("--sizes", action="append",
+                        help="override the sizes of a family, as "
+                        "family=n,n,...")
+    parser.add_argument("--trials", type=int, default=3,
+                        help="runs of opt per size (default 3)")
+    parser.add_argument("--max-exponent", type=float,
+                        help="fail if a fitted exponent exceeds this")
+    parser.add_argument("--json", help="append JSON records to this file")
+    parser.add_argument("--verbose", action="store_true",
+                        help="show the output of failing runs")
+    args = parser.parse_args()
+    sizes = parse_sizes(args.sizes)
+
+    failed = 0
+    records = []
+    with tempfile.TemporaryDirectory(prefix="enzyme-compile-") as tmpdir:
+        print("%-10s %6s %10s %8s %10s  %s" % (
+            "family", "size", "pass (s)", "growth", "rss (kB)",
+            "slowest phase"))
+        for family in args.families.split(","):
+            if family not in gen.FAMILIES:
+                sys.exit("unknown family %r" % family)
+            points = []
+            prev = None
+            for size in sizes[family]:
+                record = measure(args, family, size, tmpdir)
+                records.append(record)
+                if record["median"] is None:
+                    failed += 1
+                    print("%-10s %6d failed with exit status %d" %
+                          (family, size, record["status"]))
+                    prev = None
+                    continue
+                growth = "-"
+                if prev and prev["median"] > 0:
+                    growth = "%.2fx" % (record["median"] / prev["median"])
+                slowest = max(record["phases"].items(), key=lambda p: p[1])
+                print("%-10s %6d %10.4f %8s %10d  %s %.4f" % (
+                    family, size, record["median"], growth,
+                    record["peak_rss_kb"], slowest[0], slowest[1]))
+                points.append((size, record["median"]))
+                prev = record
+            exponent = fit_exponent(points)
+            if exponent is not None:
+                print("%-10s fitted exponent %.2f" % (family, exponent))
+                if args.max_exponent is not None and \
+                        exponent > args.max_exponent:
+                    failed += 1
+                    print("%-10s exponent %.2f exceeds %.2f" %
+                          (family, exponent, args.max_exponent))
+
+    if args.json:
+        with open(args.json, "a") as f:
+            for record in records:
+                f.write(json.dumps(record) + "\n")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,73 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../ReverseMode/harness/bench.h"
+
+struct Tangents {
+  double d[8];
+};
+
+extern double __enzyme_fwddiff(double (*)(double, double), ...);
+extern Tangents __enzyme_fwddiff8(double (*)(double, double), ...);
+extern int enzyme_width;
+extern int enzyme_const;
+
+// Every tangent goes through the same chain of scalar operations.
+static double kernel(double x, double c) {
+  double acc = x;
+  for (int i = 0; i < 32; i++) {
+    double t = acc * c + 0.5;
+    acc = sin(t) * x + exp(-t * t) * 0.25;
+  }
+  return acc;
+}
+
+static const double seeds[8] = {1.0, 0.5, -1.0, 2.0, 0.25, -0.5, 3.0, -2.0};
+
+__attribute__((noinline)) static Tangents tangents8(double x, double c) {
+  return __enzyme_fwddiff8(kernel, enzyme_width, 8, x, seeds[0], seeds[1],
+                           seeds[2], seeds[3], seeds[4], seeds[5], seeds[6],
+                           seeds[7], enzyme_const, c);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    printf("usage %s tool n\n", argv[0]);
+    return 1;
+  }
+  const char *tool = argv[1];
+  unsigned N = atoi(argv[2]);
+
+  double *x = new double[N];
+  for (unsigned i = 0; i < N; i++)
+    x[i] = (i % 1000) * 1e-3;
+
+  // Check the tangents against one scalar forward pass per seed.
+  Tangents check = tangents8(x[8], 0.75);
+  for (unsigned i = 0; i < 8; i++) {
+    double expected =
+        __enzyme_fwddiff(kernel, x[8], seeds[i], enzyme_const, 0.75);
+    if (fabs(check.d[i] - expected) > 1e-10) {
+      printf("tangent %d mismatch: %f != %f\n", i, check.d[i], expected);
+      return 1;
+    }
+  }
+
+  bench::init("fwdvector-tangents");
+  for (unsigned n = N >> 4; n <= N; n *= 4) {
+    printf("n=%d\n", n);
+    bench::params("n=" + std::to_string(n));
+    bench::run(tool, "width8", [&]() {
+      double sum = 0;
+      for (unsigned i = 0; i < n; i++) {
+        Tangents res = tangents8(x[i], 0.75);
+        for (unsigned j = 0; j < 8; j++)
+          sum += res.d[j];
+      }
+      return sum;
+    });
+  }
+
+  delete[] x;
+}
@@ -7,10 +7,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
-float tdiff(struct timeval *start, struct timeval *end) {
-  return (end->tv_sec-start->tv_sec) + 1e-6*(end->tv_usec-start->tv_usec);
-}
+#include <algorithm>
+#include "../harness/bench.h"
 
 using namespace std;
 
@@ -337,7 +335,9 @@ int main(const int argc, const char* argv[]) {
         "ba12_n253_m163691_p899155.txt",   "ba16_n1544_m942409_p4750193.txt",  "ba1_n49_m7776_p31843.txt",           "ba4_n372_m47423_p204472.txt",  "ba8_n88_m64298_p383937.txt",
         "ba13_n245_m198739_p1091386.txt",  "ba17_n1778_m993923_p5001946.txt",  "ba20_n13682_m4456117_p2987644.txt",  "ba5_n257_m65132_p225911.txt",  "ba9_n810_m88814_p393775.txt",
     };
+    bench::init("ba");
     for (auto path : paths) {
+        bench::params(path);
 
     {
 
@@ -372,11 +372,9 @@ int main(const int argc, const char* argv[]) {
     */
 
     {
-      struct timeval start, end;
-      gettimeofday(&start, NULL);
-      calculate_jacobian<compute_reproj_error_b, compute_zach_weight_error_b>(input, result);
-      gettimeofday(&end, NULL);
-      printf("Tapenade combined %0.6f\n", tdiff(&start, &end));
+      bench::run("Tapenade", "combined",
+                 [&]() { calculate_jacobian<compute_reproj_error_b, compute_zach_weight_error_b>(input, result); },
+                 [&]() { result.J = BASparseMat(input.n, input.m, input.p); });
       for(unsigned i=0; i<5; i++) {
         printf("%f ", result.J.vals[i]);
       }
@@ -418,11 +416,9 @@ int main(const int argc, const char* argv[]) {
     */
 
     {
-      struct timeval start, end;
-      gettimeofday(&start, NULL);
-      calculate_jacobian<adept_compute_reproj_error, adept_compute_zach_weight_error>(input, result);
-      gettimeofday(&end, NULL);
-      printf("Adept combined %0.6f\n", tdiff(&start, &end));
+      bench::run("Adept", "combined",
+                 [&]() { calculate_jacobian<adept_compute_reproj_error, adept_compute_zach_weight_error>(input, result); },
+                 [&]() { result.J = BASparseMat(input.n, input.m, input.p); });
       for(unsigned i=0; i<5; i++) {
         printf("%f ", result.J.vals[i]);
       }
@@ -464,11 +460,9 @@ int main(const int argc, const char* argv[]) {
     */
 
     {
-      struct timeval start, end;
-      gettimeofday(&start, NULL);
-      calculate_jacobian<dcompute_reproj_error, dcompute_zach_weight_error>(input, result);
-      gettimeofday(&end, NULL);
-      printf("Enzyme combined %0.6f\n", tdiff(&start, &end));
+      bench::run("Enzyme", "combined",
+                 [&]() { calculate_jacobian<dcompute_reproj_error, dcompute_zach_weight_error>(input, result); },
+                 [&]() { result.J = BASparseMat(input.n, input.m, input.p); });
       for(unsigned i=0; i<5; i++) {
         printf("%f ", result.J.vals[i]);
       }
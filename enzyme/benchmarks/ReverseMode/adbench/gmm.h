@@ -7,10 +7,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
-float tdiff(struct timeval *start, struct timeval *end) {
-  return (end->tv_sec-start->tv_sec) + 1e-6*(end->tv_usec-start->tv_usec);
-}
+#include <algorithm>
+#include "../harness/bench.h"
 
 using namespace std;
 
@@ -168,7 +166,9 @@ int main(const int argc, const char* argv[]) {
     getTests(paths, "data/2.5k", "2.5k/");
     getTests(paths, "data/10k", "10k/");
 
+    bench::init("gmm");
     for (auto path : paths) {
+        bench::params(path);
     	if (path == "10k/gmm_d128_K200.txt" || path == "10k/gmm_d128_K100.txt" || path == "10k/gmm_d64_K200.txt" || path == "10k/gmm_d128_K50.txt" || path == "10k/gmm_d64_K100.txt") continue;
         printf("starting path %s\n", path.c_str());
 
@@ -183,11 +183,9 @@ int main(const int argc, const char* argv[]) {
     struct GMMOutput result = { 0, std::vector<double>(Jcols) };
 
     {
-      struct timeval start, end;
-      gettimeofday(&start, NULL);
-      calculate_jacobian<gmm_objective_b>(input, result);
-      gettimeofday(&end, NULL);
-      printf("Tapenade combined %0.6f\n", tdiff(&start, &end));
+      bench::run("Tapenade", "combined",
+                 [&]() { calculate_jacobian<gmm_objective_b>(input, result); },
+                 [&]() { std::fill(result.gradient.begin(), result.gradient.end(), 0.0); });
       for(unsigned i=0; i<5; i++) {
         printf("%f ", result.gradient[i]);
       }
@@ -207,11 +205,9 @@ int main(const int argc, const char* argv[]) {
     struct GMMOutput result = { 0, std::vector<double>(Jcols) };
 
     try {
-      struct timeval start, end;
-      gettimeofday(&start, NULL);
-      calculate_jacobian<adept_dgmm_objective>(input, result);
-      gettimeofday(&end, NULL);
-      printf("Adept combined %0.6f\n", tdiff(&start, &end));
+      bench::run("Adept", "combined",
+                 [&]() { calculate_jacobian<adept_dgmm_objective>(input, result); },
+                 [&]() { std::fill(result.gradient.begin(), result.gradient.end(), 0.0); });
       for(unsigned i=0; i<5; i++) {
         printf("%f ", result.gradient[i]);
       }
@@ -233,11 +229,11 @@ int main(const int argc, const char* argv[]) {
     struct GMMOutput result = { 0, std::vector<double>(Jcols) };
 
     {
-      struct timeval start, end;
-      gettimeofday(&start, NULL);
-      calculate_jacobian<dgmm_objective>(input, result);
-      gettimeofday(&end, NULL);
-      printf("Enzyme combined %0.6f\n", tdiff(&start, &end));
+      bench::run("Enzyme", "combined",
+                 [&]() { calculate_jacobian<dgmm_objective>(input, result); },
+                 [&]() { std::fill(result.gradient.begin(), result.gradient.end(), 0.0); });
+      bench::gradient("Enzyme", "combined", result.gradient.data(),
+                      result.gradient.size());
       for(unsigned i=0; i<5; i++) {
         printf("%f ", result.gradient[i]);
       }
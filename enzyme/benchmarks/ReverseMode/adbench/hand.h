@@ -7,12 +7,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
 #include <fstream>
-
-float tdiff(struct timeval *start, struct timeval *end) {
-  return (end->tv_sec-start->tv_sec) + 1e-6*(end->tv_usec-start->tv_usec);
-}
+#include <algorithm>
+#include "../harness/bench.h"
 
 using namespace std;
 
@@ -548,7 +545,9 @@ int main(const int argc, const char* argv[]) {
 
     const HandParameters params = { false }; // true or false
 
+    bench::init("hand");
     for (auto path : paths) {
+        bench::params(path);
         printf("starting path %s\n", path.c_str());
 
     {
@@ -587,11 +586,11 @@ int main(const int argc, const char* argv[]) {
     auto us_jacobian_column = std::vector<double>(err_size);
 
     {
-      struct timeval start, end;
-      gettimeofday(&start, NULL);
-      calculate_jacobian<hand_objective_d, hand_objective_complicated_d>(objective_input, input, result, params.is_complicated, theta_d, us_d, us_jacobian_column);
-      gettimeofday(&end, NULL);
-      printf("Tapenade combined %0.6f\n", tdiff(&start, &end));
+      bench::run("Tapenade", "combined",
+                 [&]() { calculate_jacobian<hand_objective_d, hand_objective_complicated_d>(objective_input, input, result, params.is_complicated, theta_d, us_d, us_jacobian_column); },
+                 [&]() {
+                   std::fill(result.jacobian.begin(), result.jacobian.end(), 0.0);
+                 });
       for(unsigned i=0; i<5; i++) {
         printf("%f ", result.jacobian[i]);
       }
@@ -636,11 +635,11 @@ int main(const int argc, const char* argv[]) {
     auto us_jacobian_column = std::vector<double>(err_size);
 
     {
-      struct timeval start, end;
-      gettimeofday(&start, NULL);
-      calculate_jacobian<dhand_objective, dhand_objective_complicated>(objective_input, input, result, params.is_complicated, theta_d, us_d, us_jacobian_column);
-      gettimeofday(&end, NULL);
-      printf("Enzyme combined %0.6f\n", tdiff(&start, &end));
+      bench::run("Enzyme", "combined",
+                 [&]() { calculate_jacobian<dhand_objective, dhand_objective_complicated>(objective_input, input, result, params.is_complicated, theta_d, us_d, us_jacobian_column); },
+                 [&]() {
+                   std::fill(result.jacobian.begin(), result.jacobian.end(), 0.0);
+                 });
       for(unsigned i=0; i<5; i++) {
         printf("%f ", result.jacobian[i]);
       }
@@ -7,10 +7,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
-float tdiff(struct timeval *start, struct timeval *end) {
-  return (end->tv_sec-start->tv_sec) + 1e-6*(end->tv_usec-start->tv_usec);
-}
+#include <algorithm>
+#include "../harness/bench.h"
 
 using namespace std;
 
@@ -179,7 +177,9 @@ int main(const int argc, const char* argv[]) {
 
     std::vector<std::string> paths = { "lstm_l2_c1024.txt", "lstm_l4_c1024.txt", "lstm_l2_c4096.txt", "lstm_l4_c4096.txt" };
 
+    bench::init("lstm");
     for (auto path : paths) {
+        bench::params(path);
         printf("starting path %s\n", path.c_str());
 
     {
@@ -199,11 +199,13 @@ int main(const int argc, const char* argv[]) {
     struct LSTMOutput result = { 0, std::vector<double>(Jcols) };
 
     {
-      struct timeval start, end;
-      gettimeofday(&start, NULL);
-      calculate_jacobian<lstm_objective_b>(input, result);
-      gettimeofday(&end, NULL);
-      printf("Tapenade combined %0.6f\n", tdiff(&start, &end));
+      auto state = input.state;
+      bench::run("Tapenade", "combined",
+                 [&]() { calculate_jacobian<lstm_objective_b>(input, result); },
+                 [&]() {
+                   input.state = state;
+                   std::fill(result.gradient.begin(), result.gradient.end(), 0.0);
+                 });
       for(unsigned i=result.gradient.size()-5; i<result.gradient.size(); i++) {
         printf("%f ", result.gradient[i]);
       }
@@ -226,11 +228,13 @@ int main(const int argc, const char* argv[]) {
     struct LSTMOutput result = { 0, std::vector<double>(Jcols) };
 
     {
-      struct timeval start, end;
-      gettimeofday(&start, NULL);
-      calculate_jacobian<adept_dlstm_objective>(input, result);
-      gettimeofday(&end, NULL);
-      printf("Adept combined %0.6f\n", tdiff(&start, &end));
+      auto state = input.state;
+      bench::run("Adept", "combined",
+                 [&]() { calculate_jacobian<adept_dlstm_objective>(input, result); },
+                 [&]() {
+                   input.state = state;
+                   std::fill(result.gradient.begin(), result.gradient.end(), 0.0);
+                 });
       for(unsigned i=result.gradient.size()-5; i<result.gradient.size(); i++) {
         printf("%f ", result.gradient[i]);
       }
@@ -253,11 +257,15 @@ int main(const int argc, const char* argv[]) {
     struct LSTMOutput result = { 0, std::vector<double>(Jcols) };
 
     {
-      struct timeval start, end;
-      gettimeofday(&start, NULL);
-      calculate_jacobian<dlstm_objective>(input, result);
-      gettimeofday(&end, NULL);
-      printf("Enzyme combined %0.6f\n", tdiff(&start, &end));
+      auto state = input.state;
+      bench::run("Enzyme", "combined",
+                 [&]() { calculate_jacobian<dlstm_objective>(input, result); },
+                 [&]() {
+                   input.state = state;
+                   std::fill(result.gradient.begin(), result.gradient.end(), 0.0);
+                 });
+      bench::gradient("Enzyme", "combined", result.gradient.data(),
+                      result.gradient.size());
       for(unsigned i=result.gradient.size()-5; i<result.gradient.size(); i++) {
         printf("%f ", result.gradient[i]);
       }
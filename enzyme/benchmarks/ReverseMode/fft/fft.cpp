@@ -13,9 +13,7 @@ using adept::adouble;
 template<typename Return, typename... T>
 Return __enzyme_autodiff(T...);
 
-float tdiff(struct timeval *start, struct timeval *end) {
-  return (end->tv_sec-start->tv_sec) + 1e-6*(end->tv_usec-start->tv_usec);
-}
+#include "../harness/bench.h"
 
 #include "fft.h"
 
@@ -78,128 +76,77 @@ static double tfoobar_and_gradient(unsigned len) {
 }
 
 static void adept_sincos(double inp, unsigned len) {
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double *x = new double[2*len];
-  for(int i=0; i<2*len; i++) x[i] = 2.0;
-  foobar(x, len);
-  double res = x[0];
-
-  gettimeofday(&end, NULL);
-  printf("Adept real %0.6f res=%f\n", tdiff(&start, &end), res);
-  delete[] x;
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  adept::Stack stack;
-
-  aVector x(2*len);
-  for(int i=0; i<2*len; i++) x[i] = 2.0;
- // stack.new_recording();
-  afoobar(x, len);
-  double res = x(0).value();
-
-  gettimeofday(&end, NULL);
-  printf("Adept forward %0.6f res=%f\n", tdiff(&start, &end), res);
-  }
+  bench::run("Adept", "real", [&]() {
+    double *x = new double[2*len];
+    for(int i=0; i<2*len; i++) x[i] = 2.0;
+    foobar(x, len);
+    double res = x[0];
+    delete[] x;
+    return res;
+  });
 
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
+  bench::run("Adept", "forward", [&]() {
+    adept::Stack stack;
 
-  double res2 = afoobar_and_gradient(len);
+    aVector x(2*len);
+    for(int i=0; i<2*len; i++) x[i] = 2.0;
+   // stack.new_recording();
+    afoobar(x, len);
+    return x(0).value();
+  });
 
-  gettimeofday(&end, NULL);
-  printf("Adept combined %0.6f res'=%f\n", tdiff(&start, &end), res2);
-  }
+  bench::run("Adept", "combined", [&]() {
+    return afoobar_and_gradient(len);
+  });
 }
 
 
 static void tapenade_sincos(double inp, unsigned len) {
+  bench::run("Tapenade", "real", [&]() {
+    double *x = new double[2*len];
+    for(int i=0; i<2*len; i++) x[i] = 2.0;
+    foobar(x, len);
+    double res = x[0];
+    delete[] x;
+    return res;
+  });
+
+  bench::run("Tapenade", "forward", [&]() {
+    double *x = new double[2*len];
+    for(int i=0; i<2*len; i++) x[i] = 2.0;
+    foobar(x, len);
+    double res = x[0];
+    delete[] x;
+    return res;
+  });
 
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double *x = new double[2*len];
-  for(int i=0; i<2*len; i++) x[i] = 2.0;
-  foobar(x, len);
-  double res = x[0];
-
-  gettimeofday(&end, NULL);
-  printf("Tapenade real %0.6f res=%f\n", tdiff(&start, &end), res);
-  delete[] x;
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double* x = new double[2*len];
-  for(int i=0; i<2*len; i++) x[i] = 2.0;
-  foobar(x, len);
-  double res = x[0];
-
-  gettimeofday(&end, NULL);
-  printf("Tapenade forward %0.6f res=%f\n", tdiff(&start, &end), res);
-  delete[] x;
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double res2 = tfoobar_and_gradient(len);
-
-  gettimeofday(&end, NULL);
-  printf("Tapenade combined %0.6f res'=%f\n", tdiff(&start, &end), res2);
-  }
+  bench::run("Tapenade", "combined", [&]() {
+    return tfoobar_and_gradient(len);
+  });
 }
 
 static void enzyme_sincos(double inp, unsigned len) {
+  bench::run("Enzyme", "real", [&]() {
+    double *x = new double[2*len];
+    for(int i=0; i<2*len; i++) x[i] = 2.0;
+    foobar(x, len);
+    double res = x[0];
+    delete[] x;
+    return res;
+  });
+
+  bench::run("Enzyme", "forward", [&]() {
+    double *x = new double[2*len];
+    for(int i=0; i<2*len; i++) x[i] = 2.0;
+    foobar(x, len);
+    double res = x[0];
+    delete[] x;
+    return res;
+  });
 
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double *x = new double[2*len];
-  for(int i=0; i<2*len; i++) x[i] = 2.0;
-  foobar(x, len);
-  double res = x[0];
-
-  gettimeofday(&end, NULL);
-  printf("Enzyme real %0.6f res=%f\n", tdiff(&start, &end), res);
-  delete[] x;
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double *x = new double[2*len];
-  for(int i=0; i<2*len; i++) x[i] = 2.0;
-  foobar(x, len);
-  double res = x[0];
-
-  gettimeofday(&end, NULL);
-  printf("Enzyme forward %0.6f res=%f\n", tdiff(&start, &end), res);
-  delete[] x;
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double res2 = foobar_and_gradient(len);
-
-  gettimeofday(&end, NULL);
-  printf("Enzyme combined %0.6f res'=%f\n", tdiff(&start, &end), res2);
-  }
+  bench::run("Enzyme", "combined", [&]() {
+    return foobar_and_gradient(len);
+  });
 }
 
 
@@ -228,8 +175,10 @@ int main(int argc, char** argv) {
   }
   double inp = -2.1;
 
+  bench::init("fft");
   for(unsigned iters=max(1, N>>5); iters <= N; iters*=2) {
     printf("iters=%d\n", iters);
+    bench::params("len=" + std::to_string(iters));
     adept_sincos(inp, iters);
     tapenade_sincos(inp, iters);
     enzyme_sincos(inp, iters);
@@ -0,0 +1,356 @@
+// Shared timing harness for the reverse mode benchmarks.
+//
+// Each variant of a benchmark is run through bench::run, which performs
+// ENZYME_BENCH_WARMUP untimed runs (default 1) followed by ENZYME_BENCH_TRIALS
+// timed ones (default 5). It prints the median time in the
+// "<tool> <variant> <seconds>" form read by getdata.sh. If ENZYME_BENCH_JSON
+// names a file, it also appends a JSON record per variant holding the time
+// percentiles, the peak resident set size and the tape bytes of each run.
+// Tape bytes are only known for code differentiated with
+// -enzyme-cache-instrument. Records are read by compare.py, which compares
+// tools and checks results against a baseline.
+//
+// Benchmarks also pass their gradients to bench::gradient, which checks a
+// build with reduced precision caches against a full-precision run. The
+// full-precision binary saves its gradients to the file named by
+// ENZYME_BENCH_GRADIENT_SAVE; the reduced one, run with ENZYME_BENCH_TAG set
+// to tell its records apart, reads them from ENZYME_BENCH_GRADIENT_CHECK and
+// reports the maximum relative gradient error.
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/resource.h>
+#include <time.h>
+#include <type_traits>
+#include <vector>
+
+// List of cache sites registered by code built with -enzyme-cache-instrument
+extern "C" __attribute__((weak)) void *__enzyme_cache_sites;
+
+namespace bench {
+
+struct State {
+  std::string name = "unknown";
+  std::string params;
+  int warmup = 1;
+  int trials = 5;
+  const char *json = nullptr;
+  std::string tag;
+  const char *gradient_save = nullptr;
+  const char *gradient_check = nullptr;
+  State() {
+    if (const char *s = getenv("ENZYME_BENCH_WARMUP"))
+      warmup = std::max(0, atoi(s));
+    if (const char *s = getenv("ENZYME_BENCH_TRIALS"))
+      trials = std::max(1, atoi(s));
+    json = getenv("ENZYME_BENCH_JSON");
+    if (json && !*json)
+      json = nullptr;
+    if (const char *s = getenv("ENZYME_BENCH_TAG"))
+      tag = s;
+    gradient_save = getenv("ENZYME_BENCH_GRADIENT_SAVE");
+    if (gradient_save && !*gradient_save)
+      gradient_save = nullptr;
+    gradient_check = getenv("ENZYME_BENCH_GRADIENT_CHECK");
+    if (gradient_check && !*gradient_check)
+      gradient_check = nullptr;
+  }
+};
+
+inline State &state() {
+  static State S;
+  return S;
+}
+
+/// Name the benchmark the following records belong to.
+inline void init(const char *name) { state().name = name; }
+
+/// Describe the problem size of the following records, e.g. "iters=1000".
+inline void params(const std::string &p) { state().params = p; }
+
+inline double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/// Reset the peak resident set size where the kernel allows it, so the next
+/// reading covers only what follows.
+inline void reset_peak_rss() {
+  if (FILE *f = fopen("/proc/self/clear_refs", "w")) {
+    fputs("5", f);
+    fclose(f);
+  }
+}
+
+/// Peak resident set size in kB since the last reset.
+inline long peak_rss_kb() {
+  if (FILE *f = fopen("/proc/self/status", "r")) {
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f))
+      if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+        break;
+    fclose(f);
+    if (kb >= 0)
+      return kb;
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+/// Mirrors the cache site records of the Enzyme cache runtime.
+struct CacheSite {
+  const char *name;
+  uint64_t bytes, live, peak, reallocs;
+  CacheSite *next;
+  uint64_t reported;
+};
+
+/// Bytes allocated by instrumented caches so far, or -1 if there are none.
+inline int64_t tape_bytes() {
+  if (!&__enzyme_cache_sites)
+    return -1;
+  int64_t total = 0;
+  for (auto site = (CacheSite *)__enzyme_cache_sites; site; site = site->next)
+    total += site->bytes;
+  return total;
+}
+
+/// Value of quantile q of the sorted times, interpolating between ranks.
+inline double percentile(const std::vector<double> &sorted, double q) {
+  double rank = q * (sorted.size() - 1);
+  size_t lo = (size_t)rank;
+  size_t hi = std::min(lo + 1, sorted.size() - 1);
+  return sorted[lo] + (rank - lo) * (sorted[hi] - sorted[lo]);
+}
+
+inline void json_number(FILE *f, double v) {
+  if (isfinite(v))
+    fprintf(f, "%.9g", v);
+  else
+    fputs("null", f);
+}
+
+inline void json_string(FILE *f, const std::string &s) {
+  fputc('"', f);
+  for (unsigned char c : s) {
+    if (c == '"' || c == '\\')
+      fprintf(f, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(f, "\\u%04x", c);
+    else
+      fputc(c, f);
+  }
+  fputc('"', f);
+}
+
+/// Name variant is recorded under, marked with ENZYME_BENCH_TAG if set
+inline std::string tagged(const char *variant) {
+  auto &S = state();
+  if (S.tag.empty())
+    return variant;
+  return std::string(variant) + "/" + S.tag;
+}
+
+/// Open the JSON results and start the record of variant computed by tool,
+/// or return nullptr if there are no JSON results.
+inline FILE *open_record(const char *tool, const std::string &variant) {
+  auto &S = state();
+  if (!S.json)
+    return nullptr;
+  FILE *f = fopen(S.json, "a");
+  if (!f) {
+    fprintf(stderr, "could not open %s\n", S.json);
+    return nullptr;
+  }
+  fputs("{\"benchmark\": ", f);
+  json_string(f, S.name);
+  fputs(", \"params\": ", f);
+  json_string(f, S.params);
+  fputs(", \"tool\": ", f);
+  json_string(f, tool);
+  fputs(", \"variant\": ", f);
+  json_string(f, variant);
+  return f;
+}
+
+template <typename Fn>
+inline typename std::enable_if<std::is_void<decltype(std::declval<Fn>()())>::value,
+                               double>::type
+invoke(Fn &fn) {
+  fn();
+  return NAN;
+}
+
+template <typename Fn>
+inline typename std::enable_if<!std::is_void<decltype(std::declval<Fn>()())>::value,
+                               double>::type
+invoke(Fn &fn) {
+  return (double)fn();
+}
+
+struct NoReset {
+  void operator()() const {}
+};
+
+/// Time fn, the variant of the benchmark computed by tool, and report it.
+/// reset is called untimed before every run, restoring any state fn
+/// accumulates into. Returns the result of the last run of fn.
+template <typename Fn, typename Reset = NoReset>
+double run(const char *tool, const char *variant, Fn fn,
+           Reset reset = Reset()) {
+  auto &S = state();
+  double res = NAN;
+  int64_t tape = tape_bytes();
+  reset_peak_rss();
+  for (int i = 0; i < S.warmup; i++) {
+    reset();
+    res = invoke(fn);
+  }
+  std::vector<double> times;
+  for (int i = 0; i < S.trials; i++) {
+    reset();
+    double start = now();
+    res = invoke(fn);
+    times.push_back(now() - start);
+  }
+  long rss = peak_rss_kb();
+  if (tape >= 0)
+    tape = (tape_bytes() - tape) / (S.warmup + S.trials);
+
+  std::sort(times.begin(), times.end());
+  double median = percentile(times, 0.5);
+  double mean = 0;
+  for (double t : times)
+    mean += t;
+  mean /= times.size();
+
+  std::string name = tagged(variant);
+  printf("%s %s %0.6f res=%f\n", tool, name.c_str(), median, res);
+  fflush(stdout);
+
+  FILE *f = open_record(tool, name);
+  if (!f)
+    return res;
+  fprintf(f, ", \"warmup\": %d, \"trials\": %d", S.warmup, S.trials);
+  const char *names[] = {"median", "p10", "p90", "min", "max", "mean"};
+  double values[] = {median,      percentile(times, 0.1),
+                     percentile(times, 0.9), times.front(),
+                     times.back(), mean};
+  for (int i = 0; i < 6; i++) {
+    fprintf(f, ", \"%s\": ", names[i]);
+    json_number(f, values[i]);
+  }
+  fprintf(f, ", \"peak_rss_kb\": %ld, \"tape_bytes\": ", rss);
+  if (tape >= 0)
+    fprintf(f, "%lld", (long long)tape);
+  else
+    fputs("null", f);
+  fputs(", \"result\": ", f);
+  json_number(f, res);
+  fputs("}\n", f);
+  fclose(f);
+  return res;
+}
+
+/// Key a reference gradient is saved under
+inline std::string gradient_key(const char *tool, const char *variant) {
+  auto &S = state();
+  return S.name + "\t" + S.params + "\t" + tool + "\t" + variant + "\t";
+}
+
+/// Read the last reference gradient saved under key, returning false if
+/// there is none
+inline bool load_gradient(const char *path, const std::string &key,
+                          std::vector<double> &ref) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "could not open %s\n", path);
+    return false;
+  }
+  bool found = false;
+  char *line = nullptr;
+  size_t cap = 0;
+  while (getline(&line, &cap, f) > 0) {
+    if (strncmp(line, key.c_str(), key.size()))
+      continue;
+    char *cur = line + key.size();
+    size_t n = strtoull(cur, &cur, 10);
+    ref.resize(n);
+    for (size_t i = 0; i < n; i++)
+      ref[i] = strtod(cur, &cur);
+    found = true;
+  }
+  free(line);
+  fclose(f);
+  return found;
+}
+
+/// Check the gradient grad of n entries computed by tool for variant.
+/// With ENZYME_BENCH_GRADIENT_SAVE set, it is saved as the reference of later
+/// runs. With ENZYME_BENCH_GRADIENT_CHECK set, the largest relative error of
+/// any entry against the saved reference is printed and recorded. Entries
+/// are compared relative to their reference value, but to no less than 1e-6
+/// of the largest reference entry, so entries that should be zero are not
+/// divided by rounding noise. Returns the error, or NAN if it was not checked.
+template <typename T>
+double gradient(const char *tool, const char *variant, const T *grad,
+                size_t n) {
+  auto &S = state();
+  std::string key = gradient_key(tool, variant);
+  if (S.gradient_save) {
+    if (FILE *f = fopen(S.gradient_save, "a")) {
+      fprintf(f, "%s%zu", key.c_str(), n);
+      for (size_t i = 0; i < n; i++)
+        fprintf(f, " %a", (double)grad[i]);
+      fputc('\n', f);
+      fclose(f);
+    } else
+      fprintf(stderr, "could not open %s\n", S.gradient_save);
+  }
+
+  if (!S.gradient_check)
+    return NAN;
+  std::vector<double> ref;
+  if (!load_gradient(S.gradient_check, key, ref) || ref.size() != n) {
+    fprintf(stderr, "no reference gradient of %zu entries for %s %s\n", n,
+            tool, variant);
+    return NAN;
+  }
+  double scale = 0;
+  for (double r : ref)
+    scale = std::max(scale, fabs(r));
+  double error = 0;
+  for (size_t i = 0; i < n; i++) {
+    double diff = fabs((double)grad[i] - ref[i]);
+    if (diff == 0)
+      continue;
+    // A NaN or infinite entry is an unbounded error
+    if (!isfinite(diff)) {
+      error = INFINITY;
+      break;
+    }
+    error = std::max(error, diff / std::max(fabs(ref[i]), 1e-6 * scale));
+  }
+
+  std::string name = tagged(variant);
+  printf("%s %s gradient error %e\n", tool, name.c_str(), error);
+  fflush(stdout);
+  if (FILE *f = open_record(tool, name)) {
+    fputs(", \"gradient_error\": ", f);
+    json_number(f, error);
+    fputs("}\n", f);
+    fclose(f);
+  }
+  return error;
+}
+
+} // namespace bench
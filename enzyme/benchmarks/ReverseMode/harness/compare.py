@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+"""Summarize and check the JSON records written by the benchmark harness.
+
+Each input holds one JSON record per line, as appended by bench::run to the
+file named by ENZYME_BENCH_JSON. Records are keyed by benchmark, problem size,
+tool and variant; records repeated under the same key are merged, later
+fields replacing earlier ones. This joins the gradient error bench::gradient
+records for a variant with its timings.
+
+The summary lists the median time of each tool next to each other, with its
+ratio to Enzyme. Given a baseline, the script exits with status 1 if the
+median time of any record exceeds its baseline median by more than the
+threshold factor, or if the gradient error of any record exceeds the given
+gradient tolerance. Given --write-baseline, the merged records are written out
+to serve as the baseline of later runs.
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+
+
+def key(record):
+    return (record["benchmark"], record["params"], record["variant"],
+            record["tool"])
+
+
+def natural(k):
+    """Sort key ordering the numbers within a record key by value."""
+    return [[int(p) if p.isdigit() else p for p in re.split(r"(\d+)", x)]
+            for x in k]
+
+
+def load(paths, required=True):
+    records = {}
+    for path in paths:
+        if not required and not os.path.exists(path):
+            print("note: no results in %s" % path, file=sys.stderr)
+            continue
+        with open(path) as f:
+            for lineno, line in enumerate(f, 1):
+                line = line.strip()
+                if not line:
+                    continue
+                try:
+                    record = json.loads(line)
+                except ValueError as e:
+                    sys.exit("%s:%d: %s" % (path, lineno, e))
+                records.setdefault(key(record), {}).update(record)
+    return records
+
+
+def summarize(records, out):
+    rows = {}
+    tools = []
+    for (bench, params, variant, tool), record in sorted(
+            records.items(), key=lambda kv: natural(kv[0])):
+        rows.setdefault((bench, params, variant), {})[tool] = record
+        if tool not in tools:
+            tools.append(tool)
+    tools.sort(key=lambda t: (t != "Enzyme", t))
+
+    header = "%-36s" % "benchmark"
+    for tool in tools:
+        header += " %12s" % tool
+        if tool != "Enzyme":
+            header += " %9s" % "/Enzyme"
+    header += " %12s %12s" % ("Enzyme RSS", "Enzyme tape")
+    gradients = any("gradient_error" in r for r in records.values())
+    if gradients:
+        header += " %12s" % "Enzyme grad"
+    print(header, file=out)
+    for (bench, params, variant), row in sorted(
+            rows.items(), key=lambda kv: natural(kv[0])):
+        name = " ".join(x for x in (bench, params, variant) if x)
+        line = "%-36s" % name
+        enzyme = row.get("Enzyme")
+        for tool in tools:
+            record = row.get(tool)
+            if record and record.get("median") is not None:
+                line += " %12s" % ("%.6f" % record["median"])
+            else:
+                line += " %12s" % "-"
+            if tool == "Enzyme":
+                continue
+            if record and record.get("median") is not None and enzyme and \
+                    enzyme.get("median"):
+                line += " %9s" % ("%.2fx" % (record["median"] /
+                                             enzyme["median"]))
+            else:
+                line += " %9s" % "-"
+        if enzyme and enzyme.get("peak_rss_kb") is not None:
+            line += " %10dkB" % enzyme["peak_rss_kb"]
+            tape = enzyme.get("tape_bytes")
+            line += " %12s" % ("-" if tape is None else "%dB" % tape)
+        elif gradients:
+            line += " %12s %12s" % ("-", "-")
+        if gradients:
+            error = enzyme.get("gradient_error", "-") if enzyme else "-"
+            if error is None:
+                error = "inf"
+            elif error != "-":
+                error = "%.3e" % error
+            line += " %12s" % error
+        print(line, file=out)
+
+
+def check_gradients(records, tolerance, out):
+    failed = 0
+    for k, record in sorted(records.items()):
+        if "gradient_error" not in record:
+            continue
+        error = record["gradient_error"]
+        if error is None or error > tolerance:
+            failed += 1
+            print("GRADIENT %s: relative error %s exceeds %g" %
+                  (" ".join(x for x in k if x),
+                   "inf" if error is None else "%.3e" % error, tolerance),
+                  file=out)
+    return failed
+
+
+def check(records, baseline, threshold, out):
+    failed = 0
+    for k, record in sorted(records.items()):
+        base = baseline.get(k)
+        if not base or not base.get("median") or \
+                record.get("median") is None:
+            continue
+        ratio = record["median"] / base["median"]
+        if ratio > threshold:
+            failed += 1
+            print("REGRESSION %s: median %.6fs is %.2fx the baseline %.6fs" %
+                  (" ".join(x for x in k if x), record["median"], ratio,
+                   base["median"]), file=out)
+    missing = [k for k in baseline if k not in records]
+    for k in sorted(missing):
+        print("note: no result for baseline record %s" %
+              " ".join(x for x in k if x), file=out)
+    return failed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("results", nargs="+",
+                        help="JSON lines files written by the harness")
+    parser.add_argument("--baseline",
+                        help="JSON lines file of baseline records")
+    parser.add_argument("--threshold", type=float, default=1.10,
+                        help="largest allowed ratio of median time to the "
+                        "baseline (default 1.10)")
+    parser.add_argument("--gradient-tolerance", type=float,
+                        help="largest allowed relative gradient error of "
+                        "reduced precision builds")
+    parser.add_argument("--write-baseline",
+                        help="write the merged records to this file")
+    args = parser.parse_args()
+
+    records = load(args.results, required=False)
+    summarize(records, sys.stdout)
+
+    if args.write_baseline:
+        with open(args.write_baseline, "w") as f:
+            for k in sorted(records):
+                f.write(json.dumps(records[k], sort_keys=True) + "\n")
+
+    status = 0
+    if args.gradient_tolerance is not None:
+        failed = check_gradients(records, args.gradient_tolerance, sys.stdout)
+        if failed:
+            print("%d gradient(s) beyond a relative error of %g" %
+                  (failed, args.gradient_tolerance))
+            status = 1
+
+    if args.baseline:
+        failed = check(records, load([args.baseline]), args.threshold,
+                       sys.stdout)
+        if failed:
+            print("%d regression(s) beyond %.2fx" % (failed, args.threshold))
+            status = 1
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,97 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// Measures how fast the reverse pass streams through the tape. The kernel
+// overwrites its input, so every iteration must cache x[i] - A in the forward
+// pass and read it back, walking the array backwards, in the reverse pass.
+
+template<typename Return, typename... T>
+Return __enzyme_autodiff(T...);
+
+float tdiff(struct timeval *start, struct timeval *end) {
+  return (end->tv_sec-start->tv_sec) + 1e-6*(end->tv_usec-start->tv_usec);
+}
+
+static double sum(const double *x, size_t n) {
+    double res = 0;
+    for(size_t i=0; i<n; i++) {
+        res+=x[i];
+    }
+    return res;
+}
+
+static double max(double x, double y) {
+    return (x > y) ? x : y;
+}
+
+// Returns logsumexp(x), leaving exp(x[i] - max(x)) in x
+__attribute__((noinline))
+static double logsumexp_inplace(double *__restrict x, size_t n) {
+  double A = x[0];
+  for(size_t i=0; i<n; i++) {
+    A = max(A, x[i]);
+  }
+  double sema = 0;
+  for(size_t i=0; i<n; i++) {
+    double e = exp(x[i] - A);
+    x[i] = e;
+    sema += e;
+  }
+  return log(sema) + A;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    printf("usage %s n repeat\n", argv[0]);
+    return 1;
+  }
+  size_t n = atol(argv[1]);
+  unsigned long repeat = atol(argv[2]);
+
+  double *orig = new double[n];
+  double *input = new double[n];
+  double *inputp = new double[n];
+  for(size_t i=0; i<n; i++) {
+    orig[i] = 3.1415926535 / (i+1);
+  }
+
+  float primal, gradient;
+  {
+  struct timeval start, end;
+  double total = 0;
+  gettimeofday(&start, NULL);
+  for(unsigned long i=0; i<repeat; i++) {
+    memcpy(input, orig, sizeof(double)*n);
+    total += logsumexp_inplace(input, n);
+  }
+  gettimeofday(&end, NULL);
+  primal = tdiff(&start, &end);
+  printf("primal %0.6f res=%f\n", primal, total);
+  }
+
+  {
+  struct timeval start, end;
+  memset(inputp, 0, sizeof(double)*n);
+  gettimeofday(&start, NULL);
+  for(unsigned long i=0; i<repeat; i++) {
+    memcpy(input, orig, sizeof(double)*n);
+    __enzyme_autodiff<void>(logsumexp_inplace, input, inputp, n);
+  }
+  gettimeofday(&end, NULL);
+  gradient = tdiff(&start, &end);
+  printf("forward and reverse %0.6f res'=%f\n", gradient, sum(inputp, n));
+  }
+
+  // One double of x[i] - A is written and read back per element
+  double tape = 2.0 * sizeof(double) * n * repeat;
+  printf("tape traffic %0.3f GB/s over %0.6f s beyond the primal\n",
+         tape / (gradient - primal) * 1e-9, gradient - primal);
+
+  delete[] orig;
+  delete[] input;
+  delete[] inputp;
+  return 0;
+}
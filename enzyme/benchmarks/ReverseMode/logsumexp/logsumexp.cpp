@@ -1,12 +1,13 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
 #include <stdlib.h>
 #include <math.h>
 #include <inttypes.h>
 #include <string.h>
 
+#include "../harness/bench.h"
+
 #include <adept_source.h>
 #include <adept_arrays.h>
 using adept::adouble;
@@ -19,11 +20,6 @@ extern int enzyme_const;
 template<typename Return, typename... T>
 Return __enzyme_autodiff(T...);
 
-float tdiff(struct timeval *start, struct timeval *end) {
-  return (end->tv_sec-start->tv_sec) + 1e-6*(end->tv_usec-start->tv_usec);
-}
-
-
 static double sum(const double *x, size_t n) {
     double res = 0;
     for(int i=0; i<n; i++) {
@@ -53,22 +49,6 @@ static double logsumexp(const double *__restrict x, size_t n) {
 }
 
 
-static adouble alogsumexp(const aVector &x, size_t n) {
-  adouble A = x[0];
-  for(int i=0; i<n; i++) {
-    A = amax(A, x[i]);
-  }
-  adouble ema[n];
-  for(int i=0; i<n; i++) {
-    ema[i] = exp(x[i] - A);
-  }
-  adouble sema = 0;
-  for(int i=0; i<n; i++)
-    sema += ema[i];
-  return log(sema) + A;
-}
-
-
 extern "C" {
 #include <adBuffer.h>
 }
@@ -126,173 +106,79 @@ adouble alogsumexp2(const aVector &x, size_t n) {
 }
 
 static void adept_sincos(double *input, double *inputp, unsigned long n, unsigned long repeat) {
-  {
-  struct timeval start, end;
-  //gettimeofday(&start, NULL);
- 
   adept::Stack stack;
- 
-  aVector inp(n);
-  for(int i=0; i<n; i++) inp(i) = input[i];
-  memset(inputp, 0, sizeof(double)*n);
-  double total = 0;
 
-  gettimeofday(&start, NULL);
-  for (int iter = 0; iter < repeat; iter++) {
-    stack.new_recording();
-    adouble resa = alogsumexp(inp, n);
-    stack.pause_recording();
-    total += resa.value();
-    stack.continue_recording();
-  }
-  gettimeofday(&end, NULL);
-
-  stack.pause_recording();
-
-  printf("adept forward (recording) %0.6f res'=%f\n", tdiff(&start, &end), total);
-  }
-  {
-  struct timeval start, end;
-  //gettimeofday(&start, NULL);
- 
-  adept::Stack stack;
- 
   aVector inp(n);
   for(int i=0; i<n; i++) inp(i) = input[i];
-  memset(inputp, 0, sizeof(double)*n);
 
-  gettimeofday(&start, NULL);
-  for (int iter = 0; iter < repeat; iter++) {
-    stack.new_recording();
-    adouble resa = alogsumexp(inp, n);
-    resa.set_gradient(1.0);
-    stack.reverse();
-    stack.pause_recording();
-    for (int i = 0; i < n; i++) {
-        inputp[i] += inp(i).get_gradient();
+  bench::run("Adept", "forward", [&]() {
+    double total = 0;
+    for (int iter = 0; iter < repeat; iter++) {
+      stack.new_recording();
+      adouble resa = alogsumexp2(inp, n);
+      stack.pause_recording();
+      total += resa.value();
+      stack.continue_recording();
     }
-    stack.continue_recording();
-  }
-  gettimeofday(&end, NULL);
-
-  stack.pause_recording();
-
-  printf("adept forward reverse %0.6f res'=%f\n", tdiff(&start, &end), sum(inputp, n));
-  }
-}
-static void adept2_sincos(double *input, double *inputp, unsigned long n, unsigned long repeat) {
-  {
-  struct timeval start, end;
-  //gettimeofday(&start, NULL);
- 
-  adept::Stack stack;
- 
-  aVector inp(n);
-  for(int i=0; i<n; i++) inp(i) = input[i];
-  memset(inputp, 0, sizeof(double)*n);
-  double total = 0;
-
-  gettimeofday(&start, NULL);
-  for (int iter = 0; iter < repeat; iter++) {
-    stack.new_recording();
-    adouble resa = alogsumexp2(inp, n);
-    stack.pause_recording();
-    total += resa.value();
-    stack.continue_recording();
-  }
-  gettimeofday(&end, NULL);
-
-  stack.pause_recording();
-
-  printf("adept2 forward (recording) %0.6f res'=%f\n", tdiff(&start, &end), total);
-  }
-  {
-  struct timeval start, end;
-  //gettimeofday(&start, NULL);
- 
-  adept::Stack stack;
- 
-  aVector inp(n);
-  for(int i=0; i<n; i++) inp(i) = input[i];
-  memset(inputp, 0, sizeof(double)*n);
-
-  gettimeofday(&start, NULL);
-  for (int iter = 0; iter < repeat; iter++) {
-    stack.new_recording();
-    adouble resa = alogsumexp2(inp, n);
-    resa.set_gradient(1.0);
-    stack.reverse();
-    stack.pause_recording();
-    for (int i = 0; i < n; i++) {
-        inputp[i] += inp(i).get_gradient();
+    return total;
+  });
+
+  bench::run("Adept", "combined", [&]() {
+    for (int iter = 0; iter < repeat; iter++) {
+      stack.new_recording();
+      adouble resa = alogsumexp2(inp, n);
+      resa.set_gradient(1.0);
+      stack.reverse();
+      stack.pause_recording();
+      for (int i = 0; i < n; i++) {
+          inputp[i] += inp(i).get_gradient();
+      }
+      stack.continue_recording();
     }
-    stack.continue_recording();
-  }
-  gettimeofday(&end, NULL);
+    return sum(inputp, n);
+  }, [&]() { memset(inputp, 0, sizeof(double)*n); });
 
   stack.pause_recording();
-
-  printf("adept2 forward reverse %0.6f res'=%f\n", tdiff(&start, &end), sum(inputp, n));
-  }
 }
 
 static void enzyme_sincos(double *input, double *inputp, unsigned long n, unsigned long repeat) {
-    double realinput = input[0];
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-  double total = 0;
-  for(int i=0; i<repeat; i++) {
-    input[0] = realinput + (double)i/10000000;
-    total += logsumexp(input, n);
-  }
-
-  gettimeofday(&end, NULL);
-  printf("enzyme forward %0.6f res'=%f\n", tdiff(&start, &end), total);
-  }
-  {
-      input[0] = realinput;
-  struct timeval start, end;
-  memset(inputp, 0, sizeof(double)*n);
-
-  gettimeofday(&start, NULL);
-
-  for(int i=0; i<repeat; i++) {
-    __enzyme_autodiff<void>(logsumexp, input, inputp, n);
-  }
+  double realinput = input[0];
+  bench::run("Enzyme", "forward", [&]() {
+    double total = 0;
+    for(int i=0; i<repeat; i++) {
+      input[0] = realinput + (double)i/10000000;
+      total += logsumexp(input, n);
+    }
+    input[0] = realinput;
+    return total;
+  });
 
-  gettimeofday(&end, NULL);
-  printf("enzyme forward and reverse %0.6f res'=%f\n", tdiff(&start, &end), sum(inputp, n));
-  }
+  bench::run("Enzyme", "combined", [&]() {
+    for(int i=0; i<repeat; i++) {
+      __enzyme_autodiff<void>(logsumexp, input, inputp, n);
+    }
+    return sum(inputp, n);
+  }, [&]() { memset(inputp, 0, sizeof(double)*n); });
 }
-static void tapenade_sincos(double *input, double *inputp, unsigned long n, unsigned long repeat) {
-    double realinput = input[0];
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-  double total = 0;
-  for(int i=0; i<repeat; i++) {
-    input[0] = realinput + (double)i/10000000;
-    total += logsumexp(input, n);
-  }
-
-  gettimeofday(&end, NULL);
-  printf("tapenade forward %0.6f res'=%f\n", tdiff(&start, &end), total);
-  }
-  {
-      input[0] = realinput;
-  struct timeval start, end;
-  memset(inputp, 0, sizeof(double)*n);
 
-  gettimeofday(&start, NULL);
-
-  for(int i=0; i<repeat; i++) {
-    logsumexp_b(input, inputp, n, 1.0);
-  }
+static void tapenade_sincos(double *input, double *inputp, unsigned long n, unsigned long repeat) {
+  double realinput = input[0];
+  bench::run("Tapenade", "forward", [&]() {
+    double total = 0;
+    for(int i=0; i<repeat; i++) {
+      input[0] = realinput + (double)i/10000000;
+      total += logsumexp(input, n);
+    }
+    input[0] = realinput;
+    return total;
+  });
 
-  gettimeofday(&end, NULL);
-  printf("tapenade forward and reverse %0.6f res'=%f\n", tdiff(&start, &end), sum(inputp, n));
-  }
+  bench::run("Tapenade", "combined", [&]() {
+    for(int i=0; i<repeat; i++) {
+      logsumexp_b(input, inputp, n, 1.0);
+    }
+    return sum(inputp, n);
+  }, [&]() { memset(inputp, 0, sizeof(double)*n); });
 }
 
 int main(int argc, char** argv) {
@@ -309,9 +195,10 @@ int main(int argc, char** argv) {
     input[i] = 3.1415926535 / (i+1);
   }
   
-  //adept_sincos(input, inputp, n, repeat);
-  
-  adept2_sincos(input, inputp, n, repeat);
+  bench::init("logsumexp");
+  bench::params("n=" + std::to_string(n) + " repeat=" + std::to_string(repeat));
+
+  adept_sincos(input, inputp, n, repeat);
 
   tapenade_sincos(input, inputp, n, repeat);
 
@@ -1,20 +1,17 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
 #include <stdlib.h>
 #include <math.h>
 #include <inttypes.h>
 #include <string.h>
 
+#include "../harness/bench.h"
+
 extern int enzyme_const;
 template<typename Return, typename... T>
 Return __enzyme_autodiff(T...);
 
-float tdiff(struct timeval *start, struct timeval *end) {
-  return (end->tv_sec-start->tv_sec) + 1e-6*(end->tv_usec-start->tv_usec);
-}
-
 #include <adept_arrays.h>
 using adept::adouble;
 using adept::aMatrix;
@@ -27,6 +24,12 @@ using adept::Vector;
 #define ITERS 1000
 #define RATE 0.00000001
 
+// Restore the matrix descended on and clear its gradient
+static void reset_descent(double *Min, double *Mout) {
+  for(int i=0; i<N*M; i++) Min[i] = 3*i;
+  memset(Mout, 0, sizeof(double)*N*M);
+}
+
 double matvec_real(double* mat, double* vec) {
   double *out = (double*)malloc(sizeof(double)*N);
   //double *out = new double[N];
@@ -146,96 +149,47 @@ void sincos_and_gradient(double *Min, double *Mout, double *vecin, double *vecou
 #endif
 
 static void adept_sincos(double *Min, double *Mout, double *Vin, double *Vout) {
-
-  {
-  struct timeval start, end;
-
-  double res2 = 0;
   adept::Stack stack;
 
-    aMatrix mat(N,M);
-    for(int i=0; i<N; i++) {
-    for(int j=0; j<M; j++) {
-        mat(i, j) = Min[i*M+j];
-    }
-    }
-    Vector vec(M);
-    for(int i=0; i<M; i++) vec(i) = Vin[i];
-
-
-  gettimeofday(&start, NULL);
-  for (int iter = 0; iter < ITERS; iter++) {
-    stack.new_recording();
-    adouble resa = matvec(mat, vec);
-    resa.set_gradient(1.0);
-    stack.continue_recording();
-  }
-    //stack.reverse();
-    //stack.pause_recording();
-    /*
-    for (int i = 0; i < N; i++) {
-      for (int j = 0; j < M; j++) {
-        mat(i,j) -= mat(i,j).get_gradient()*RATE;
-      }
-    }*/
-  gettimeofday(&end, NULL);
-  //gettimeofday(&end, NULL);
-  printf("%0.6f res'=%f %f %f\n", tdiff(&start, &end), Mout[1], Mout[2], Mout[3]);
-
-  }
-
-
-
-  {
-  struct timeval start, end;
-  //gettimeofday(&start, NULL);
-
-  double res2 = 0;
-  {
-  adept::Stack stack;
+  aMatrix mat(N,M);
+  Vector vec(M);
+  for(int i=0; i<M; i++) vec(i) = Vin[i];
 
-    aMatrix mat(N,M);
+  auto reset = [&]() {
+    reset_descent(Min, Mout);
     for(int i=0; i<N; i++) {
-    for(int j=0; j<M; j++) {
+      for(int j=0; j<M; j++) {
         mat(i, j) = Min[i*M+j];
-    }
-    }
-    Vector vec(M);
-    for(int i=0; i<M; i++) vec(i) = Vin[i];
-
-
-  gettimeofday(&start, NULL);
-  for (int iter = 0; iter < ITERS; iter++) {
-    stack.new_recording();
-    adouble resa = matvec(mat, vec);
-    resa.set_gradient(1.0);
-    stack.reverse();
-    stack.pause_recording();
-    for (int i = 0; i < N; i++) {
-      for (int j = 0; j < M; j++) {
-        mat(i,j) -= mat(i,j).get_gradient()*RATE;
       }
     }
-    stack.continue_recording();
-  }
-  gettimeofday(&end, NULL);
-#if 0
-    stack.new_recording();
-     gettimeofday(&start, NULL);
-  adouble resa = matvec(mat, vec);
-  res2 = resa.value();
-
-    resa.set_gradient(1.0);
-    stack.reverse();
-    gettimeofday(&end, NULL);
-    stack.pause_recording();
-    for (int i = 0; i < N; i++) {
-      for (int j = 0; j < M; j++) {
-        Mout[i*M+j] = mat(i,j).get_gradient();
+  };
+
+  bench::run("Adept", "forward", [&]() {
+    double res = 0;
+    for (int iter = 0; iter < ITERS; iter++) {
+      stack.new_recording();
+      adouble resa = matvec(mat, vec);
+      resa.set_gradient(1.0);
+      res = resa.value();
+      stack.continue_recording();
+    }
+    return res;
+  }, reset);
+
+  bench::run("Adept", "combined", [&]() {
+    for (int iter = 0; iter < ITERS; iter++) {
+      stack.new_recording();
+      adouble resa = matvec(mat, vec);
+      resa.set_gradient(1.0);
+      stack.reverse();
+      stack.pause_recording();
+      for (int i = 0; i < N; i++) {
+        for (int j = 0; j < M; j++) {
+          mat(i,j) -= mat(i,j).get_gradient()*RATE;
+        }
       }
+      stack.continue_recording();
     }
-#endif
-    //for(int i=0; i<M; i++) Vout[i] = vec(i).get_gradient();
 
     stack.pause_recording();
     for (int i = 0; i < N; i++) {
@@ -243,103 +197,59 @@ static void adept_sincos(double *Min, double *Mout, double *Vin, double *Vout) {
         Mout[i*M+j] = mat(i,j).get_gradient();
       }
     }
-
-  }
-  //gettimeofday(&end, NULL);
-  printf("%0.6f res'=%f %f %f\n", tdiff(&start, &end), Mout[1], Mout[2], Mout[3]);
-  }
+    stack.continue_recording();
+    return Mout[1];
+  }, reset);
+  stack.pause_recording();
 }
 #endif
 
 static void tapenade_sincos(double *Min, double *Mout, double *Vin, double *Vout) {
+  bench::run("Tapenade", "real", [&]() { return matvec_real(Min, Vin); });
 
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double res = matvec_real(Min, Vin);
-
-  gettimeofday(&end, NULL);
-  printf("tapenade %0.6f res=%f\n", tdiff(&start, &end), res);
-  }
-
-  {
-  struct timeval start, end;
-  double tmp = Min[0];
-  gettimeofday(&start, NULL);
-
-  double sum = 0;
-  for(int i=0; i<ITERS; i++) {
+  bench::run("Tapenade", "forward", [&]() {
+    double tmp = Min[0];
+    double sum = 0;
+    for(int i=0; i<ITERS; i++) {
       Min[0] = tmp + i/100000000.;
-        sum += matvec_real(Min, Vin);
-  }
-
-  gettimeofday(&end, NULL);
-  printf("tapenade mv %0.6f res=%f\n", tdiff(&start, &end), sum);
-  Min[0] = tmp;
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-  double res2;
-
-  for(int i=0; i<ITERS; i++) {
-  for(int i=0; i<N*M; i++) { Mout[i] = 0; }
-  //for(int i=0; i<M; i++) { Vout[i] = 0; }
-    matvec_real_b(Min, Mout, Vin, 1.0);
-  //res2 = __builtin_autodiff(matvec_real, Min, Mout, Vin, Vout);
-  for(int i=0; i<N*M; i++) { Min[i] -= Mout[i] * RATE; }
-  }
-
-  gettimeofday(&end, NULL);
-  printf("tapenade %0.6f res'=%f %f %f\n", tdiff(&start, &end), Mout[1], Mout[2], Mout[3]);
-  }
+      sum += matvec_real(Min, Vin);
+    }
+    Min[0] = tmp;
+    return sum;
+  });
+
+  bench::run("Tapenade", "combined", [&]() {
+    for(int i=0; i<ITERS; i++) {
+      for(int i=0; i<N*M; i++) { Mout[i] = 0; }
+      matvec_real_b(Min, Mout, Vin, 1.0);
+      for(int i=0; i<N*M; i++) { Min[i] -= Mout[i] * RATE; }
+    }
+    return Mout[1];
+  }, [&]() { reset_descent(Min, Mout); });
 }
-static void enzyme_sincos(double *Min, double *Mout, double *Vin, double *Vout) {
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double res = matvec_real(Min, Vin);
 
-  gettimeofday(&end, NULL);
-  printf("%0.6f res=%f\n", tdiff(&start, &end), res);
-  }
-
-  {
-  struct timeval start, end;
-  double tmp = Min[0];
-  gettimeofday(&start, NULL);
+static void enzyme_sincos(double *Min, double *Mout, double *Vin, double *Vout) {
+  bench::run("Enzyme", "real", [&]() { return matvec_real(Min, Vin); });
 
-  double sum = 0;
-  for(int i=0; i<ITERS; i++) {
+  bench::run("Enzyme", "forward", [&]() {
+    double tmp = Min[0];
+    double sum = 0;
+    for(int i=0; i<ITERS; i++) {
       Min[0] = tmp + i/100000000.;
-        sum += matvec_real(Min, Vin);
-  }
-
-  gettimeofday(&end, NULL);
-  printf("mv %0.6f res=%f\n", tdiff(&start, &end), sum);
-  Min[0] = tmp;
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-  double res2;
-
-  for(int i=0; i<ITERS; i++) {
-  for(int i=0; i<N*M; i++) { Mout[i] = 0; }
-  //for(int i=0; i<M; i++) { Vout[i] = 0; }
-  res2 = __enzyme_autodiff<double>(matvec_real, Min, Mout, enzyme_const, Vin);
-  //res2 = __builtin_autodiff(matvec_real, Min, Mout, Vin, Vout);
-  for(int i=0; i<N*M; i++) { Min[i] -= Mout[i] * RATE; }
-  }
-
-  gettimeofday(&end, NULL);
-  printf("%0.6f res'=%f %f %f\n", tdiff(&start, &end), Mout[1], Mout[2], Mout[3]);
-  }
+      sum += matvec_real(Min, Vin);
+    }
+    Min[0] = tmp;
+    return sum;
+  });
+
+  bench::run("Enzyme", "combined", [&]() {
+    for(int i=0; i<ITERS; i++) {
+      for(int i=0; i<N*M; i++) { Mout[i] = 0; }
+      __enzyme_autodiff<double>(matvec_real, Min, Mout, enzyme_const, Vin);
+      for(int i=0; i<N*M; i++) { Min[i] -= Mout[i] * RATE; }
+    }
+    return Mout[1];
+  }, [&]() { reset_descent(Min, Mout); });
 }
 
 int main(int argc, char** argv) {
@@ -349,18 +259,20 @@ int main(int argc, char** argv) {
   double *Vin = new double[M];
   double *Vout = new double[M];
 
-  for(int i=0; i<N*M; i++) Min[i] = 3*i;
   for(int i=0; i<M; i++) Vin[i] = 1*i;
 
-  memset(Mout, 0, sizeof(double)*N*M);
+  bench::init("matdescent");
+  bench::params("n=" + std::to_string(N) + " m=" + std::to_string(M));
+
+  reset_descent(Min, Mout);
   memset(Vout, 0, sizeof(double)*M);
   adept_sincos(Min, Mout, Vin, Vout);
 
-  memset(Mout, 0, sizeof(double)*N*M);
+  reset_descent(Min, Mout);
   memset(Vout, 0, sizeof(double)*M);
   tapenade_sincos(Min, Mout, Vin, Vout);
 
-  memset(Mout, 0, sizeof(double)*N*M);
+  reset_descent(Min, Mout);
   memset(Vout, 0, sizeof(double)*M);
   enzyme_sincos(Min, Mout, Vin, Vout);
 }
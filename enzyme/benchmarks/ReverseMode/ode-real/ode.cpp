@@ -6,6 +6,9 @@
 #include <math.h>
 #include <inttypes.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <adept_source.h>
 #include <adept.h>
 #include <adept_arrays.h>
@@ -15,6 +18,7 @@ using adept::aVector;
 template<typename Return, typename... T>
 Return __enzyme_autodiff(T...);
 extern "C" {
+  void __enzyme_checkpoint(void*, ...);
   extern int enzyme_dup;
   extern int enzyme_const;
   extern int enzyme_dupnoneed;
@@ -500,6 +504,53 @@ double tfoobar(const double* p, const state_type x, const state_type adjoint, do
     return dx[0];
 }
 
+//! Time stepping
+// Explicit Euler on the full brusselator state, differentiated with respect
+// to the parameters either with every step on the tape or checkpointed.
+static void euler_step(double* __restrict x, const double* __restrict p) {
+    double dxdt[2 * N * N];
+    brusselator_2d_loop(dxdt, dxdt + N * N, x, x + N * N, p, 2.1);
+    for (int i = 0; i < 2 * N * N; i++)
+        x[i] += 1e-5 * dxdt[i];
+}
+
+static double euler_taped(const double* p, uint64_t steps) {
+    state_type x;
+    init_brusselator(x.data(), x.data() + N * N);
+    for (uint64_t i = 0; i < steps; i++)
+        euler_step(x.data(), p);
+    return x[0];
+}
+
+static double euler_checkpointed(const double* p, uint64_t steps) {
+    state_type x;
+    init_brusselator(x.data(), x.data() + N * N);
+    __enzyme_checkpoint((void*)euler_step, steps, x.data(), sizeof(x), p);
+    return x[0];
+}
+
+// Run fn in a child process so the peak RSS reported is that of fn alone
+template<typename Fn>
+static void measure_rss(const char* name, uint64_t steps, Fn fn) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    double res = fn();
+
+    gettimeofday(&end, NULL);
+    printf("Enzyme %s %0.6f res=%f\n", name, tdiff(&start, &end), res);
+    fflush(stdout);
+    _exit(0);
+  }
+  int status;
+  struct rusage usage;
+  wait4(pid, &status, 0, &usage);
+  printf("Enzyme %s peak_rss_kb=%ld steps=%" PRIu64 "\n", name, usage.ru_maxrss, steps);
+}
+
 //! Main
 int main(int argc, char** argv) {
   const double p[3] = { /*A*/ 3.4, /*B*/ 1, /*alpha*/10. };
@@ -547,6 +598,20 @@ int main(int argc, char** argv) {
   gettimeofday(&end, NULL);
   printf("Enzyme combined %0.6f res=%f\n", tdiff(&start, &end), res);
   }
+
+  int max_steps = argc > 1 ? atoi(argv[1]) : 1000;
+  for(int steps=max_steps/4; steps<=max_steps; steps+=max_steps/4) {
+    measure_rss("taped", steps, [=]() {
+      double dp[3] = { 0. };
+      __enzyme_autodiff<void>(euler_taped, p, dp, (uint64_t)steps);
+      return dp[0];
+    });
+    measure_rss("checkpoint", steps, [=]() {
+      double dp[3] = { 0. };
+      __enzyme_autodiff<void>(euler_checkpointed, p, dp, (uint64_t)steps);
+      return dp[0];
+    });
+  }
   //printf("res=%f\n", foobar(1000));
 }
 
@@ -10,9 +10,7 @@
 #include <adept.h>
 using adept::adouble;
 
-static float tdiff(struct timeval *start, struct timeval *end) {
-  return (end->tv_sec-start->tv_sec) + 1e-6*(end->tv_usec-start->tv_usec);
-}
+#include "../harness/bench.h"
 
 #define BOOST_MATH_NO_LONG_DOUBLE_MATH_FUNCTIONS
 #define BOOST_NO_EXCEPTIONS
@@ -65,37 +63,15 @@ double afoobar_and_gradient(double xin, double& xgrad, uint64_t iters) {
 }
 
 void adept_sincos(double inp, uint64_t iters) {
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double res = foobar(inp, iters);
-
-  gettimeofday(&end, NULL);
-  printf("Adept real %0.6f res=%f\n", tdiff(&start, &end), res);
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  adept::Stack stack;
- // stack.new_recording();
-  adouble resa = afoobar(inp, iters);
-  double res = resa.value();
-
-  gettimeofday(&end, NULL);
-  printf("Adept forward %0.6f res=%f\n", tdiff(&start, &end), res);
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double res2 = 0;
-  afoobar_and_gradient(inp, res2, iters);
-
-  gettimeofday(&end, NULL);
-  printf("Adept combined %0.6f res'=%f\n", tdiff(&start, &end), res2);
-  }
+  bench::run("Adept", "real", [&]() { return foobar(inp, iters); });
+  bench::run("Adept", "forward", [&]() {
+    adept::Stack stack;
+    adouble resa = afoobar(inp, iters);
+    return resa.value();
+  });
+  bench::run("Adept", "combined", [&]() {
+    double res2 = 0;
+    afoobar_and_gradient(inp, res2, iters);
+    return res2;
+  });
 }
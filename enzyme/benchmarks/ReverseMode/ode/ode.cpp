@@ -9,10 +9,9 @@
 
 template<typename Return, typename... T>
 Return __enzyme_autodiff(T...);
+extern "C" void __enzyme_checkpoint(void*, ...);
 
-static float tdiff(struct timeval *start, struct timeval *end) {
-  return (end->tv_sec-start->tv_sec) + 1e-6*(end->tv_usec-start->tv_usec);
-}
+#include "../harness/bench.h"
 
 #define BOOST_MATH_NO_LONG_DOUBLE_MATH_FUNCTIONS
 #define BOOST_NO_EXCEPTIONS
@@ -54,37 +53,40 @@ double foobar(double t, uint64_t iters) {
 void adept_sincos(double inp, uint64_t iters);
 
 static void enzyme_sincos(double inp, uint64_t iters) {
+  bench::run("Enzyme", "real", [&]() { return foobar(inp, iters); });
+  bench::run("Enzyme", "forward", [&]() { return foobar(inp, iters); });
+  bench::run("Enzyme", "combined",
+             [&]() { return __enzyme_autodiff<double>(foobar, inp, iters); });
+}
 
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double res = foobar(inp, iters);
-
-  gettimeofday(&end, NULL);
-  printf("Enzyme real %0.6f res=%f\n", tdiff(&start, &end), res);
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double res = foobar(inp, iters);
-
-  gettimeofday(&end, NULL);
-  printf("Enzyme forward %0.6f res=%f\n", tdiff(&start, &end), res);
-  }
+// Explicit Euler on the same equation, so the time loop is visible to Enzyme
+static void euler_step(double* x, const double* dt) {
+    const double a = 1.2;
+    x[0] += dt[0] * (-a * x[0]);
+}
 
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-  double res2;
+static double euler_taped(double t, uint64_t iters) {
+    double x = 1.0;
+    double dt = t / iters;
+    for (uint64_t i = 0; i < iters; i++)
+        euler_step(&x, &dt);
+    return x;
+}
 
-  res2 = __enzyme_autodiff<double>(foobar, inp, iters);
+static double euler_checkpointed(double t, uint64_t iters) {
+    double x = 1.0;
+    double dt = t / iters;
+    __enzyme_checkpoint((void*)euler_step, iters, &x, sizeof(x), &dt);
+    return x;
+}
 
-  gettimeofday(&end, NULL);
-  printf("Enzyme combined %0.6f res'=%f\n", tdiff(&start, &end), res2);
-  }
+static void enzyme_checkpoint(double inp, uint64_t iters) {
+  bench::run("Enzyme", "taped", [&]() {
+    return __enzyme_autodiff<double>(euler_taped, inp, iters);
+  });
+  bench::run("Enzyme", "checkpoint", [&]() {
+    return __enzyme_autodiff<double>(euler_checkpointed, inp, iters);
+  });
 }
 
 int main(int argc, char** argv) {
@@ -92,9 +94,12 @@ int main(int argc, char** argv) {
   int max_iters = atoi(argv[1]) ;
   double inp = 2.1;
 
+  bench::init("ode");
   for(int iters=max_iters/20; iters<=max_iters; iters+=max_iters/20) {
     printf("iters=%d\n", iters);
+    bench::params("iters=" + std::to_string(iters));
     adept_sincos(inp, iters);
     enzyme_sincos(inp, iters);
+    enzyme_checkpoint(inp, iters);
   }
 }
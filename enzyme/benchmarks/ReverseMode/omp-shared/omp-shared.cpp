@@ -0,0 +1,92 @@
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Measures how the reverse pass of a parallel loop scales when every
+// iteration reads the same few shared coefficients. Each iteration adds to
+// the shadow of all of them, so with atomic accumulation every thread
+// contends on the same cache lines, whereas a thread-private shadow is folded
+// into the shared one once per thread.
+
+template<typename Return, typename... T>
+Return __enzyme_autodiff(T...);
+
+#define DEGREE 8
+
+static double sum(const double *x, size_t n) {
+    double res = 0;
+    for(size_t i=0; i<n; i++) {
+        res+=x[i];
+    }
+    return res;
+}
+
+// out[i] = sum_k coef[k] * x[i]^k
+__attribute__((noinline))
+static void polyeval(const double *__restrict coef, const double *__restrict x,
+                     double *__restrict out, size_t n) {
+  double w[DEGREE];
+  for (int k=0; k<DEGREE; k++)
+    w[k] = coef[k];
+  #pragma omp parallel for
+  for(size_t i=0; i<n; i++) {
+    double res = w[DEGREE-1];
+    for (int k=DEGREE-2; k>=0; k--)
+      res = res * x[i] + w[k];
+    out[i] = res;
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    printf("usage %s n repeat\n", argv[0]);
+    return 1;
+  }
+  size_t n = atol(argv[1]);
+  unsigned long repeat = atol(argv[2]);
+
+  double coef[DEGREE], dcoef[DEGREE];
+  for (int k=0; k<DEGREE; k++)
+    coef[k] = 1.0 / (k+1);
+  double *x = new double[n];
+  double *dx = new double[n];
+  double *out = new double[n];
+  double *dout = new double[n];
+  for(size_t i=0; i<n; i++) {
+    x[i] = 1.0 / (i+1);
+  }
+
+  int maxthreads = omp_get_max_threads();
+  // Powers of two up to, and always including, every available thread
+  for (int threads=1;; threads = (threads*2 < maxthreads) ? threads*2 : maxthreads) {
+    omp_set_num_threads(threads);
+
+    double start = omp_get_wtime();
+    for(unsigned long r=0; r<repeat; r++)
+      polyeval(coef, x, out, n);
+    double primal = omp_get_wtime() - start;
+
+    memset(dcoef, 0, sizeof(dcoef));
+    memset(dx, 0, sizeof(double)*n);
+    start = omp_get_wtime();
+    for(unsigned long r=0; r<repeat; r++) {
+      for(size_t i=0; i<n; i++)
+        dout[i] = 1.0;
+      __enzyme_autodiff<void>(polyeval, coef, dcoef, x, dx, out, dout, n);
+    }
+    double gradient = omp_get_wtime() - start;
+
+    printf("threads %d primal %0.6f forward and reverse %0.6f res'=%f %f\n",
+           threads, primal, gradient, sum(dcoef, DEGREE), sum(dx, n));
+    if (threads == maxthreads)
+      break;
+  }
+
+  delete[] x;
+  delete[] dx;
+  delete[] out;
+  delete[] dout;
+  return 0;
+}
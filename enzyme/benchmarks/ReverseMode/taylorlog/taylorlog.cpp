@@ -1,19 +1,16 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
 #include <stdlib.h>
 #include <math.h>
 #include <inttypes.h>
 #include <string.h>
 
+#include "../harness/bench.h"
+
 template<typename Return, typename... T>
 Return __enzyme_autodiff(T...);
 
-float tdiff(struct timeval *start, struct timeval *end) {
-  return (end->tv_sec-start->tv_sec) + 1e-6*(end->tv_usec-start->tv_usec);
-}
-
 #include <adept_source.h>
 #include <adept.h>
 using adept::adouble;
@@ -60,116 +57,50 @@ double sincos_and_gradient(double xin, double& xgrad) {
 }
 
 static void adept_sincos(double inp) {
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
+  bench::run("Adept", "real", [&]() { return sincos_real(inp); });
 
-  double res = sincos_real(inp);
-
-  gettimeofday(&end, NULL);
-  printf("%0.6f res=%f\n", tdiff(&start, &end), res);
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  adept::Stack stack;
- // stack.new_recording();
-  adouble resa = sincos(inp);
-  double res = resa.value();
-
-  gettimeofday(&end, NULL);
-  printf("%0.6f res=%f\n", tdiff(&start, &end), res);
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double res2 = 0;
-  sincos_and_gradient(inp, res2);
-
-  gettimeofday(&end, NULL);
-  printf("%0.6f res'=%f\n", tdiff(&start, &end), res2);
-  }
+  bench::run("Adept", "forward", [&]() {
+    adept::Stack stack;
+   // stack.new_recording();
+    adouble resa = sincos(inp);
+    return resa.value();
+  });
+
+  bench::run("Adept", "combined", [&]() {
+    double res2 = 0;
+    sincos_and_gradient(inp, res2);
+    return res2;
+  });
 }
 
 static void tapenade_sincos(double inp) {
+  bench::run("Tapenade", "real", [&]() { return sincos_real(inp); });
 
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double res = sincos_real(inp);
-
-  gettimeofday(&end, NULL);
-  printf("tapenade %0.6f res=%f\n", tdiff(&start, &end), res);
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double res = sincos_real(inp);
-
-  gettimeofday(&end, NULL);
-  printf("tapenade %0.6f res=%f\n", tdiff(&start, &end), res);
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-  double res2 = 0;
+  bench::run("Tapenade", "forward", [&]() { return sincos_real(inp); });
 
-  sincos_real_tapenade(inp, &res2, 1.0);
-
-  gettimeofday(&end, NULL);
-  printf("tapendade %0.6f res'=%f\n", tdiff(&start, &end), res2);
-  }
+  bench::run("Tapenade", "combined", [&]() {
+    double res2 = 0;
+    sincos_real_tapenade(inp, &res2, 1.0);
+    return res2;
+  });
 }
 
 static void enzyme_sincos(double inp) {
+  bench::run("Enzyme", "real", [&]() { return sincos_real(inp); });
 
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
+  bench::run("Enzyme", "forward", [&]() { return sincos_real(inp); });
 
-  double res = sincos_real(inp);
-
-  gettimeofday(&end, NULL);
-  printf("%0.6f res=%f\n", tdiff(&start, &end), res);
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-
-  double res = sincos_real(inp);
-
-  gettimeofday(&end, NULL);
-  printf("%0.6f res=%f\n", tdiff(&start, &end), res);
-  }
-
-  {
-  struct timeval start, end;
-  gettimeofday(&start, NULL);
-  double res2;
-
-  res2 = __enzyme_autodiff<double>(sincos_real, inp);
-
-  gettimeofday(&end, NULL);
-  printf("%0.6f res'=%f\n", tdiff(&start, &end), res2);
-  }
+  bench::run("Enzyme", "combined", [&]() {
+    return __enzyme_autodiff<double>(sincos_real, inp);
+  });
 }
 
 int main(int argc, char** argv) {
 
   double inp = atof(argv[1]) ;
-  printf("adept\n");
+  bench::init("taylorlog");
+  bench::params("n=" + std::to_string(SINCOSN) + " x=" + std::string(argv[1]));
   adept_sincos(inp);
-  printf("tapenade\n");
   tapenade_sincos(inp);
-  printf("enzyme\n");
   enzyme_sincos(inp);
 }
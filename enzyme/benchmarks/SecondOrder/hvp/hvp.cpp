@@ -0,0 +1,109 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../ReverseMode/harness/bench.h"
+
+template <typename Return, typename... T> Return __enzyme_autodiff(T...);
+template <typename Return, typename... T> Return __enzyme_fwddiff(T...);
+template <typename Return, typename... T> Return __enzyme_hvp(T...);
+
+static double max(double x, double y) { return (x > y) ? x : y; }
+
+static double logsumexp(const double *__restrict x, size_t n) {
+  double A = x[0];
+  for (int i = 0; i < n; i++) {
+    A = max(A, x[i]);
+  }
+  double sema = 0;
+  for (int i = 0; i < n; i++) {
+    sema += exp(x[i] - A);
+  }
+  return log(sema) + A;
+}
+
+// The Hessian-vector products, once with __enzyme_hvp and once by forward
+// differentiation of the reverse mode gradient. __enzyme_hvp lowers to the
+// nested form, so the two should take the same time. The nn benchmark
+// compares them on its loss as well.
+
+__attribute__((noinline)) static void
+logsumexp_hvp(const double *x, const double *v, double *g, double *hv,
+              size_t n) {
+  __enzyme_hvp<void>(logsumexp, x, v, g, hv, n);
+}
+
+static void logsumexp_grad(const double *x, double *g, size_t n) {
+  __enzyme_autodiff<void>(logsumexp, x, g, n);
+}
+
+__attribute__((noinline)) static void
+logsumexp_nested(const double *x, const double *v, double *g, double *hv,
+                 size_t n) {
+  __enzyme_fwddiff<void>(logsumexp_grad, x, v, g, hv, n);
+}
+
+static bool check(const char *name, const double *a, const double *b,
+                  size_t n) {
+  for (size_t i = 0; i < n; i++)
+    if (fabs(a[i] - b[i]) > 1e-8 * (1 + fabs(b[i]))) {
+      printf("%s mismatch at %zu: %f != %f\n", name, i, a[i], b[i]);
+      return false;
+    }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("usage %s n\n", argv[0]);
+    return 1;
+  }
+  size_t N = atoi(argv[1]);
+
+  double *x = new double[N];
+  double *v = new double[N];
+  double *g = new double[N];
+  double *hv = new double[N];
+  double *g2 = new double[N];
+  double *hv2 = new double[N];
+  for (size_t i = 0; i < N; i++) {
+    x[i] = (i % 1000) * 1e-3 - 0.5;
+    v[i] = ((i * 7) % 13) * 0.1 - 0.6;
+  }
+
+  // Both ways must agree before they are timed.
+  memset(g, 0, N * sizeof(double));
+  memset(hv, 0, N * sizeof(double));
+  memset(g2, 0, N * sizeof(double));
+  memset(hv2, 0, N * sizeof(double));
+  logsumexp_hvp(x, v, g, hv, N);
+  logsumexp_nested(x, v, g2, hv2, N);
+  if (!check("logsumexp", hv, hv2, N) || !check("logsumexp", g, g2, N))
+    return 1;
+
+  bench::init("secondorder-hvp");
+  for (size_t n = N >> 4; n <= N; n *= 4) {
+    printf("n=%zu\n", n);
+    bench::params("n=" + std::to_string(n));
+    bench::run("Enzyme", "logsumexp", [&]() {
+      memset(g, 0, n * sizeof(double));
+      memset(hv, 0, n * sizeof(double));
+      logsumexp_hvp(x, v, g, hv, n);
+      return hv[0];
+    });
+    bench::run("Nested", "logsumexp", [&]() {
+      memset(g, 0, n * sizeof(double));
+      memset(hv, 0, n * sizeof(double));
+      logsumexp_nested(x, v, g, hv, n);
+      return hv[0];
+    });
+  }
+
+  delete[] x;
+  delete[] v;
+  delete[] g;
+  delete[] hv;
+  delete[] g2;
+  delete[] hv2;
+}
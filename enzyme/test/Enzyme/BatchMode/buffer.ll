@@ -0,0 +1,112 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-batch-vectorize -S | FileCheck %s
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -S | FileCheck %s --check-prefix=SCALAR
+
+@last = global double 0.000000e+00, align 8
+@init = private unnamed_addr constant [2 x double] [double 1.000000e+00, double 2.000000e+00], align 8
+
+define void @axpy(double* %x, double* %y, double %a) {
+entry:
+  %xv = load double, double* %x, align 8
+  %yv = load double, double* %y, align 8
+  %mul = fmul double %xv, %a
+  %add = fadd double %mul, %yv
+  store double %add, double* %y, align 8
+  store double %add, double* @last, align 8
+  ret void
+}
+
+define void @reset(double* %p) {
+entry:
+  %0 = bitcast double* %p to i8*
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %0, i8* align 8 bitcast ([2 x double]* @init to i8*), i64 16, i1 false)
+  ret void
+}
+
+define void @copy(double* %p, double* %q) {
+entry:
+  %0 = bitcast double* %p to i8*
+  %1 = bitcast double* %q to i8*
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %0, i8* align 8 %1, i64 16, i1 false)
+  call void @llvm.memset.p0i8.i64(i8* align 8 %1, i8 0, i64 16, i1 false)
+  ret void
+}
+
+define void @backup(double* %p) {
+entry:
+  %0 = bitcast double* %p to i8*
+  %1 = getelementptr inbounds i8, i8* %0, i64 64
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %1, i8* align 8 %0, i64 16, i1 false)
+  ret void
+}
+
+define void @test(double* %x, double* %y, double* %x1, double* %x2, double* %x3, double* %x4, double* %p) {
+entry:
+  tail call void (...) @__enzyme_batch(void (double*, double*, double)* nonnull @axpy, metadata !"enzyme_width", i64 4, metadata !"enzyme_buffer", i64 8, double* %x, metadata !"enzyme_buffer", i64 8, double* %y, metadata !"enzyme_scalar", double 2.000000e+00)
+  tail call void (...) @__enzyme_batch(void (double*, double*, double)* nonnull @axpy, metadata !"enzyme_width", i64 4, metadata !"enzyme_vector", double* %x1, double* %x2, double* %x3, double* %x4, metadata !"enzyme_buffer", i64 8, double* %y, metadata !"enzyme_scalar", double 2.000000e+00)
+  tail call void (...) @__enzyme_batch(void (double*)* nonnull @reset, metadata !"enzyme_width", i64 4, metadata !"enzyme_buffer", i64 16, double* %p)
+  tail call void (...) @__enzyme_batch(void (double*, double*)* nonnull @copy, metadata !"enzyme_width", i64 4, metadata !"enzyme_buffer", i64 16, double* %p, metadata !"enzyme_buffer", i64 16, double* %x)
+  tail call void (...) @__enzyme_batch(void (double*)* nonnull @backup, metadata !"enzyme_width", i64 4, metadata !"enzyme_buffer", i64 16, double* %p)
+  ret void
+}
+
+declare void @__enzyme_batch(...)
+
+declare void @llvm.memcpy.p0i8.p0i8.i64(i8* noalias nocapture writeonly, i8* noalias nocapture readonly, i64, i1 immarg)
+
+declare void @llvm.memset.p0i8.i64(i8* nocapture writeonly, i8, i64, i1 immarg)
+
+; CHECK: define internal void @batch_axpy([4 x double*] %x, [4 x double*] %y, double %a)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %unwrap.x0 = extractvalue [4 x double*] %x, 0
+; CHECK-NEXT:   %0 = bitcast double* %unwrap.x0 to i8*
+; CHECK-NEXT:   %1 = getelementptr inbounds i8, i8* %0, i64 8
+; CHECK-NEXT:   %unwrap.x1 = bitcast i8* %1 to double*
+; CHECK:        %unwrap.y0 = extractvalue [4 x double*] %y, 0
+; CHECK:        %[[xp:.+]] = bitcast double* %unwrap.x0 to <4 x double>*
+; CHECK-NEXT:   %xv.vec = load <4 x double>, <4 x double>* %[[xp]], align 8
+; CHECK-NEXT:   %[[yp:.+]] = bitcast double* %unwrap.y0 to <4 x double>*
+; CHECK-NEXT:   %yv.vec = load <4 x double>, <4 x double>* %[[yp]], align 8
+; CHECK:        %add.vec = fadd <4 x double> %mul.vec, %yv.vec
+; CHECK:        %[[sp:.+]] = bitcast double* %unwrap.y0 to <4 x double>*
+; CHECK-NEXT:   store <4 x double> %add.vec, <4 x double>* %[[sp]], align 8
+; CHECK-NEXT:   store double %add0, double* @last, align 8
+; CHECK-NEXT:   store double %add1, double* @last, align 8
+; CHECK-NEXT:   store double %add2, double* @last, align 8
+; CHECK-NEXT:   store double %add3, double* @last, align 8
+; CHECK-NEXT:   ret void
+
+; CHECK: define internal void @batch_axpy.1([4 x double*] %x, [4 x double*] %y, double %a)
+; CHECK:        %x.vec = insertelement <4 x double*> %{{.*}}, double* %unwrap.x3, i64 3
+; CHECK:        %xv.vec = call <4 x double> @llvm.masked.gather.v4f64.v4p0f64(<4 x double*> %x.vec, i32 8, <4 x i1> <i1 true, i1 true, i1 true, i1 true>, <4 x double> undef)
+; CHECK:        %yv.vec = load <4 x double>, <4 x double>* %{{.*}}, align 8
+
+; CHECK: define internal void @batch_reset([4 x double*] %p)
+; CHECK:        call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %{{.*}}, i8* align 8 bitcast ([2 x double]* @init to i8*), i64 16, i1 false)
+; CHECK-NEXT:   call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %{{.*}}, i8* align 8 bitcast ([2 x double]* @init to i8*), i64 16, i1 false)
+; CHECK-NEXT:   call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %{{.*}}, i8* align 8 bitcast ([2 x double]* @init to i8*), i64 16, i1 false)
+; CHECK-NEXT:   call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %{{.*}}, i8* align 8 bitcast ([2 x double]* @init to i8*), i64 16, i1 false)
+; CHECK-NEXT:   ret void
+
+; The lanes of %q may overlap those of %p, so the copies stay in lane order
+; CHECK: define internal void @batch_copy([4 x double*] %p, [4 x double*] %q)
+; CHECK:        %unwrap.q3 = bitcast i8* %{{.*}} to double*
+; CHECK-NEXT:   %[[dst:.+]] = bitcast double* %unwrap.p0 to i8*
+; CHECK:        %[[src:.+]] = bitcast double* %unwrap.q0 to i8*
+; CHECK:        call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %[[dst]], i8* align 8 %[[src]], i64 16, i1 false)
+; CHECK-NEXT:   call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %{{.*}}, i8* align 8 %{{.*}}, i64 16, i1 false)
+; CHECK-NEXT:   call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %{{.*}}, i8* align 8 %{{.*}}, i64 16, i1 false)
+; CHECK-NEXT:   call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %{{.*}}, i8* align 8 %{{.*}}, i64 16, i1 false)
+; CHECK-NEXT:   call void @llvm.memset.p0i8.i64(i8* align 8 %[[src]], i8 0, i64 64, i1 false)
+; CHECK-NEXT:   ret void
+
+; CHECK: define internal void @batch_backup([4 x double*] %p)
+; CHECK:        %unwrap.p3 = bitcast i8* %{{.*}} to double*
+; CHECK-NEXT:   %[[bsrc:.+]] = bitcast double* %unwrap.p0 to i8*
+; CHECK:        %[[bdst:.+]] = getelementptr inbounds i8, i8* %[[bsrc]], i64 64
+; CHECK:        call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %[[bdst]], i8* align 8 %[[bsrc]], i64 64, i1 false)
+; CHECK-NEXT:   ret void
+
+; SCALAR: define internal void @batch_copy([4 x double*] %p, [4 x double*] %q)
+; SCALAR-COUNT-4: call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %{{.*}}, i8* align 8 %{{.*}}, i64 16, i1 false)
+; SCALAR-COUNT-4: call void @llvm.memset.p0i8.i64(i8* align 8 %{{.*}}, i8 0, i64 16, i1 false)
+; SCALAR-NEXT:    ret void
@@ -0,0 +1,66 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-batch-vectorize -S | FileCheck %s
+
+declare [4 x double] @__enzyme_batch(...)
+
+define double @halve(double %x, double* %out) {
+entry:
+  br label %loop
+
+loop:
+  %y = phi double [ %x, %entry ], [ %y.next, %loop ]
+  %n = phi i64 [ 0, %entry ], [ %n.next, %loop ]
+  %y.next = fmul double %y, 5.000000e-01
+  %n.next = add i64 %n, 1
+  %cmp = fcmp ogt double %y.next, 1.000000e+00
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  %conv = sitofp i64 %n.next to double
+  %res = fadd double %y.next, %conv
+  %big = fcmp ogt double %x, 1.000000e+01
+  br i1 %big, label %store, label %done
+
+store:
+  %idx = fptosi double %conv to i64
+  %p = getelementptr inbounds double, double* %out, i64 %idx
+  store double %x, double* %p
+  br label %done
+
+done:
+  ret double %res
+}
+
+define [4 x double] @vhalve(double %x1, double %x2, double %x3, double %x4, double* %out) {
+entry:
+  %r = call [4 x double] (...) @__enzyme_batch(double (double, double*)* @halve, metadata !"enzyme_width", i64 4, metadata !"enzyme_vector", double %x1, double %x2, double %x3, double %x4, metadata !"enzyme_scalar", double* %out)
+  ret [4 x double] %r
+}
+
+; CHECK: define internal [4 x double] @batch_halve([4 x double] %x, double* %out)
+; CHECK: entry:
+; CHECK: %masked.scratch0 = alloca double
+; CHECK: %masked.scratch3 = alloca double
+; CHECK: loop:
+; CHECK-NEXT: %loop.active.vec = phi <4 x i1> [ <i1 true, i1 true, i1 true, i1 true>, %entry ], [ %loop.active.next.vec, %loop ]
+; CHECK-NEXT: %y.next.exit.vec = phi <4 x double> [ undef, %entry ], [ %y.next.exit.next.vec, %loop ]
+; CHECK-NEXT: %n.next.exit.vec = phi <4 x i64> [ undef, %entry ], [ %n.next.exit.next.vec, %loop ]
+; CHECK-NEXT: %y.vec = phi <4 x double> [ %x.vec, %entry ], [ %y.next.vec, %loop ]
+; CHECK-NEXT: %n = phi i64 [ 0, %entry ], [ %n.next, %loop ]
+; CHECK: %cmp.vec = fcmp ogt <4 x double> %y.next.vec, <double 1.000000e+00, double 1.000000e+00, double 1.000000e+00, double 1.000000e+00>
+; CHECK: %loop.active.next.vec = and <4 x i1> %cmp.vec, %loop.active.vec
+; CHECK: %loop.leave.vec = and <4 x i1> %cmp.not.vec, %loop.active.vec
+; CHECK: %y.next.exit.next.vec = select <4 x i1> %loop.leave.vec, <4 x double> %y.next.vec, <4 x double> %y.next.exit.vec
+; CHECK: %n.next.exit.next.vec = select <4 x i1> %loop.leave.vec, <4 x i64> %{{.*}}, <4 x i64> %n.next.exit.vec
+; CHECK: %loop.any = call i1 @llvm.vector.reduce.or.v4i1(<4 x i1> %loop.active.next.vec)
+; CHECK-NEXT: br i1 %loop.any, label %loop, label %exit
+
+; CHECK: exit:
+; CHECK: %conv.vec = sitofp <4 x i64> %n.next.exit.next.vec to <4 x double>
+; CHECK: %res.vec = fadd <4 x double> %y.next.exit.next.vec, %conv.vec
+; CHECK: %big.vec = fcmp ogt <4 x double> %x.vec, <double 1.000000e+01, double 1.000000e+01, double 1.000000e+01, double 1.000000e+01>
+; CHECK-NOT: br i1
+; CHECK: store:
+; CHECK: %p.masked.vec = select <4 x i1> %big.vec, <4 x double*> %{{.*}}, <4 x double*> %{{.*}}
+; CHECK-NEXT: call void @llvm.masked.scatter.v4f64.v4p0f64(<4 x double> %x.vec, <4 x double*> %p.masked.vec, i32 8, <4 x i1> <i1 true, i1 true, i1 true, i1 true>)
+; CHECK: done:
+; CHECK: ret [4 x double]
@@ -22,4 +22,14 @@ entry:
 declare [4 x double] @__enzyme_batch(...)
 
 
-; XFAIL: -
\ No newline at end of file
+; CHECK: define internal [4 x double] @batch_relu([4 x double] %x, double %a)
+; CHECK: %cmp0 = fcmp fast ogt double %unwrap.x0, 0.000000e+00
+; CHECK: %cmp3 = fcmp fast ogt double %unwrap.x3, 0.000000e+00
+; CHECK: %cmp.not0 = xor i1 %cmp0, true
+; CHECK: %cmp.not3 = xor i1 %cmp3, true
+; CHECK-NOT: br i1
+; CHECK: %ax0 = fmul double %unwrap.x0, %a
+; CHECK: %ax3 = fmul double %unwrap.x3, %a
+; CHECK: %{{.*}} = select i1 %cmp.not0, double %unwrap.x0, double %ax0
+; CHECK: %{{.*}} = select i1 %cmp.not3, double %unwrap.x3, double %ax3
+; CHECK: ret [4 x double]
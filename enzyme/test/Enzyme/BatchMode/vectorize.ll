@@ -0,0 +1,75 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-batch-vectorize -S | FileCheck %s
+
+declare [4 x double] @__enzyme_batch(...)
+declare double @llvm.powi.f64.i32(double, i32)
+declare double @llvm.fabs.f64(double)
+
+define double @poly(double %x, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi double [ 1.000000e+00, %entry ], [ %acc.next, %loop ]
+  %p = call double @llvm.powi.f64.i32(double %x, i32 3)
+  %neg = fneg double %p
+  %cmp = fcmp olt double %acc, %x
+  %sel = select i1 %cmp, double %p, double %neg
+  %a = call double @llvm.fabs.f64(double %sel)
+  %conv = sitofp i64 %i to double
+  %t = fmul double %a, %conv
+  %acc.next = fadd double %acc, %t
+  %i.next = add nuw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret double %acc.next
+}
+
+define [4 x double] @vpoly(double %x1, double %x2, double %x3, double %x4, i64 %n) {
+entry:
+  %call = call [4 x double] (...) @__enzyme_batch(double (double, i64)* @poly, metadata !"enzyme_width", i64 4, metadata !"enzyme_vector", double %x1, double %x2, double %x3, double %x4, metadata !"enzyme_scalar", i64 %n)
+  ret [4 x double] %call
+}
+
+; CHECK: define internal [4 x double] @batch_poly([4 x double] %x, i64 %n)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %unwrap.x0 = extractvalue [4 x double] %x, 0
+; CHECK-NEXT:   %unwrap.x1 = extractvalue [4 x double] %x, 1
+; CHECK-NEXT:   %unwrap.x2 = extractvalue [4 x double] %x, 2
+; CHECK-NEXT:   %unwrap.x3 = extractvalue [4 x double] %x, 3
+; CHECK-NEXT:   %0 = insertelement <4 x double> {{(undef|poison)}}, double %unwrap.x0, i64 0
+; CHECK-NEXT:   %1 = insertelement <4 x double> %0, double %unwrap.x1, i64 1
+; CHECK-NEXT:   %2 = insertelement <4 x double> %1, double %unwrap.x2, i64 2
+; CHECK-NEXT:   %x.vec = insertelement <4 x double> %2, double %unwrap.x3, i64 3
+; CHECK-NEXT:   br label %loop
+
+; CHECK: loop:
+; CHECK-NEXT:   %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+; CHECK-NEXT:   %acc.vec = phi <4 x double> [ <double 1.000000e+00, double 1.000000e+00, double 1.000000e+00, double 1.000000e+00>, %entry ], [ %acc.next.vec, %loop ]
+; CHECK-NEXT:   %p.vec = call <4 x double> @llvm.powi.v4f64.i32(<4 x double> %x.vec, i32 3)
+; CHECK-NEXT:   %neg.vec = fneg <4 x double> %p.vec
+; CHECK-NEXT:   %cmp.vec = fcmp olt <4 x double> %acc.vec, %x.vec
+; CHECK-NEXT:   %sel.vec = select <4 x i1> %cmp.vec, <4 x double> %p.vec, <4 x double> %neg.vec
+; CHECK-NEXT:   %a.vec = call <4 x double> @llvm.fabs.v4f64(<4 x double> %sel.vec)
+; CHECK-NEXT:   %conv = sitofp i64 %i to double
+; CHECK-NEXT:   %.splatinsert = insertelement <4 x double> {{(undef|poison)}}, double %conv, i{{(32|64)}} 0
+; CHECK-NEXT:   %.splat = shufflevector <4 x double> %.splatinsert, <4 x double> {{(undef|poison)}}, <4 x i32> zeroinitializer
+; CHECK-NEXT:   %t.vec = fmul <4 x double> %a.vec, %.splat
+; CHECK-NEXT:   %acc.next.vec = fadd <4 x double> %acc.vec, %t.vec
+; CHECK-NEXT:   %acc.next0 = extractelement <4 x double> %acc.next.vec, i64 0
+; CHECK-NEXT:   %acc.next1 = extractelement <4 x double> %acc.next.vec, i64 1
+; CHECK-NEXT:   %acc.next2 = extractelement <4 x double> %acc.next.vec, i64 2
+; CHECK-NEXT:   %acc.next3 = extractelement <4 x double> %acc.next.vec, i64 3
+; CHECK-NEXT:   %i.next = add nuw i64 %i, 1
+; CHECK-NEXT:   %done = icmp eq i64 %i.next, %n
+; CHECK-NEXT:   br i1 %done, label %exit, label %loop
+
+; CHECK: exit:
+; CHECK-NEXT:   %mrv = insertvalue [4 x double] {{(undef|poison)}}, double %acc.next0, 0
+; CHECK-NEXT:   %mrv1 = insertvalue [4 x double] %mrv, double %acc.next1, 1
+; CHECK-NEXT:   %mrv2 = insertvalue [4 x double] %mrv1, double %acc.next2, 2
+; CHECK-NEXT:   %mrv3 = insertvalue [4 x double] %mrv2, double %acc.next3, 3
+; CHECK-NEXT:   ret [4 x double] %mrv3
+; CHECK-NEXT: }
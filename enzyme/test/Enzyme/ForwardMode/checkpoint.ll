@@ -0,0 +1,48 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -S | FileCheck %s
+
+define void @step(double* %x, double* %p) {
+entry:
+  %x0 = load double, double* %x
+  %p0 = load double, double* %p
+  %s = call double @llvm.sin.f64(double %x0)
+  %m = fmul double %x0, %p0
+  %y = fadd double %m, %s
+  store double %y, double* %x
+  ret void
+}
+
+define void @f(double* %x, double* %p, i64 %n) {
+entry:
+  call void (i8*, ...) @__enzyme_checkpoint(i8* bitcast (void (double*, double*)* @step to i8*), i64 %n, double* %x, i64 8, double* %p)
+  ret void
+}
+
+define void @dsquare(double* %x, double* %dx, double* %p, double* %dp, i64 %n) {
+entry:
+  call void (...) @__enzyme_fwddiff(void (double*, double*, i64)* @f, double* %x, double* %dx, double* %p, double* %dp, i64 %n)
+  ret void
+}
+
+declare double @llvm.sin.f64(double)
+
+declare void @__enzyme_checkpoint(i8*, ...)
+
+declare void @__enzyme_fwddiff(...)
+
+; CHECK: define internal void @fwddiffef(double* %x, double* %"x'", double* %p, double* %"p'", i64 %n)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   call void @__enzyme_checkpoint_loop.fwddiffestep(i64 %n, double* %x, double* %"x'", double* %p, double* %"p'")
+; CHECK-NEXT:   ret void
+; CHECK-NEXT: }
+
+; CHECK: define internal void @__enzyme_checkpoint_loop.fwddiffestep(i64 %n, double* %0, double* %1, double* %2, double* %3)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %4 = icmp sle i64 %n, 0
+; CHECK-NEXT:   br i1 %4, label %step.end, label %step.body
+
+; CHECK: step.body:
+; CHECK-NEXT:   %step.iv = phi i64 [ 0, %entry ], [ %step.next, %step.body ]
+; CHECK-NEXT:   call void @fwddiffestep(double* %0, double* %1, double* %2, double* %3)
+; CHECK-NEXT:   %step.next = add nuw i64 %step.iv, 1
+; CHECK-NEXT:   %5 = icmp eq i64 %step.next, %n
+; CHECK-NEXT:   br i1 %5, label %step.end, label %step.body
@@ -0,0 +1,66 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -early-cse -S | FileCheck %s
+
+; double f(double *x, double c) { return x[0] * x[0] * x[1] * c; }
+define double @f(double* %x, double %c) {
+entry:
+  %x0 = load double, double* %x
+  %p1 = getelementptr inbounds double, double* %x, i64 1
+  %x1 = load double, double* %p1
+  %a = fmul double %x0, %x0
+  %b = fmul double %a, %x1
+  %r = fmul double %b, %c
+  ret double %r
+}
+
+declare void @__enzyme_hvp(...)
+
+define void @hvp(double* %x, double* %v, double* %g, double* %hv, double %c) {
+entry:
+  call void (...) @__enzyme_hvp(double (double*, double)* @f, double* %x, double* %v, double* %g, double* %hv, double %c)
+  ret void
+}
+
+; CHECK: define void @hvp(double* %x, double* %v, double* %g, double* %hv, double %c)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   call void @fwddiffediffef(double* %x, double* %v, double* %g, double* %hv, double %c, double 1.000000e+00)
+; CHECK-NEXT:   ret void
+; CHECK-NEXT: }
+
+; CHECK: define internal void @fwddiffediffef(double* %x, double* %"x'", double* %"x'1", double* %"x''", double %c, double %differeturn)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %"x0'ipl" = load double, double* %"x'", align 8
+; CHECK-NEXT:   %x0 = load double, double* %x, align 8
+; CHECK-NEXT:   %"p1'ipg'ipg" = getelementptr inbounds double, double* %"x''", i64 1
+; CHECK-NEXT:   %"p1'ipg" = getelementptr inbounds double, double* %"x'1", i64 1
+; CHECK-NEXT:   %"p1'ipg6" = getelementptr inbounds double, double* %"x'", i64 1
+; CHECK-NEXT:   %p1 = getelementptr inbounds double, double* %x, i64 1
+; CHECK-NEXT:   %"x1'ipl" = load double, double* %"p1'ipg6", align 8
+; CHECK-NEXT:   %x1 = load double, double* %p1, align 8
+; CHECK-NEXT:   %a = fmul double %x0, %x0
+; CHECK-NEXT:   %0 = fmul fast double %"x0'ipl", %x0
+; CHECK-NEXT:   %1 = fadd fast double %0, %0
+; CHECK-NEXT:   %m0diffeb = fmul fast double %differeturn, %c
+; CHECK-NEXT:   %m0diffea = fmul fast double %m0diffeb, %x1
+; CHECK-NEXT:   %2 = fmul fast double %"x1'ipl", %m0diffeb
+; CHECK-NEXT:   %m1diffex1 = fmul fast double %m0diffeb, %a
+; CHECK-NEXT:   %3 = fmul fast double %1, %m0diffeb
+; CHECK-NEXT:   %m0diffex0 = fmul fast double %m0diffea, %x0
+; CHECK-NEXT:   %4 = fmul fast double %2, %x0
+; CHECK-NEXT:   %5 = fmul fast double %"x0'ipl", %m0diffea
+; CHECK-NEXT:   %6 = fadd fast double %4, %5
+; CHECK-NEXT:   %7 = fadd fast double %m0diffex0, %m0diffex0
+; CHECK-NEXT:   %8 = fadd fast double %6, %6
+; CHECK-NEXT:   %"'ipl" = load double, double* %"p1'ipg'ipg", align 8
+; CHECK-NEXT:   %9 = load double, double* %"p1'ipg", align 8
+; CHECK-NEXT:   %10 = fadd fast double %9, %m1diffex1
+; CHECK-NEXT:   %11 = fadd fast double %"'ipl", %3
+; CHECK-NEXT:   store double %10, double* %"p1'ipg", align 8
+; CHECK-NEXT:   store double %11, double* %"p1'ipg'ipg", align 8
+; CHECK-NEXT:   %"'ipl7" = load double, double* %"x''", align 8
+; CHECK-NEXT:   %12 = load double, double* %"x'1", align 8
+; CHECK-NEXT:   %13 = fadd fast double %12, %7
+; CHECK-NEXT:   %14 = fadd fast double %"'ipl7", %8
+; CHECK-NEXT:   store double %13, double* %"x'1", align 8
+; CHECK-NEXT:   store double %14, double* %"x''", align 8
+; CHECK-NEXT:   ret void
+; CHECK-NEXT: }
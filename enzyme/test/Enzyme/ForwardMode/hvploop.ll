@@ -0,0 +1,71 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -early-cse -S | FileCheck %s
+
+; double f(double *x, long n) { double p = 1; for (long i = 0; i < n; i++) p *= x[i]; return p; }
+define double @f(double* %x, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %p = phi double [ 1.000000e+00, %entry ], [ %p.next, %loop ]
+  %xi.ptr = getelementptr inbounds double, double* %x, i64 %i
+  %xi = load double, double* %xi.ptr
+  %p.next = fmul double %p, %xi
+  %i.next = add nuw nsw i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret double %p.next
+}
+
+declare void @__enzyme_hvp(...)
+
+define void @hvp(double* %x, double* %v, double* %g, double* %hv, i64 %n) {
+entry:
+  call void (...) @__enzyme_hvp(double (double*, i64)* @f, double* %x, double* %v, double* %g, double* %hv, i64 %n)
+  ret void
+}
+
+; The product p is cached by the gradient for its reverse loop. As it depends
+; on x, the cache gets a shadow holding the tangents of p, stored and loaded
+; alongside it.
+
+; CHECK: define void @hvp(double* %x, double* %v, double* %g, double* %hv, i64 %n)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   call void @fwddiffediffef(double* %x, double* %v, double* %g, double* %hv, i64 %n, double 1.000000e+00)
+; CHECK-NEXT:   ret void
+; CHECK-NEXT: }
+
+; CHECK: define internal void @fwddiffediffef(double* %x, double* %"x'", double* %"x'1", double* %"x''", i64 %n, double %differeturn)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %0 = add i64 %n, -1
+; CHECK-NEXT:   %mallocsize = mul nuw nsw i64 %n, 8
+; CHECK-NEXT:   %malloccall = tail call noalias nonnull i8* @malloc(i64 %mallocsize)
+; CHECK-NEXT:   %1 = tail call noalias nonnull i8* @malloc(i64 %mallocsize)
+; CHECK-NEXT:   %"p_malloccache'ipc" = bitcast i8* %1 to double*
+; CHECK-NEXT:   %p_malloccache = bitcast i8* %malloccall to double*
+; CHECK-NEXT:   br label %loop
+
+; CHECK: loop:
+; CHECK-NEXT:   %iv1 = phi i64 [ %iv.next2, %loop ], [ 0, %entry ]
+; CHECK-NEXT:   %[[dp:.+]] = phi fast double [ 0.000000e+00, %entry ], [ %[[dpnext:.+]], %loop ]
+; CHECK-NEXT:   %p = phi double [ 1.000000e+00, %entry ], [ %p.next, %loop ]
+; CHECK-NEXT:   %iv.next2 = add nuw nsw i64 %iv1, 1
+; CHECK-NEXT:   %"'ipg" = getelementptr inbounds double, double* %"p_malloccache'ipc", i64 %iv1
+; CHECK-NEXT:   %[[pc:.+]] = getelementptr inbounds double, double* %p_malloccache, i64 %iv1
+; CHECK-NEXT:   store double %p, double* %[[pc]], align 8
+; CHECK-NEXT:   store double %[[dp]], double* %"'ipg", align 8
+; CHECK:        %[[dpnext]] = fadd fast double
+
+; CHECK: invertentry:
+; CHECK-NEXT:   tail call void @free(i8* nonnull %malloccall)
+; CHECK:        call void @free(i8* nonnull %1)
+
+; CHECK: invertloop:
+; CHECK:        %"'ipg6" = getelementptr inbounds double, double* %"p_malloccache'ipc", i64 %[[idx:.+]]
+; CHECK-NEXT:   %[[pc2:.+]] = getelementptr inbounds double, double* %p_malloccache, i64 %[[idx]]
+; CHECK-NEXT:   %"'ipl" = load double, double* %"'ipg6", align 8
+; CHECK-NEXT:   %[[p2:.+]] = load double, double* %[[pc2]], align 8
+; CHECK-NEXT:   %m1diffexi = fmul fast double %"p.next'de.0", %[[p2]]
+; CHECK:        fmul fast double %"'ipl", %"p.next'de.0"
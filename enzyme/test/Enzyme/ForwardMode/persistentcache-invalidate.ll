@@ -0,0 +1,62 @@
+; RUN: rm -rf %t %t.ll
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-dir=%t -mem2reg -instsimplify -simplifycfg -S | FileCheck %s
+; A change to the registered derivative of @square misses the cache.
+; RUN: sed -e 's/2.000000e+00/3.000000e+00/' %s > %t.ll
+; RUN: %opt < %t.ll %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-dir=%t -enzyme-print -S -o /dev/null 2>&1 | FileCheck --check-prefix=MISS %s
+; So does a change to an option affecting the generated code.
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-dir=%t -enzyme-loop-invariant-cache=false -enzyme-print -S -o /dev/null 2>&1 | FileCheck --check-prefix=MISS %s
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-dir=%t -enzyme-print -S -o /dev/null 2>&1 | FileCheck --check-prefix=HIT %s
+; RUN: ls %t | FileCheck --check-prefix=FILES %s
+
+define double @square(double %x) {
+entry:
+  %mul = fmul double %x, %x
+  ret double %mul
+}
+
+define { double, double } @square_fwd(double %x, double %dx) {
+entry:
+  %p = fmul double %x, %x
+  %m = fmul double %x, %dx
+  %d = fmul double %m, 2.000000e+00
+  %r0 = insertvalue { double, double } undef, double %p, 0
+  %r1 = insertvalue { double, double } %r0, double %d, 1
+  ret { double, double } %r1
+}
+
+@__enzyme_register_derivative_square = global [2 x i8*] [i8* bitcast (double (double)* @square to i8*), i8* bitcast ({ double, double } (double, double)* @square_fwd to i8*)]
+
+define double @tester(double %x) {
+entry:
+  %sq = call double @square(double %x)
+  %res = fadd double %sq, %x
+  ret double %res
+}
+
+define double @test_derivative(double %x) {
+entry:
+  %0 = tail call double (double (double)*, ...) @__enzyme_fwddiff(double (double)* nonnull @tester, double %x, double 1.000000e+00)
+  ret double %0
+}
+
+declare double @__enzyme_fwddiff(double (double)*, ...)
+
+; CHECK: define internal double @fwddiffetester(double %x, double %"x'")
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %0 = call fast double @fixderivative_square(double %x, double %"x'")
+; CHECK-NEXT:   %1 = fadd fast double %0, %"x'"
+; CHECK-NEXT:   ret double %1
+; CHECK-NEXT: }
+
+; MISS: prefn:
+; MISS: after simplification
+; MISS: postfn:
+
+; HIT: prefn:
+; HIT-NOT: after simplification
+; HIT: postfn:
+
+; FILES: {{^[0-9a-f]+\.bc$}}
+; FILES-NEXT: {{^[0-9a-f]+\.bc$}}
+; FILES-NEXT: {{^[0-9a-f]+\.bc$}}
+; FILES-NOT: {{.}}
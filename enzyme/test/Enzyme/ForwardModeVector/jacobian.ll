@@ -0,0 +1,95 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -S | FileCheck %s
+
+define void @f(double* %x, double* %y) {
+entry:
+  %x0 = load double, double* %x
+  %p1 = getelementptr inbounds double, double* %x, i64 1
+  %x1 = load double, double* %p1
+  %m = fmul double %x0, %x1
+  store double %m, double* %y
+  %s = call double @llvm.sin.f64(double %x0)
+  %q1 = getelementptr inbounds double, double* %y, i64 1
+  store double %s, double* %q1
+  %sq = fmul double %x1, %x1
+  %q2 = getelementptr inbounds double, double* %y, i64 2
+  store double %sq, double* %q2
+  ret void
+}
+
+declare double @llvm.sin.f64(double)
+
+declare void @__enzyme_jacobian(...)
+
+define void @jacobian(double* %x, double* %y, double* %J) {
+entry:
+  call void (...) @__enzyme_jacobian(void (double*, double*)* @f, double* %x, double* %y, double* %J, i32 2, i32 3)
+  ret void
+}
+
+define void @jacobian_dyn(double* %x, double* %y, double* %J, i64 %n, i64 %m) {
+entry:
+  call void (...) @__enzyme_jacobian(void (double*, double*)* @f, double* %x, double* %y, double* %J, i64 %n, i64 %m, metadata !"enzyme_width", i64 4)
+  ret void
+}
+
+; CHECK: define void @jacobian(double* %x, double* %y, double* %J)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %malloccall = tail call noalias nonnull dereferenceable(80) dereferenceable_or_null(80) i8* @malloc(i64 80)
+; CHECK-NEXT:   %0 = bitcast i8* %malloccall to double*
+; CHECK-NEXT:   %1 = getelementptr double, double* %0, i64 4
+; CHECK-NEXT:   call void @llvm.memset.p0i8.i64(i8* align 8 %malloccall, i8 0, i64 32, i1 false)
+; CHECK-NEXT:   br label %jacobian.chunk.header
+
+; CHECK: jacobian.chunk.header:
+; CHECK-NEXT:   %jacobian.chunk = phi i64 [ 0, %entry ], [ %jacobian.chunk.next, %jacobian.lane.exit ]
+; CHECK-NEXT:   %2 = icmp ult i64 %jacobian.chunk, 2
+; CHECK-NEXT:   br i1 %2, label %jacobian.chunk.body, label %jacobian.chunk.exit
+
+; CHECK: jacobian.chunk.body:
+; CHECK-NEXT:   %3 = getelementptr double, double* %0, i64 %jacobian.chunk
+; CHECK-NEXT:   store double 1.000000e+00, double* %3, align 8
+; CHECK-NEXT:   %4 = bitcast double* %1 to i8*
+; CHECK-NEXT:   call void @llvm.memset.p0i8.i64(i8* align 8 %4, i8 0, i64 24, i1 false)
+; CHECK-NEXT:   %5 = add i64 %jacobian.chunk, 1
+; CHECK-NEXT:   %6 = icmp ult i64 %5, 2
+; CHECK-NEXT:   %7 = getelementptr double, double* %0, i64 2
+; CHECK-NEXT:   %8 = select i1 %6, i64 %5, i64 0
+; CHECK-NEXT:   %9 = getelementptr double, double* %7, i64 %8
+; CHECK-NEXT:   %10 = select i1 %6, double 1.000000e+00, double 0.000000e+00
+; CHECK-NEXT:   store double %10, double* %9, align 8
+; CHECK-NEXT:   %11 = getelementptr double, double* %1, i64 3
+; CHECK-NEXT:   %12 = bitcast double* %11 to i8*
+; CHECK-NEXT:   call void @llvm.memset.p0i8.i64(i8* align 8 %12, i8 0, i64 24, i1 false)
+; CHECK-NEXT:   %13 = insertvalue [2 x double*] undef, double* %0, 0
+; CHECK-NEXT:   %14 = insertvalue [2 x double*] %13, double* %7, 1
+; CHECK-NEXT:   %15 = insertvalue [2 x double*] undef, double* %1, 0
+; CHECK-NEXT:   %16 = insertvalue [2 x double*] %15, double* %11, 1
+; CHECK-NEXT:   call void @fwddiffe2f(double* %x, [2 x double*] %14, double* %y, [2 x double*] %16)
+; CHECK-NEXT:   store double 0.000000e+00, double* %3, align 8
+; CHECK-NEXT:   store double 0.000000e+00, double* %9, align 8
+; CHECK-NEXT:   %17 = sub i64 2, %jacobian.chunk
+; CHECK-NEXT:   %18 = icmp ult i64 %17, 2
+; CHECK-NEXT:   %19 = select i1 %18, i64 %17, i64 2
+; CHECK-NEXT:   br label %jacobian.lane.header
+
+; CHECK: jacobian.copy.body:
+; CHECK-NEXT:   %25 = getelementptr double, double* %22, i64 %jacobian.copy
+; CHECK-NEXT:   %26 = load double, double* %25, align 8
+; CHECK-NEXT:   %27 = mul i64 %jacobian.copy, 2
+; CHECK-NEXT:   %28 = add i64 %27, %23
+; CHECK-NEXT:   %29 = getelementptr double, double* %J, i64 %28
+; CHECK-NEXT:   store double %26, double* %29, align 8
+
+; CHECK: jacobian.chunk.exit:
+; CHECK-NEXT:   tail call void @free(i8* nonnull %malloccall)
+; CHECK-NEXT:   ret void
+
+; CHECK: define void @jacobian_dyn(double* %x, double* %y, double* %J, i64 %n, i64 %m)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %0 = icmp ule i64 %n, %m
+; CHECK-NEXT:   br i1 %0, label %jacobian.fwd, label %jacobian.rev
+
+; CHECK: call void @fwddiffe4f(double* %x, [4 x double*] %{{.*}}, double* %y, [4 x double*] %{{.*}})
+; CHECK: call void @diffe4f(double* %x, [4 x double*] %{{.*}}, double* %y, [4 x double*] %{{.*}})
+
+; CHECK: define internal void @fwddiffe2f(double* %x, [2 x double*] %"x'", double* %y, [2 x double*] %"y'")
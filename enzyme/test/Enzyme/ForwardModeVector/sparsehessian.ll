@@ -0,0 +1,59 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -S | FileCheck %s
+
+declare double @llvm.sin.f64(double)
+
+; f = x[0] * x[1] + sin(x[2])
+define double @f(double* %x) {
+entry:
+  %x0 = load double, double* %x
+  %p1 = getelementptr inbounds double, double* %x, i64 1
+  %x1 = load double, double* %p1
+  %p2 = getelementptr inbounds double, double* %x, i64 2
+  %x2 = load double, double* %p2
+  %a = fmul double %x0, %x1
+  %s = call double @llvm.sin.f64(double %x2)
+  %r = fadd double %a, %s
+  ret double %r
+}
+
+declare i64 @__enzyme_sparse_hessian(...)
+
+define i64 @sparse(double* %x, i64* %rows, i64* %cols, double* %vals, i64 %cap) {
+entry:
+  %nnz = call i64 (...) @__enzyme_sparse_hessian(double (double*)* @f, double* %x, i64 3, i64* %rows, i64* %cols, double* %vals, i64 %cap)
+  ret i64 %nnz
+}
+
+; The Hessian is the sparse Jacobian of the gradient, whose columns take a
+; single color.
+
+; CHECK: @jacobian.seeds = private unnamed_addr constant [3 x double] [double 1.000000e+00, double 1.000000e+00, double 1.000000e+00]
+; CHECK: @jacobian.src = private unnamed_addr constant [3 x i64] [i64 0, i64 1, i64 2]
+; CHECK: @jacobian.cols = private unnamed_addr constant [3 x i64] [i64 1, i64 0, i64 2]
+; CHECK: @jacobian.rows = private unnamed_addr constant [3 x i64] [i64 0, i64 1, i64 2]
+
+; CHECK: define i64 @sparse(double* %x, i64* %rows, i64* %cols, double* %vals, i64 %cap)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %malloccall = tail call noalias nonnull dereferenceable(24) dereferenceable_or_null(24) i8* @malloc(i64 24)
+; CHECK-NEXT:   %0 = bitcast i8* %malloccall to double*
+; CHECK-NEXT:   call void @llvm.memset.p0i8.i64(i8* %malloccall, i8 0, i64 24, i1 false)
+; CHECK-NEXT:   %malloccall1 = tail call noalias nonnull dereferenceable(24) dereferenceable_or_null(24) i8* @malloc(i64 24)
+; CHECK-NEXT:   %1 = bitcast i8* %malloccall1 to double*
+; CHECK-NEXT:   call void @llvm.memset.p0i8.i64(i8* align 8 %malloccall1, i8 0, i64 24, i1 false)
+; CHECK-NEXT:   call void @fwddiffehessian_grad_f(double* %x, double* getelementptr inbounds ([3 x double], [3 x double]* @jacobian.seeds, i64 0, i64 0), double* %0, double* %1)
+; CHECK:      jacobian.gather.exit:
+; CHECK:        tail call void @free(i8* nonnull %malloccall1)
+; CHECK-NEXT:   tail call void @free(i8* nonnull %malloccall)
+; CHECK-NEXT:   ret i64 3
+; CHECK-NEXT: }
+
+; CHECK: define internal void @hessian_grad_f(double* %x, double* %dx)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %x0.i = load double, double* %x, align 8
+; CHECK-NEXT:   %"p1'ipg.i" = getelementptr inbounds double, double* %dx, i64 1
+; CHECK-NEXT:   %p1.i = getelementptr inbounds double, double* %x, i64 1
+; CHECK-NEXT:   %x1.i = load double, double* %p1.i, align 8
+; CHECK-NEXT:   %"p2'ipg.i" = getelementptr inbounds double, double* %dx, i64 2
+; CHECK-NEXT:   %p2.i = getelementptr inbounds double, double* %x, i64 2
+; CHECK-NEXT:   %x2.i = load double, double* %p2.i, align 8
+; CHECK-NEXT:   %0 = call fast double @llvm.cos.f64(double %x2.i)
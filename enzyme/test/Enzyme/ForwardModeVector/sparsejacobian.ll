@@ -0,0 +1,85 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -S | FileCheck %s
+
+declare double @llvm.sin.f64(double)
+
+; y[0] = x[0] * x[1], y[1] = sin(x[1]) + x[2], y[2] = x[2] * x[3] + x[0]
+define void @f(double* %x, double* %y) {
+entry:
+  %x0 = load double, double* %x
+  %p1 = getelementptr inbounds double, double* %x, i64 1
+  %x1 = load double, double* %p1
+  %p2 = getelementptr inbounds double, double* %x, i64 2
+  %x2 = load double, double* %p2
+  %p3 = getelementptr inbounds double, double* %x, i64 3
+  %x3 = load double, double* %p3
+  %a = fmul double %x0, %x1
+  store double %a, double* %y
+  %s = call double @llvm.sin.f64(double %x1)
+  %b = fadd double %s, %x2
+  %q1 = getelementptr inbounds double, double* %y, i64 1
+  store double %b, double* %q1
+  %c = fmul double %x2, %x3
+  %d = fadd double %c, %x0
+  %q2 = getelementptr inbounds double, double* %y, i64 2
+  store double %d, double* %q2
+  ret void
+}
+
+@enzyme_csr = global i32 0
+
+declare i32 @__enzyme_sparse_jacobian(...)
+
+define i32 @sparse(double* %x, double* %y, i32* %rows, i32* %cols, double* %vals, i32 %cap) {
+entry:
+  %csr = load i32, i32* @enzyme_csr
+  %nnz = call i32 (...) @__enzyme_sparse_jacobian(void (double*, double*)* @f, double* %x, double* %y, i64 4, i64 3, i32* %rows, i32* %cols, double* %vals, i32 %cap, i32 %csr)
+  ret i32 %nnz
+}
+
+; The columns are compressed to three colors, {0}, {1, 3} and {2}.
+
+; CHECK: @jacobian.seeds = private unnamed_addr constant [12 x double] [double 1.000000e+00, double 0.000000e+00, double 0.000000e+00, double 0.000000e+00, double 0.000000e+00, double 1.000000e+00, double 0.000000e+00, double 1.000000e+00, double 0.000000e+00, double 0.000000e+00, double 1.000000e+00, double 0.000000e+00]
+; CHECK: @jacobian.src = private unnamed_addr constant [7 x i64] [i64 0, i64 3, i64 4, i64 7, i64 2, i64 8, i64 5]
+; CHECK: @jacobian.cols = private unnamed_addr constant [7 x i32] [i32 0, i32 1, i32 1, i32 2, i32 0, i32 2, i32 3]
+; CHECK: @jacobian.rows = private unnamed_addr constant [4 x i32] [i32 0, i32 2, i32 4, i32 7]
+
+; CHECK: define i32 @sparse(double* %x, double* %y, i32* %rows, i32* %cols, double* %vals, i32 %cap)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %0 = zext i32 %cap to i64
+; CHECK-NEXT:   %malloccall = tail call noalias nonnull dereferenceable(72) dereferenceable_or_null(72) i8* @malloc(i64 72)
+; CHECK-NEXT:   %1 = bitcast i8* %malloccall to double*
+; CHECK-NEXT:   call void @llvm.memset.p0i8.i64(i8* align 8 %malloccall, i8 0, i64 72, i1 false)
+; CHECK-NEXT:   %2 = getelementptr inbounds double, double* %1, i64 3
+; CHECK-NEXT:   %3 = getelementptr inbounds double, double* %1, i64 6
+; CHECK-NEXT:   %4 = insertvalue [3 x double*] undef, double* %1, 0
+; CHECK-NEXT:   %5 = insertvalue [3 x double*] %4, double* %2, 1
+; CHECK-NEXT:   %6 = insertvalue [3 x double*] %5, double* %3, 2
+; CHECK-NEXT:   call void @fwddiffe3f(double* %x, [3 x double*] [double* getelementptr inbounds ([12 x double], [12 x double]* @jacobian.seeds, i64 0, i64 0), double* getelementptr inbounds ([12 x double], [12 x double]* @jacobian.seeds, i64 0, i64 4), double* getelementptr inbounds ([12 x double], [12 x double]* @jacobian.seeds, i64 0, i64 8)], double* %y, [3 x double*] %6)
+; CHECK-NEXT:   %7 = icmp ult i64 7, %0
+; CHECK-NEXT:   %8 = select i1 %7, i64 7, i64 %0
+; CHECK-NEXT:   br label %jacobian.gather.header
+
+; CHECK: jacobian.gather.header:
+; CHECK-NEXT:   %jacobian.gather = phi i64 [ 0, %entry ], [ %jacobian.gather.next, %jacobian.gather.body ]
+; CHECK-NEXT:   %9 = icmp ult i64 %jacobian.gather, %8
+; CHECK-NEXT:   br i1 %9, label %jacobian.gather.body, label %jacobian.gather.exit
+
+; CHECK: jacobian.gather.body:
+; CHECK-NEXT:   %10 = getelementptr i64, i64* getelementptr inbounds ([7 x i64], [7 x i64]* @jacobian.src, i64 0, i64 0), i64 %jacobian.gather
+; CHECK-NEXT:   %11 = load i64, i64* %10
+; CHECK-NEXT:   %12 = getelementptr double, double* %vals, i64 %jacobian.gather
+; CHECK-NEXT:   %13 = getelementptr double, double* %1, i64 %11
+; CHECK-NEXT:   %14 = load double, double* %13
+; CHECK-NEXT:   store double %14, double* %12
+; CHECK-NEXT:   %jacobian.gather.next = add nuw i64 %jacobian.gather, 1
+; CHECK-NEXT:   br label %jacobian.gather.header
+
+; CHECK: jacobian.gather.exit:
+; CHECK-NEXT:   %15 = mul i64 %8, 4
+; CHECK-NEXT:   %16 = bitcast i32* %cols to i8*
+; CHECK-NEXT:   call void @llvm.memcpy.p0i8.p0i8.i64(i8* %16, i8* bitcast ([7 x i32]* @jacobian.cols to i8*), i64 %15, i1 false)
+; CHECK-NEXT:   %17 = bitcast i32* %rows to i8*
+; CHECK-NEXT:   call void @llvm.memcpy.p0i8.p0i8.i64(i8* %17, i8* bitcast ([4 x i32]* @jacobian.rows to i8*), i64 16, i1 false)
+; CHECK-NEXT:   tail call void @free(i8* nonnull %malloccall)
+; CHECK-NEXT:   ret i32 7
+; CHECK-NEXT: }
@@ -0,0 +1,62 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -S | FileCheck %s
+
+; y[i] = x[i] * x[i + 1] for i < 3, computed in a loop
+define void @f(double* %x, double* %y) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %i.next = add nuw nsw i64 %i, 1
+  %p = getelementptr inbounds double, double* %x, i64 %i
+  %a = load double, double* %p
+  %p1 = getelementptr inbounds double, double* %x, i64 %i.next
+  %b = load double, double* %p1
+  %m = fmul double %a, %b
+  %q = getelementptr inbounds double, double* %y, i64 %i
+  store double %m, double* %q
+  %done = icmp eq i64 %i.next, 3
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+declare i64 @__enzyme_sparse_jacobian(...)
+
+define i64 @sparse(double* %x, double* %y, i64* %rows, i64* %cols, double* %vals, i64 %cap) {
+entry:
+  %nnz = call i64 (...) @__enzyme_sparse_jacobian(void (double*, double*)* @f, double* %x, double* %y, i64 4, i64 3, i64* %rows, i64* %cols, double* %vals, i64 %cap)
+  ret i64 %nnz
+}
+
+; The pattern is not derived statically from the loop, so the inputs each
+; output depends on are propagated through @f at runtime, first counting and
+; then listing the entries of each row, and the columns colored from them.
+
+; CHECK: define i64 @sparse(double* %x, double* %y, i64* %rows, i64* %cols, double* %vals, i64 %cap)
+; CHECK: call void @jacobian_deps_preprocess_f(double* %x, double* %y, i64* %0, i64* %1)
+; CHECK: call i64 @llvm.ctpop.i64(
+; CHECK: call void @jacobian_deps_preprocess_f(double* %x, double* %y, i64* %0, i64* %1)
+; CHECK: call i64 @llvm.cttz.i64(i64 %jacobian.dep, i1 true)
+; CHECK: jacobian.colorcol.header:
+; CHECK: jacobian.pick.body:
+; CHECK: call void @fwddiffe4f(double* %x, [4 x double*] %{{.*}}, double* %y, [4 x double*] %{{.*}})
+; CHECK: call void @f(double* %x, double* %y)
+; CHECK: ret i64
+
+; CHECK: define internal void @jacobian_deps_preprocess_f(double* %x, double* %y, i64* %dx, i64* %dy)
+; CHECK: loop:
+; CHECK:   %a = load double, double* %p, align 8
+; CHECK-NEXT:   %[[dx0:.+]] = bitcast i64* %dx to i8*
+; CHECK-NEXT:   %[[x0:.+]] = ptrtoint double* %x to i64
+; CHECK-NEXT:   %[[p0:.+]] = ptrtoint double* %p to i64
+; CHECK-NEXT:   %[[off0:.+]] = sub i64 %[[p0]], %[[x0]]
+; CHECK-NEXT:   %[[g0:.+]] = getelementptr i8, i8* %[[dx0]], i64 %[[off0]]
+; CHECK-NEXT:   %[[c0:.+]] = bitcast i8* %[[g0]] to i64*
+; CHECK-NEXT:   %"a'deps" = load i64, i64* %[[c0]], align 8
+; CHECK:   %"b'deps" = load i64, i64* %{{.+}}, align 8
+; CHECK-NEXT:   %m = fmul double %a, %b
+; CHECK-NEXT:   %[[mdeps:.+]] = or i64 %"a'deps", %"b'deps"
+; CHECK:   store double %m, double* %q, align 8
+; CHECK:   store i64 %[[mdeps]], i64* %{{.+}}, align 8
@@ -0,0 +1,75 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-vector-shadows -mem2reg -instsimplify -simplifycfg -S | FileCheck %s
+
+%struct.Gradients = type { double, double, double, double }
+
+declare %struct.Gradients @__enzyme_fwddiff(double (double, i64)*, ...)
+
+declare double @llvm.sin.f64(double)
+
+define double @tester(double %x, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %acc = phi double [ %x, %entry ], [ %next, %loop ]
+  %s = call fast double @llvm.sin.f64(double %acc)
+  %m = fmul fast double %s, %x
+  %next = fadd fast double %m, %acc
+  %inc = add nuw nsw i64 %i, 1
+  %cmp = icmp eq i64 %inc, %n
+  br i1 %cmp, label %exit, label %loop
+
+exit:
+  ret double %next
+}
+
+define %struct.Gradients @test_derivative(double %x, i64 %n) {
+entry:
+  %0 = tail call %struct.Gradients (double (double, i64)*, ...) @__enzyme_fwddiff(double (double, i64)* nonnull @tester, metadata !"enzyme_width", i64 4, double %x, double 1.0, double 2.0, double 3.0, double 4.0, i64 %n)
+  ret %struct.Gradients %0
+}
+
+; CHECK: define %struct.Gradients @test_derivative(double %x, i64 %n)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %0 = call fast <4 x double> @fwddiffe4tester(double %x, <4 x double> <double 1.000000e+00, double 2.000000e+00, double 3.000000e+00, double 4.000000e+00>, i64 %n)
+; CHECK-NEXT:   %1 = extractelement <4 x double> %0, i64 0
+; CHECK-NEXT:   %2 = extractelement <4 x double> %0, i64 1
+; CHECK-NEXT:   %3 = extractelement <4 x double> %0, i64 2
+; CHECK-NEXT:   %4 = extractelement <4 x double> %0, i64 3
+; CHECK-NEXT:   %5 = insertvalue %struct.Gradients zeroinitializer, double %1, 0
+; CHECK-NEXT:   %6 = insertvalue %struct.Gradients %5, double %2, 1
+; CHECK-NEXT:   %7 = insertvalue %struct.Gradients %6, double %3, 2
+; CHECK-NEXT:   %8 = insertvalue %struct.Gradients %7, double %4, 3
+; CHECK-NEXT:   ret %struct.Gradients %8
+
+; CHECK: define internal <4 x double> @fwddiffe4tester(double %x, <4 x double> %"x'", i64 %n)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   br label %loop
+
+; CHECK: loop:
+; CHECK-NEXT:   %iv = phi i64 [ %iv.next, %loop ], [ 0, %entry ]
+; CHECK-NEXT:   %0 = phi fast <4 x double> [ %"x'", %entry ], [ %6, %loop ]
+; CHECK-NEXT:   %acc = phi double [ %x, %entry ], [ %next, %loop ]
+; CHECK-NEXT:   %iv.next = add nuw nsw i64 %iv, 1
+; CHECK-NEXT:   %s = call fast double @llvm.sin.f64(double %acc)
+; CHECK-NEXT:   %1 = call fast double @llvm.cos.f64(double %acc)
+; CHECK-NEXT:   %.splatinsert = insertelement <4 x double> poison, double %1, i32 0
+; CHECK-NEXT:   %.splat = shufflevector <4 x double> %.splatinsert, <4 x double> poison, <4 x i32> zeroinitializer
+; CHECK-NEXT:   %2 = fmul fast <4 x double> %0, %.splat
+; CHECK-NEXT:   %m = fmul fast double %s, %x
+; CHECK-NEXT:   %.splatinsert1 = insertelement <4 x double> poison, double %s, i32 0
+; CHECK-NEXT:   %.splat2 = shufflevector <4 x double> %.splatinsert1, <4 x double> poison, <4 x i32> zeroinitializer
+; CHECK-NEXT:   %3 = fmul fast <4 x double> %"x'", %.splat2
+; CHECK-NEXT:   %.splatinsert3 = insertelement <4 x double> poison, double %x, i32 0
+; CHECK-NEXT:   %.splat4 = shufflevector <4 x double> %.splatinsert3, <4 x double> poison, <4 x i32> zeroinitializer
+; CHECK-NEXT:   %4 = fmul fast <4 x double> %2, %.splat4
+; CHECK-NEXT:   %5 = fadd fast <4 x double> %4, %3
+; CHECK-NEXT:   %next = fadd fast double %m, %acc
+; CHECK-NEXT:   %6 = fadd fast <4 x double> %5, %0
+; CHECK-NEXT:   %cmp = icmp eq i64 %iv.next, %n
+; CHECK-NEXT:   br i1 %cmp, label %exit, label %loop
+
+; CHECK: exit:
+; CHECK-NEXT:   ret <4 x double> %6
+; CHECK-NEXT: }
@@ -0,0 +1,69 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-instrument -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+
+@__enzyme_cache_sites = external global i8*
+
+define double @f(double* %x, i64 %n) !dbg !5 {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %s = phi double [ 0.000000e+00, %entry ], [ %s2, %loop ]
+  %p = getelementptr inbounds double, double* %x, i64 %i
+  %v = load double, double* %p, !dbg !8
+  store double 0.000000e+00, double* %p
+  %m = fmul double %v, %v
+  %s2 = fadd double %s, %m
+  %inc = add nuw nsw i64 %i, 1
+  %sq = mul i64 %inc, %inc
+  %c = icmp ult i64 %sq, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret double %s2
+}
+
+declare { i8*, double } @__enzyme_augmentfwd(i8*, ...)
+declare void @__enzyme_reverse(i8*, ...)
+
+define i8* @sites() {
+entry:
+  %s = load i8*, i8** @__enzyme_cache_sites
+  ret i8* %s
+}
+
+define void @tester(double* %x, double* %dx, i64 %n) {
+entry:
+  %aug = call { i8*, double } (i8*, ...) @__enzyme_augmentfwd(i8* bitcast (double (double*, i64)* @f to i8*), double* %x, double* %dx, i64 %n)
+  %tape = extractvalue { i8*, double } %aug, 0
+  call void (i8*, ...) @__enzyme_reverse(i8* bitcast (double (double*, i64)* @f to i8*), double* %x, double* %dx, i64 %n, double 1.000000e+00, i8* %tape)
+  ret void
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "sum.c", directory: "/tmp")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = distinct !DISubprogram(name: "f", scope: !1, file: !1, line: 1, type: !6, scopeLine: 1, spFlags: DISPFlagDefinition, unit: !0, retainedNodes: !2)
+!6 = !DISubroutineType(types: !7)
+!7 = !{null}
+!8 = !DILocation(line: 4, column: 16, scope: !5)
+
+; The sites list is referenced by the program, so the declaration becomes the definition
+; CHECK: @__enzyme_cache_sites = linkonce_odr global i8* null
+
+; CHECK: define internal { i8*, double } @augmented_f(double* %x, double* %"x'", i64 %n)
+; CHECK: grow.i:
+; CHECK:   %{{.+}} = call i8* @__enzyme_cache_site.realloc(i8* %{{.+}}, i64 %{{.+}})
+
+; The cache read from the tape was allocated through the runtime, so the reverse releases it there
+; CHECK: define internal void @diffef(double* %x, double* %"x'", i64 %n, double %differeturn, i8* %tapeArg)
+; CHECK:   %truetape = load double*, double** %0
+; CHECK: invertentry:
+; CHECK-NEXT:   %[[tapemem:.+]] = bitcast double* %truetape to i8*
+; CHECK-NEXT:   tail call void @__enzyme_cache_free(i8* nonnull %[[tapemem]])
+; CHECK-NEXT:   ret void
@@ -0,0 +1,91 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-instrument -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+
+define double @f(double* %x, i64 %n) !dbg !5 {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %inc, %loop ]
+  %s = phi double [ 0.000000e+00, %entry ], [ %s2, %loop ]
+  %p = getelementptr inbounds double, double* %x, i64 %i
+  %v = load double, double* %p, !dbg !8
+  store double 0.000000e+00, double* %p
+  %m = fmul double %v, %v
+  %s2 = fadd double %s, %m
+  %inc = add nuw nsw i64 %i, 1
+  %sq = mul i64 %inc, %inc
+  %c = icmp ult i64 %sq, %n
+  br i1 %c, label %loop, label %loop2
+
+loop2:
+  %j = phi i64 [ 0, %loop ], [ %jinc, %loop2 ]
+  %t = phi double [ %s2, %loop ], [ %t2, %loop2 ]
+  %q = getelementptr inbounds double, double* %x, i64 %j
+  %w = load double, double* %q, !dbg !9
+  store double 1.000000e+00, double* %q
+  %wm = fmul double %w, %w
+  %t2 = fadd double %t, %wm
+  %jinc = add nuw nsw i64 %j, 1
+  %c2 = icmp ult i64 %jinc, %n
+  br i1 %c2, label %loop2, label %exit
+
+exit:
+  ret double %t2
+}
+
+declare double @__enzyme_autodiff(i8*, ...)
+
+define double @tester(double* %x, double* %dx, i64 %n) {
+entry:
+  %r = call double (i8*, ...) @__enzyme_autodiff(i8* bitcast (double (double*, i64)* @f to i8*), double* %x, double* %dx, i64 %n)
+  ret double %r
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "sum.c", directory: "/tmp")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = distinct !DISubprogram(name: "f", scope: !1, file: !1, line: 1, type: !6, scopeLine: 1, spFlags: DISPFlagDefinition, unit: !0, retainedNodes: !2)
+!6 = !DISubroutineType(types: !7)
+!7 = !{null}
+!8 = !DILocation(line: 4, column: 16, scope: !5)
+!9 = !DILocation(line: 9, column: 16, scope: !5)
+
+; CHECK: @__enzyme_cache_site = internal global { i8*, i64, i64, i64, i64, i8*, i64 } { i8* getelementptr inbounds ([23 x i8], [23 x i8]* @[[vname:.+]], i32 0, i32 0), i64 0, i64 0, i64 0, i64 0, i8* null, i64 0 }, align 8
+; CHECK: @llvm.global_ctors = appending global [1 x { i32, void ()*, i8* }] [{ i32, void ()*, i8* } { i32 65535, void ()* @__enzyme_cache_register_sites, i8* null }]
+; CHECK: @__enzyme_cache_sites = linkonce_odr global i8* null
+; CHECK: @[[vname]] = private unnamed_addr constant [23 x i8] c"sum.c:4:16 v in diffef\00"
+; CHECK: @[[wsite:__enzyme_cache_site.+]] = internal global { i8*, i64, i64, i64, i64, i8*, i64 } { i8* getelementptr inbounds ([23 x i8], [23 x i8]* @[[wname:.+]], i32 0, i32 0)
+; CHECK: @[[wname]] = private unnamed_addr constant [23 x i8] c"sum.c:9:16 w in diffef\00"
+
+; CHECK: define internal void @diffef(double* %x, double* %"x'", i64 %n, double %differeturn)
+; CHECK: grow.i:
+; CHECK:   %{{.+}} = call i8* @__enzyme_cache_site.realloc(i8* %{{.+}}, i64 %{{.+}})
+; CHECK: loop2.preheader:
+; CHECK:   %[[wmem:.+]] = call i8* @__enzyme_cache_malloc(i8* bitcast ({ i8*, i64, i64, i64, i64, i8*, i64 }* @[[wsite]] to i8*), i64 %mallocsize)
+; CHECK:   tail call void @__enzyme_cache_free(i8* nonnull %{{.+}})
+; CHECK:   tail call void @__enzyme_cache_free(i8* nonnull %[[wmem]])
+
+; CHECK: define internal void @__enzyme_cache_register_sites()
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   call void @__enzyme_cache_register(i8* bitcast ({ i8*, i64, i64, i64, i64, i8*, i64 }* @__enzyme_cache_site to i8*))
+; CHECK-NEXT:   call void @__enzyme_cache_register(i8* bitcast ({ i8*, i64, i64, i64, i64, i8*, i64 }* @[[wsite]] to i8*))
+; CHECK-NEXT:   ret void
+
+; CHECK: define linkonce_odr void @__enzyme_cache_register(i8* %site)
+; CHECK:   %{{.+}} = call i32 @atexit(void ()* @__enzyme_cache_report)
+
+; CHECK: define linkonce_odr void @__enzyme_cache_report()
+
+; CHECK: define internal i8* @__enzyme_exponentialallocation.__enzyme_cache_site(i8* %ptr, i64 %size, i64 %tsize)
+; CHECK:   %{{.+}} = call i8* @__enzyme_cache_site.realloc(i8* %ptr, i64 %{{.+}})
+
+; CHECK: define linkonce_odr i8* @__enzyme_cache_realloc(i8* %site, i8* %ptr, i64 %size)
+; CHECK: define linkonce_odr i8* @__enzyme_cache_malloc(i8* %site, i64 %size)
+; CHECK:   %mem = call i8* @malloc(i64 %{{.+}})
+; CHECK: define linkonce_odr void @__enzyme_cache_free(i8* %ptr)
+; CHECK:   call void @free(i8* %base)
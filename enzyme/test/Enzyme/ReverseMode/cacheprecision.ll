@@ -0,0 +1,69 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-precision=float -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-precision=bfloat -enzyme-cache-precision-check -mem2reg -instsimplify -simplifycfg -S | FileCheck %s --check-prefix=BF; fi
+
+define double @f(double %x, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i1, %loop ]
+  %s = phi double [ %x, %entry ], [ %s1, %loop ]
+  %s1 = fmul double %s, %s
+  %i1 = add nuw i64 %i, 1
+  %c = icmp eq i64 %i1, %n
+  br i1 %c, label %exit, label %loop
+
+exit:
+  ret double %s1
+}
+
+define double @df(double %x, i64 %n) {
+entry:
+  %r = call double (i8*, ...) @__enzyme_autodiff(i8* bitcast (double (double, i64)* @f to i8*), double %x, i64 %n)
+  ret double %r
+}
+
+declare double @__enzyme_autodiff(i8*, ...)
+
+; CHECK: define internal { double } @diffef(double %x, i64 %n, double %differeturn)
+; CHECK: %mallocsize = mul nuw nsw i64 %n, 4
+; CHECK: %s_malloccache = bitcast i8* %malloccall to float*
+; CHECK: loop:
+; CHECK: %[[t:.+]] = fptrunc double %s to float
+; CHECK-NEXT: %[[p:.+]] = getelementptr inbounds float, float* %s_malloccache, i64 %iv
+; CHECK-NEXT: store float %[[t]], float* %[[p]], align 4, !invariant.group
+; CHECK: invertloop:
+; CHECK: %[[lp:.+]] = getelementptr inbounds float, float* %s_malloccache, i64 %"iv'ac.0"
+; CHECK-NEXT: %[[l:.+]] = load float, float* %[[lp]], align 4, !invariant.group
+; CHECK-NEXT: %[[e:.+]] = fpext float %[[l]] to double
+; CHECK-NEXT: %m0diffes = fmul fast double %"s1'de.0", %[[e]]
+
+; BF: @__enzyme_cache_precision_error = weak global double 0.000000e+00, align 8
+; BF: define internal { double } @diffef(double %x, i64 %n, double %differeturn)
+; BF: %mallocsize = mul nuw nsw i64 %n, 2
+; BF: %s_malloccache = bitcast i8* %malloccall to i16*
+; BF: loop:
+; BF: %[[f:.+]] = fptrunc double %s to float
+; BF-NEXT: %[[b:.+]] = bitcast float %[[f]] to i32
+; BF-NEXT: %[[h:.+]] = lshr i32 %[[b]], 16
+; BF-NEXT: %[[lsb:.+]] = and i32 %[[h]], 1
+; BF-NEXT: %[[bias:.+]] = add i32 %[[lsb]], 32767
+; BF-NEXT: %[[sum:.+]] = add i32 %[[b]], %[[bias]]
+; BF-NEXT: %[[r:.+]] = lshr i32 %[[sum]], 16
+; BF-NEXT: %[[nan:.+]] = fcmp uno float %[[f]], %[[f]]
+; BF-NEXT: %[[sel:.+]] = select i1 %[[nan]], i32 32704, i32 %[[r]]
+; BF-NEXT: %[[t:.+]] = trunc i32 %[[sel]] to i16
+; BF: %[[rel:.+]] = select i1 %{{.+}}, double 0.000000e+00, double %{{.+}}
+; BF-NEXT: %[[nanrel:.+]] = fcmp uno double %[[rel]], %[[rel]]
+; BF-NEXT: %[[err:.+]] = select i1 %[[nanrel]], double 0.000000e+00, double %[[rel]]
+; BF-NEXT: %[[bits:.+]] = bitcast double %[[err]] to i64
+; BF-NEXT: %{{.+}} = atomicrmw umax i64* bitcast (double* @__enzyme_cache_precision_error to i64*), i64 %[[bits]] monotonic
+; BF-NEXT: %[[p:.+]] = getelementptr inbounds i16, i16* %s_malloccache, i64 %iv
+; BF-NEXT: store i16 %[[t]], i16* %[[p]], align 2, !invariant.group
+; BF: invertloop:
+; BF: %[[l:.+]] = load i16, i16* %{{.+}}, align 2, !invariant.group
+; BF-NEXT: %[[z:.+]] = zext i16 %[[l]] to i32
+; BF-NEXT: %[[s:.+]] = shl i32 %[[z]], 16
+; BF-NEXT: %[[fl:.+]] = bitcast i32 %[[s]] to float
+; BF-NEXT: %[[e:.+]] = fpext float %[[fl]] to double
+; BF-NEXT: %m0diffes = fmul fast double %"s1'de.0", %[[e]]
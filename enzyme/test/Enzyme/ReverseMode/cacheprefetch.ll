@@ -0,0 +1,74 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-nontemporal-cache -enzyme-cache-prefetch=8 -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+
+declare double @llvm.exp.f64(double)
+declare double @llvm.log.f64(double)
+declare double @llvm.maxnum.f64(double, double)
+
+define double @lse(double* noalias %x, i64 %n) {
+entry:
+  %x0 = load double, double* %x
+  br label %maxl
+
+maxl:
+  %i = phi i64 [ 0, %entry ], [ %i1, %maxl ]
+  %A = phi double [ %x0, %entry ], [ %A1, %maxl ]
+  %p = getelementptr inbounds double, double* %x, i64 %i
+  %v = load double, double* %p
+  %A1 = call double @llvm.maxnum.f64(double %A, double %v)
+  %i1 = add nuw i64 %i, 1
+  %c = icmp eq i64 %i1, %n
+  br i1 %c, label %sum, label %maxl
+
+sum:
+  %j = phi i64 [ 0, %maxl ], [ %j1, %sum ]
+  %s = phi double [ 0.0, %maxl ], [ %s1, %sum ]
+  %q = getelementptr inbounds double, double* %x, i64 %j
+  %w = load double, double* %q
+  %d = fsub double %w, %A1
+  %e = call double @llvm.exp.f64(double %d)
+  store double %e, double* %q
+  %s1 = fadd double %s, %e
+  %j1 = add nuw i64 %j, 1
+  %c2 = icmp eq i64 %j1, %n
+  br i1 %c2, label %exit, label %sum
+
+exit:
+  %l = call double @llvm.log.f64(double %s1)
+  %r = fadd double %l, %A1
+  ret double %r
+}
+
+define void @dlse(double* %x, double* %dx, i64 %n) {
+entry:
+  call void (i8*, ...) @__enzyme_autodiff(i8* bitcast (double (double*, i64)* @lse to i8*), double* %x, double* %dx, i64 %n)
+  ret void
+}
+
+declare void @__enzyme_autodiff(i8*, ...)
+
+; CHECK: define internal void @diffelse(double* noalias %x, double* %"x'", i64 %n, double %differeturn)
+
+; CHECK: maxl:
+; CHECK:   %3 = getelementptr inbounds double, double* %A_malloccache, i64 %iv
+; CHECK-NEXT:   store double %A, double* %3, align 8, !nontemporal ![[nt:[0-9]+]], !invariant.group
+
+; CHECK: sum:
+; CHECK:   store double %e, double* %q, align 8, !alias.scope
+; CHECK-NEXT:   %5 = getelementptr inbounds double, double* %d_malloccache, i64 %iv1
+; CHECK-NEXT:   store double %d, double* %5, align 8, !nontemporal ![[nt]], !invariant.group
+
+; CHECK: invertmaxl:
+; CHECK:   %10 = getelementptr inbounds double, double* %A_malloccache, i64 %"iv'ac.0"
+; CHECK-NEXT:   %11 = getelementptr double, double* %10, i64 -8
+; CHECK-NEXT:   %12 = bitcast double* %11 to i8*
+; CHECK-NEXT:   call void @llvm.prefetch.p0i8(i8* %12, i32 0, i32 3, i32 1)
+; CHECK-NEXT:   %13 = load double, double* %10, align 8, !invariant.group
+
+; CHECK: invertsum:
+; CHECK:   %27 = getelementptr inbounds double, double* %d_malloccache, i64 %"iv1'ac.0"
+; CHECK-NEXT:   %28 = getelementptr double, double* %27, i64 -8
+; CHECK-NEXT:   %29 = bitcast double* %28 to i8*
+; CHECK-NEXT:   call void @llvm.prefetch.p0i8(i8* %29, i32 0, i32 3, i32 1)
+; CHECK-NEXT:   %30 = load double, double* %27, align 8, !invariant.group
+
+; CHECK: ![[nt]] = !{i32 1}
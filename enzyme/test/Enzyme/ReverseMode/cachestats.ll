@@ -0,0 +1,35 @@
+; RUN: rm -rf %t
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-print-cache-stats -S -o /dev/null 2>&1 | FileCheck %s
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-dir=%t -enzyme-print-cache-stats -S -o /dev/null 2>&1 | FileCheck %s
+; Derivatives reloaded from the persistent cache are still in-memory misses.
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-dir=%t -enzyme-print-cache-stats -S -o /dev/null 2>&1 | FileCheck --check-prefix=PERSISTENT %s
+
+define double @square(double %x) {
+entry:
+  %mul = fmul fast double %x, %x
+  ret double %mul
+}
+
+define double @test_derivatives(double %x) {
+entry:
+  %0 = call double (double (double)*, ...) @__enzyme_autodiff(double (double)* @square, double %x)
+  %1 = call double (double (double)*, ...) @__enzyme_autodiff(double (double)* @square, double %x)
+  %2 = call double (double (double)*, ...) @__enzyme_fwddiff(double (double)* @square, double %x, double 1.000000e+00)
+  %3 = call double (double (double)*, ...) @__enzyme_fwddiff(double (double)* @square, double %x, double 1.000000e+00)
+  %4 = fadd double %0, %1
+  %5 = fadd double %2, %3
+  %6 = fadd double %4, %5
+  ret double %6
+}
+
+declare double @__enzyme_autodiff(double (double)*, ...)
+
+declare double @__enzyme_fwddiff(double (double)*, ...)
+
+; CHECK: augmented cache: hits=0 misses=0 persistent=0
+; CHECK-NEXT: reverse cache: hits=1 misses=1 persistent=0
+; CHECK-NEXT: forward cache: hits=1 misses=1 persistent=0
+
+; PERSISTENT: augmented cache: hits=0 misses=0 persistent=0
+; PERSISTENT-NEXT: reverse cache: hits=1 misses=1 persistent=1
+; PERSISTENT-NEXT: forward cache: hits=1 misses=1 persistent=1
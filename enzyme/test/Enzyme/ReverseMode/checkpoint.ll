@@ -0,0 +1,73 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -S | FileCheck %s
+
+define void @step(double* %x, double* %p) {
+entry:
+  %x0 = load double, double* %x
+  %p0 = load double, double* %p
+  %s = call double @llvm.sin.f64(double %x0)
+  %m = fmul double %x0, %p0
+  %y = fadd double %m, %s
+  store double %y, double* %x
+  ret void
+}
+
+define void @f(double* %x, double* %p, i64 %n) {
+entry:
+  call void (i8*, ...) @__enzyme_checkpoint(i8* bitcast (void (double*, double*)* @step to i8*), i64 %n, double* %x, i64 8, double* %p)
+  ret void
+}
+
+define void @dsquare(double* %x, double* %dx, double* %p, double* %dp, i64 %n) {
+entry:
+  call void (...) @__enzyme_autodiff(void (double*, double*, i64)* @f, double* %x, double* %dx, double* %p, double* %dp, i64 %n)
+  ret void
+}
+
+declare double @llvm.sin.f64(double)
+
+declare void @__enzyme_checkpoint(i8*, ...)
+
+declare void @__enzyme_autodiff(...)
+
+; CHECK: define void @f(double* %x, double* %p, i64 %n)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   call void @__enzyme_checkpoint_loop.step(i64 %n, double* %x, double* %p)
+; CHECK-NEXT:   ret void
+; CHECK-NEXT: }
+
+; CHECK: define internal void @diffef(double* %x, double* %"x'", double* %p, double* %"p'", i64 %n)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %checkpoints = call i8* @__enzyme_checkpoint_fwd.step(i64 %n, i64 8, double* %x, double* %p)
+; CHECK-NEXT:   call void @__enzyme_checkpoint_rev.diffestep(i64 %n, i64 8, i8* %checkpoints, double* %"x'", double* %p, double* %"p'")
+; CHECK-NEXT:   tail call void @free(i8* nonnull %checkpoints)
+; CHECK-NEXT:   ret void
+; CHECK-NEXT: }
+
+; CHECK: define internal i8* @__enzyme_checkpoint_fwd.step(i64 %n, i64 %bytes, double* %state, double* %0)
+; CHECK: %[[neg:.+]] = icmp slt i64 %n, 0
+; CHECK-NEXT: %count = select i1 %[[neg]], i64 0, i64 %n
+; CHECK: %interval = select i1 %{{.*}}, i64 1, i64 %{{.*}}
+; CHECK: %nsegments = udiv i64 %{{.*}}, %interval
+; CHECK: %[[snaps:.+]] = tail call noalias nonnull i8* @malloc(i64 %{{.*}})
+; CHECK: store:
+; CHECK-NEXT:   %[[seg:.+]] = udiv i64 %step.iv, %interval
+; CHECK-NEXT:   %[[off:.+]] = mul i64 %[[seg]], %bytes
+; CHECK-NEXT:   %[[slot:.+]] = getelementptr inbounds i8, i8* %[[snaps]], i64 %[[off]]
+; CHECK-NEXT:   call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 1 %[[slot]], i8* align 1 %{{.*}}, i64 %bytes, i1 false)
+; CHECK: run:
+; CHECK-NEXT:   call void @step(double* %state, double* %0)
+
+; CHECK: define internal void @__enzyme_checkpoint_rev.diffestep(i64 %n, i64 %bytes, i8* %checkpoints, double* %0, double* %1, double* %2)
+; CHECK: %[[states:.+]] = tail call noalias nonnull i8* @malloc(i64 %{{.*}})
+; CHECK-NEXT: %[[scratch:.+]] = tail call noalias nonnull i8* @malloc(i64 %bytes)
+; CHECK-NEXT: %[[scratchd:.+]] = bitcast i8* %[[scratch]] to double*
+; CHECK: recompute.body:
+; CHECK: call void @step(double* %{{.*}}, double* %1)
+; CHECK: reverse.body:
+; CHECK: call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 1 %[[scratch]], i8* align 1 %{{.*}}, i64 %bytes, i1 false)
+; CHECK-NEXT: call void @diffestep(double* %[[scratchd]], double* %0, double* %1, double* %2)
+
+; CHECK: define internal void @__enzyme_checkpoint_loop.step(i64 %n, double* %0, double* %1)
+; CHECK: step.body:
+; CHECK-NEXT:   %step.iv = phi i64 [ 0, %entry ], [ %step.next, %step.body ]
+; CHECK-NEXT:   call void @step(double* %0, double* %1)
@@ -0,0 +1,66 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-coalesce-cache -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+
+define double @f(double* %x, float* %y, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i1, %loop ]
+  %a = phi double [ 1.000000e+00, %entry ], [ %a2, %loop ]
+  %px = getelementptr inbounds double, double* %x, i64 %i
+  %xv = load double, double* %px
+  %py = getelementptr inbounds float, float* %y, i64 %i
+  %yv = load float, float* %py
+  %yd = fpext float %yv to double
+  %a1 = fmul double %a, %xv
+  %a2 = fmul double %a1, %yd
+  store double 0.000000e+00, double* %px
+  store float 0.000000e+00, float* %py
+  %i1 = add nuw i64 %i, 1
+  %c = icmp eq i64 %i1, %n
+  br i1 %c, label %exit, label %loop
+
+exit:
+  ret double %a2
+}
+
+define void @df(double* %x, double* %dx, float* %y, float* %dy, i64 %n) {
+entry:
+  call void (i8*, ...) @__enzyme_autodiff(i8* bitcast (double (double*, float*, i64)* @f to i8*), double* %x, double* %dx, float* %y, float* %dy, i64 %n)
+  ret void
+}
+
+declare void @__enzyme_autodiff(i8*, ...)
+
+; CHECK: define internal void @diffef(double* %x, double* %"x'", float* %y, float* %"y'", i64 %n, double %differeturn)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %0 = add i64 %n, -1
+; CHECK-NEXT:   %1 = mul nuw nsw i64 %n, 24
+; CHECK-NEXT:   %malloccall = tail call noalias nonnull i8* @malloc(i64 %1)
+; CHECK-NEXT:   %2 = getelementptr inbounds i8, i8* %malloccall, i64 8
+; CHECK-NEXT:   %3 = getelementptr inbounds i8, i8* %malloccall, i64 16
+; CHECK-NOT: @malloc(
+
+; CHECK: %4 = mul nuw nsw i64 %iv, 24
+; CHECK-NEXT:   %5 = getelementptr inbounds i8, i8* %3, i64 %4
+; CHECK-NEXT:   %6 = bitcast i8* %5 to double*
+; CHECK-NEXT:   store double %xv, double* %6, align 8, !invariant.group
+; CHECK-NEXT:   %7 = mul nuw nsw i64 %iv, 24
+; CHECK-NEXT:   %8 = getelementptr inbounds i8, i8* %2, i64 %7
+; CHECK-NEXT:   %9 = bitcast i8* %8 to double*
+; CHECK-NEXT:   store double %a, double* %9, align 8, !invariant.group
+; CHECK-NEXT:   %10 = mul nuw nsw i64 %iv, 24
+; CHECK-NEXT:   %11 = getelementptr inbounds i8, i8* %malloccall, i64 %10
+; CHECK-NEXT:   %12 = bitcast i8* %11 to float*
+; CHECK-NEXT:   store float %yv, float* %12, align 4, !invariant.group
+
+; CHECK: invertentry:
+; CHECK-NEXT:   tail call void @free(i8* nonnull %malloccall)
+; CHECK-NEXT:   ret void
+
+; CHECK: invertloop:
+; CHECK:   %13 = mul nuw nsw i64 %"iv'ac.0", 24
+; CHECK-NEXT:   %14 = getelementptr inbounds i8, i8* %malloccall, i64 %13
+; CHECK-NEXT:   %15 = bitcast i8* %14 to float*
+; CHECK-NEXT:   %16 = load float, float* %15, align 4, !invariant.group
+; CHECK-NOT: call void @free(
@@ -0,0 +1,100 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-file-tape -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+
+declare double @llvm.sin.f64(double)
+
+define double @tester(double* %x, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i1, %loop ]
+  %s = phi double [ 1.0, %entry ], [ %s1, %loop ]
+  %p = getelementptr inbounds double, double* %x, i64 %i
+  %v = load double, double* %p
+  %sn = call double @llvm.sin.f64(double %s)
+  %m = fmul double %sn, %v
+  %s1 = fadd double %m, %s
+  %i1 = add nuw i64 %i, 1
+  %c = icmp eq i64 %i1, %n
+  br i1 %c, label %wl, label %loop
+
+wl:
+  %t = phi double [ %s1, %loop ], [ %t1, %wl ]
+  %sn2 = call double @llvm.sin.f64(double %t)
+  %t0 = fmul double %t, 0.99999
+  %sn3 = fmul double %sn2, 1.0e-6
+  %t1 = fadd double %t0, %sn3
+  %cw = fcmp ogt double %t1, 1.0e-3
+  br i1 %cw, label %wl, label %exit
+
+exit:
+  %r = fadd double %t1, %s1
+  ret double %r
+}
+
+define void @dtester(double* %x, double* %dx, i64 %n) {
+entry:
+  call void (double (double*, i64)*, ...) @__enzyme_autodiff(double (double*, i64)* nonnull @tester, double* %x, double* %dx, i64 %n)
+  ret void
+}
+
+declare void @__enzyme_autodiff(double (double*, i64)*, ...)
+
+; CHECK: define internal void @diffetester(double* %x, double* %"x'", i64 %n, double %differeturn)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %0 = add i64 %n, -1
+; CHECK-NEXT:   %mallocsize = mul nuw nsw i64 %n, 8
+; CHECK-NEXT:   %malloccall = tail call noalias nonnull i8* @__enzyme_file_tape_malloc(i64 %mallocsize)
+; CHECK-NEXT:   %s_malloccache = bitcast i8* %malloccall to double*
+
+; CHECK: push.i:
+; CHECK:   %[[table:.+]] = call i8* @__enzyme_exponentialallocation(i8* %{{.+}}, i64 %{{.+}}, i64 8)
+; CHECK:   %[[block:.+]] = call noalias nonnull i8* @__enzyme_file_tape_malloc(i64 8388608)
+
+; CHECK: invertentry:
+; CHECK-NEXT:   %base.i = getelementptr inbounds i8, i8* %malloccall, i64 -16
+; CHECK:   %{{.+}} = call i32 @munmap(i8* %base.i, i64 %len.i)
+; CHECK:   call void @free(i8* %base.i)
+
+; CHECK: invertloop:
+; CHECK:   %[[cur:.+]] = getelementptr inbounds double, double* %s_malloccache, i64 %"iv'ac.0"
+; CHECK-NEXT:   %[[last:.+]] = getelementptr double, double* %[[cur]], i64 1
+; CHECK:   %[[curi:.+]] = ptrtoint i8* %{{.+}} to i64
+; CHECK-NEXT:   %[[lasti:.+]] = ptrtoint i8* %{{.+}} to i64
+; CHECK-NEXT:   %[[lw:.+]] = lshr i64 %[[lasti]], 20
+; CHECK-NEXT:   %[[cw:.+]] = lshr i64 %[[curi]], 20
+; CHECK-NEXT:   %[[cross:.+]] = icmp ne i64 %[[cw]], %[[lw]]
+; CHECK-NEXT:   br i1 %[[cross]], label %advise.i, label %__enzyme_file_tape_readahead.exit
+
+; CHECK: advise.i:
+; CHECK-NEXT:   %[[win:.+]] = and i64 %[[curi]], -1048576
+; CHECK-NEXT:   %[[below:.+]] = sub i64 %[[win]], 1048576
+; CHECK-NEXT:   %[[p:.+]] = inttoptr i64 %[[below]] to i8*
+; CHECK-NEXT:   %{{.+}} = call i32 @madvise(i8* %[[p]], i64 1048576, i32 3)
+
+; CHECK: release.i:
+; CHECK:   call void @__enzyme_file_tape_free(i8* nonnull %segment1.i)
+
+; CHECK: define internal i8* @__enzyme_file_tape_malloc(i64 %size)
+; CHECK:   %total = add nuw nsw i64 %size, 16
+; CHECK-NEXT:   %[[small:.+]] = icmp ult i64 %size, 1048576
+; CHECK-NEXT:   br i1 %[[small]], label %heap, label %file
+; CHECK: file:
+; CHECK:   %fd = call i32 @mkstemp(i8* %[[path:.+]])
+; CHECK: resize:
+; CHECK-NEXT:   %{{.+}} = call i32 @unlink(i8* %[[path]])
+; CHECK-NEXT:   %{{.+}} = call i32 @ftruncate(i32 %fd, i64 %total)
+; CHECK: map:
+; CHECK-NEXT:   %mem = call i8* @mmap(i8* null, i64 %total, i32 3, i32 1, i32 %fd, i64 0)
+; CHECK-NEXT:   %{{.+}} = call i32 @close(i32 %fd)
+; CHECK: mapped:
+; CHECK:   store i64 %total, i64* %{{.+}}
+; CHECK: heap:
+; CHECK-NEXT:   %[[h:.+]] = call i8* @malloc(i64 %total)
+; CHECK:   store i64 0, i64* %{{.+}}
+
+; CHECK: define internal i8** @__enzyme_segmentedallocation.filetape(i8** %table, i64 %iter, i64 %segment, i64 %size)
+; CHECK:   %{{.+}} = tail call noalias nonnull i8* @__enzyme_file_tape_malloc(i64 %size)
+
+; CHECK: define internal void @__enzyme_segmenteddeallocation.filetape(i8** %table, i64 %iter, i64 %segment)
+; CHECK:   tail call void @__enzyme_file_tape_free(i8* nonnull %segment1)
@@ -0,0 +1,58 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-narrow-int-cache -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+
+define double @f(double* %x, i32* %sel, i64* %off, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i1, %loop ]
+  %acc = phi double [ 0.000000e+00, %entry ], [ %acc1, %loop ]
+  %ps = getelementptr inbounds i32, i32* %sel, i64 %i
+  %s = load i32, i32* %ps, !range !0
+  %po = getelementptr inbounds i64, i64* %off, i64 %i
+  %o = load i64, i64* %po, !range !1
+  %s64 = zext i32 %s to i64
+  %k = add i64 %s64, %o
+  %px = getelementptr inbounds double, double* %x, i64 %k
+  %v = load double, double* %px
+  %m = fmul double %v, %v
+  %acc1 = fadd double %acc, %m
+  store i32 0, i32* %ps
+  store i64 0, i64* %po
+  %i1 = add nuw i64 %i, 1
+  %c = icmp eq i64 %i1, %n
+  br i1 %c, label %exit, label %loop
+
+exit:
+  ret double %acc1
+}
+
+define void @df(double* %x, double* %dx, i32* %sel, i64* %off, i64 %n) {
+entry:
+  call void (i8*, ...) @__enzyme_autodiff(i8* bitcast (double (double*, i32*, i64*, i64)* @f to i8*), double* %x, double* %dx, i32* %sel, i64* %off, i64 %n)
+  ret void
+}
+
+declare void @__enzyme_autodiff(i8*, ...)
+
+!0 = !{i32 0, i32 300}
+!1 = !{i64 -3, i64 4}
+
+; The cached offset %k lies in [-3, 302], so it is stored as a sign extended i16
+
+; CHECK: define internal void @diffef(double* %x, double* %"x'", i32* %sel, i64* %off, i64 %n, double %differeturn)
+; CHECK:   %mallocsize5 = mul nuw nsw i64 %n, 2
+; CHECK-NEXT:   %malloccall6 = tail call noalias nonnull i8* @malloc(i64 %mallocsize5)
+; CHECK-NEXT:   %k_malloccache = bitcast i8* %malloccall6 to i16*
+
+; CHECK: loop:
+; CHECK:   %k = add i64 %s64, %o
+; CHECK:   %1 = trunc i64 %k to i16
+; CHECK-NEXT:   %2 = getelementptr inbounds i16, i16* %k_malloccache, i64 %iv
+; CHECK-NEXT:   store i16 %1, i16* %2, align 2, !invariant.group
+
+; CHECK: invertloop:
+; CHECK:   %7 = getelementptr inbounds i16, i16* %k_malloccache, i64 %"iv'ac.0"
+; CHECK-NEXT:   %8 = load i16, i16* %7, align 2, !invariant.group
+; CHECK-NEXT:   %9 = sext i16 %8 to i64
+; CHECK-NEXT:   %"px'ipg_unwrap" = getelementptr inbounds double, double* %"x'", i64 %9
@@ -0,0 +1,59 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-narrow-int-cache -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+
+define double @f(double* %x, i32* %sel, i64* %off, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i1, %loop ]
+  %acc = phi double [ 0.000000e+00, %entry ], [ %acc1, %loop ]
+  %ps = getelementptr inbounds i32, i32* %sel, i64 %i
+  %s = load i32, i32* %ps
+  %s64 = zext i32 %s to i64
+  %q = and i64 %s64, 8
+  %k = or i64 %q, 3
+  %po = getelementptr inbounds i64, i64* %off, i64 %i
+  %o = load i64, i64* %po, !range !0
+  %px = getelementptr inbounds double, double* %x, i64 %k
+  %v = load double, double* %px
+  %py = getelementptr inbounds double, double* %x, i64 %o
+  %w = load double, double* %py
+  %m = fmul double %v, %w
+  %acc1 = fadd double %acc, %m
+  store i32 0, i32* %ps
+  store i64 0, i64* %po
+  %i1 = add nuw i64 %i, 1
+  %c = icmp eq i64 %i1, %n
+  br i1 %c, label %exit, label %loop
+
+exit:
+  ret double %acc1
+}
+
+define void @df(double* %x, double* %dx, i32* %sel, i64* %off, i64 %n) {
+entry:
+  call void (i8*, ...) @__enzyme_autodiff(i8* bitcast (double (double*, i32*, i64*, i64)* @f to i8*), double* %x, double* %dx, i32* %sel, i64* %off, i64 %n)
+  ret void
+}
+
+declare void @__enzyme_autodiff(i8*, ...)
+
+!0 = !{i64 5, i64 7}
+
+; %o is either 5 or 6, so whether it is 6 is stored as an i1 and selected back
+
+; CHECK: define internal void @diffef(double* %x, double* %"x'", i32* %sel, i64* %off, i64 %n, double %differeturn)
+; CHECK:   %[[omem:.+]] = tail call noalias nonnull i8* @malloc(i64 %n)
+; CHECK-NEXT:   %o_malloccache = bitcast i8* %[[omem]] to i1*
+
+; CHECK: loop:
+; CHECK:   %o = load i64, i64* %po, align 4, !range !0
+; CHECK:   %[[ishigh:.+]] = icmp eq i64 %o, 6
+; CHECK-NEXT:   %[[oslot:.+]] = getelementptr inbounds i1, i1* %o_malloccache, i64 %iv
+; CHECK-NEXT:   store i1 %[[ishigh]], i1* %[[oslot]], align 1, !invariant.group
+
+; CHECK: invertloop:
+; CHECK:   %[[oslot2:.+]] = getelementptr inbounds i1, i1* %o_malloccache, i64 %"iv'ac.0"
+; CHECK-NEXT:   %[[bit:.+]] = load i1, i1* %[[oslot2]], align 1, !invariant.group
+; CHECK-NEXT:   %[[oval:.+]] = select i1 %[[bit]], i64 6, i64 5
+; CHECK-NEXT:   %"py'ipg_unwrap" = getelementptr inbounds double, double* %"x'", i64 %[[oval]]
@@ -0,0 +1,120 @@
+; RUN: if [ %llvmver -ge 9 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-privatize-shadows=64 -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+
+source_filename = "ompprivatize.c"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+%struct.ident_t = type { i32, i32, i32, i32, i8* }
+
+@0 = private unnamed_addr constant [23 x i8] c";unknown;unknown;0;0;;\00", align 1
+@1 = private unnamed_addr constant %struct.ident_t { i32 0, i32 514, i32 0, i32 0, i8* getelementptr inbounds ([23 x i8], [23 x i8]* @0, i32 0, i32 0) }, align 8
+@2 = private unnamed_addr constant %struct.ident_t { i32 0, i32 2, i32 0, i32 0, i8* getelementptr inbounds ([23 x i8], [23 x i8]* @0, i32 0, i32 0) }, align 8
+
+define void @dtest([4 x double]* %w, [4 x double]* %dw, double* %x, double* %dx, double* %out, double* %dout, i64 %n) {
+entry:
+  call void (i8*, ...) @__enzyme_autodiff(i8* bitcast (void ([4 x double]*, double*, double*, i64)* @f to i8*), [4 x double]* %w, [4 x double]* %dw, double* %x, double* %dx, double* %out, double* %dout, i64 %n)
+  ret void
+}
+
+declare void @__enzyme_autodiff(i8*, ...)
+
+define internal void @f([4 x double]* %w, double* %x, double* %out, i64 %n) {
+entry:
+  tail call void (%struct.ident_t*, i32, void (i32*, i32*, ...)*, ...) @__kmpc_fork_call(%struct.ident_t* nonnull @2, i32 4, void (i32*, i32*, ...)* bitcast (void (i32*, i32*, i64, [4 x double]*, double*, double*)* @.omp_outlined. to void (i32*, i32*, ...)*), i64 %n, [4 x double]* %w, double* %x, double* %out)
+  ret void
+}
+
+define internal void @.omp_outlined.(i32* noalias nocapture readonly %.global_tid., i32* noalias nocapture readnone %.bound_tid., i64 %length, [4 x double]* nocapture nonnull readonly align 8 dereferenceable(32) %w, double* nocapture readonly %x, double* nocapture %out) {
+entry:
+  %.omp.lb = alloca i64, align 8
+  %.omp.ub = alloca i64, align 8
+  %.omp.stride = alloca i64, align 8
+  %.omp.is_last = alloca i32, align 4
+  %sub4 = add i64 %length, -1
+  %cmp.not = icmp eq i64 %length, 0
+  br i1 %cmp.not, label %omp.precond.end, label %omp.precond.then
+
+omp.precond.then:
+  store i64 0, i64* %.omp.lb, align 8
+  store i64 %sub4, i64* %.omp.ub, align 8
+  store i64 1, i64* %.omp.stride, align 8
+  store i32 0, i32* %.omp.is_last, align 4
+  %tid = load i32, i32* %.global_tid., align 4
+  call void @__kmpc_for_static_init_8u(%struct.ident_t* nonnull @1, i32 %tid, i32 34, i32* nonnull %.omp.is_last, i64* nonnull %.omp.lb, i64* nonnull %.omp.ub, i64* nonnull %.omp.stride, i64 1, i64 1)
+  %ub = load i64, i64* %.omp.ub, align 8
+  %cmp6 = icmp ugt i64 %ub, %sub4
+  %cond = select i1 %cmp6, i64 %sub4, i64 %ub
+  store i64 %cond, i64* %.omp.ub, align 8
+  %lb = load i64, i64* %.omp.lb, align 8
+  %add29 = add i64 %cond, 1
+  %cmp730 = icmp ult i64 %lb, %add29
+  br i1 %cmp730, label %omp.inner.for.body, label %omp.loop.exit
+
+omp.inner.for.body:
+  %iv = phi i64 [ %iv.next, %omp.inner.for.body ], [ %lb, %omp.precond.then ]
+  %j = and i64 %iv, 3
+  %wp = getelementptr inbounds [4 x double], [4 x double]* %w, i64 0, i64 %j
+  %wv = load double, double* %wp, align 8
+  %w0p = getelementptr inbounds [4 x double], [4 x double]* %w, i64 0, i64 0
+  %w0 = load double, double* %w0p, align 8
+  %xp = getelementptr inbounds double, double* %x, i64 %iv
+  %xv = load double, double* %xp, align 8
+  %m = fmul double %wv, %xv
+  %m2 = fmul double %m, %w0
+  %op = getelementptr inbounds double, double* %out, i64 %iv
+  store double %m2, double* %op, align 8
+  %iv.next = add nuw i64 %iv, 1
+  %ub2 = load i64, i64* %.omp.ub, align 8
+  %add = add i64 %ub2, 1
+  %cmp7 = icmp ult i64 %iv.next, %add
+  br i1 %cmp7, label %omp.inner.for.body, label %omp.loop.exit
+
+omp.loop.exit:
+  call void @__kmpc_for_static_fini(%struct.ident_t* nonnull @1, i32 %tid)
+  br label %omp.precond.end
+
+omp.precond.end:
+  ret void
+}
+
+declare void @__kmpc_for_static_init_8u(%struct.ident_t*, i32, i32, i32*, i64*, i64*, i64*, i64, i64)
+declare void @__kmpc_for_static_fini(%struct.ident_t*, i32)
+declare !callback !0 void @__kmpc_fork_call(%struct.ident_t*, i32, void (i32*, i32*, ...)*, ...)
+
+!0 = !{!1}
+!1 = !{i64 2, i64 -1, i64 -1, i1 true}
+
+; CHECK: define internal void @diffe.omp_outlined.(i32* noalias nocapture readonly %.global_tid., i32* noalias nocapture readnone %.bound_tid., i64 %length, [4 x double]* nocapture nonnull readonly align 8 dereferenceable(32) %w, [4 x double]* nocapture %"w'", double* nocapture readonly %x, double* nocapture %"x'", double* nocapture %out, double* nocapture %"out'", { double*, double*, double* }* %tapeArg)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %"w'priv" = alloca [4 x double], align 16
+; CHECK-NEXT:   store [4 x double] zeroinitializer, [4 x double]* %"w'priv", align 8
+
+; CHECK: invertomp.inner.for.body:
+; CHECK:   %[[xadd:.+]] = atomicrmw fadd double* %"xp'ipg_unwrap", double %m1diffexv monotonic, align 8
+; CHECK-NEXT:   %"w0p'ipg_unwrap" = getelementptr inbounds [4 x double], [4 x double]* %"w'priv", i64 0, i64 0
+; CHECK-NEXT:   %[[w0:.+]] = load double, double* %"w0p'ipg_unwrap", align 8
+; CHECK-NEXT:   %[[w0a:.+]] = fadd fast double %[[w0]], %m1diffew0
+; CHECK-NEXT:   store double %[[w0a]], double* %"w0p'ipg_unwrap", align 8
+; CHECK-NEXT:   %j_unwrap = and i64 %_unwrap1, 3
+; CHECK-NEXT:   %"wp'ipg_unwrap" = getelementptr inbounds [4 x double], [4 x double]* %"w'priv", i64 0, i64 %j_unwrap
+; CHECK-NEXT:   %[[wj:.+]] = load double, double* %"wp'ipg_unwrap", align 8
+; CHECK-NEXT:   %[[wja:.+]] = fadd fast double %[[wj]], %m0diffewv
+; CHECK-NEXT:   store double %[[wja]], double* %"wp'ipg_unwrap", align 8
+
+; CHECK: invertentry_privred:
+; CHECK-NEXT:   %[[idx:.+]] = phi i64 [ 0, %invertentry ], [ %[[next:.+]], %invertentry_privinc ]
+; CHECK-NEXT:   %[[pp:.+]] = getelementptr inbounds [4 x double], [4 x double]* %"w'priv", i64 0, i64 %[[idx]]
+; CHECK-NEXT:   %[[pv:.+]] = load double, double* %[[pp]], align 8
+; CHECK-NEXT:   %[[nz:.+]] = fcmp une double %[[pv]], 0.000000e+00
+; CHECK-NEXT:   br i1 %[[nz]], label %invertentry_privadd, label %invertentry_privinc
+
+; CHECK: invertentry_privadd:
+; CHECK-NEXT:   %[[sc:.+]] = bitcast [4 x double]* %"w'" to double*
+; CHECK-NEXT:   %[[sp:.+]] = getelementptr inbounds double, double* %[[sc]], i64 %[[idx]]
+; CHECK-NEXT:   %[[r:.+]] = atomicrmw fadd double* %[[sp]], double %[[pv]] monotonic, align 8
+; CHECK-NEXT:   br label %invertentry_privinc
+
+; CHECK: invertentry_privinc:
+; CHECK-NEXT:   %[[next]] = add nuw nsw i64 %[[idx]], 1
+; CHECK-NEXT:   %[[done:.+]] = icmp eq i64 %[[next]], 4
+; CHECK-NEXT:   br i1 %[[done]], label %invertentry_privend, label %invertentry_privred
@@ -0,0 +1,44 @@
+; RUN: rm -rf %t %t.ll
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-dir=%t -S -o /dev/null; fi
+; Differentiating with an enzyme_workspace serves allocations from it, so the
+; derivative cached without one must not be reused.
+; RUN: sed -e 's/to i8\*), double %x/to i8*), metadata !"enzyme_workspace", %workspace* %w, double %x/' %s > %t.ll
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %t.ll %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-dir=%t -enzyme-print -S 2>&1 | FileCheck --check-prefix=MISS %s; fi
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-dir=%t -enzyme-print -S -o /dev/null 2>&1 | FileCheck --check-prefix=HIT %s; fi
+
+%workspace = type { i8*, i64, i64, i64 }
+
+declare double @llvm.sin.f64(double)
+
+define double @f(double %x, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i1, %loop ]
+  %v = phi double [ %x, %entry ], [ %v1, %loop ]
+  %s = call double @llvm.sin.f64(double %v)
+  %v1 = fmul double %s, %v
+  %i1 = add nuw i64 %i, 1
+  %c = icmp eq i64 %i1, %n
+  br i1 %c, label %exit, label %loop
+
+exit:
+  ret double %v1
+}
+
+define double @df(double %x, i64 %n, %workspace* %w) {
+entry:
+  %r = call double (i8*, ...) @__enzyme_autodiff(i8* bitcast (double (double, i64)* @f to i8*), double %x, i64 %n)
+  ret double %r
+}
+
+declare double @__enzyme_autodiff(i8*, ...)
+
+; MISS: after simplification
+; MISS: define internal { double } @diffef(double %x, i64 %n, double %differeturn)
+; MISS: load i8*, i8** @__enzyme_workspace
+
+; HIT: prefn:
+; HIT-NOT: after simplification
+; HIT: postfn:
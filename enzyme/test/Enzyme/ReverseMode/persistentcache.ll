@@ -0,0 +1,69 @@
+; RUN: rm -rf %t
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-dir=%t -mem2reg -instsimplify -simplifycfg -S | FileCheck %s
+; RUN: ls %t | FileCheck --check-prefix=FILES %s
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-dir=%t -mem2reg -instsimplify -simplifycfg -S | FileCheck %s
+; The second compilation reloads the derivative rather than generating it.
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-cache-dir=%t -enzyme-print -S -o /dev/null 2>&1 | FileCheck --check-prefix=HIT %s
+
+@scale = internal global double 2.000000e+00
+
+define internal double @square(double %x) {
+entry:
+  %s = load double, double* @scale
+  %mul = fmul double %x, %x
+  %res = fmul double %mul, %s
+  ret double %res
+}
+
+define double @tester(double %x) {
+entry:
+  %sq = call double @square(double %x)
+  %res = fadd double %sq, %x
+  ret double %res
+}
+
+define double @test_derivative(double %x) {
+entry:
+  %0 = tail call double (double (double)*, ...) @__enzyme_autodiff(double (double)* nonnull @tester, double %x)
+  ret double %0
+}
+
+declare double @__enzyme_autodiff(double (double)*, ...)
+
+; CHECK: define double @test_derivative(double %x)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %0 = call { double } @diffetester(double %x, double 1.000000e+00)
+; CHECK-NEXT:   %1 = extractvalue { double } %0, 0
+; CHECK-NEXT:   ret double %1
+; CHECK-NEXT: }
+
+; CHECK: define internal { double } @diffetester(double %x, double %differeturn)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %0 = call { double } @diffesquare(double %x, double %differeturn)
+; CHECK-NEXT:   %1 = extractvalue { double } %0, 0
+; CHECK-NEXT:   %2 = fadd fast double %differeturn, %1
+; CHECK-NEXT:   %3 = insertvalue { double } undef, double %2, 0
+; CHECK-NEXT:   ret { double } %3
+; CHECK-NEXT: }
+
+; CHECK: define internal { double } @diffesquare(double %x, double %differeturn)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %s = load double, double* @scale, align 8
+; CHECK-NEXT:   %m0diffemul = fmul fast double %differeturn, %s
+; CHECK-NEXT:   %m0diffex = fmul fast double %m0diffemul, %x
+; CHECK-NEXT:   %m1diffex = fmul fast double %m0diffemul, %x
+; CHECK-NEXT:   %0 = fadd fast double %m0diffex, %m1diffex
+; CHECK-NEXT:   %1 = insertvalue { double } undef, double %0, 0
+; CHECK-NEXT:   ret { double } %1
+; CHECK-NEXT: }
+
+; Both derivatives are cached, that of @square on its own and within that of
+; @tester.
+; FILES: {{^[0-9a-f]+\.bc$}}
+; FILES-NEXT: {{^[0-9a-f]+\.bc$}}
+; FILES-NOT: tmp
+
+; HIT: prefn:
+; HIT-NOT: after simplification
+; HIT-NOT: @diffesquare
+; HIT: postfn:
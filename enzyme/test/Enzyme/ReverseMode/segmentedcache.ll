@@ -0,0 +1,156 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-segmented-cache=16 -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+
+declare double @llvm.sin.f64(double)
+
+; Newton-like iteration whose trip count depends on the data
+define double @f(double %x) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i1, %loop ]
+  %v = phi double [ %x, %entry ], [ %v1, %loop ]
+  %s = call double @llvm.sin.f64(double %v)
+  %m = fmul double %s, %v
+  %v1 = fsub double %v, %m
+  %i1 = add nuw i64 %i, 1
+  %c = fcmp olt double %m, 1.000000e-08
+  br i1 %c, label %exit, label %loop
+
+exit:
+  ret double %v1
+}
+
+define double @df(double %x) {
+entry:
+  %r = call double (i8*, ...) @__enzyme_autodiff(i8* bitcast (double (double)* @f to i8*), double %x)
+  ret double %r
+}
+
+declare double @__enzyme_autodiff(i8*, ...)
+
+; CHECK: define internal { double } @diffef(double %x, double %differeturn)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   br label %loop
+
+; CHECK: loop:
+; CHECK-NEXT:   %v_cache.0 = phi double** [ null, %entry ], [ %11, %__enzyme_segmentedallocation.exit ]
+; CHECK-NEXT:   %iv = phi i64 [ %iv.next, %__enzyme_segmentedallocation.exit ], [ 0, %entry ]
+; CHECK-NEXT:   %v = phi double [ %x, %entry ], [ %v1, %__enzyme_segmentedallocation.exit ]
+; CHECK-NEXT:   %iv.next = add nuw nsw i64 %iv, 1
+; CHECK-NEXT:   %0 = bitcast double** %v_cache.0 to i8**
+; CHECK-NEXT:   %1 = urem i64 %iv, 16
+; CHECK-NEXT:   %2 = icmp eq i64 %1, 0
+; CHECK-NEXT:   br i1 %2, label %push.i, label %__enzyme_segmentedallocation.exit
+
+; CHECK: push.i:
+; CHECK-NEXT:   %3 = udiv i64 %iv, 16
+; CHECK-NEXT:   %4 = bitcast i8** %0 to i8*
+; CHECK-NEXT:   %5 = add nuw nsw i64 %3, 1
+; CHECK-NEXT:   %6 = call i8* @__enzyme_exponentialallocation(i8* %4, i64 %5, i64 8)
+; CHECK-NEXT:   %7 = bitcast i8* %6 to i8**
+; CHECK-NEXT:   %8 = call noalias nonnull i8* @malloc(i64 128)
+; CHECK-NEXT:   %9 = getelementptr inbounds i8*, i8** %7, i64 %3
+; CHECK-NEXT:   store i8* %8, i8** %9, align 8
+; CHECK-NEXT:   br label %__enzyme_segmentedallocation.exit
+
+; CHECK: __enzyme_segmentedallocation.exit:
+; CHECK-NEXT:   %10 = phi i8** [ %7, %push.i ], [ %0, %loop ]
+; CHECK-NEXT:   %11 = bitcast i8** %10 to double**
+; CHECK-NEXT:   %12 = urem i64 %iv, 16
+; CHECK-NEXT:   %13 = udiv i64 %iv, 16
+; CHECK-NEXT:   %14 = getelementptr inbounds double*, double** %11, i64 %13
+; CHECK-NEXT:   %15 = load double*, double** %14, align 8
+; CHECK-NEXT:   %16 = getelementptr inbounds double, double* %15, i64 %12
+; CHECK-NEXT:   store double %v, double* %16, align 8, !invariant.group !0
+; CHECK-NEXT:   %s = call double @llvm.sin.f64(double %v)
+; CHECK-NEXT:   %m = fmul double %s, %v
+; CHECK-NEXT:   %v1 = fsub double %v, %m
+; CHECK-NEXT:   %c = fcmp olt double %m, 1.000000e-08
+; CHECK-NEXT:   br i1 %c, label %invertloop, label %loop
+
+; CHECK: invertentry:
+; CHECK-NEXT:   %17 = insertvalue { double } undef, double %34, 0
+; CHECK-NEXT:   %18 = bitcast double** %11 to i8*
+; CHECK-NEXT:   tail call void @free(i8* nonnull %18)
+; CHECK-NEXT:   ret { double } %17
+
+; CHECK: invertloop:
+; CHECK-NEXT:   %"x'de.0" = phi double [ %34, %incinvertloop ], [ 0.000000e+00, %__enzyme_segmentedallocation.exit ]
+; CHECK-NEXT:   %"v1'de.0" = phi double [ %32, %incinvertloop ], [ %differeturn, %__enzyme_segmentedallocation.exit ]
+; CHECK-NEXT:   %"iv'ac.0" = phi i64 [ %39, %incinvertloop ], [ %iv, %__enzyme_segmentedallocation.exit ]
+; CHECK-NEXT:   %19 = fneg fast double %"v1'de.0"
+; CHECK-NEXT:   %20 = urem i64 %"iv'ac.0", 16
+; CHECK-NEXT:   %21 = udiv i64 %"iv'ac.0", 16
+; CHECK-NEXT:   %22 = getelementptr inbounds double*, double** %11, i64 %21
+; CHECK-NEXT:   %23 = load double*, double** %22, align 8
+; CHECK-NEXT:   %24 = getelementptr inbounds double, double* %23, i64 %20
+; CHECK-NEXT:   %25 = load double, double* %24, align 8, !invariant.group !0
+; CHECK-NEXT:   %m0diffes = fmul fast double %19, %25
+; CHECK-NEXT:   %26 = call double @llvm.sin.f64(double %25)
+; CHECK-NEXT:   %m1diffev = fmul fast double %19, %26
+; CHECK-NEXT:   %27 = fadd fast double %"v1'de.0", %m1diffev
+; CHECK-NEXT:   %28 = call fast double @llvm.cos.f64(double %25)
+; CHECK-NEXT:   %29 = fmul fast double %m0diffes, %28
+; CHECK-NEXT:   %30 = fadd fast double %27, %29
+; CHECK-NEXT:   %31 = icmp eq i64 %"iv'ac.0", 0
+; CHECK-NEXT:   %32 = select fast i1 %31, double 0.000000e+00, double %30
+; CHECK-NEXT:   %33 = fadd fast double %"x'de.0", %30
+; CHECK-NEXT:   %34 = select fast i1 %31, double %33, double %"x'de.0"
+; CHECK-NEXT:   %35 = urem i64 %"iv'ac.0", 16
+; CHECK-NEXT:   %36 = icmp eq i64 %35, 0
+; CHECK-NEXT:   br i1 %36, label %release.i, label %__enzyme_segmenteddeallocation.exit
+
+; CHECK: release.i:
+; CHECK-NEXT:   %37 = udiv i64 %"iv'ac.0", 16
+; CHECK-NEXT:   %38 = getelementptr inbounds i8*, i8** %10, i64 %37
+; CHECK-NEXT:   %segment1.i = load i8*, i8** %38, align 8
+; CHECK-NEXT:   call void @free(i8* nonnull %segment1.i)
+; CHECK-NEXT:   br label %__enzyme_segmenteddeallocation.exit
+
+; CHECK: __enzyme_segmenteddeallocation.exit:
+; CHECK-NEXT:   br i1 %31, label %invertentry, label %incinvertloop
+
+; CHECK: incinvertloop:
+; CHECK-NEXT:   %39 = add nsw i64 %"iv'ac.0", -1
+; CHECK-NEXT:   br label %invertloop
+; CHECK-NEXT: }
+
+; CHECK: define internal i8** @__enzyme_segmentedallocation(i8** %table, i64 %iter, i64 %segment, i64 %size)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %0 = urem i64 %iter, %segment
+; CHECK-NEXT:   %1 = icmp eq i64 %0, 0
+; CHECK-NEXT:   br i1 %1, label %push, label %ok
+
+; CHECK: push:
+; CHECK-NEXT:   %2 = udiv i64 %iter, %segment
+; CHECK-NEXT:   %3 = bitcast i8** %table to i8*
+; CHECK-NEXT:   %4 = add nuw nsw i64 %2, 1
+; CHECK-NEXT:   %5 = call i8* @__enzyme_exponentialallocation(i8* %3, i64 %4, i64 8)
+; CHECK-NEXT:   %6 = bitcast i8* %5 to i8**
+; CHECK-NEXT:   %7 = tail call noalias nonnull i8* @malloc(i64 %size)
+; CHECK-NEXT:   %8 = getelementptr inbounds i8*, i8** %6, i64 %2
+; CHECK-NEXT:   store i8* %7, i8** %8, align 8
+; CHECK-NEXT:   br label %ok
+
+; CHECK: ok:
+; CHECK-NEXT:   %9 = phi i8** [ %6, %push ], [ %table, %entry ]
+; CHECK-NEXT:   ret i8** %9
+; CHECK-NEXT: }
+
+; CHECK: define internal void @__enzyme_segmenteddeallocation(i8** %table, i64 %iter, i64 %segment)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %0 = urem i64 %iter, %segment
+; CHECK-NEXT:   %1 = icmp eq i64 %0, 0
+; CHECK-NEXT:   br i1 %1, label %release, label %end
+
+; CHECK: release:
+; CHECK-NEXT:   %2 = udiv i64 %iter, %segment
+; CHECK-NEXT:   %3 = getelementptr inbounds i8*, i8** %table, i64 %2
+; CHECK-NEXT:   %segment1 = load i8*, i8** %3, align 8
+; CHECK-NEXT:   tail call void @free(i8* nonnull %segment1)
+; CHECK-NEXT:   br label %end
+
+; CHECK: end:
+; CHECK-NEXT:   ret void
+; CHECK-NEXT: }
@@ -0,0 +1,38 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-time-report-json=%t -S -o /dev/null && cat %t | FileCheck %s
+
+define double @square(double %x) {
+entry:
+  %mul = fmul fast double %x, %x
+  ret double %mul
+}
+
+define double @tester(double %x) {
+entry:
+  %call = call double @square(double %x)
+  %add = fadd fast double %call, %x
+  ret double %add
+}
+
+define double @test_derivative(double %x) {
+entry:
+  %0 = tail call double (double (double)*, ...) @__enzyme_autodiff(double (double)* nonnull @tester, double %x)
+  ret double %0
+}
+
+declare double @__enzyme_autodiff(double (double)*, ...)
+
+; CHECK: {
+; CHECK-NEXT:   "module": "<stdin>",
+; CHECK-NEXT:   "phases": {
+; CHECK-NEXT:     "preprocess": {"wall": {{[0-9.]+}}, "user": {{[0-9.]+}}, "system": {{[0-9.]+}}, "calls": 2, "peak_malloc_bytes": {{[0-9]+}}},
+; CHECK-NEXT:     "typeanalysis": {"wall": {{[0-9.]+}}, "user": {{[0-9.]+}}, "system": {{[0-9.]+}}, "calls": {{[1-9][0-9]*}}, "peak_malloc_bytes": {{[0-9]+}}},
+; CHECK-NEXT:     "activityanalysis": {"wall": {{[0-9.]+}}, "user": {{[0-9.]+}}, "system": {{[0-9.]+}}, "calls": {{[1-9][0-9]*}}, "peak_malloc_bytes": {{[0-9]+}}},
+; CHECK-NEXT:     "mincut": {"wall": {{[0-9.]+}}, "user": {{[0-9.]+}}, "system": {{[0-9.]+}}, "calls": {{[0-9]+}}, "peak_malloc_bytes": {{[0-9]+}}},
+; CHECK-NEXT:     "synthesis": {"wall": {{[0-9.]+}}, "user": {{[0-9.]+}}, "system": {{[0-9.]+}}, "calls": 2, "peak_malloc_bytes": {{[0-9]+}}},
+; CHECK-NEXT:     "postopt": {"wall": {{[0-9.]+}}, "user": {{[0-9.]+}}, "system": {{[0-9.]+}}, "calls": 0, "peak_malloc_bytes": 0}
+; CHECK-NEXT:   },
+; CHECK-NEXT:   "functions": {
+; CHECK-NEXT:     "square (ReverseModeCombined)": {"wall": {{[0-9.]+}}, "user": {{[0-9.]+}}, "system": {{[0-9.]+}}, "calls": 1, "peak_malloc_bytes": {{[0-9]+}}},
+; CHECK-NEXT:     "tester (ReverseModeCombined)": {"wall": {{[0-9.]+}}, "user": {{[0-9.]+}}, "system": {{[0-9.]+}}, "calls": 1, "peak_malloc_bytes": {{[0-9]+}}}
+; CHECK-NEXT:   }
+; CHECK-NEXT: }
@@ -0,0 +1,53 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -S -o /dev/null 2> %t.serial
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-type-analysis-threads=2 -S -o /dev/null 2> %t.two
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-type-analysis-threads=4 -S -o /dev/null 2> %t.four
+; RUN: diff %t.two %t.four
+; RUN: sort %t.serial > %t.serial.sorted
+; RUN: sort %t.four > %t.four.sorted
+; RUN: diff %t.serial.sorted %t.four.sorted
+; RUN: FileCheck %s < %t.four
+; RUN: not grep -v '^not handling more than 6 pointer lookups deep dt:{[^}]*} only(-1): {[^}]*}$' %t.four
+
+; Functions analyzed concurrently warn about too deep type trees. Each
+; function's warnings must be printed whole and in the same order regardless
+; of the number of threads. Without threads, functions are analyzed as they
+; are differentiated, which orders the same warnings differently.
+
+define internal double @deepa(double******** %p) {
+entry:
+  %l1 = load double*******, double******** %p, align 8
+  %l2 = load double******, double******* %l1, align 8
+  %l3 = load double*****, double****** %l2, align 8
+  %l4 = load double****, double***** %l3, align 8
+  %l5 = load double***, double**** %l4, align 8
+  %l6 = load double**, double*** %l5, align 8
+  %l7 = load double*, double** %l6, align 8
+  %l8 = load double, double* %l7, align 8
+  %mul = fmul double %l8, %l8
+  ret double %mul
+}
+
+define internal double @deepb(double******** %p) {
+entry:
+  %l1 = load double*******, double******** %p, align 8
+  %l2 = load double******, double******* %l1, align 8
+  %l3 = load double*****, double****** %l2, align 8
+  %l4 = load double****, double***** %l3, align 8
+  %l5 = load double***, double**** %l4, align 8
+  %l6 = load double**, double*** %l5, align 8
+  %l7 = load double*, double** %l6, align 8
+  %l8 = load double, double* %l7, align 8
+  %add = fadd double %l8, %l8
+  ret double %add
+}
+
+define void @test_derivatives(double******** %p, double******** %dp) {
+entry:
+  %0 = call double (...) @__enzyme_autodiff(double (double********)* @deepa, double******** %p, double******** %dp)
+  %1 = call double (...) @__enzyme_autodiff(double (double********)* @deepb, double******** %p, double******** %dp)
+  ret void
+}
+
+declare double @__enzyme_autodiff(...)
+
+; CHECK: not handling more than 6 pointer lookups deep
@@ -0,0 +1,70 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -S -o %t.serial
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -enzyme-type-analysis-threads=4 -mem2reg -instsimplify -simplifycfg -S -o %t.parallel
+; RUN: diff %t.serial %t.parallel
+; RUN: FileCheck %s < %t.parallel
+
+; The functions differentiated by each call are analyzed concurrently, which
+; must give the same derivatives as analyzing them one after another.
+
+%struct.pair = type { i64, double }
+
+define internal double @square(double %x) {
+entry:
+  %mul = fmul double %x, %x
+  ret double %mul
+}
+
+define internal double @sum(double* %x, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %next, %loop ]
+  %acc = phi double [ 0.000000e+00, %entry ], [ %add, %loop ]
+  %gep = getelementptr inbounds double, double* %x, i64 %i
+  %ld = load double, double* %gep, align 8
+  %sq = call double @square(double %ld)
+  %add = fadd double %acc, %sq
+  %next = add nuw nsw i64 %i, 1
+  %cmp = icmp ult i64 %next, %n
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret double %add
+}
+
+define internal double @second(%struct.pair* %p) {
+entry:
+  %gep = getelementptr inbounds %struct.pair, %struct.pair* %p, i64 0, i32 1
+  %ld = load double, double* %gep, align 8
+  %sq = call double @square(double %ld)
+  ret double %sq
+}
+
+define internal double @cube(double %x) {
+entry:
+  %sq = call double @square(double %x)
+  %mul = fmul double %sq, %x
+  ret double %mul
+}
+
+define void @test_derivatives(double* %x, double* %dx, i64 %n, %struct.pair* %p, %struct.pair* %dp) {
+entry:
+  %0 = call double (...) @__enzyme_autodiff(double (double*, i64)* @sum, double* %x, double* %dx, i64 %n)
+  %1 = call double (...) @__enzyme_autodiff(double (%struct.pair*)* @second, %struct.pair* %p, %struct.pair* %dp)
+  %2 = call double (...) @__enzyme_autodiff(double (double)* @cube, double 2.000000e+00)
+  ret void
+}
+
+declare double @__enzyme_autodiff(...)
+
+; CHECK: define void @test_derivatives
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   call void @diffesum(double* %x, double* %dx, i64 %n, double 1.000000e+00)
+; CHECK-NEXT:   call void @diffesecond(%struct.pair* %p, %struct.pair* %dp, double 1.000000e+00)
+; CHECK-NEXT:   %0 = call { double } @diffecube(double 2.000000e+00, double 1.000000e+00)
+; CHECK-NEXT:   ret void
+
+; CHECK: define internal void @diffesum(double* %x, double* %"x'", i64 %n, double %differeturn)
+; CHECK: define internal void @diffesecond(%struct.pair* %p, %struct.pair* %"p'", double %differeturn)
+; CHECK: define internal { double } @diffecube(double %x, double %differeturn)
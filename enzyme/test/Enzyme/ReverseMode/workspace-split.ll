@@ -0,0 +1,77 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+
+%struct.ws = type { i8*, i64, i64, i64 }
+
+declare double @llvm.sin.f64(double)
+
+define double @f(double %x, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i1, %loop ]
+  %v = phi double [ %x, %entry ], [ %v1, %loop ]
+  %s = call double @llvm.sin.f64(double %v)
+  %v1 = fmul double %s, %v
+  %i1 = add nuw i64 %i, 1
+  %c = icmp eq i64 %i1, %n
+  br i1 %c, label %exit, label %loop
+
+exit:
+  ret double %v1
+}
+
+define i8* @aug(double %x, i64 %n, %struct.ws* %w) {
+entry:
+  %a = call { i8*, double } (i8*, ...) @__enzyme_augmentfwd(i8* bitcast (double (double, i64)* @f to i8*), metadata !"enzyme_workspace", %struct.ws* %w, double %x, i64 %n)
+  %t = extractvalue { i8*, double } %a, 0
+  ret i8* %t
+}
+
+define double @rev(double %x, i64 %n, i8* %t) {
+entry:
+  %r = call double (i8*, ...) @__enzyme_reverse(i8* bitcast (double (double, i64)* @f to i8*), double %x, i64 %n, double 1.000000e+00, i8* %t)
+  ret double %r
+}
+
+declare { i8*, double } @__enzyme_augmentfwd(i8*, ...)
+
+declare double @__enzyme_reverse(i8*, ...)
+
+; The tape of the augmented forward pass stays in the workspace
+; CHECK: define i8* @aug(double %x, i64 %n, %struct.ws* %w)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %prevworkspace = load i8*, i8** @__enzyme_workspace, align 8
+; CHECK-NEXT:   %0 = bitcast %struct.ws* %w to i8*
+; CHECK-NEXT:   store i8* %0, i8** @__enzyme_workspace, align 8
+; CHECK-NEXT:   %1 = call { i8*, double } @augmented_f(double %x, i64 %n)
+; CHECK-NEXT:   store i8* %prevworkspace, i8** @__enzyme_workspace, align 8
+; CHECK-NEXT:   %t = extractvalue { i8*, double } %1, 0
+; CHECK-NEXT:   ret i8* %t
+; CHECK-NEXT: }
+
+; CHECK: define internal { i8*, double } @augmented_f(double %x, i64 %n)
+; CHECK:   %tapemem = bitcast i8* %malloccall{{.*}} to { double*, i8* }*
+; CHECK:   %workspace = load i8*, i8** @__enzyme_workspace, align 8
+; CHECK-NEXT:   %[[wsslot:.+]] = getelementptr inbounds { double*, i8* }, { double*, i8* }* %tapemem, i32 0, i32 1
+; CHECK-NEXT:   store i8* %workspace, i8** %[[wsslot]], align 8
+
+; The reverse pass frees through the workspace recorded on the tape, even
+; though it is called without one
+; CHECK: define internal { double } @diffef(double %x, i64 %n, double %differeturn, i8* %tapeArg)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %0 = bitcast i8* %tapeArg to { double*, i8* }*
+; CHECK-NEXT:   %truetape = load { double*, i8* }, { double*, i8* }* %0, align 8
+; CHECK-NEXT:   %prevworkspace = load i8*, i8** @__enzyme_workspace, align 8
+; CHECK-NEXT:   %workspace = extractvalue { double*, i8* } %truetape, 1
+; CHECK-NEXT:   %1 = icmp eq i8* %workspace, null
+; CHECK-NEXT:   %2 = select i1 %1, i8* %prevworkspace, i8* %workspace
+; CHECK-NEXT:   store i8* %2, i8** @__enzyme_workspace, align 8
+; CHECK-NEXT:   %ws.i = load i8*, i8** @__enzyme_workspace, align 8
+; CHECK: release.i:
+; CHECK-NEXT:   call void @free(i8* %tapeArg)
+; CHECK: invertentry:
+; CHECK:   %ws.i7 = load i8*, i8** @__enzyme_workspace, align 8
+; CHECK: __enzyme_workspace_free.exit12:
+; CHECK-NEXT:   store i8* %prevworkspace, i8** @__enzyme_workspace, align 8
+; CHECK-NEXT:   ret { double } %14
@@ -0,0 +1,114 @@
+; RUN: if [ %llvmver -lt 16 ]; then %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -S | FileCheck %s; fi
+
+%struct.ws = type { i8*, i64, i64, i64 }
+
+declare double @llvm.sin.f64(double)
+
+define double @f(double %x, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i1, %loop ]
+  %v = phi double [ %x, %entry ], [ %v1, %loop ]
+  %s = call double @llvm.sin.f64(double %v)
+  %v1 = fmul double %s, %v
+  %i1 = add nuw i64 %i, 1
+  %c = icmp eq i64 %i1, %n
+  br i1 %c, label %exit, label %loop
+
+exit:
+  ret double %v1
+}
+
+define double @df(double %x, i64 %n, %struct.ws* %w) {
+entry:
+  %r = call double (i8*, ...) @__enzyme_autodiff(i8* bitcast (double (double, i64)* @f to i8*), metadata !"enzyme_workspace", %struct.ws* %w, double %x, i64 %n)
+  ret double %r
+}
+
+declare double @__enzyme_autodiff(i8*, ...)
+
+; CHECK: @__enzyme_workspace = internal thread_local global i8* null
+
+; CHECK: define double @df(double %x, i64 %n, %struct.ws* %w)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %prevworkspace = load i8*, i8** @__enzyme_workspace, align 8
+; CHECK-NEXT:   %0 = bitcast %struct.ws* %w to i8*
+; CHECK-NEXT:   store i8* %0, i8** @__enzyme_workspace, align 8
+; CHECK-NEXT:   %1 = bitcast %struct.ws* %w to { i8*, i64, i64, i64 }*
+; CHECK-NEXT:   %2 = getelementptr inbounds { i8*, i64, i64, i64 }, { i8*, i64, i64, i64 }* %1, i32 0, i32 2
+; CHECK-NEXT:   %workspacemark = load i64, i64* %2, align 4
+; CHECK-NEXT:   %3 = call { double } @diffef(double %x, i64 %n, double 1.000000e+00)
+; CHECK-NEXT:   store i64 %workspacemark, i64* %2, align 4
+; CHECK-NEXT:   store i8* %prevworkspace, i8** @__enzyme_workspace, align 8
+; CHECK-NEXT:   %4 = extractvalue { double } %3, 0
+; CHECK-NEXT:   ret double %4
+; CHECK-NEXT: }
+
+; CHECK: define internal { double } @diffef(double %x, i64 %n, double %differeturn)
+; CHECK:   %mallocsize = mul nuw nsw i64 %n, 8
+; CHECK-NEXT:   %ws.i = load i8*, i8** @__enzyme_workspace, align 8
+; CHECK:   %v_malloccache = bitcast i8* %malloccall3 to double*
+; CHECK: invertentry:
+; CHECK:   %ws.i4 = load i8*, i8** @__enzyme_workspace, align 8
+; CHECK: release.i:
+; CHECK-NEXT:   call void @free(i8* %malloccall3)
+
+; CHECK: define internal i8* @__enzyme_workspace_malloc(i64 %size)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %ws = load i8*, i8** @__enzyme_workspace, align 8
+; CHECK-NEXT:   %0 = icmp eq i8* %ws, null
+; CHECK-NEXT:   br i1 %0, label %fallback, label %arena
+
+; CHECK: arena:
+; CHECK-NEXT:   %1 = bitcast i8* %ws to { i8*, i64, i64, i64 }*
+; CHECK-NEXT:   %2 = getelementptr inbounds { i8*, i64, i64, i64 }, { i8*, i64, i64, i64 }* %1, i32 0, i32 0
+; CHECK-NEXT:   %3 = getelementptr inbounds { i8*, i64, i64, i64 }, { i8*, i64, i64, i64 }* %1, i32 0, i32 1
+; CHECK-NEXT:   %4 = getelementptr inbounds { i8*, i64, i64, i64 }, { i8*, i64, i64, i64 }* %1, i32 0, i32 2
+; CHECK-NEXT:   %5 = getelementptr inbounds { i8*, i64, i64, i64 }, { i8*, i64, i64, i64 }* %1, i32 0, i32 3
+; CHECK-NEXT:   %base = load i8*, i8** %2, align 8
+; CHECK-NEXT:   %cap = load i64, i64* %3, align 4
+; CHECK-NEXT:   %used = load i64, i64* %4, align 4
+; CHECK-NEXT:   %highwater = load i64, i64* %5, align 4
+; CHECK-NEXT:   %6 = ptrtoint i8* %base to i64
+; CHECK-NEXT:   %7 = add i64 %6, %used
+; CHECK-NEXT:   %8 = add i64 %7, 15
+; CHECK-NEXT:   %9 = and i64 %8, -16
+; CHECK-NEXT:   %start = sub i64 %9, %6
+; CHECK-NEXT:   %10 = add i64 %size, 15
+; CHECK-NEXT:   %11 = and i64 %10, -16
+; CHECK-NEXT:   %end = add i64 %start, %11
+; CHECK-NEXT:   store i64 %end, i64* %4, align 4
+; CHECK-NEXT:   %12 = icmp ugt i64 %end, %highwater
+; CHECK-NEXT:   %13 = select i1 %12, i64 %end, i64 %highwater
+; CHECK-NEXT:   store i64 %13, i64* %5, align 4
+; CHECK-NEXT:   %14 = icmp ule i64 %end, %cap
+; CHECK-NEXT:   br i1 %14, label %bump, label %fallback
+
+; CHECK: bump:
+; CHECK-NEXT:   %15 = getelementptr inbounds i8, i8* %base, i64 %start
+
+; CHECK: fallback:
+; CHECK-NEXT:   %16 = call i8* @malloc(i64 %size)
+
+; CHECK: define internal void @__enzyme_workspace_free(i8* %ptr)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %ws = load i8*, i8** @__enzyme_workspace, align 8
+; CHECK-NEXT:   %0 = icmp eq i8* %ws, null
+; CHECK-NEXT:   br i1 %0, label %release, label %arena
+
+; CHECK: arena:
+; CHECK-NEXT:   %1 = bitcast i8* %ws to { i8*, i64, i64, i64 }*
+; CHECK-NEXT:   %2 = getelementptr inbounds { i8*, i64, i64, i64 }, { i8*, i64, i64, i64 }* %1, i32 0, i32 0
+; CHECK-NEXT:   %base = load i8*, i8** %2, align 8
+; CHECK-NEXT:   %3 = getelementptr inbounds { i8*, i64, i64, i64 }, { i8*, i64, i64, i64 }* %1, i32 0, i32 1
+; CHECK-NEXT:   %cap = load i64, i64* %3, align 4
+; CHECK-NEXT:   %4 = ptrtoint i8* %base to i64
+; CHECK-NEXT:   %5 = ptrtoint i8* %ptr to i64
+; CHECK-NEXT:   %6 = sub i64 %5, %4
+; CHECK-NEXT:   %7 = icmp ult i64 %6, %cap
+; CHECK-NEXT:   br i1 %7, label %end, label %release
+
+; CHECK: release:
+; CHECK-NEXT:   call void @free(i8* %ptr)
@@ -0,0 +1,75 @@
+; RUN: %opt < %s %loadEnzyme -enzyme -enzyme-preopt=false -mem2reg -instsimplify -simplifycfg -S | FileCheck %s
+
+define void @f(double* %x, double* %y) {
+entry:
+  %x0 = load double, double* %x
+  %p1 = getelementptr inbounds double, double* %x, i64 1
+  %x1 = load double, double* %p1
+  %p2 = getelementptr inbounds double, double* %x, i64 2
+  %x2 = load double, double* %p2
+  %m = fmul double %x0, %x1
+  %m2 = fmul double %m, %x2
+  store double %m2, double* %y
+  %a = fadd double %x0, %x2
+  %q1 = getelementptr inbounds double, double* %y, i64 1
+  store double %a, double* %q1
+  ret void
+}
+
+declare void @__enzyme_jacobian(...)
+
+define void @jacobian(double* %x, double* %y, double* %J) {
+entry:
+  call void (...) @__enzyme_jacobian(void (double*, double*)* @f, double* %x, double* %y, double* %J, i64 3, i64 2)
+  ret void
+}
+
+; CHECK: define void @jacobian(double* %x, double* %y, double* %J)
+; CHECK-NEXT: entry:
+; CHECK-NEXT:   %malloccall = tail call noalias nonnull dereferenceable(80) dereferenceable_or_null(80) i8* @malloc(i64 80)
+; CHECK-NEXT:   %0 = bitcast i8* %malloccall to double*
+; CHECK-NEXT:   %1 = getelementptr double, double* %0, i64 4
+; CHECK-NEXT:   call void @llvm.memset.p0i8.i64(i8* align 8 %malloccall, i8 0, i64 32, i1 false)
+; CHECK-NEXT:   br label %jacobian.chunk.header
+
+; CHECK: jacobian.chunk.header:
+; CHECK-NEXT:   %jacobian.chunk = phi i64 [ 0, %entry ], [ %jacobian.chunk.next, %jacobian.chunk.body ]
+; CHECK-NEXT:   %2 = icmp ult i64 %jacobian.chunk, 2
+; CHECK-NEXT:   br i1 %2, label %jacobian.chunk.body, label %jacobian.chunk.exit
+
+; CHECK: jacobian.chunk.body:
+; CHECK-NEXT:   %3 = getelementptr double, double* %0, i64 %jacobian.chunk
+; CHECK-NEXT:   store double 1.000000e+00, double* %3, align 8
+; CHECK-NEXT:   %4 = mul i64 %jacobian.chunk, 3
+; CHECK-NEXT:   %5 = getelementptr double, double* %J, i64 %4
+; CHECK-NEXT:   %6 = bitcast double* %5 to i8*
+; CHECK-NEXT:   call void @llvm.memset.p0i8.i64(i8* align 8 %6, i8 0, i64 24, i1 false)
+; CHECK-NEXT:   %7 = add i64 %jacobian.chunk, 1
+; CHECK-NEXT:   %8 = icmp ult i64 %7, 2
+; CHECK-NEXT:   %9 = getelementptr double, double* %0, i64 2
+; CHECK-NEXT:   %10 = select i1 %8, i64 %7, i64 0
+; CHECK-NEXT:   %11 = getelementptr double, double* %9, i64 %10
+; CHECK-NEXT:   %12 = select i1 %8, double 1.000000e+00, double 0.000000e+00
+; CHECK-NEXT:   store double %12, double* %11, align 8
+; CHECK-NEXT:   %13 = getelementptr double, double* %1, i64 3
+; CHECK-NEXT:   %14 = mul i64 %7, 3
+; CHECK-NEXT:   %15 = getelementptr double, double* %J, i64 %14
+; CHECK-NEXT:   %16 = select i1 %8, double* %15, double* %13
+; CHECK-NEXT:   %17 = bitcast double* %16 to i8*
+; CHECK-NEXT:   call void @llvm.memset.p0i8.i64(i8* align 8 %17, i8 0, i64 24, i1 false)
+; CHECK-NEXT:   %18 = insertvalue [2 x double*] undef, double* %5, 0
+; CHECK-NEXT:   %19 = insertvalue [2 x double*] %18, double* %16, 1
+; CHECK-NEXT:   %20 = insertvalue [2 x double*] undef, double* %0, 0
+; CHECK-NEXT:   %21 = insertvalue [2 x double*] %20, double* %9, 1
+; CHECK-NEXT:   call void @diffe2f(double* %x, [2 x double*] %19, double* %y, [2 x double*] %21)
+; CHECK-NEXT:   store double 0.000000e+00, double* %3, align 8
+; CHECK-NEXT:   store double 0.000000e+00, double* %11, align 8
+; CHECK-NEXT:   %jacobian.chunk.next = add nuw i64 %jacobian.chunk, 2
+; CHECK-NEXT:   br label %jacobian.chunk.header
+
+; CHECK: jacobian.chunk.exit:
+; CHECK-NEXT:   tail call void @free(i8* nonnull %malloccall)
+; CHECK-NEXT:   ret void
+; CHECK-NEXT: }
+
+; CHECK: define internal void @diffe2f(double* %x, [2 x double*] %"x'", double* %y, [2 x double*] %"y'")
@@ -0,0 +1,67 @@
+// RUN: %clang -O0 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O1 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O2 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O3 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O0 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-batch-vectorize -S | %lli -
+// RUN: %clang -O2 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-batch-vectorize -S | %lli -
+
+#include "test_utils.h"
+#include <stdio.h>
+
+struct Vector {
+  double x1, x2, x3, x4;
+};
+
+extern Vector __enzyme_batch(...);
+
+extern int enzyme_width;
+extern int enzyme_vector;
+extern int enzyme_scalar;
+
+// A branch on the batched argument.
+double relu(double x, double a) {
+  if (x > 0)
+    return a * x;
+  return x;
+}
+
+// A loop whose trip count depends on the batched argument.
+double halvings(double x, double *out) {
+  int n = 0;
+  while (x > 1.0) {
+    x *= 0.5;
+    n++;
+  }
+  if (n > 3)
+    out[n % 4] = x;
+  return n + x;
+}
+
+Vector vecrelu(double x1, double x2, double x3, double x4, double a) {
+  return __enzyme_batch(relu, enzyme_width, 4, enzyme_vector, x1, x2, x3, x4,
+                        enzyme_scalar, a);
+}
+
+Vector vechalvings(double x1, double x2, double x3, double x4, double *out) {
+  return __enzyme_batch(halvings, enzyme_width, 4, enzyme_vector, x1, x2, x3,
+                        x4, enzyme_scalar, out);
+}
+
+int main() {
+  double vals[] = {-2.5, 3.0, 100.0, 17.0};
+
+  Vector result = vecrelu(vals[0], vals[1], vals[2], vals[3], 0.5);
+  APPROX_EQ(result.x1, relu(vals[0], 0.5), 1e-10);
+  APPROX_EQ(result.x2, relu(vals[1], 0.5), 1e-10);
+  APPROX_EQ(result.x3, relu(vals[2], 0.5), 1e-10);
+  APPROX_EQ(result.x4, relu(vals[3], 0.5), 1e-10);
+
+  double out[4] = {0}, expected_out[4] = {0};
+  result = vechalvings(vals[0], vals[1], vals[2], vals[3], out);
+  APPROX_EQ(result.x1, halvings(vals[0], expected_out), 1e-10);
+  APPROX_EQ(result.x2, halvings(vals[1], expected_out), 1e-10);
+  APPROX_EQ(result.x3, halvings(vals[2], expected_out), 1e-10);
+  APPROX_EQ(result.x4, halvings(vals[3], expected_out), 1e-10);
+  for (int i = 0; i < 4; i++)
+    APPROX_EQ(out[i], expected_out[i], 1e-10);
+}
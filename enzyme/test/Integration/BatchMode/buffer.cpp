@@ -0,0 +1,69 @@
+// RUN: %clang -O0 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O1 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O2 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O3 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O0 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-batch-vectorize -S | %lli -
+// RUN: %clang -O2 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-batch-vectorize -S | %lli -
+
+#include "test_utils.h"
+#include <stdio.h>
+#include <string.h>
+
+extern void __enzyme_batch(...);
+
+extern int enzyme_width;
+extern int enzyme_buffer;
+extern int enzyme_scalar;
+
+struct Particle {
+  double pos, vel;
+};
+
+double last;
+
+// Loads and stores through a pointer into a buffer of structs.
+void step(Particle *p, double dt) {
+  p->pos += dt * p->vel;
+  last = p->pos;
+}
+
+// Copies between two buffers whose lanes are as wide as the copy.
+void reset(Particle *p, const Particle *init) {
+  memcpy(p, init, sizeof(Particle));
+}
+
+void vecstep(Particle *ps, double dt) {
+  __enzyme_batch(step, enzyme_width, 4, enzyme_buffer, sizeof(Particle), ps,
+                 enzyme_scalar, dt);
+}
+
+void vecreset(Particle *ps, const Particle *init) {
+  __enzyme_batch(reset, enzyme_width, 4, enzyme_buffer, sizeof(Particle), ps,
+                 enzyme_buffer, sizeof(Particle), init);
+}
+
+int main() {
+  Particle init[4] = {{0.0, 1.0}, {1.0, -2.0}, {2.0, 0.5}, {3.0, 4.0}};
+  Particle ps[4], expected[4];
+  double expected_last;
+
+  vecreset(ps, init);
+  memcpy(expected, init, sizeof(init));
+  for (int i = 0; i < 4; i++) {
+    APPROX_EQ(ps[i].pos, expected[i].pos, 1e-10);
+    APPROX_EQ(ps[i].vel, expected[i].vel, 1e-10);
+  }
+
+  for (int t = 0; t < 2; t++)
+    for (int i = 0; i < 4; i++)
+      step(&expected[i], 0.25);
+  expected_last = last;
+  last = 0;
+
+  vecstep(ps, 0.25);
+  vecstep(ps, 0.25);
+
+  for (int i = 0; i < 4; i++)
+    APPROX_EQ(ps[i].pos, expected[i].pos, 1e-10);
+  APPROX_EQ(last, expected_last, 1e-10);
+}
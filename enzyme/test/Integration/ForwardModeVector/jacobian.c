@@ -0,0 +1,55 @@
+// RUN: %clang -O0 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O1 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O2 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O3 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O0 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-inline=1 -S | %lli -
+// RUN: %clang -O1 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-inline=1 -S | %lli -
+// RUN: %clang -O2 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-inline=1 -S | %lli -
+// RUN: %clang -O3 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-inline=1 -S | %lli -
+
+#include "test_utils.h"
+
+extern void __enzyme_jacobian(void (*)(double *, double *), ...);
+extern int enzyme_width;
+extern int enzyme_col_major;
+
+#define N 5
+#define M 3
+
+// y = A sin(x), with A[i][j] = i + j + 1
+void f(double *x, double *y) {
+  for (int i = 0; i < M; i++) {
+    y[i] = 0;
+    for (int j = 0; j < N; j++)
+      y[i] += (i + j + 1) * sin(x[j]);
+  }
+}
+
+// z = x * x, elementwise
+void g(double *x, double *z) {
+  for (int j = 0; j < N; j++)
+    z[j] = x[j] * x[j];
+}
+
+int main() {
+  double x[N] = {0.1, 0.2, 0.3, 0.4, 0.5};
+  double y[M], z[N];
+  double J[M * N], Jt[M * N], K[N * N];
+
+  // More inputs than outputs, computed in reverse mode.
+  __enzyme_jacobian(f, x, y, J, N, M);
+  __enzyme_jacobian(f, x, y, Jt, N, M, enzyme_col_major, enzyme_width, 2);
+  for (int i = 0; i < M; i++)
+    for (int j = 0; j < N; j++) {
+      APPROX_EQ(J[i * N + j], (i + j + 1) * cos(x[j]), 1e-10);
+      APPROX_EQ(Jt[j * M + i], (i + j + 1) * cos(x[j]), 1e-10);
+    }
+
+  // As many inputs as outputs, computed in forward mode.
+  __enzyme_jacobian(g, x, z, K, N, N, enzyme_width, 2);
+  for (int i = 0; i < N; i++) {
+    APPROX_EQ(z[i], x[i] * x[i], 1e-10);
+    for (int j = 0; j < N; j++)
+      APPROX_EQ(K[i * N + j], i == j ? 2 * x[j] : 0.0, 1e-10);
+  }
+}
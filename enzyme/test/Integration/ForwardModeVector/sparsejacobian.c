@@ -0,0 +1,62 @@
+// RUN: %clang -O0 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O1 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O2 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O3 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -O0 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-inline=1 -S | %lli -
+// RUN: %clang -O1 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-inline=1 -S | %lli -
+// RUN: %clang -O2 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-inline=1 -S | %lli -
+// RUN: %clang -O3 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-inline=1 -S | %lli -
+
+#include "test_utils.h"
+
+extern int __enzyme_sparse_jacobian(void (*)(double *, double *), ...);
+extern int enzyme_csr;
+
+#define N 6
+
+// y[i] = x[i - 1] - 2 x[i]^2 + sin(x[i + 1]), a tridiagonal Jacobian
+void f(double *x, double *y) {
+  for (int i = 0; i < N; i++) {
+    y[i] = -2 * x[i] * x[i];
+    if (i > 0)
+      y[i] += x[i - 1];
+    if (i < N - 1)
+      y[i] += sin(x[i + 1]);
+  }
+}
+
+double entry(double *x, int i, int j) {
+  if (j == i - 1)
+    return 1;
+  if (j == i)
+    return -4 * x[i];
+  if (j == i + 1)
+    return cos(x[j]);
+  return 0;
+}
+
+int main() {
+  double x[N] = {0.1, 0.2, 0.3, 0.4, 0.5, 0.6};
+  double y[N];
+  int rows[3 * N], cols[3 * N];
+  double vals[3 * N];
+
+  int nnz = __enzyme_sparse_jacobian(f, x, y, N, N, rows, cols, vals, 3 * N);
+  APPROX_EQ(nnz, 3 * N - 2, 1e-10);
+  for (int k = 0; k < nnz; k++) {
+    APPROX_EQ(vals[k], entry(x, rows[k], cols[k]), 1e-10);
+    if (k > 0)
+      APPROX_EQ(rows[k - 1] * N + cols[k - 1] < rows[k] * N + cols[k], 1,
+                1e-10);
+  }
+
+  // Only the first row fits.
+  nnz = __enzyme_sparse_jacobian(f, x, y, N, N, rows, cols, vals, 2,
+                                 enzyme_csr);
+  APPROX_EQ(nnz, 3 * N - 2, 1e-10);
+  APPROX_EQ(vals[0], entry(x, 0, 0), 1e-10);
+  APPROX_EQ(vals[1], entry(x, 0, 1), 1e-10);
+  for (int i = 0; i < N; i++)
+    APPROX_EQ(rows[i], i == 0 ? 0 : 3 * i - 1, 1e-10);
+  APPROX_EQ(rows[N], nnz, 1e-10);
+}
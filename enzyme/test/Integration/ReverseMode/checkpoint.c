@@ -0,0 +1,50 @@
+// RUN: %clang -std=c11 -O0 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli - 
+// RUN: %clang -std=c11 -O1 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli - 
+// RUN: %clang -std=c11 -O2 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli - 
+// RUN: %clang -std=c11 -O3 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli - 
+// RUN: %clang -std=c11 -O2 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-checkpoint-interval=3 -S | %lli - 
+// RUN: %clang -std=c11 -O2 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-checkpoint-recompute -S | %lli - 
+
+#include "test_utils.h"
+
+void __enzyme_autodiff(void*, ...);
+void __enzyme_checkpoint(void*, ...);
+
+void step(double* x, const double* dt) {
+    double v = x[1];
+    x[1] -= dt[0] * sin(x[0]);
+    x[0] += dt[0] * v;
+}
+
+void taped(double* x, const double* dt, long n) {
+    for (long i = 0; i < n; i++)
+        step(x, dt);
+}
+
+void checkpointed(double* x, const double* dt, long n) {
+    __enzyme_checkpoint((void*)step, n, x, 2 * sizeof(double), dt);
+}
+
+int main() {
+    for (long n = 1; n < 40; n += 7) {
+        double x[2] = {0.5, 0.1};
+        double dx[2] = {1.0, 2.0};
+        double dt = 0.01;
+        double ddt = 0.0;
+        __enzyme_autodiff((void*)taped, x, dx, &dt, &ddt, n);
+
+        double cx[2] = {0.5, 0.1};
+        double cdx[2] = {1.0, 2.0};
+        double cdt = 0.01;
+        double cddt = 0.0;
+        __enzyme_autodiff((void*)checkpointed, cx, cdx, &cdt, &cddt, n);
+
+        printf("n=%ld dx=[%f, %f] ddt=%f\n", n, cdx[0], cdx[1], cddt);
+        APPROX_EQ(cx[0], x[0], 1e-10);
+        APPROX_EQ(cx[1], x[1], 1e-10);
+        APPROX_EQ(cdx[0], dx[0], 1e-10);
+        APPROX_EQ(cdx[1], dx[1], 1e-10);
+        APPROX_EQ(cddt, ddt, 1e-10);
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+// RUN: %clang -std=c11 -O0 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -std=c11 -O1 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -std=c11 -O2 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -std=c11 -O3 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -S | %lli -
+// RUN: %clang -std=c11 -O2 %s -S -emit-llvm -o - | %opt - %loadEnzyme -enzyme -enzyme-segmented-cache=8 -S | %lli -
+
+#include "test_utils.h"
+
+int enzyme_workspace;
+int enzyme_allocated;
+int enzyme_tape;
+int enzyme_const;
+int enzyme_out;
+double __enzyme_autodiff(void*, ...);
+double __enzyme_fwddiff(void*, ...);
+size_t __enzyme_augmentsize(void*, ...);
+double __enzyme_augmentfwd(void*, ...);
+double __enzyme_reverse(void*, ...);
+
+struct workspace {
+  void *base;
+  size_t size;
+  size_t used;
+  size_t highwater;
+};
+
+double f(double x, const double* data, long n) {
+  double v = x;
+  long i = 0;
+  while (i < n && data[i] > 0) {
+    v = sin(v) * data[i] + v;
+    i++;
+  }
+  return v;
+}
+
+int main() {
+  double data[100];
+  for (int i = 0; i < 100; i++)
+    data[i] = (i % 37 == 36) ? -1.0 : 0.01 * (i + 1);
+
+  // The first call runs without memory, recording how much it needs
+  struct workspace ws = {0, 0, 0, 0};
+  double d0 = __enzyme_autodiff((void*)f, enzyme_workspace, &ws, 0.5, data,
+                                100L);
+  double r0 = __enzyme_autodiff((void*)f, 0.5, data, 100L);
+  printf("d=%f highwater=%zu\n", d0, ws.highwater);
+  APPROX_EQ(d0, r0, 1e-10);
+  if (ws.used != 0)
+    return 1;
+
+  ws.size = ws.highwater;
+  ws.base = malloc(ws.size);
+  for (int i = 0; i < 5; i++) {
+    double x = 0.1 * i;
+    double d = __enzyme_autodiff((void*)f, enzyme_workspace, &ws, x, data,
+                                 100L);
+    double r = __enzyme_autodiff((void*)f, x, data, 100L);
+    printf("x=%f d=%f r=%f\n", x, d, r);
+    APPROX_EQ(d, r, 1e-10);
+    if (ws.used != 0 || ws.highwater != ws.size)
+      return 1;
+  }
+
+  // Forward mode releases everything it allocated when it returns
+  for (int i = 0; i < 5; i++) {
+    double x = 0.1 * i;
+    double d = __enzyme_fwddiff((void*)f, enzyme_workspace, &ws, x, 1.0,
+                                enzyme_const, data, enzyme_const, 100L);
+    double r = __enzyme_autodiff((void*)f, x, data, 100L);
+    APPROX_EQ(d, r, 1e-10);
+    if (ws.used != 0)
+      return 1;
+  }
+
+  // The tape of an augmented forward pass stays in the workspace until the
+  // reverse pass, which releases it through the same workspace even when it
+  // is not passed one itself
+  size_t size = __enzyme_augmentsize((void*)f, enzyme_out, enzyme_const,
+                                     enzyme_const);
+  void *tape = malloc(size);
+  for (int i = 0; i < 5; i++) {
+    double x = 0.1 * i;
+    __enzyme_augmentfwd((void*)f, enzyme_workspace, &ws, enzyme_allocated,
+                        size, enzyme_tape, tape, x, enzyme_const, data,
+                        enzyme_const, 100L);
+    if (ws.used == 0)
+      return 1;
+    double d = __enzyme_reverse((void*)f, enzyme_allocated, size, enzyme_tape,
+                                tape, x, enzyme_const, data, enzyme_const,
+                                100L, 1.0);
+    double r = __enzyme_autodiff((void*)f, x, data, 100L);
+    APPROX_EQ(d, r, 1e-10);
+    ws.used = 0;
+  }
+  free(tape);
+
+  free(ws.base);
+  return 0;
+}
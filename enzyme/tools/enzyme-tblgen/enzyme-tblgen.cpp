@@ -276,6 +276,7 @@ bool handle(raw_ostream &os, Record *pattern, Init *resultTree,
     }
     if (anyVector) {
       os << " } else {\n";
+      os << " SmallVector<Value *, 4> lanes;\n";
       os << " for(unsigned int idx=0, W=gutils->getWidth(); idx<W; idx++) {\n";
 
       if (isCall || isIntr) {
@@ -288,7 +289,8 @@ bool handle(raw_ostream &os, Record *pattern, Init *resultTree,
         if (i > 0)
           os << ", ";
         if (vectorValued[i])
-          os << builder << ".CreateExtractValue(args[" << i << "], {idx})";
+          os << "GradientUtils::extractLane(" << builder << ", args[" << i
+             << "], idx)";
         else
           os << "args[" << i << "]";
       }
@@ -325,10 +327,13 @@ bool handle(raw_ostream &os, Record *pattern, Init *resultTree,
         os << "   V->setCallingConv(cconv);\n";
       }
       os << "   if (res == nullptr) res = "
-            "UndefValue::get(ArrayType::get(V->getType(), "
-            "gutils->getWidth()));\n";
-      os << "   res = " << builder << ".CreateInsertValue(res, V, {idx});\n";
-      os << " }\n }\n";
+            "UndefValue::get(gutils->getShadowType(V->getType()));\n";
+      os << "   if (res->getType()->isVectorTy()) lanes.push_back(V);\n";
+      os << "   else res = " << builder << ".CreateInsertValue(res, V, {idx});\n";
+      os << " }\n";
+      os << " if (res->getType()->isVectorTy()) res = gutils->packShadowLanes("
+         << builder << ", lanes);\n";
+      os << " }\n";
     }
     os << " res; })";
     return anyVector;
@@ -419,18 +424,24 @@ static void emitDerivatives(const RecordKeeper &recordKeeper, raw_ostream &os) {
       else
         os << "            Value *out = "
               "UndefValue::get(gutils->getShadowType(res->getType()));\n";
-
+      os << "            SmallVector<Value *, 4> lanes;\n";
       os << "            for(unsigned int idx=0, W=gutils->getWidth(); idx<W; "
             "idx++) {\n";
       os << "              Value *V = "
-            "Builder2.CreateFAdd(Builder2.CreateExtractValue(res, {idx}), ";
+            "Builder2.CreateFAdd(GradientUtils::extractLane(Builder2, res, "
+            "idx), ";
       if (vectorValued)
-        os << "Builder2.CreateExtractValue(tmp, {idx})";
+        os << "GradientUtils::extractLane(Builder2, tmp, idx)";
       else
         os << "tmp";
       os << ");\n";
-      os << "              out = Builder2.CreateInsertValue(out, V, {idx});\n";
+      os << "              if (out->getType()->isVectorTy()) "
+            "lanes.push_back(V);\n";
+      os << "              else out = Builder2.CreateInsertValue(out, V, "
+            "{idx});\n";
       os << "            }\n";
+      os << "            if (out->getType()->isVectorTy()) out = "
+            "gutils->packShadowLanes(Builder2, lanes);\n";
       os << "            res = out;\n";
       os << "          }\n";
       os << "        }\n";